@@ -0,0 +1,545 @@
+/**
+ * @file collector_bench.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Benchmarks of the stages of a data collection on synthetic trees
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include <benchmark/benchmark.h>
+
+#include "../collector.h"
+#include "../fifo.h"
+#include "../filename_matcher.h"
+#include "../path_table.h"
+#include "../prefetcher.h"
+#include "../tree_walker.h"
+#include "tree_generator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+
+/*
+ * Every stage runs in isolation on a tree generated once per shape:
+ *
+ *     collector_bench --benchmark_out=results.json --benchmark_out_format=json
+ *
+ * writes the results as JSON, next to the usual console output.
+ * The trees are generated below $TMPDIR, or COLLECTOR_BENCH_DIR if set, and
+ * removed when the benchmarks are done.
+ * Memory is reported as the heap in use per listed entry, `heap_per_entry`.
+ */
+
+
+namespace
+{
+    std::filesystem::path base_directory()
+    {
+        static std::filesystem::path const base
+        {
+            (std::getenv("COLLECTOR_BENCH_DIR") ? std::filesystem::path {std::getenv("COLLECTOR_BENCH_DIR")} : std::filesystem::temp_directory_path())
+                / std::filesystem::path {"collector_bench." + std::to_string(getpid())}
+        };
+        return base;
+    }
+
+
+    /**
+     * @brief Get the generated tree of a shape, generating it on first use,
+     * traversal benchmarks use empty files
+     *
+     */
+    TreeGenerator const& tree(std::size_t const files, std::size_t const depth, SizeDistribution const distribution, std::uint64_t const max_size = 1 << 20)
+    {
+        static std::map<std::tuple<std::size_t, std::size_t, SizeDistribution, std::uint64_t>, TreeGenerator> trees {};
+
+        auto const key {std::make_tuple(files, depth, distribution, max_size)};
+        auto entry {trees.find(key)};
+        if (entry == trees.end())
+        {
+            TreeShape shape {};
+            shape.files = files;
+            shape.depth = depth;
+            shape.distribution = distribution;
+            shape.max_size = max_size;
+
+            entry = trees.emplace(key, TreeGenerator {shape}).first;
+            std::filesystem::path const root
+            {
+                base_directory() / std::filesystem::path {"tree." + std::to_string(files) + "." + std::to_string(depth) + "." + std::to_string(static_cast<int>(distribution)) + "." + std::to_string(max_size)}
+            };
+            if (!entry->second.generate(root))
+            {
+                std::exit(EXIT_FAILURE);
+            }
+        }
+        return entry->second;
+    }
+
+
+    std::size_t heap_in_use()
+    {
+        return mallinfo2().uordblks;
+    }
+
+
+    /**
+     * @brief Name of the `index`th file of a synthetic tree of 100 directories
+     * of 100 directories each, below a typical input directory
+     *
+     */
+    std::string synthetic_name(std::size_t const index)
+    {
+        return "core.service." + std::to_string(index) + ".lz4";
+    }
+
+
+    std::string synthetic_directory(std::size_t const index)
+    {
+        return "dir_" + std::to_string(index);
+    }
+
+
+    std::string const SYNTHETIC_ROOT {"/var/lib/collector/input"};
+
+
+    std::filesystem::path output_directory()
+    {
+        std::filesystem::path const output {base_directory() / std::filesystem::path {"output"}};
+        std::filesystem::create_directories(output);
+        return output;
+    }
+
+
+    /**
+     * @brief Fraction of the pages of a file in the page cache, by `mincore`
+     *
+     */
+    double resident(std::filesystem::path const& file)
+    {
+        std::size_t const size {static_cast<std::size_t>(std::filesystem::file_size(file))};
+        std::size_t const page_size {static_cast<std::size_t>(sysconf(_SC_PAGESIZE))};
+        std::vector<unsigned char> pages((size + page_size - 1) / page_size);
+
+        int const file_descriptor {open(file.c_str(), O_RDONLY)};
+        void* const mapping {mmap(nullptr, size, PROT_READ, MAP_SHARED, file_descriptor, 0)};
+        close(file_descriptor);
+        if (mapping == MAP_FAILED)
+        {
+            return 0;
+        }
+        bool const queried {mincore(mapping, size, pages.data()) == 0};
+        munmap(mapping, size);
+        if (!queried)
+        {
+            return 0;
+        }
+
+        return static_cast<double>(std::count_if(pages.begin(), pages.end(), [](unsigned char page) { return page & 1; }))
+            / static_cast<double>(pages.size());
+    }
+}
+
+
+/**
+ * @brief List a tree with `range(0)` files and `range(1)` levels of
+ * subdirectories, recursively unless the tree is flat
+ *
+ */
+void BM_collect_files(benchmark::State& state)
+{
+    std::size_t const depth {static_cast<std::size_t>(state.range(1))};
+    TreeGenerator const& generator {tree(static_cast<std::size_t>(state.range(0)), depth, SizeDistribution::FIXED)};
+    // the first file lies in the root directory of the tree
+    std::filesystem::path const root {generator.files().front().parent_path()};
+    FileSelection const selection {depth == 0 ? FileSelection::FILES : FileSelection::FILES_AND_DIRECTORIES};
+
+    for (auto _ : state)
+    {
+        std::size_t const before {heap_in_use()};
+        std::vector<std::filesystem::path> const files {Collector::collect_files(root, selection)};
+        state.counters["heap_per_entry"] = static_cast<double>(heap_in_use() - before) / static_cast<double>(files.size());
+        benchmark::DoNotOptimize(files);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(generator.files().size()));
+}
+
+
+/**
+ * @brief List a tree like `BM_collect_files`, into a path table
+ *
+ */
+void BM_collect_file_table(benchmark::State& state)
+{
+    std::size_t const depth {static_cast<std::size_t>(state.range(1))};
+    TreeGenerator const& generator {tree(static_cast<std::size_t>(state.range(0)), depth, SizeDistribution::FIXED)};
+    std::filesystem::path const root {generator.files().front().parent_path()};
+    FileSelection const selection {depth == 0 ? FileSelection::FILES : FileSelection::FILES_AND_DIRECTORIES};
+
+    for (auto _ : state)
+    {
+        std::size_t const before {heap_in_use()};
+        PathTable files {};
+        Collector::collect_files(root, selection, files);
+        state.counters["heap_per_entry"] = static_cast<double>(heap_in_use() - before) / static_cast<double>(files.count());
+        benchmark::DoNotOptimize(files);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(generator.files().size()));
+}
+
+
+/**
+ * @brief Traverse a tree of `range(0)` files and `range(1)` levels of
+ * subdirectories with `std::filesystem::recursive_directory_iterator`, the
+ * traversal before `TreeWalker`
+ *
+ */
+void BM_recursive_iterator(benchmark::State& state)
+{
+    TreeGenerator const& generator {tree(static_cast<std::size_t>(state.range(0)), static_cast<std::size_t>(state.range(1)), SizeDistribution::FIXED, 0)};
+    std::filesystem::path const root {generator.files().front().parent_path()};
+
+    for (auto _ : state)
+    {
+        PathTable files {};
+        std::vector<std::uint32_t> parents {files.add_root(root.native(), false)};
+        for (std::filesystem::recursive_directory_iterator entries {root}, end {}; entries != end; ++entries)
+        {
+            std::size_t const depth {static_cast<std::size_t>(entries.depth())};
+            parents.resize(depth + 1);
+            parents.push_back(files.add(parents[depth], entries->path().filename().native()));
+        }
+        benchmark::DoNotOptimize(files);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(generator.files().size()));
+}
+
+
+/**
+ * @brief Traverse the same tree as `BM_recursive_iterator` with a TreeWalker
+ * of `range(2)` threads
+ *
+ */
+void BM_tree_walker(benchmark::State& state)
+{
+    TreeGenerator const& generator {tree(static_cast<std::size_t>(state.range(0)), static_cast<std::size_t>(state.range(1)), SizeDistribution::FIXED, 0)};
+    std::filesystem::path const root {generator.files().front().parent_path()};
+    TreeWalker walker {static_cast<unsigned int>(state.range(2))};
+
+    for (auto _ : state)
+    {
+        PathTable files {};
+        walker.walk(root, files, files.add_root(root.native(), false));
+        state.counters["steals"] = static_cast<double>(walker.steals());
+        state.counters["stats"] = static_cast<double>(walker.stats());
+        benchmark::DoNotOptimize(files);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(generator.files().size()));
+}
+
+
+/**
+ * @brief Hold the paths of `range(0)` files of a synthetic tree as a list of
+ * complete paths, the representation before path tables
+ *
+ */
+void BM_path_list(benchmark::State& state)
+{
+    std::size_t const entries {static_cast<std::size_t>(state.range(0))};
+
+    for (auto _ : state)
+    {
+        std::size_t const before {heap_in_use()};
+        std::vector<std::filesystem::path> paths {};
+        for (std::size_t i {0}; i < entries; ++i)
+        {
+            paths.emplace_back(SYNTHETIC_ROOT + "/" + synthetic_directory(i / 10000) + "/" + synthetic_directory(i / 100 % 100) + "/" + synthetic_name(i));
+        }
+        state.counters["heap_per_entry"] = static_cast<double>(heap_in_use() - before) / static_cast<double>(entries);
+        benchmark::DoNotOptimize(paths);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(entries));
+}
+
+
+/**
+ * @brief Hold the same paths as `BM_path_list` in a path table
+ *
+ */
+void BM_path_table(benchmark::State& state)
+{
+    std::size_t const entries {static_cast<std::size_t>(state.range(0))};
+
+    for (auto _ : state)
+    {
+        std::size_t const before {heap_in_use()};
+        PathTable paths {};
+        std::uint32_t const root {paths.add_root(SYNTHETIC_ROOT, false)};
+        std::uint32_t directory {PathTable::NONE};
+        std::uint32_t subdirectory {PathTable::NONE};
+        for (std::size_t i {0}; i < entries; ++i)
+        {
+            if (i % 10000 == 0)
+            {
+                directory = paths.add(root, synthetic_directory(i / 10000), false);
+            }
+            if (i % 100 == 0)
+            {
+                subdirectory = paths.add(directory, synthetic_directory(i / 100 % 100), false);
+            }
+            paths.add(subdirectory, synthetic_name(i));
+        }
+        state.counters["heap_per_entry"] = static_cast<double>(heap_in_use() - before) / static_cast<double>(entries);
+        benchmark::DoNotOptimize(paths);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(entries));
+}
+
+
+/**
+ * @brief Measure the disk usage of the files of a tree, sizes distributed
+ * by `range(2)`
+ *
+ */
+void BM_collect_disk_usage(benchmark::State& state)
+{
+    TreeGenerator const& generator {tree(static_cast<std::size_t>(state.range(0)), static_cast<std::size_t>(state.range(1)), static_cast<SizeDistribution>(state.range(2)))};
+    std::filesystem::path const output {output_directory()};
+
+    for (auto _ : state)
+    {
+        std::vector<std::filesystem::path> files {generator.files()};
+        std::vector<std::filesystem::path> temporaries {};
+        Collector::collect_disk_usage(files, temporaries, output);
+        benchmark::DoNotOptimize(files);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(generator.files().size()));
+    std::filesystem::remove_all(output);
+}
+
+
+/**
+ * @brief Archive the files of a tree, sizes distributed by `range(2)`
+ *
+ */
+void BM_store_files(benchmark::State& state)
+{
+    TreeGenerator const& generator {tree(static_cast<std::size_t>(state.range(0)), static_cast<std::size_t>(state.range(1)), static_cast<SizeDistribution>(state.range(2)))};
+    std::filesystem::path const archive {output_directory() / std::filesystem::path {"archive.tar"}};
+
+    for (auto _ : state)
+    {
+        Collector::store_files(generator.files(), {}, archive, false);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(generator.files().size()));
+    state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(generator.bytes()));
+    std::filesystem::remove_all(archive.parent_path());
+}
+
+
+/**
+ * @brief Archive a 256 MiB file whose first half is cached, reading it
+ * through the cache (`range(0)` 0), cache-neutrally (1) or with `O_DIRECT`
+ * (2), and report the fraction of its pages cached before and after
+ *
+ */
+void BM_store_cache(benchmark::State& state)
+{
+    TreeGenerator const& generator {tree(1, 0, SizeDistribution::FIXED, 256 << 20)};
+    std::filesystem::path const& file {generator.files().front()};
+    std::filesystem::path const archive {output_directory() / std::filesystem::path {"archive.tar"}};
+
+    CacheOptions cache {};
+    cache.neutral = state.range(0) == 1;
+    cache.direct_threshold = state.range(0) == 2 ? TAR_COPY_THRESHOLD : 0;
+
+    PathTable files {};
+    Collector::collect_files(file.parent_path(), FileSelection::FILES, files);
+
+    double before {0};
+    double after {0};
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        int const file_descriptor {open(file.c_str(), O_RDONLY)};
+        posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_DONTNEED);
+        std::vector<char> buffer(1 << 20);
+        for (off_t offset {0}; offset < (128 << 20); offset += static_cast<off_t>(buffer.size()))
+        {
+            benchmark::DoNotOptimize(pread(file_descriptor, buffer.data(), buffer.size(), offset));
+        }
+        close(file_descriptor);
+        before = resident(file);
+        state.ResumeTiming();
+
+        Collector::store_files(files, {}, archive, false, {}, nullptr, nullptr, cache);
+
+        state.PauseTiming();
+        after = resident(file);
+        state.ResumeTiming();
+    }
+
+    state.counters["resident_before"] = before;
+    state.counters["resident_after"] = after;
+    state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(generator.bytes()));
+    std::filesystem::remove_all(archive.parent_path());
+}
+
+
+/**
+ * @brief Archive a tree of `range(0)` mid-sized files with a cold page cache,
+ * reading them ahead with `range(1)` threads, 0 for the batched reads
+ *
+ */
+void BM_store_prefetch(benchmark::State& state)
+{
+    TreeGenerator const& generator {tree(static_cast<std::size_t>(state.range(0)), 2, SizeDistribution::LOG_UNIFORM)};
+    std::filesystem::path const archive {output_directory() / std::filesystem::path {"archive.tar"}};
+
+    // the first file lies in the root directory of the tree
+    PathTable files {};
+    Collector::collect_files(generator.files().front().parent_path(), FileSelection::FILES_AND_DIRECTORIES, files);
+
+    PrefetchOptions prefetch {};
+    prefetch.readers = static_cast<unsigned int>(state.range(1));
+
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        for (auto const& file : generator.files())
+        {
+            int const file_descriptor {open(file.c_str(), O_RDONLY)};
+            posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_DONTNEED);
+            close(file_descriptor);
+        }
+        state.ResumeTiming();
+
+        Collector::store_files(files, {}, archive, false, {}, nullptr, nullptr, {}, prefetch);
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(generator.files().size()));
+    state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(generator.bytes()));
+    std::filesystem::remove_all(archive.parent_path());
+}
+
+
+/**
+ * @brief Match the names of the files of a tree against the default pattern
+ *
+ */
+void BM_match(benchmark::State& state)
+{
+    TreeGenerator const& generator {tree(static_cast<std::size_t>(state.range(0)), 0, SizeDistribution::FIXED)};
+    FilenameMatcher const matcher {};
+
+    std::vector<std::string> names {};
+    for (auto const& file : generator.files())
+    {
+        names.push_back(file.filename().native());
+    }
+
+    for (auto _ : state)
+    {
+        for (auto const& name : names)
+        {
+            benchmark::DoNotOptimize(matcher.match(name));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(names.size()));
+}
+
+
+/**
+ * @brief Pass triggers through a queue on a single thread, i.e. the cost of
+ * a push and a pop without contention
+ *
+ */
+template <typename Queue>
+void BM_trigger_fifo(benchmark::State& state)
+{
+    Queue queue {};
+    Trigger const trigger {"/var/dumps", {"/var/dumps/core.Service.0.lz4"}, {}, {}, 0};
+    Trigger item {};
+
+    for (auto _ : state)
+    {
+        queue.push(trigger);
+        queue.pop(item);
+        benchmark::DoNotOptimize(item);
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+void tree_arguments(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->ArgNames({"files", "depth", "distribution"});
+    for (std::int64_t const distribution : {static_cast<std::int64_t>(SizeDistribution::UNIFORM), static_cast<std::int64_t>(SizeDistribution::LOG_UNIFORM)})
+    {
+        benchmark->Args({100, 0, distribution});
+        benchmark->Args({1000, 3, distribution});
+    }
+    benchmark->Unit(benchmark::kMillisecond);
+    benchmark->UseRealTime();
+}
+
+
+BENCHMARK(BM_collect_files)->ArgNames({"files", "depth"})->Args({1000, 0})->Args({1000, 3})->Args({10000, 4})->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_collect_file_table)->ArgNames({"files", "depth"})->Args({1000, 0})->Args({1000, 3})->Args({10000, 4})->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_recursive_iterator)->ArgNames({"files", "depth"})->Args({10000, 4})->Args({100000, 5})->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_tree_walker)->ArgNames({"files", "depth", "threads"})->ArgsProduct({{10000, 100000}, {4, 5}, {1, 2, 4, 8}})->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_path_list)->ArgNames({"entries"})->Arg(1000000)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK(BM_path_table)->ArgNames({"entries"})->Arg(1000000)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK(BM_collect_disk_usage)->Apply(tree_arguments);
+BENCHMARK(BM_store_files)->Apply(tree_arguments);
+BENCHMARK(BM_store_cache)->ArgNames({"mode"})->DenseRange(0, 2)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_store_prefetch)->ArgNames({"files", "readers"})->ArgsProduct({{2000}, {0, 1, 2, 4, 8}})->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK(BM_match)->ArgNames({"files"})->Arg(1000);
+BENCHMARK_TEMPLATE(BM_trigger_fifo, blocking_fifo<Trigger>);
+BENCHMARK_TEMPLATE(BM_trigger_fifo, lockfree_fifo<Trigger>);
+
+
+int main(int argc, char** argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+
+    // identify the measured version in the JSON context
+    benchmark::AddCustomContext("collector_revision", COLLECTOR_REVISION);
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    std::error_code error {};
+    std::filesystem::remove_all(base_directory(), error);
+    return 0;
+}
@@ -0,0 +1,101 @@
+/**
+ * @file fifo_bench.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Microbenchmark of the concurrent fifo queues
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include <benchmark/benchmark.h>
+
+#include "../fifo.h"
+
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <thread>
+#include <vector>
+
+
+constexpr int ITEMS = 1 << 16;
+
+
+/**
+ * @brief Pass a fixed number of items from `range(0)` producers to `range(1)`
+ * consumers through a queue
+ *
+ */
+template <typename Queue, typename T>
+void BM_fifo(benchmark::State& state)
+{
+    int const producers {static_cast<int>(state.range(0))};
+    int const consumers {static_cast<int>(state.range(1))};
+
+    T const value {};
+
+    for (auto _ : state)
+    {
+        Queue queue {};
+        std::atomic<int> remaining {ITEMS};
+
+        std::vector<std::thread> threads {};
+        for (int i {0}; i < consumers; ++i)
+        {
+            threads.emplace_back([&queue, &remaining]
+            {
+                T item {};
+                while (queue.pop(item))
+                {
+                    // the last consumed item closes the queue
+                    if (--remaining == 0)
+                    {
+                        queue.close();
+                    }
+                }
+            });
+        }
+        for (int i {0}; i < producers; ++i)
+        {
+            threads.emplace_back([&queue, &value, i, producers]
+            {
+                for (int j {i}; j < ITEMS; j += producers)
+                {
+                    queue.push(value);
+                }
+            });
+        }
+
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * ITEMS);
+}
+
+
+void arguments(benchmark::internal::Benchmark* benchmark)
+{
+    // several watchers feeding the collector, i.e. N producers
+    int const threads {static_cast<int>(std::max(std::thread::hardware_concurrency() / 2, 2u))};
+
+    benchmark->ArgNames({"producers", "consumers"});
+    benchmark->Args({1, 1});
+    benchmark->Args({threads, 1});
+    benchmark->Args({threads, threads});
+    benchmark->UseRealTime();
+}
+
+
+BENCHMARK_TEMPLATE(BM_fifo, blocking_fifo<int>, int)->Apply(arguments);
+BENCHMARK_TEMPLATE(BM_fifo, lockfree_fifo<int>, int)->Apply(arguments);
+BENCHMARK_TEMPLATE(BM_fifo, blocking_fifo<std::filesystem::path>, std::filesystem::path)->Apply(arguments);
+BENCHMARK_TEMPLATE(BM_fifo, lockfree_fifo<std::filesystem::path>, std::filesystem::path)->Apply(arguments);
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,415 @@
+/**
+ * @file load_harness.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Trigger storm load generator measuring end-to-end latencies of a
+ * live collector
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "../collector.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+
+
+/*
+ * A generator thread creates matching files at a given rate, in bursts,
+ * mixed with non-matching churn, in the input directory of a live collector.
+ * Completion is detected by the completion callback of the collector, i.e.
+ * without polling the output directory or sleeping.
+ */
+
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    // a rate is sustainable if the collector finishes at most this fraction
+    // of the generation time after the generator, plus the latency of the
+    // last trigger itself
+    constexpr double BACKLOG_FRACTION {0.1};
+    constexpr std::chrono::milliseconds BACKLOG_LIMIT {50};
+
+    // time to wait for outstanding collections after the last trigger
+    constexpr std::chrono::seconds COMPLETION_TIMEOUT {30};
+
+
+    struct Options
+    {
+        double rate {50.0};
+        std::size_t burst {1};
+        std::size_t count {500};
+        std::size_t churn {10};
+        unsigned int workers {0};
+        long window {0};
+        bool search {false};
+        std::filesystem::path directory {std::filesystem::temp_directory_path()};
+    };
+
+
+    struct Result
+    {
+        std::size_t triggers {0};
+        std::size_t completed {0};
+        std::vector<double> latencies {};
+        double generated {0.0};
+        double backlog {0.0};
+        std::uint64_t dropped {0};
+        std::uint64_t failed {0};
+    };
+
+
+    /**
+     * @brief Completion times of the triggering files, filled by the
+     * collector threads
+     *
+     */
+    class Completions
+    {
+    public:
+        explicit Completions(std::size_t const count) :
+            times(count)
+        {
+        }
+
+        void complete(Trigger const& trigger)
+        {
+            auto const now {Clock::now()};
+            std::lock_guard<std::mutex> lock {mutex};
+
+            // the file name carries the index of the trigger, probes have none
+            for (auto const& file : trigger.files)
+            {
+                std::string const name {file.filename().native()};
+                if (name.compare(0, 10, "core.load.") != 0)
+                {
+                    probed = true;
+                    continue;
+                }
+                std::size_t const index {std::stoul(name.substr(10))};
+                if (index < times.size() && times[index] == Clock::time_point {})
+                {
+                    times[index] = now;
+                    ++completed;
+                }
+            }
+            condition.notify_all();
+        }
+
+        bool wait_for_probe(Clock::duration const timeout)
+        {
+            std::unique_lock<std::mutex> lock {mutex};
+            return condition.wait_for(lock, timeout, [this] { return probed; });
+        }
+
+        bool wait_for_all(Clock::time_point const deadline)
+        {
+            std::unique_lock<std::mutex> lock {mutex};
+            return condition.wait_until(lock, deadline, [this] { return completed == times.size(); });
+        }
+
+        std::vector<Clock::time_point> snapshot()
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            return times;
+        }
+
+    private:
+        std::mutex mutex {};
+        std::condition_variable condition {};
+        std::vector<Clock::time_point> times {};
+        std::size_t completed {0};
+        bool probed {false};
+    };
+
+
+    bool create_file(std::filesystem::path const& file, std::size_t const size = 0)
+    {
+        int const file_descriptor {open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+        if (file_descriptor < 0)
+        {
+            return false;
+        }
+        std::string const contents(size, 'x');
+        bool const result {::write(file_descriptor, contents.data(), contents.size()) == static_cast<ssize_t>(contents.size())};
+        close(file_descriptor);
+        return result;
+    }
+
+
+    double percentile(std::vector<double> const& sorted, double const fraction)
+    {
+        if (sorted.empty())
+        {
+            return 0.0;
+        }
+        return sorted[static_cast<std::size_t>(fraction * static_cast<double>(sorted.size() - 1) + 0.5)];
+    }
+
+
+    /**
+     * @brief Drive a fresh collector with `options.count` triggers at a given
+     * rate
+     *
+     */
+    Result run(Options const& options, double const rate)
+    {
+        std::filesystem::path const base {options.directory / std::filesystem::path {"load_harness." + std::to_string(getpid())}};
+        std::filesystem::path const input {base / std::filesystem::path {"input"}};
+        std::filesystem::path const output {base / std::filesystem::path {"output"}};
+        std::error_code error {};
+        std::filesystem::remove_all(base, error);
+        std::filesystem::create_directories(input);
+        std::filesystem::create_directories(output);
+
+        Completions completions {options.count};
+        Collector collector {input, output, FileSelection::FILES};
+        if (options.workers > 0)
+        {
+            collector.set_workers(options.workers);
+        }
+        collector.set_coalescing_window(std::chrono::milliseconds {options.window});
+        collector.set_completion_callback([&completions](Trigger const& trigger, std::filesystem::path const& archive)
+        {
+            // archives are not needed, keep the output directory small
+            std::error_code ignored {};
+            std::filesystem::remove(archive, ignored);
+            completions.complete(trigger);
+        });
+
+        // the collector logs every collection from all of its threads, which
+        // is not of interest here, warnings are expected as churn vanishes
+        // while being collected, hence its output is discarded for the run
+        std::cout.flush();
+        std::cerr.flush();
+        int const console {dup(STDOUT_FILENO)};
+        int const errors {dup(STDERR_FILENO)};
+        int const null {open("/dev/null", O_WRONLY | O_CLOEXEC)};
+        if (null >= 0)
+        {
+            dup2(null, STDOUT_FILENO);
+            dup2(null, STDERR_FILENO);
+            close(null);
+        }
+
+        std::thread worker {&Collector::monitor_and_collect, &collector};
+
+        // probe until the input directory is watched
+        bool ready {false};
+        for (int i {0}; i < 100 && !ready; ++i)
+        {
+            create_file(input / std::filesystem::path {"core.probe." + std::to_string(i) + ".lz4"});
+            ready = completions.wait_for_probe(std::chrono::milliseconds {50});
+        }
+
+        Result result {};
+        result.triggers = options.count;
+        std::vector<Clock::time_point> created(options.count);
+
+        auto const interval
+        {
+            std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double> {static_cast<double>(options.burst) / rate})
+        };
+        auto const begin {Clock::now()};
+        auto next {begin};
+
+        for (std::size_t i {0}; ready && i < options.count; ++i)
+        {
+            if (i % options.burst == 0)
+            {
+                std::this_thread::sleep_until(next);
+                next += interval;
+            }
+
+            created[i] = Clock::now();
+            create_file(input / std::filesystem::path {"core.load." + std::to_string(i) + ".lz4"});
+
+            // churn: non-matching files are written and renamed over logs
+            for (std::size_t j {0}; j < options.churn; ++j)
+            {
+                std::filesystem::path const temporary {input / std::filesystem::path {"tmp." + std::to_string(j)}};
+                create_file(temporary, 256);
+                std::filesystem::rename(temporary, input / std::filesystem::path {"service." + std::to_string(j) + ".log"}, error);
+            }
+        }
+        auto const end {Clock::now()};
+
+        completions.wait_for_all(end + COMPLETION_TIMEOUT);
+
+        collector.stop();
+        worker.join();
+        std::cout.flush();
+        std::cerr.flush();
+        for (auto const& [saved, descriptor] : {std::pair {console, STDOUT_FILENO}, std::pair {errors, STDERR_FILENO}})
+        {
+            if (saved >= 0)
+            {
+                dup2(saved, descriptor);
+                close(saved);
+            }
+        }
+
+        if (!ready)
+        {
+            std::cerr << "Error, the collector did not start collecting" << std::endl;
+        }
+
+        auto const completed {completions.snapshot()};
+        Clock::time_point last {end};
+        for (std::size_t i {0}; i < completed.size(); ++i)
+        {
+            if (completed[i] != Clock::time_point {})
+            {
+                result.latencies.push_back(std::chrono::duration<double, std::milli> {completed[i] - created[i]}.count());
+                last = std::max(last, completed[i]);
+            }
+        }
+        std::sort(result.latencies.begin(), result.latencies.end());
+        result.completed = result.latencies.size();
+        result.generated = std::chrono::duration<double> {end - begin}.count();
+        result.backlog = std::chrono::duration<double> {last - end}.count();
+        result.dropped = collector.get_metrics().dropped.load();
+        result.failed = collector.get_metrics().failed.load();
+
+        std::filesystem::remove_all(base, error);
+        return result;
+    }
+
+
+    bool sustainable(Result const& result)
+    {
+        return result.completed == result.triggers
+            && result.backlog <= BACKLOG_FRACTION * result.generated + std::chrono::duration<double> {BACKLOG_LIMIT}.count();
+    }
+
+
+    double achieved(Result const& result)
+    {
+        return result.generated > 0.0 ? static_cast<double>(result.triggers) / result.generated : 0.0;
+    }
+
+
+    void report(double const rate, Result const& result)
+    {
+        std::cout << "rate " << rate << "/s (achieved " << achieved(result) << "/s): " << result.completed << " of "
+                  << result.triggers << " triggers in " << result.generated << " s, latency p50 " << percentile(result.latencies, 0.5) << " ms, p99 "
+                  << percentile(result.latencies, 0.99) << " ms, max "
+                  << (result.latencies.empty() ? 0.0 : result.latencies.back()) << " ms, backlog "
+                  << result.backlog << " s, " << result.dropped << " dropped, " << result.failed << " failed"
+                  << (sustainable(result) ? "" : " (not sustainable)") << std::endl;
+    }
+
+
+    void print_usage(std::string const& name)
+    {
+        std::cout << "Usage: " << name << " [ -r RATE ] [ -b BURST ] [ -n COUNT ] [ -c CHURN ] [ -j WORKERS ] [ -w WINDOW ] [ -m ] [ -d DIRECTORY ]" << std::endl
+            << "  -r RATE       triggers per second (default: 50)" << std::endl
+            << "  -b BURST      triggers created at once (default: 1)" << std::endl
+            << "  -n COUNT      number of triggers per run (default: 500)" << std::endl
+            << "  -c CHURN      non-matching files written per trigger (default: 10)" << std::endl
+            << "  -j WORKERS    number of collector threads (default: number of CPUs)" << std::endl
+            << "  -w WINDOW     coalescing window in milliseconds (default: 0)" << std::endl
+            << "  -m            search the maximum sustainable rate, starting at RATE" << std::endl
+            << "  -d DIRECTORY  directory for the input and output trees (default: $TMPDIR)" << std::endl;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    Options options {};
+
+    int option {};
+    while ((option = getopt(argc, argv, "r:b:n:c:j:w:md:")) != -1)
+    {
+        switch (option)
+        {
+            case 'r':
+                options.rate = std::strtod(optarg, nullptr);
+                break;
+            case 'b':
+                options.burst = std::max<std::size_t>(std::strtoul(optarg, nullptr, 10), 1);
+                break;
+            case 'n':
+                options.count = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'c':
+                options.churn = std::strtoul(optarg, nullptr, 10);
+                break;
+            case 'j':
+                options.workers = static_cast<unsigned int>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'w':
+                options.window = std::strtol(optarg, nullptr, 10);
+                break;
+            case 'm':
+                options.search = true;
+                break;
+            case 'd':
+                options.directory = optarg;
+                break;
+            default:
+                print_usage(std::string {argv[0]});
+                return -1;
+        }
+    }
+
+    if (options.rate <= 0.0 || options.count == 0)
+    {
+        print_usage(std::string {argv[0]});
+        return -1;
+    }
+
+    Result const result {run(options, options.rate)};
+    report(options.rate, result);
+
+    if (!options.search)
+    {
+        return sustainable(result) ? 0 : 1;
+    }
+
+    // double the rate until the collector falls behind, then bisect, the
+    // generator shares the machine and may not reach every rate itself
+    double good {sustainable(result) ? achieved(result) : 0.0};
+    double bad {sustainable(result) ? 0.0 : options.rate};
+    bool saturated {achieved(result) < 0.9 * options.rate};
+    for (double rate {options.rate * 2}; bad == 0.0 && !saturated; rate *= 2)
+    {
+        Result const step {run(options, rate)};
+        report(rate, step);
+        (sustainable(step) ? good : bad) = sustainable(step) ? std::max(good, achieved(step)) : rate;
+        saturated = achieved(step) < 0.9 * rate;
+    }
+    for (int i {0}; i < 4 && bad > 0.0 && !saturated; ++i)
+    {
+        double const rate {(good + bad) / 2};
+        Result const step {run(options, rate)};
+        report(rate, step);
+        (sustainable(step) ? good : bad) = sustainable(step) ? std::max(good, achieved(step)) : rate;
+    }
+
+    if (saturated)
+    {
+        std::cout << "the generator cannot create triggers any faster, the collector kept up" << std::endl;
+    }
+    std::cout << "maximum sustainable rate: " << good << " triggers/s" << std::endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file matcher_bench.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Benchmark of file name matching, DFA versus std::regex
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include <benchmark/benchmark.h>
+
+#include "../filename_matcher.h"
+
+#include <regex>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief File names as seen in a dump directory, mostly non-core churn
+ *
+ */
+std::vector<std::string> const NAMES
+{
+    "core.ServiceName.3057.57dd721409bc4ab4b38a3c33a36a608a.3717.1647975805000000.lz4",
+    "core.Service.0.lz4",
+    "service.log",
+    "service.log.1",
+    ".service.log.swp",
+    "tmp.XXXXXXkq3Fz1",
+    "core.ServiceName.3057.57dd721409bc4ab4b38a3c33a36a608a.3717.1647975805000000.lz4.tmp",
+    "core.ServiceName.3057.57DD721409BC4AB4B38A3C33A36A608A.lz4",
+    "metrics-2022-08-24T12:00:00.json",
+    "disk_usage.txt"
+};
+
+
+void BM_regex(benchmark::State& state)
+{
+    std::regex const regex {std::string {FilenameMatcher::DEFAULT_PATTERN}};
+
+    for (auto _ : state)
+    {
+        for (auto const& name : NAMES)
+        {
+            benchmark::DoNotOptimize(std::regex_match(name, regex));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * NAMES.size());
+}
+
+
+void BM_regex_fallback(benchmark::State& state)
+{
+    FilenameMatcher const matcher {std::regex {std::string {FilenameMatcher::DEFAULT_PATTERN}}};
+
+    for (auto _ : state)
+    {
+        for (auto const& name : NAMES)
+        {
+            benchmark::DoNotOptimize(matcher.match(name));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * NAMES.size());
+}
+
+
+void BM_dfa(benchmark::State& state)
+{
+    FilenameMatcher const matcher {};
+
+    for (auto _ : state)
+    {
+        for (auto const& name : NAMES)
+        {
+            benchmark::DoNotOptimize(matcher.match(name));
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * NAMES.size());
+}
+
+
+BENCHMARK(BM_regex);
+BENCHMARK(BM_regex_fallback);
+BENCHMARK(BM_dfa);
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,122 @@
+/**
+ * @file tree_generator.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a generator of synthetic directory trees
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "tree_generator.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+TreeGenerator::TreeGenerator(TreeShape const& shape) :
+    shape {shape}
+{
+}
+
+
+bool TreeGenerator::generate(std::filesystem::path const& root)
+{
+    std::error_code error {};
+    std::filesystem::remove_all(root, error);
+    generated.clear();
+    total = 0;
+
+    // complete tree of directories, breadth first
+    std::vector<std::filesystem::path> directories {root};
+    for (std::size_t begin {0}, level {0}; level < shape.depth; ++level)
+    {
+        std::size_t const end {directories.size()};
+        for (std::size_t i {begin}; i < end; ++i)
+        {
+            for (std::size_t j {0}; j < shape.fanout; ++j)
+            {
+                directories.push_back(directories[i] / std::filesystem::path {"dir" + std::to_string(j)});
+            }
+        }
+        begin = end;
+    }
+    for (auto const& directory : directories)
+    {
+        std::filesystem::create_directories(directory, error);
+        if (error)
+        {
+            std::cerr << "Error, cannot create " << directory << ": " << error.message() << std::endl;
+            return false;
+        }
+    }
+
+    std::mt19937_64 random {shape.seed};
+    std::uniform_real_distribution<double> uniform {0.0, 1.0};
+    double const low {std::log(static_cast<double>(shape.min_size) + 1.0)};
+    double const high {std::log(static_cast<double>(shape.max_size) + 1.0)};
+
+    std::vector<char> contents(static_cast<std::size_t>(shape.max_size), 'x');
+
+    for (std::size_t i {0}; i < shape.files; ++i)
+    {
+        std::uint64_t size {shape.max_size};
+        if (shape.distribution == SizeDistribution::UNIFORM)
+        {
+            size = shape.min_size + static_cast<std::uint64_t>(uniform(random) * static_cast<double>(shape.max_size - shape.min_size));
+        }
+        else if (shape.distribution == SizeDistribution::LOG_UNIFORM)
+        {
+            size = static_cast<std::uint64_t>(std::exp(low + uniform(random) * (high - low)) - 1.0);
+        }
+        size = std::min(std::max(size, shape.min_size), shape.max_size);
+
+        // every 100th file is a core, the others are logs
+        std::string const name
+        {
+            i % 100 == 0
+                ? "core.Service" + std::to_string(i) + "." + std::to_string(1000 + i) + ".lz4"
+                : "service" + std::to_string(i) + ".log"
+        };
+        std::filesystem::path const file {directories[i % directories.size()] / std::filesystem::path {name}};
+
+        int const file_descriptor {open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+        if (file_descriptor < 0 || ::write(file_descriptor, contents.data(), static_cast<std::size_t>(size)) != static_cast<ssize_t>(size))
+        {
+            std::cerr << "Error, cannot write " << file << ": " << std::strerror(errno) << std::endl;
+            if (file_descriptor >= 0)
+            {
+                close(file_descriptor);
+            }
+            return false;
+        }
+        close(file_descriptor);
+
+        generated.push_back(file);
+        total += size;
+    }
+
+    return true;
+}
+
+
+std::vector<std::filesystem::path> const& TreeGenerator::files() const
+{
+    return generated;
+}
+
+
+std::uint64_t TreeGenerator::bytes() const
+{
+    return total;
+}
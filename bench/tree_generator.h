@@ -0,0 +1,111 @@
+/**
+ * @file tree_generator.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a generator of synthetic directory trees
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+
+/**
+ * @brief Distribution of the sizes of generated files
+ *
+ */
+enum class SizeDistribution
+{
+    /**
+     * @brief Every file has the maximum size
+     *
+     */
+    FIXED,
+
+    /**
+     * @brief Sizes are uniformly distributed between minimum and maximum
+     *
+     */
+    UNIFORM,
+
+    /**
+     * @brief Logarithms of the sizes are uniformly distributed, i.e. many
+     * small files and few large ones, like logs next to cores
+     *
+     */
+    LOG_UNIFORM
+};
+
+
+/**
+ * @brief Shape of a synthetic directory tree
+ *
+ */
+struct TreeShape
+{
+    std::size_t files {1000};
+    std::size_t depth {2};
+    std::size_t fanout {4};
+    std::uint64_t min_size {0};
+    std::uint64_t max_size {4096};
+    SizeDistribution distribution {SizeDistribution::LOG_UNIFORM};
+    std::uint64_t seed {1};
+};
+
+
+/**
+ * @brief Generator of synthetic directory trees for benchmarks.
+ *
+ * Directories form a complete tree of `depth` levels with `fanout`
+ * subdirectories each, files are spread round-robin over all directories.
+ * File names resemble the contents of a dump directory, i.e. mostly logs and
+ * a few cores.
+ * The same shape and seed always generate the same tree.
+ *
+ */
+class TreeGenerator
+{
+public:
+    /**
+     * @brief Construct a new TreeGenerator object
+     *
+     * @param shape Shape of the trees to generate
+     */
+    explicit TreeGenerator(TreeShape const& shape);
+
+    /**
+     * @brief Generate a tree, replacing any existing directory
+     *
+     * @param root Directory to create the tree in
+     * @return true on success, false otherwise
+     */
+    bool generate(std::filesystem::path const& root);
+
+    /**
+     * @brief Get the generated regular files
+     *
+     * @return Paths of the files, in order of creation
+     */
+    std::vector<std::filesystem::path> const& files() const;
+
+    /**
+     * @brief Get the total size of the generated files
+     *
+     * @return number of bytes
+     */
+    std::uint64_t bytes() const;
+
+private:
+    TreeShape shape {};
+    std::vector<std::filesystem::path> generated {};
+    std::uint64_t total {0};
+};
@@ -0,0 +1,611 @@
+/**
+ * @file block_compressor.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a multithreaded, seekable block compressor
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "block_compressor.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef COLLECTOR_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef COLLECTOR_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+
+/*
+ * Frames are terminated by a seek table as specified by the zstd seekable
+ * format, within a skippable frame that lz4 decoders skip as well.
+ *
+ * See https://github.com/facebook/zstd/blob/dev/contrib/seekable_format/zstd_seekable_compression_format.md,
+ *     https://github.com/facebook/zstd/blob/dev/doc/zstd_compression_format.md
+ * and https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md.
+ */
+
+
+namespace
+{
+    constexpr std::uint32_t ZSTD_FRAME_MAGIC = 0xFD2FB528;
+    constexpr std::uint32_t LZ4_FRAME_MAGIC = 0x184D2204;
+
+    // skippable frames of the member index and the seek table
+    constexpr std::uint32_t INDEX_MAGIC = 0x184D2A5C;
+    constexpr std::uint32_t SEEK_TABLE_MAGIC = 0x184D2A5E;
+    constexpr std::uint32_t SEEKABLE_MAGIC = 0x8F92EAB1;
+
+    constexpr std::size_t SKIPPABLE_HEADER_SIZE = 8;
+    constexpr std::size_t SEEK_TABLE_FOOTER_SIZE = 9;
+
+    constexpr std::size_t TAR_BLOCK = 512;
+    constexpr std::size_t TAR_RECORD = 20 * TAR_BLOCK;
+
+    // frames are compressed ahead of the writer by at most this many blocks
+    // per thread
+    constexpr std::size_t BLOCKS_PER_THREAD = 2;
+
+
+    void append_le(std::vector<char>& output, std::uint64_t value, std::size_t const bytes)
+    {
+        for (std::size_t i {0}; i < bytes; ++i, value >>= 8)
+        {
+            output.push_back(static_cast<char>(value & 0xFF));
+        }
+    }
+
+
+    std::uint64_t read_le(char const* data, std::size_t const bytes)
+    {
+        std::uint64_t value {0};
+        for (std::size_t i {bytes}; i-- > 0;)
+        {
+            value = (value << 8) | static_cast<unsigned char>(data[i]);
+        }
+        return value;
+    }
+
+
+    bool read_at(int const file_descriptor, char* data, std::size_t size, std::uint64_t offset)
+    {
+        while (size > 0)
+        {
+            ssize_t const n {pread(file_descriptor, data, size, static_cast<off_t>(offset))};
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                return false;
+            }
+            data += n;
+            size -= static_cast<std::size_t>(n);
+            offset += static_cast<std::uint64_t>(n);
+        }
+        return true;
+    }
+
+
+    bool write_all(int const file_descriptor, char const* data, std::size_t size)
+    {
+        while (size > 0)
+        {
+            ssize_t const n {::write(file_descriptor, data, size)};
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                return false;
+            }
+            data += n;
+            size -= static_cast<std::size_t>(n);
+        }
+        return true;
+    }
+
+
+    /**
+     * @brief Compress a block into a single, independent frame
+     *
+     */
+    bool compress_frame(Compression const algorithm, [[maybe_unused]] int const level, [[maybe_unused]] std::vector<char> const& input, [[maybe_unused]] std::vector<char>& output)
+    {
+        switch (algorithm)
+        {
+#ifdef COLLECTOR_WITH_ZSTD
+            case Compression::ZSTD:
+            {
+                // the context is reused for every block of a thread
+                thread_local std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)> context {ZSTD_createCCtx(), &ZSTD_freeCCtx};
+
+                output.resize(ZSTD_compressBound(input.size()));
+                std::size_t const size {ZSTD_compressCCtx(context.get(), output.data(), output.size(), input.data(), input.size(), level)};
+                if (ZSTD_isError(size))
+                {
+                    std::cerr << "Error while compressing: " << ZSTD_getErrorName(size) << std::endl;
+                    return false;
+                }
+                output.resize(size);
+                return true;
+            }
+#endif
+#ifdef COLLECTOR_WITH_LZ4
+            case Compression::LZ4:
+            {
+                LZ4F_preferences_t preferences {};
+                preferences.compressionLevel = level;
+                preferences.frameInfo.contentSize = input.size();
+
+                output.resize(LZ4F_compressFrameBound(input.size(), &preferences));
+                std::size_t const size {LZ4F_compressFrame(output.data(), output.size(), input.data(), input.size(), &preferences)};
+                if (LZ4F_isError(size))
+                {
+                    std::cerr << "Error while compressing: " << LZ4F_getErrorName(size) << std::endl;
+                    return false;
+                }
+                output.resize(size);
+                return true;
+            }
+#endif
+            default:
+            {
+                std::cerr << "Error, compression algorithm is not available" << std::endl;
+                return false;
+            }
+        }
+    }
+
+
+    /**
+     * @brief Decompress a single frame of a known uncompressed size
+     *
+     */
+    bool decompress_frame(std::vector<char> const& input, std::vector<char>& output, [[maybe_unused]] std::size_t const size)
+    {
+        if (input.size() < 4)
+        {
+            return false;
+        }
+
+        std::uint32_t const magic {static_cast<std::uint32_t>(read_le(input.data(), 4))};
+        output.resize(size);
+
+#ifdef COLLECTOR_WITH_ZSTD
+        if (magic == ZSTD_FRAME_MAGIC)
+        {
+            std::size_t const result {ZSTD_decompress(output.data(), output.size(), input.data(), input.size())};
+            if (ZSTD_isError(result) || result != size)
+            {
+                std::cerr << "Error while decompressing frame" << std::endl;
+                return false;
+            }
+            return true;
+        }
+#endif
+#ifdef COLLECTOR_WITH_LZ4
+        if (magic == LZ4_FRAME_MAGIC)
+        {
+            LZ4F_dctx* context {nullptr};
+            if (LZ4F_isError(LZ4F_createDecompressionContext(&context, LZ4F_VERSION)))
+            {
+                return false;
+            }
+
+            std::size_t produced {0};
+            std::size_t consumed {0};
+            std::size_t result {1};
+            while (result != 0 && consumed < input.size() && produced < size)
+            {
+                std::size_t destination {size - produced};
+                std::size_t source {input.size() - consumed};
+                result = LZ4F_decompress(context, output.data() + produced, &destination, input.data() + consumed, &source, nullptr);
+                if (LZ4F_isError(result))
+                {
+                    break;
+                }
+                produced += destination;
+                consumed += source;
+            }
+            LZ4F_freeDecompressionContext(context);
+
+            if (LZ4F_isError(result) || produced != size)
+            {
+                std::cerr << "Error while decompressing frame" << std::endl;
+                return false;
+            }
+            return true;
+        }
+#endif
+
+        std::cerr << "Error, unknown or unavailable frame format " << std::hex << magic << std::dec << std::endl;
+        return false;
+    }
+}
+
+
+BlockCompressor::BlockCompressor(int const output_descriptor, CompressionOptions const& options) :
+    output_descriptor {output_descriptor},
+    options {options}
+{
+    // frame sizes are stored with 32 bits in the seek table
+    this->options.block_size = std::clamp<std::size_t>(options.block_size, TAR_BLOCK, 1u << 30);
+    this->options.threads = options.threads > 0 ? options.threads : available_cpus();
+
+    if (options.algorithm == Compression::NONE || !supported(options.algorithm))
+    {
+        std::cerr << "Error, compression algorithm is not available" << std::endl;
+        failed = true;
+        return;
+    }
+
+    block.reserve(this->options.block_size);
+    for (unsigned int i {0}; i < this->options.threads; ++i)
+    {
+        threads.emplace_back(&BlockCompressor::compress, this);
+    }
+}
+
+
+BlockCompressor::~BlockCompressor()
+{
+    blocks.close();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+
+bool BlockCompressor::supported(Compression const algorithm)
+{
+    switch (algorithm)
+    {
+        case Compression::NONE:
+            return true;
+        case Compression::ZSTD:
+#ifdef COLLECTOR_WITH_ZSTD
+            return true;
+#else
+            return false;
+#endif
+        case Compression::LZ4:
+#ifdef COLLECTOR_WITH_LZ4
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+
+std::optional<Compression> BlockCompressor::parse(std::string const& name)
+{
+    if (name == "none")
+    {
+        return Compression::NONE;
+    }
+    if (name == "zstd")
+    {
+        return Compression::ZSTD;
+    }
+    if (name == "lz4")
+    {
+        return Compression::LZ4;
+    }
+    return std::nullopt;
+}
+
+
+std::string BlockCompressor::extension(Compression const algorithm)
+{
+    switch (algorithm)
+    {
+        case Compression::ZSTD:
+            return ".zst";
+        case Compression::LZ4:
+            return ".lz4";
+        case Compression::NONE:
+        default:
+            return "";
+    }
+}
+
+
+bool BlockCompressor::write(char const* data, std::size_t size)
+{
+    while (size > 0 && !failed)
+    {
+        std::size_t const chunk {std::min(size, options.block_size - block.size())};
+        block.insert(block.end(), data, data + chunk);
+        data += chunk;
+        size -= chunk;
+
+        if (block.size() == options.block_size)
+        {
+            submit();
+        }
+    }
+    return !failed;
+}
+
+
+bool BlockCompressor::finish(std::vector<ArchiveMember> const& members)
+{
+    if (!block.empty())
+    {
+        submit();
+    }
+    write_frames(0);
+
+    if (failed)
+    {
+        return false;
+    }
+
+    // member index: begin and end offset as well as the name of each member
+    std::vector<char> index {};
+    append_le(index, INDEX_MAGIC, 4);
+    append_le(index, 0, 4);
+    for (auto const& member : members)
+    {
+        append_le(index, member.begin, 8);
+        append_le(index, member.end, 8);
+        append_le(index, member.name.size(), 4);
+        index.insert(index.end(), member.name.begin(), member.name.end());
+    }
+    std::uint64_t const index_size {index.size() - SKIPPABLE_HEADER_SIZE};
+    for (std::size_t i {0}; i < 4; ++i)
+    {
+        index[4 + i] = static_cast<char>((index_size >> (8 * i)) & 0xFF);
+    }
+
+    // seek table, without checksums
+    std::vector<char> table {};
+    append_le(table, SEEK_TABLE_MAGIC, 4);
+    append_le(table, seek_table.size() * 8 + SEEK_TABLE_FOOTER_SIZE, 4);
+    for (auto const& [compressed, uncompressed] : seek_table)
+    {
+        append_le(table, compressed, 4);
+        append_le(table, uncompressed, 4);
+    }
+    append_le(table, seek_table.size(), 4);
+    append_le(table, 0, 1);
+    append_le(table, SEEKABLE_MAGIC, 4);
+
+    return write_output(index.data(), index.size()) && write_output(table.data(), table.size());
+}
+
+
+void BlockCompressor::compress()
+{
+    Block input {};
+
+    while (blocks.pop(input))
+    {
+        Frame frame {};
+        frame.size = static_cast<std::uint32_t>(input.data->size());
+        frame.failed = !compress_frame(options.algorithm, options.level, *input.data, frame.data);
+
+        {
+            std::lock_guard<std::mutex> lock {mutex};
+            frames.emplace(input.index, std::move(frame));
+        }
+        frame_done.notify_all();
+    }
+}
+
+
+bool BlockCompressor::submit()
+{
+    auto data {std::make_shared<std::vector<char> const>(std::move(block))};
+    block = std::vector<char> {};
+    block.reserve(options.block_size);
+
+    blocks.push(Block {submitted++, std::move(data)});
+
+    // bound the memory of blocks which are compressed ahead
+    return write_frames(options.threads * BLOCKS_PER_THREAD);
+}
+
+
+bool BlockCompressor::write_frames(std::size_t const keep)
+{
+    while (submitted - written > keep)
+    {
+        Frame frame {};
+        {
+            std::unique_lock<std::mutex> lock {mutex};
+            frame_done.wait(lock, [this] { return frames.count(written) > 0; });
+
+            auto const entry {frames.find(written)};
+            frame = std::move(entry->second);
+            frames.erase(entry);
+        }
+        ++written;
+
+        if (frame.failed)
+        {
+            failed = true;
+            continue;
+        }
+
+        write_output(frame.data.data(), frame.data.size());
+        seek_table.emplace_back(static_cast<std::uint32_t>(frame.data.size()), frame.size);
+    }
+    return !failed;
+}
+
+
+bool BlockCompressor::write_output(char const* data, std::size_t size)
+{
+    if (!failed && !write_all(output_descriptor, data, size))
+    {
+        std::cerr << "Error while writing compressed archive: " << std::strerror(errno) << std::endl;
+        failed = true;
+    }
+    return !failed;
+}
+
+
+bool BlockCompressor::extract(std::filesystem::path const& archive, std::string const& member, std::filesystem::path const& output_file)
+{
+    int const file_descriptor {open(archive.c_str(), O_RDONLY | O_CLOEXEC)};
+    if (file_descriptor < 0)
+    {
+        std::cerr << "Cannot open " << archive << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat status {};
+    char footer[SEEK_TABLE_FOOTER_SIZE] {};
+    bool valid
+    {
+        fstat(file_descriptor, &status) == 0
+            && static_cast<std::uint64_t>(status.st_size) >= SEEK_TABLE_FOOTER_SIZE
+            && read_at(file_descriptor, footer, SEEK_TABLE_FOOTER_SIZE, static_cast<std::uint64_t>(status.st_size) - SEEK_TABLE_FOOTER_SIZE)
+            && read_le(footer + 5, 4) == SEEKABLE_MAGIC
+    };
+
+    // locate the frames, the member index follows the last frame
+    std::uint64_t const count {valid ? read_le(footer, 4) : 0};
+    std::size_t const entry_size {(footer[4] & 0x80) ? 12u : 8u};
+    std::uint64_t const table_size {SKIPPABLE_HEADER_SIZE + count * entry_size + SEEK_TABLE_FOOTER_SIZE};
+    valid = valid && table_size <= static_cast<std::uint64_t>(status.st_size);
+
+    std::vector<char> table(valid ? count * entry_size : 0);
+    valid = valid && read_at(file_descriptor, table.data(), table.size(), static_cast<std::uint64_t>(status.st_size) - table_size + SKIPPABLE_HEADER_SIZE);
+
+    // compressed and uncompressed start offsets of every frame
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> offsets {{0, 0}};
+    for (std::uint64_t i {0}; valid && i < count; ++i)
+    {
+        offsets.emplace_back
+        (
+            offsets.back().first + read_le(table.data() + i * entry_size, 4),
+            offsets.back().second + read_le(table.data() + i * entry_size + 4, 4)
+        );
+    }
+
+    char header[SKIPPABLE_HEADER_SIZE] {};
+    valid = valid
+        && read_at(file_descriptor, header, SKIPPABLE_HEADER_SIZE, offsets.back().first)
+        && read_le(header, 4) == INDEX_MAGIC;
+    std::vector<char> index(valid ? read_le(header + 4, 4) : 0);
+    valid = valid && read_at(file_descriptor, index.data(), index.size(), offsets.back().first + SKIPPABLE_HEADER_SIZE);
+
+    if (!valid)
+    {
+        std::cerr << archive << " is no seekable archive" << std::endl;
+        close(file_descriptor);
+        return false;
+    }
+
+    // find the member, directories are stored with a trailing slash
+    std::string name {member};
+    while (name.size() > 1 && name.back() == '/')
+    {
+        name.pop_back();
+    }
+
+    std::optional<ArchiveMember> found {};
+    for (std::size_t position {0}; position + 20 <= index.size();)
+    {
+        ArchiveMember entry {};
+        entry.begin = read_le(index.data() + position, 8);
+        entry.end = read_le(index.data() + position + 8, 8);
+        std::size_t const length {static_cast<std::size_t>(read_le(index.data() + position + 16, 4))};
+        entry.name.assign(index.data() + position + 20, std::min(length, index.size() - position - 20));
+        position += 20 + length;
+
+        if (entry.name == name)
+        {
+            found = entry;
+            break;
+        }
+    }
+
+    if (!found || found->end > offsets.back().second)
+    {
+        std::cerr << "Cannot find " << member << " in " << archive << std::endl;
+        close(file_descriptor);
+        return false;
+    }
+
+    // decompress only the frames overlapping the member
+    auto const first
+    {
+        std::upper_bound(offsets.begin(), offsets.end(), found->begin, [](std::uint64_t const offset, auto const& entry)
+        {
+            return offset < entry.second;
+        }) - 1
+    };
+
+    int const output_descriptor {open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+    if (output_descriptor < 0)
+    {
+        std::cerr << "Cannot create " << output_file << ": " << std::strerror(errno) << std::endl;
+        close(file_descriptor);
+        return false;
+    }
+
+    // every frame is written as soon as it is decompressed, trimmed to the
+    // member, such that at most one frame is held in memory
+    bool result {true};
+    std::vector<char> compressed {};
+    std::vector<char> frame {};
+    for (auto current {first}; result && current + 1 != offsets.end() && current->second < found->end; ++current)
+    {
+        compressed.resize((current + 1)->first - current->first);
+        if (!read_at(file_descriptor, compressed.data(), compressed.size(), current->first)
+            || !decompress_frame(compressed, frame, (current + 1)->second - current->second))
+        {
+            result = false;
+            break;
+        }
+
+        std::uint64_t const begin {std::max(found->begin, current->second)};
+        std::uint64_t const end {std::min(found->end, (current + 1)->second)};
+        result = write_all(output_descriptor, frame.data() + (begin - current->second), static_cast<std::size_t>(end - begin));
+        if (!result)
+        {
+            std::cerr << "Error while writing " << output_file << ": " << std::strerror(errno) << std::endl;
+        }
+    }
+    close(file_descriptor);
+
+    // the member is a complete tar entry, terminate it like an archive
+    std::size_t const size {static_cast<std::size_t>(found->end - found->begin)};
+    std::size_t const total {(size + 2 * TAR_BLOCK + TAR_RECORD - 1) / TAR_RECORD * TAR_RECORD};
+    std::vector<char> const padding(total - size, '\0');
+    if (result && !write_all(output_descriptor, padding.data(), padding.size()))
+    {
+        std::cerr << "Error while writing " << output_file << ": " << std::strerror(errno) << std::endl;
+        result = false;
+    }
+    close(output_descriptor);
+
+    if (!result)
+    {
+        unlink(output_file.c_str());
+    }
+    return result;
+}
@@ -0,0 +1,218 @@
+/**
+ * @file block_compressor.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a multithreaded, seekable block compressor
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include "fifo.h"
+#include "throttle.h"
+
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+constexpr std::size_t COMPRESSION_BLOCK_SIZE = 1 << 20;
+
+
+/**
+ * @brief Compression algorithm of output archives
+ *
+ */
+enum class Compression
+{
+    NONE,
+    ZSTD,
+    LZ4
+};
+
+
+/**
+ * @brief Configuration of the compression of output archives
+ *
+ */
+struct CompressionOptions
+{
+    /**
+     * @brief Compression algorithm, archives are not compressed by default
+     *
+     */
+    Compression algorithm {Compression::NONE};
+
+    /**
+     * @brief Compression level, 0 selects the default level of the algorithm
+     *
+     */
+    int level {0};
+
+    /**
+     * @brief Number of threads compressing blocks in parallel, 0 for one per
+     * available CPU, or a share of them if collecting concurrently
+     *
+     */
+    unsigned int threads {0};
+
+    /**
+     * @brief Number of uncompressed bytes per independently compressed frame
+     *
+     */
+    std::size_t block_size {COMPRESSION_BLOCK_SIZE};
+};
+
+
+/**
+ * @brief Location of a member within the uncompressed archive
+ *
+ */
+struct ArchiveMember
+{
+    std::string name {};
+    std::uint64_t begin {0};
+    std::uint64_t end {0};
+};
+
+
+/**
+ * @brief Compressor splitting a stream into blocks which are compressed in
+ * parallel as independent zstd or lz4 frames and written in order.
+ *
+ * The output is terminated by two skippable frames, which every decoder
+ * ignores: an index of the archive members, followed by a seek table in the
+ * zstd seekable format.
+ * Thus a single member can be extracted by decompressing only the frames
+ * containing it, see `extract`.
+ *
+ */
+class BlockCompressor
+{
+public:
+    /**
+     * @brief Construct a new BlockCompressor object, starting the compression
+     * threads
+     *
+     * @param output_descriptor File descriptor compressed frames are written to
+     * @param options Algorithm, level, number of threads and block size
+     */
+    BlockCompressor(int const output_descriptor, CompressionOptions const& options);
+
+    /**
+     * @brief Destroy the BlockCompressor object, stopping the compression
+     * threads
+     *
+     */
+    ~BlockCompressor();
+
+    BlockCompressor(BlockCompressor const&) = delete;
+    BlockCompressor& operator=(BlockCompressor const&) = delete;
+
+    /**
+     * @brief Checks whether an algorithm is available in this build
+     *
+     * @param algorithm Compression algorithm
+     * @return true if archives can be compressed with the algorithm
+     */
+    static bool supported(Compression const algorithm);
+
+    /**
+     * @brief Parse the name of a compression algorithm
+     *
+     * @param name "zstd", "lz4" or "none"
+     * @return algorithm, or nothing if the name is unknown
+     */
+    static std::optional<Compression> parse(std::string const& name);
+
+    /**
+     * @brief Get the file name extension of an algorithm
+     *
+     * @param algorithm Compression algorithm
+     * @return ".zst", ".lz4" or an empty string
+     */
+    static std::string extension(Compression const algorithm);
+
+    /**
+     * @brief Append data to the uncompressed stream
+     *
+     * @param data Data to append
+     * @param size Number of bytes to append
+     * @return true on success, false otherwise
+     */
+    bool write(char const* data, std::size_t size);
+
+    /**
+     * @brief Compress the remaining data and write the member index and the
+     * seek table
+     *
+     * @param members Members of the uncompressed archive
+     * @return true on success, false otherwise
+     */
+    bool finish(std::vector<ArchiveMember> const& members);
+
+    /**
+     * @brief Extract a single member of a compressed archive, decompressing
+     * only the frames it is stored in
+     *
+     * Hard links are extracted as links only.
+     *
+     * @param archive Compressed archive written by a `BlockCompressor`
+     * @param member Name of the member
+     * @param output_file Path of a tar archive containing only the member
+     * @return true on success, false otherwise
+     */
+    static bool extract(std::filesystem::path const& archive, std::string const& member, std::filesystem::path const& output_file);
+
+private:
+    struct Block
+    {
+        std::uint64_t index {0};
+        std::shared_ptr<std::vector<char> const> data {};
+    };
+
+    struct Frame
+    {
+        std::vector<char> data {};
+        std::uint32_t size {0};
+        bool failed {false};
+    };
+
+    void compress();
+    bool submit();
+    bool write_frames(std::size_t const keep);
+    bool write_output(char const* data, std::size_t size);
+
+private:
+    int output_descriptor {-1};
+    CompressionOptions options {};
+    bool failed {false};
+
+    std::vector<char> block {};
+    std::uint64_t submitted {0};
+    std::uint64_t written {0};
+
+    // sizes of every written frame, compressed and uncompressed
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> seek_table {};
+
+    blocking_fifo<Block> blocks {};
+    std::mutex mutex {};
+    std::condition_variable frame_done {};
+    std::map<std::uint64_t, Frame> frames {};
+
+    std::vector<std::thread> threads {};
+};
@@ -0,0 +1,510 @@
+/**
+ * @file chunk_store.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a content-addressed chunk store for collected files
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "chunk_store.h"
+#include "sha256.h"
+#include "tar_writer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+
+/*
+ * Manifests are text files, one member per line:
+ *
+ *     <type> <mode> <uid> <gid> <mtime> <size> <major> <minor> <name> <link> <chunks>
+ *
+ * Numbers are decimal, names are percent-encoded, empty names are written as
+ * "-", and chunks are a comma-separated list of SHA-256 digests or "-".
+ */
+
+
+namespace
+{
+    constexpr std::string_view MANIFEST_HEADER {"collector-manifest 1"};
+
+
+    /**
+     * @brief Percent-encode a name such that it contains no white space
+     *
+     */
+    std::string encode(std::string const& value)
+    {
+        if (value.empty())
+        {
+            return "-";
+        }
+        if (value == "-")
+        {
+            return "%2D";
+        }
+
+        static char const digits[] {"0123456789ABCDEF"};
+        std::string result {};
+        for (char const c : value)
+        {
+            auto const byte {static_cast<unsigned char>(c)};
+            if (byte <= 0x20 || byte == 0x7F || c == '%')
+            {
+                result += '%';
+                result += digits[byte >> 4];
+                result += digits[byte & 15];
+            }
+            else
+            {
+                result += c;
+            }
+        }
+        return result;
+    }
+
+
+    /**
+     * @brief Decode a percent-encoded name, failing on malformed escapes
+     *
+     */
+    bool decode(std::string const& value, std::string& result)
+    {
+        result.clear();
+        if (value == "-")
+        {
+            return true;
+        }
+
+        auto const digit = [] (char const c) -> int
+        {
+            if (c >= '0' && c <= '9')
+            {
+                return c - '0';
+            }
+            if (c >= 'A' && c <= 'F')
+            {
+                return c - 'A' + 10;
+            }
+            if (c >= 'a' && c <= 'f')
+            {
+                return c - 'a' + 10;
+            }
+            return -1;
+        };
+
+        for (std::size_t i {0}; i < value.size(); ++i)
+        {
+            if (value[i] != '%')
+            {
+                result += value[i];
+                continue;
+            }
+
+            int const high {i + 2 < value.size() ? digit(value[i + 1]) : -1};
+            int const low {i + 2 < value.size() ? digit(value[i + 2]) : -1};
+            if (high < 0 || low < 0)
+            {
+                return false;
+            }
+            result += static_cast<char>(high << 4 | low);
+            i += 2;
+        }
+        return true;
+    }
+
+
+    /**
+     * @brief Derive the member name from a path like GNU tar does, i.e. strip
+     * leading slashes
+     *
+     */
+    std::string member_name(std::filesystem::path const& name)
+    {
+        std::string result {name.generic_string()};
+        result.erase(0, result.find_first_not_of('/'));
+        return result;
+    }
+}
+
+
+ChunkStore::ChunkStore(std::filesystem::path const& root, std::size_t const cache_limit) :
+    chunks {root / std::filesystem::path {"chunks"}},
+    cache_limit {cache_limit}
+{
+}
+
+
+bool ChunkStore::store(std::vector<std::filesystem::path> const& files, std::filesystem::path const& manifest)
+{
+    std::cout << "Storing collected data in chunk store " << chunks << std::endl;
+
+    std::ofstream output {manifest};
+    if (!output)
+    {
+        std::cerr << "Error, cannot create manifest " << manifest << std::endl;
+        return false;
+    }
+    output << MANIFEST_HEADER << '\n';
+
+    bool result {true};
+    std::map<std::pair<dev_t, ino_t>, std::string> hard_links {};
+
+    for (auto const& file : files)
+    {
+        struct statx status {};
+        if (statx(AT_FDCWD, file.c_str(), AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS, &status) != 0)
+        {
+            std::cerr << "Cannot stat " << file << ": " << std::strerror(errno) << std::endl;
+            continue;
+        }
+
+        TarWriter::Header header {};
+        header.name = member_name(file);
+        header.mode = status.stx_mode & 07777;
+        header.uid = status.stx_uid;
+        header.gid = status.stx_gid;
+        header.mtime = status.stx_mtime.tv_sec;
+
+        Cached cached {};
+
+        switch (status.stx_mode & S_IFMT)
+        {
+            case S_IFREG:
+            {
+                // store further links to an already stored inode as hard links
+                std::pair<dev_t, ino_t> const inode {makedev(status.stx_dev_major, status.stx_dev_minor), status.stx_ino};
+                if (status.stx_nlink > 1)
+                {
+                    auto const [link, inserted] = hard_links.try_emplace(inode, header.name);
+                    if (!inserted)
+                    {
+                        header.type = '1';
+                        header.link_name = link->second;
+                        break;
+                    }
+                }
+
+                header.type = '0';
+                cached.size = status.stx_size;
+                cached.mtime = status.stx_mtime.tv_sec * 1000000000 + status.stx_mtime.tv_nsec;
+                cached.ctime = status.stx_ctime.tv_sec * 1000000000 + status.stx_ctime.tv_nsec;
+
+                // unchanged files are neither read nor stored again
+                bool unchanged {false};
+                {
+                    std::lock_guard<std::mutex> lock {mutex};
+                    auto const entry {cache.find(inode)};
+                    if (entry != cache.end() && entry->second.size == cached.size
+                        && entry->second.mtime == cached.mtime && entry->second.ctime == cached.ctime)
+                    {
+                        recently_used.splice(recently_used.begin(), recently_used, entry->second.used);
+                        cached.chunks = entry->second.chunks;
+                        skipped += cached.size;
+                        unchanged = true;
+                    }
+                }
+
+                if (!unchanged)
+                {
+                    if (!store_file(file, status.stx_size, cached))
+                    {
+                        hard_links.erase(inode);
+                        result = false;
+                        continue;
+                    }
+
+                    remember(inode, cached);
+                }
+
+                header.size = cached.size;
+                break;
+            }
+            case S_IFDIR:
+            {
+                header.type = '5';
+                if (!header.name.empty() && header.name.back() != '/')
+                {
+                    header.name += '/';
+                }
+                break;
+            }
+            case S_IFLNK:
+            {
+                std::vector<char> target(static_cast<std::size_t>(status.stx_size) + 1);
+                ssize_t const length {readlink(file.c_str(), target.data(), target.size())};
+                if (length < 0)
+                {
+                    std::cerr << "Cannot read link " << file << ": " << std::strerror(errno) << std::endl;
+                    continue;
+                }
+                header.type = '2';
+                header.link_name.assign(target.data(), static_cast<std::size_t>(length));
+                break;
+            }
+            case S_IFCHR:
+            case S_IFBLK:
+            {
+                header.type = S_ISCHR(status.stx_mode) ? '3' : '4';
+                header.device_major = status.stx_rdev_major;
+                header.device_minor = status.stx_rdev_minor;
+                break;
+            }
+            case S_IFIFO:
+            {
+                header.type = '6';
+                break;
+            }
+            default:
+            {
+                std::cerr << file << ": socket ignored" << std::endl;
+                continue;
+            }
+        }
+
+        std::string chunk_list {};
+        for (auto const& chunk : cached.chunks)
+        {
+            chunk_list += (chunk_list.empty() ? "" : ",") + chunk;
+        }
+
+        output << header.type << ' ' << header.mode << ' ' << header.uid << ' ' << header.gid << ' '
+               << header.mtime << ' ' << header.size << ' ' << header.device_major << ' ' << header.device_minor << ' '
+               << encode(header.name) << ' ' << encode(header.link_name) << ' ' << encode(chunk_list) << '\n';
+    }
+
+    output.close();
+    if (!output)
+    {
+        std::cerr << "Error while writing manifest " << manifest << std::endl;
+        return false;
+    }
+    return result;
+}
+
+
+bool ChunkStore::rebuild(std::filesystem::path const& manifest, std::filesystem::path const& chunks, std::filesystem::path const& output_file)
+{
+    std::ifstream input {manifest};
+    std::string line {};
+
+    if (!std::getline(input, line) || line != MANIFEST_HEADER)
+    {
+        std::cerr << manifest << " is no manifest" << std::endl;
+        return false;
+    }
+
+    TarWriter archive {output_file};
+    bool result {archive.is_open()};
+
+    while (result && std::getline(input, line))
+    {
+        std::istringstream fields {line};
+        TarWriter::Header header {};
+        std::string name {};
+        std::string link_name {};
+        std::string chunk_list {};
+
+        if (!(fields >> header.type >> header.mode >> header.uid >> header.gid >> header.mtime >> header.size
+                     >> header.device_major >> header.device_minor >> name >> link_name >> chunk_list))
+        {
+            std::cerr << "Malformed manifest entry: " << line << std::endl;
+            result = false;
+            break;
+        }
+        std::string digest_list {};
+        if (!decode(name, header.name) || !decode(link_name, header.link_name) || !decode(chunk_list, digest_list))
+        {
+            std::cerr << "Malformed manifest entry: " << line << std::endl;
+            result = false;
+            break;
+        }
+
+        std::vector<std::filesystem::path> parts {};
+        std::istringstream digests {digest_list};
+        for (std::string digest {}; std::getline(digests, digest, ',');)
+        {
+            parts.push_back(chunks / std::filesystem::path {digest.substr(0, 2)} / std::filesystem::path {digest});
+        }
+
+        result = archive.add(header, parts);
+    }
+
+    return archive.finish() && result;
+}
+
+
+std::uint64_t ChunkStore::bytes_skipped() const
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return skipped;
+}
+
+
+std::uint64_t ChunkStore::bytes_stored() const
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return stored;
+}
+
+
+void ChunkStore::set_throttle(Throttle* throttle)
+{
+    this->throttle = throttle;
+}
+
+
+void ChunkStore::remember(std::pair<dev_t, ino_t> const& inode, Cached const& cached)
+{
+    auto const weight = [] (Cached const& entry) { return std::max<std::size_t>(entry.chunks.size(), 1); };
+
+    std::lock_guard<std::mutex> lock {mutex};
+
+    auto entry {cache.find(inode)};
+    if (entry == cache.end())
+    {
+        recently_used.push_front(inode);
+        entry = cache.emplace(inode, cached).first;
+    }
+    else
+    {
+        cache_size -= weight(entry->second);
+        recently_used.splice(recently_used.begin(), recently_used, entry->second.used);
+        entry->second = cached;
+    }
+    entry->second.used = recently_used.begin();
+    cache_size += weight(entry->second);
+
+    // forget the least recently collected inodes, e.g. of deleted cores,
+    // such that a long-running collector does not grow, whatever root or
+    // directory they were collected for
+    while (cache_size > cache_limit && !recently_used.empty())
+    {
+        auto const oldest {cache.find(recently_used.back())};
+        cache_size -= weight(oldest->second);
+        cache.erase(oldest);
+        recently_used.pop_back();
+    }
+}
+
+
+bool ChunkStore::store_file(std::filesystem::path const& file, std::uint64_t const size, Cached& cached)
+{
+    int const file_descriptor {open(file.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)};
+    if (file_descriptor < 0)
+    {
+        std::cerr << "Cannot open " << file << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    std::vector<char> buffer(static_cast<std::size_t>(std::min<std::uint64_t>(size, CHUNK_SIZE)));
+    std::uint64_t total {0};
+    bool result {true};
+
+    // the file is stored with the size it had when it was listed
+    while (total < size && result)
+    {
+        std::size_t const chunk {static_cast<std::size_t>(std::min<std::uint64_t>(size - total, CHUNK_SIZE))};
+        std::size_t filled {0};
+        if (throttle)
+        {
+            throttle->acquire(chunk);
+        }
+        while (filled < chunk)
+        {
+            ssize_t const n {read(file_descriptor, buffer.data() + filled, chunk - filled)};
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                break;
+            }
+            filled += static_cast<std::size_t>(n);
+        }
+
+        if (filled == 0)
+        {
+            break;
+        }
+
+        std::string const digest {Sha256::hex(buffer.data(), filled)};
+        result = store_chunk(digest, buffer.data(), filled);
+        cached.chunks.push_back(digest);
+        total += filled;
+    }
+    close(file_descriptor);
+
+    if (total < size)
+    {
+        std::cerr << file << ": file shrank by " << size - total << " bytes" << std::endl;
+    }
+    cached.size = total;
+    return result;
+}
+
+
+bool ChunkStore::store_chunk(std::string const& digest, char const* data, std::size_t const size)
+{
+    std::filesystem::path const path {chunk_path(digest)};
+    std::error_code error {};
+
+    // chunks of previous collections and runs are reused, unchanged files
+    // do not get here at all, hence digests are not remembered in memory
+    if (!std::filesystem::exists(path, error))
+    {
+        std::filesystem::create_directories(path.parent_path(), error);
+
+        // write under a temporary name, such that chunks appear atomically,
+        // even if several threads store the same chunk at once
+        std::filesystem::path const temporary
+        {
+            path.native() + ".tmp." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()))
+        };
+
+        std::ofstream output {temporary, std::ios::binary};
+        output.write(data, static_cast<std::streamsize>(size));
+        output.close();
+
+        if (!output)
+        {
+            std::cerr << "Error while writing chunk " << path << std::endl;
+            std::filesystem::remove(temporary, error);
+            return false;
+        }
+
+        std::filesystem::rename(temporary, path, error);
+        if (error)
+        {
+            std::cerr << "Error while storing chunk " << path << ": " << error.message() << std::endl;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock {mutex};
+        stored += size;
+    }
+
+    return true;
+}
+
+
+std::filesystem::path ChunkStore::chunk_path(std::string const& digest) const
+{
+    // spread chunks over 256 directories by the first byte of their digest
+    return chunks / std::filesystem::path {digest.substr(0, 2)} / std::filesystem::path {digest};
+}
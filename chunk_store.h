@@ -0,0 +1,143 @@
+/**
+ * @file chunk_store.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a content-addressed chunk store for collected files
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include "throttle.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+
+constexpr std::size_t CHUNK_SIZE = 1 << 20;
+
+/**
+ * @brief Number of chunk digests the store remembers for unchanged files, i.e.
+ * about 25 MiB of memory for 256 GiB of collected contents
+ *
+ */
+constexpr std::size_t CHUNK_CACHE_LIMIT = 1 << 18;
+
+
+/**
+ * @brief Content-addressed store of file contents, as alternative to writing
+ * a complete tar archive per trigger.
+ *
+ * Files are cut into chunks of `CHUNK_SIZE` bytes, every chunk is stored once
+ * under its SHA-256 digest in `<root>/chunks/`.
+ * A trigger produces a small manifest listing the metadata and chunks of
+ * every collected file, from which `rebuild` restores a plain tar archive.
+ * Since logs grow by appending, fixed-size chunks keep all but the last
+ * chunk of a grown file.
+ * Files whose inode, size, modification and change time are unchanged since
+ * they were last stored are not read again at all, the least recently
+ * collected inodes are forgotten once their chunks exceed a limit.
+ * The store may be used by several threads at once.
+ *
+ */
+class ChunkStore
+{
+public:
+    /**
+     * @brief Construct a new ChunkStore object
+     *
+     * @param root Directory holding the `chunks` directory, e.g. the output
+     * directory
+     * @param cache_limit Number of chunk digests remembered for unchanged
+     * files, counting files without chunks as one
+     */
+    explicit ChunkStore(std::filesystem::path const& root, std::size_t const cache_limit = CHUNK_CACHE_LIMIT);
+
+    /**
+     * @brief Store a list of files and write a manifest referencing them
+     *
+     * @param files Files to store, in order
+     * @param manifest File path of the manifest
+     * @return true on success, false otherwise
+     */
+    bool store(std::vector<std::filesystem::path> const& files, std::filesystem::path const& manifest);
+
+    /**
+     * @brief Rebuild a plain tar archive from a manifest
+     *
+     * @param manifest Manifest written by `store`
+     * @param chunks Directory holding the chunks, i.e. `<root>/chunks`
+     * @param output_file File path of the tar archive
+     * @return true on success, false otherwise
+     */
+    static bool rebuild(std::filesystem::path const& manifest, std::filesystem::path const& chunks, std::filesystem::path const& output_file);
+
+    /**
+     * @brief Get the number of bytes which were not read, since their files
+     * were unchanged
+     *
+     * @return number of bytes
+     */
+    std::uint64_t bytes_skipped() const;
+
+    /**
+     * @brief Get the number of bytes written to new chunks
+     *
+     * @return number of bytes
+     */
+    std::uint64_t bytes_stored() const;
+
+    /**
+     * @brief Limit the rate files are read at
+     *
+     * @param throttle Token buckets shared with other stages, nullptr for no
+     * limit
+     */
+    void set_throttle(Throttle* throttle);
+
+private:
+    struct Cached
+    {
+        std::uint64_t size {0};
+        std::int64_t mtime {0};
+        std::int64_t ctime {0};
+        std::vector<std::string> chunks {};
+
+        // position within the order of use
+        std::list<std::pair<dev_t, ino_t>>::iterator used {};
+    };
+
+    void remember(std::pair<dev_t, ino_t> const& inode, Cached const& cached);
+
+    bool store_file(std::filesystem::path const& file, std::uint64_t const size, Cached& cached);
+    bool store_chunk(std::string const& digest, char const* data, std::size_t const size);
+    std::filesystem::path chunk_path(std::string const& digest) const;
+
+private:
+    std::filesystem::path chunks {};
+    Throttle* throttle {nullptr};
+
+    mutable std::mutex mutex {};
+    std::map<std::pair<dev_t, ino_t>, Cached> cache {};
+
+    // inodes of the cache, most recently used first, and their weight
+    std::list<std::pair<dev_t, ino_t>> recently_used {};
+    std::size_t cache_limit {CHUNK_CACHE_LIMIT};
+    std::size_t cache_size {0};
+    std::uint64_t skipped {0};
+    std::uint64_t stored {0};
+};
@@ -11,24 +11,67 @@
 
 
 #include "collector.h"
-
-#include <chrono>
+#include "disk_usage.h"
+#include "io_ring.h"
+#include "snapshot.h"
+#include "tar_writer.h"
+#include "tree_walker.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <sstream>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/fanotify.h>
 #include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 
 void Collector::monitor_and_collect()
 {
-    std::cout << "Start monitoring " << input_path << std::endl;
+    for (auto& root : roots)
+    {
+        std::cout << "Start monitoring " << root->input_path << ", storing collected data in " << root->output_path << std::endl;
+
+        // roots writing to the same output directory share a chunk store
+        if (deduplication && !root->chunk_store)
+        {
+            auto& store {chunk_stores[root->output_path]};
+            if (!store)
+            {
+                store = std::make_unique<ChunkStore>(root->output_path);
+                store->set_throttle(throttle.get());
+            }
+            root->chunk_store = store.get();
+        }
+    }
     std::cout << "Please type <q> and press <RETURN> to stop the program and quit." << std::endl;
 
-    // start both worker threads
+    std::cout << "Collecting with " << workers << " worker thread(s)" << std::endl;
+
+    // start the monitor thread and the pool of collector threads
     monitor_thread = std::thread{&Collector::monitor, this};
-    collector_thread = std::thread{&Collector::collect, this};
+    if (!metrics_file.empty() || !metrics_socket.empty())
+    {
+        metrics_thread = std::thread{&Collector::export_metrics, this};
+    }
+    for (unsigned int i {0}; i < workers; ++i)
+    {
+        collector_threads.emplace_back(&Collector::collect, this);
+    }
 
 
     /*
@@ -42,16 +85,19 @@ void Collector::monitor_and_collect()
 
 
     // start polling stdin for program termination, i.e. input of <q>
-    pollfd poll_descriptor {};
-    poll_descriptor.fd = STDIN_FILENO;
-    poll_descriptor.events = POLLIN;
+    // the stop eventfd wakes up the poll if stop() is called by another thread
+    pollfd poll_descriptors[2] {};
+    poll_descriptors[0].fd = STDIN_FILENO;
+    poll_descriptors[0].events = POLLIN;
+    poll_descriptors[1].fd = stop_descriptor;
+    poll_descriptors[1].events = POLLIN;
 
-    char buffer {};
+    char buffer[BUFFER_SIZE];
 
-    for (;;)
+    while (is_running.load())
     {
         // poll from stdin
-        int poll_number {poll(&poll_descriptor, 1, -1)};
+        int poll_number {poll(poll_descriptors, 2, -1)};
 
         // error or interrupt
         if (poll_number < 0)
@@ -64,31 +110,161 @@ void Collector::monitor_and_collect()
             break;
         }
 
+        // stop requested
+        if (poll_descriptors[1].revents & POLLIN)
+        {
+            break;
+        }
+
         // event arrived
-        if (poll_number > 0)
+        if (poll_descriptors[0].revents & (POLLIN | POLLHUP))
         {
-            if (poll_descriptor.revents & POLLIN)
+            // read from stdin, quit out of loop if a 'q' character is found
+            ssize_t const n {read(STDIN_FILENO, buffer, BUFFER_SIZE)};
+
+            if (n > 0 && std::memchr(buffer, 'q', static_cast<std::size_t>(n)))
             {
-                /*
-                 * read from stdin until 'q' character is found,
-                 * then quit out of loop
-                 */
-                while (read(STDIN_FILENO, &buffer, 1) > 0 && buffer != 'q')
-                {
-                    continue;
-                }
                 break;
             }
+
+            // stdin is closed, e.g. when running as a service, wait for stop()
+            if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
+            {
+                poll_descriptors[0].fd = -1;
+            }
         }
     }
 
     std::cout << "Stopping worker threads" << std::endl;
 
-    // request interruption of worker threads
-    is_running.store(false);
+    // request interruption of worker threads, the monitor thread flushes
+    // triggers within their coalescing window before it finishes, after
+    // that the collector threads see the end of the queue
+    stop();
 
     monitor_thread.join();
-    collector_thread.join();
+    queue->close();
+    for (auto& thread : collector_threads)
+    {
+        thread.join();
+    }
+    collector_threads.clear();
+
+    if (!queue->empty())
+    {
+        std::cout << "Discarding " << queue->size() << " pending file creation event(s)" << std::endl;
+        metrics.dropped.fetch_add(queue->size(), std::memory_order_relaxed);
+    }
+
+    if (metrics_thread.joinable())
+    {
+        metrics_thread.join();
+    }
+
+    // the final metrics include every collection and discarded event
+    if (!metrics_file.empty())
+    {
+        metrics.write(metrics_file, queue->size());
+    }
+}
+
+
+void Collector::stop()
+{
+    is_running.store(false);
+
+    // wake up every poll() on the eventfd, the queue is closed only once the
+    // monitor thread has handed over its pending triggers
+    std::uint64_t const value {1};
+    if (write(stop_descriptor, &value, sizeof(value)) < 0)
+    {
+        std::cerr << "Error while signalling worker threads to stop" << std::endl;
+    }
+}
+
+
+void Collector::simulate_overflow()
+{
+    overflow_requested.store(true);
+}
+
+
+void Collector::export_metrics()
+{
+    int listen_descriptor {-1};
+    if (!metrics_socket.empty())
+    {
+        listen_descriptor = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        std::strncpy(address.sun_path, metrics_socket.c_str(), sizeof(address.sun_path) - 1);
+
+        // a socket left behind by a previous run is replaced
+        unlink(metrics_socket.c_str());
+        if (listen_descriptor < 0 || metrics_socket.native().size() >= sizeof(address.sun_path)
+            || bind(listen_descriptor, reinterpret_cast<sockaddr const*>(&address), sizeof(address)) != 0
+            || listen(listen_descriptor, 16) != 0)
+        {
+            std::cerr << "Error, cannot serve metrics on " << metrics_socket << ": " << std::strerror(errno) << std::endl;
+            if (listen_descriptor >= 0)
+            {
+                close(listen_descriptor);
+                listen_descriptor = -1;
+            }
+        }
+    }
+
+    // the metrics file is rewritten periodically, the socket answers on
+    // demand only
+    int const timeout {metrics_file.empty() ? -1 : static_cast<int>(std::chrono::milliseconds {METRICS_INTERVAL}.count())};
+    pollfd descriptors[2] {{stop_descriptor, POLLIN, 0}, {listen_descriptor, POLLIN, 0}};
+
+    while (is_running.load())
+    {
+        int const ready {poll(descriptors, 2, timeout)};
+
+        if (ready < 0 && errno != EINTR)
+        {
+            std::cerr << "Error while waiting for metrics requests" << std::endl;
+            break;
+        }
+        if (descriptors[0].revents & POLLIN)
+        {
+            break;
+        }
+
+        if (descriptors[1].revents & POLLIN)
+        {
+            int const connection {accept4(listen_descriptor, nullptr, nullptr, SOCK_CLOEXEC)};
+            if (connection >= 0)
+            {
+                std::ostringstream text {};
+                metrics.write(text, queue->size());
+                std::string const response {text.str()};
+                for (std::size_t offset {0}; offset < response.size();)
+                {
+                    ssize_t const n {send(connection, response.data() + offset, response.size() - offset, MSG_NOSIGNAL)};
+                    if (n <= 0 && errno != EINTR)
+                    {
+                        break;
+                    }
+                    offset += static_cast<std::size_t>(std::max<ssize_t>(n, 0));
+                }
+                close(connection);
+            }
+        }
+        else if (ready == 0)
+        {
+            metrics.write(metrics_file, queue->size());
+        }
+    }
+
+    if (listen_descriptor >= 0)
+    {
+        close(listen_descriptor);
+        unlink(metrics_socket.c_str());
+    }
 }
 
 
@@ -105,10 +281,13 @@ void Collector::monitor()
      * and https://man7.org/linux/man-pages/man2/read.2.html
      */
 
-    // initialize inotify
-    int file_descriptor {inotify_init1(IN_NONBLOCK)};
+    // initialize a single inotify and fanotify instance for all roots,
+    // io_uring reads from blocking descriptors such that a read completes as
+    // soon as events are available
+    bool const use_ring {IoRing::available()};
+    inotify_descriptor = inotify_init1(use_ring ? 0 : IN_NONBLOCK);
 
-    if (file_descriptor < 0)
+    if (inotify_descriptor < 0)
     {
         std::cerr << "Error while initializing inotify."
                   << "Please type <q> and press <RETURN> to quit"
@@ -116,267 +295,1764 @@ void Collector::monitor()
         return;
     }
 
-    // add the input directory to inotify's watch list
-    int watch_descriptor {inotify_add_watch(file_descriptor, input_path.c_str(), IN_CREATE)};
-
-    if (watch_descriptor < 0)
+    if (recursive && filesystem_marks)
     {
-        std::cerr << "Error, cannot watch " << input_path.c_str() << "."
-                  << "Please type <q> and press <RETURN> to quit"
-                  << std::endl;
-        return;
-    }
-
-    /*
-     * The polling mechanism is heavily inspired by the inotify example that is
-     * part of the inotify man pages.
-     * The poll man page was also referenced.
-     *
-     * See https://man7.org/linux/man-pages/man7/inotify.7.html
-     * and https://man7.org/linux/man-pages/man2/poll.2.html
-     */
+        fanotify_descriptor = fanotify_init
+        (
+            FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | (use_ring ? 0 : FAN_NONBLOCK),
+            O_RDONLY | O_LARGEFILE | O_CLOEXEC
+        );
 
-    pollfd poll_descriptor {};
-    poll_descriptor.fd = file_descriptor;
-    poll_descriptor.events = POLLIN;
+        if (fanotify_descriptor < 0)
+        {
+            std::cout << "fanotify is not available (" << std::strerror(errno) << "), watching every directory with inotify" << std::endl;
+        }
+    }
 
-    // repeat until interrupt signal by main thread is sent
-    while (is_running.load())
+    // add the input directories to the watch lists, seeding their indexes
+    std::size_t watched {0};
+    for (auto& root : roots)
     {
-        // poll from inotify
-        int poll_number {poll(&poll_descriptor, 1, 30)};
+        root->filesystem_mark = fanotify_descriptor >= 0 && mark_filesystem(*root);
+        root->watch = watch_directory(*root, root->input_path);
 
-        // error or interrupt
-        if (poll_number < 0)
+        if (root->watch < 0)
         {
-            if (errno == EINTR)
-            {
-                continue;
-            }
-            std::cerr << "Error while polling from stdin" << std::endl;
-            break;
+            std::cerr << "Error, cannot watch " << root->input_path.c_str() << std::endl;
+            continue;
         }
 
-        // event arrived
-        if (poll_number > 0)
+        if (!root->filesystem_mark)
         {
-            if (poll_descriptor.revents & POLLIN)
+            // roots must not overlap, an existing watch belongs to another one
+            int top {-1};
+            watches.path(root->watch, top);
+            auto const owner {root_watches.find(top)};
+            if (owner != root_watches.end())
             {
-                // handle event separately
-                handle_file_event(file_descriptor);
+                std::cerr << "Error, " << root->input_path << " overlaps " << owner->second->input_path << std::endl;
+                root->watch = -1;
+                continue;
             }
+            root_watches.emplace(root->watch, root.get());
         }
+        ++watched;
     }
 
-    std::cout << "Stop monitoring " << input_path << std::endl;
+    if (watched == 0)
+    {
+        std::cerr << "Error, no input directory is watched."
+                  << "Please type <q> and press <RETURN> to quit"
+                  << std::endl;
+    }
+    else
+    {
+        report_watches();
 
-    // remove input directory from watch list and close inotify file descriptor
-    inotify_rm_watch(file_descriptor, watch_descriptor);
-    close(file_descriptor);
+        if (use_ring)
+        {
+            monitor_ring();
+        }
+        else
+        {
+            monitor_poll();
+        }
+    }
 
-    std::cout << "Monitor thread finished" << std::endl;
-}
+    // hand over triggers whose coalescing window is still open
+    flush_triggers(true);
 
+    for (auto const& root : roots)
+    {
+        std::cout << "Stop monitoring " << root->input_path << std::endl;
+    }
+    report_watches();
 
-void Collector::collect()
-{
-    // repeat until interrupt signal by main thread is sent
-    while (is_running.load())
+    // closing the descriptors removes all watches and marks
+    close(inotify_descriptor);
+    inotify_descriptor = -1;
+    if (fanotify_descriptor >= 0)
+    {
+        close(fanotify_descriptor);
+        fanotify_descriptor = -1;
+    }
+    for (auto& root : roots)
     {
-        // if file creation events are available, handle all of them
-        while (!queue->empty())
+        if (root->mount_descriptor >= 0)
         {
-            std::filesystem::path const file {queue->pop()};
+            close(root->mount_descriptor);
+            root->mount_descriptor = -1;
+        }
+        root->watch = -1;
+        root->filesystem_mark = false;
+        root->index.invalidate();
+    }
+    watches.clear();
+    root_watches.clear();
+    moved_directories.clear();
+    directory_handles.clear();
 
-            std::vector<std::filesystem::path> file_names
-            {
-                collect_files(file.parent_path(), selection)
-            };
-            std::vector<std::filesystem::path> temporaries;
+    std::cout << "Monitor thread finished" << std::endl;
+}
 
-            collect_disk_usage(file_names, temporaries, file.parent_path());
 
-            // create a unique archive name by hashing the name of the created file
-            std::string hash {std::to_string(std::hash<std::string>{}(std::string{file.filename().c_str()}))};
-            store_files
-            (
-                file_names,
-                temporaries,
-                output_path / std::filesystem::path {"archive." + hash + ".tar"}
-            );
-        }
+bool Collector::mark_filesystem(Root& root)
+{
+    /*
+     * fanotify reports the directory of an event as file handle, which is
+     * resolved by open_by_handle_at().
+     * Marking a file system a second time for another root has no effect.
+     *
+     * See https://man7.org/linux/man-pages/man7/fanotify.7.html
+     * and https://man7.org/linux/man-pages/man2/fanotify_mark.2.html
+     */
 
-        using namespace std::chrono_literals;
-        std::this_thread::sleep_for(1s);
+    std::uint64_t const mask {FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_ONDIR};
+    if (fanotify_mark(fanotify_descriptor, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, root.input_path.c_str()) < 0)
+    {
+        std::cout << "Cannot mark the file system of " << root.input_path << " (" << std::strerror(errno)
+                  << "), watching every directory with inotify" << std::endl;
+        return false;
     }
 
-    std::cout << "Collector thread finished" << std::endl;
-}
+    std::error_code error {};
+    root.canonical_input = std::filesystem::canonical(root.input_path, error);
+    root.mount_descriptor = open(root.input_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
+    // events identify their file system by its id
+    struct statfs status {};
+    if (error || root.mount_descriptor < 0 || fstatfs(root.mount_descriptor, &status) < 0)
+    {
+        std::cerr << "Error, cannot open " << root.input_path << std::endl;
+        return false;
+    }
+    std::memcpy(&root.filesystem, &status.f_fsid, sizeof(root.filesystem));
 
-Collector::Collector
-(
-    std::filesystem::path const& input_path,
-    std::filesystem::path const& output_path,
-    FileSelection const selection
-) :
-    input_path {input_path},
-    output_path {output_path},
-    selection {selection}
-{
+    return true;
 }
 
 
-void Collector::set_regex(std::regex const& regex)
+void Collector::monitor_poll()
 {
-    file_regex = regex;
-}
-
+    /*
+     * The polling mechanism is inspired by the inotify example that is part
+     * of the inotify man pages, using epoll such that any number of
+     * descriptors is waited for at once.
+     *
+     * See https://man7.org/linux/man-pages/man7/inotify.7.html
+     * and https://man7.org/linux/man-pages/man7/epoll.7.html
+     */
 
-/*
- * For std::filesystem, the cppreference was referenced.
- *
- * See https://en.cppreference.com/w/cpp/filesystem,
- *     https://en.cppreference.com/w/cpp/filesystem/path,
- *     https://en.cppreference.com/w/cpp/filesystem/directory_iterator,
- *     https://en.cppreference.com/w/cpp/filesystem/create_directory,
- *     https://en.cppreference.com/w/cpp/filesystem/remove.
- *
- * For the execution of bash commands, cppreference was referenced.
- *
- * See https://en.cppreference.com/w/cpp/filesystem/remove.
- */
+    int const epoll_descriptor {epoll_create1(EPOLL_CLOEXEC)};
+    if (epoll_descriptor < 0)
+    {
+        std::cerr << "Error while creating epoll instance" << std::endl;
+        return;
+    }
 
+    for (int const file_descriptor : {inotify_descriptor, fanotify_descriptor, stop_descriptor})
+    {
+        epoll_event event {};
+        event.events = EPOLLIN;
+        event.data.fd = file_descriptor;
+        if (file_descriptor >= 0 && epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, file_descriptor, &event) < 0)
+        {
+            std::cerr << "Error while adding descriptor to epoll instance" << std::endl;
+        }
+    }
 
-std::vector<std::filesystem::path> Collector::collect_files
-(
-    std::filesystem::path const& path,
-    FileSelection const selection
-)
-{
-    std::cout << "Collecting selected files from " << path << std::endl;
+    epoll_event events[3] {};
 
-    switch (selection)
+    // repeat until interrupt signal by main thread is sent
+    while (is_running.load())
     {
-        case FileSelection::FILES:
+        // wait for events until the next coalescing window closes, without
+        // timeout otherwise since stop() signals the eventfd
+        int const ready {epoll_wait(epoll_descriptor, events, 3, flush_triggers())};
+
+        // error or interrupt
+        if (ready < 0)
         {
-            // iterate through directory and select regular files only
-            std::vector<std::filesystem::path> files;
-            for (auto const& entry : std::filesystem::directory_iterator{path})
+            if (errno == EINTR)
             {
-                if (entry.is_regular_file())
-                {
-                    files.push_back(entry.path());
-                }
+                continue;
             }
-            return files;
+            std::cerr << "Error while waiting for events, stopping" << std::endl;
+            stop();
+            break;
         }
-        case FileSelection::FILES_AND_DIRECTORIES:
-        default:
+
+        // handle the events of every ready descriptor separately
+        for (int i {0}; i < ready; ++i)
         {
-            // traverse the complete directory tree, i.e. recurse into subdirectories
-            std::vector<std::filesystem::path> files;
-            for (auto const& entry : std::filesystem::recursive_directory_iterator{path})
+            if (events[i].data.fd != stop_descriptor && (events[i].events & EPOLLIN))
             {
-                files.push_back(entry.path());
+                handle_file_event(events[i].data.fd);
             }
-            return files;
         }
     }
-}
-
-
-void Collector::collect_disk_usage
-(
-    std::vector<std::filesystem::path>& files,
-    std::vector<std::filesystem::path>& temporaries,
-    std::filesystem::path const& output_path
-)
-{
-    std::filesystem::path usage {output_path / std::filesystem::path {"disk_usage.txt"}};
-
-    std::cout << "Writing disk usage information to " << usage << std::endl;
-
-    for (auto const& file : files)
-    {
-        // append disk usage information to text file
-        std::system(std::string {"du -sh " + file.native() + " >> " + usage.native()}.c_str());
-    }
 
-    files.push_back(usage);
-    temporaries.push_back(usage);
+    close(epoll_descriptor);
 }
 
 
-void Collector::store_files
-(
-    std::vector<std::filesystem::path> const& files,
-    std::vector<std::filesystem::path> const& temporaries,
-    std::filesystem::path const& output_file,
-    bool delete_temporaries
-)
+void Collector::monitor_ring()
 {
-    std::cout << "Storing collected data as tar archive in " << output_file << std::endl;
-
-    std::string command {"tar -cf " + output_file.native()};
-
-    // add every given file to command, creating a file list
-    for (auto const& file : files)
+    enum : std::uint64_t
     {
-        command += " " + file.native();
-    }
-
-    std::system(command.c_str());
-
-    if (delete_temporaries)
+        INOTIFY,
+        FANOTIFY,
+        STOP,
+        TIMEOUT,
+        CANCEL
+    };
+
+    int const descriptors[2] {inotify_descriptor, fanotify_descriptor};
+    IoRing ring {8};
+
+    // keep a read of events in flight per instance, it completes once events
+    // are available, without a separate poll(), the queue was drained no
+    // earlier than the read was prepared
+    bool read_pending[2] {false, false};
+    std::chrono::system_clock::time_point read_started[2] {};
+    auto const prepare_read = [&] (std::uint64_t const instance)
     {
-        // remove temporary files
-        for (auto const& file : temporaries)
+        read_started[instance] = std::chrono::system_clock::now();
+        read_pending[instance] = ring.prepare_read
+        (
+            descriptors[instance], event_buffers[instance].data(), event_buffers[instance].size(), static_cast<std::uint64_t>(-1), instance
+        );
+    };
+
+    for (std::uint64_t const instance : {INOTIFY, FANOTIFY})
+    {
+        if (descriptors[instance] >= 0)
         {
-            std::system(std::string {"rm -rf " + file.native()}.c_str());
+            prepare_read(instance);
         }
     }
-}
-
-
-void Collector::handle_file_event(int const file_descriptor)
-{
-    alignas(inotify_event) char buffer[BUFFER_SIZE];
+    ring.prepare_poll(stop_descriptor, POLLIN, STOP);
+    bool stop_pending {true};
+    bool timeout_pending {false};
 
     // repeat until interrupt signal by main thread is sent
-    while (is_running.load())
+    while (is_running.load() && (read_pending[INOTIFY] || read_pending[FANOTIFY]) && stop_pending)
     {
-        // read file creation events into buffer
-        int n = read(file_descriptor, buffer, BUFFER_SIZE);
-
-        if (n < 0 && errno != EAGAIN)
+        // wake up when the next coalescing window closes, windows only open
+        // after the pending one, hence a single timeout is sufficient
+        int const timeout {flush_triggers()};
+        if (timeout >= 0 && !timeout_pending)
         {
-            std::cerr << "Error while reading from " << input_path.c_str() << "."
-                  << "Please type <q> and press <RETURN> to quit"
-                  << std::endl;
-            return;
+            timeout_pending = ring.prepare_timeout(std::chrono::milliseconds {timeout}, TIMEOUT);
         }
 
-        // no file creation events available, break out of loop
-        if (n <= 0)
+        // the process must not keep running without monitoring its inputs
+        int const result {ring.submit(1)};
+        if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY)
         {
+            std::cerr << "Error while waiting for file system events: " << std::strerror(-result) << ", stopping" << std::endl;
+            stop();
             break;
         }
 
-        inotify_event const* event {};
-        // handle every file creation event in the buffer
-        for (char* ptr {buffer}; ptr < buffer + n; ptr += sizeof(inotify_event) + event->len)
+        IoRing::Completion completion {};
+        while (ring.next(completion))
         {
-            event = (inotify_event const*) ptr;
-            if (event->len)
+            if (completion.user_data == INOTIFY || completion.user_data == FANOTIFY)
             {
-                // if the file name matches the regex, push the file to the queue
-                if ((event->mask & IN_CREATE) && std::regex_match(event->name, file_regex))
+                std::uint64_t const instance {completion.user_data};
+                read_pending[instance] = false;
+                if (completion.result > 0)
                 {
-                    std::cout << "New matching file/directory '" << event->name << "' created" << std::endl;
-                    queue->push(input_path / std::filesystem::path{event->name});
+                    // the buffer is resized before the next read is in flight
+                    handle_batch(instance, static_cast<std::size_t>(completion.result), read_started[instance]);
                 }
-            }
+                else if (completion.result != -EINTR && completion.result != -EAGAIN)
+                {
+                    std::cerr << "Error while reading file system events: " << std::strerror(-completion.result) << ", stopping" << std::endl;
+                    stop();
+                    continue;
+                }
+
+                // transient errors re-arm the read, such that the instance
+                // stays monitored
+                prepare_read(instance);
+                if (!read_pending[instance])
+                {
+                    std::cerr << "Error, cannot read file system events, stopping" << std::endl;
+                    stop();
+                }
+            }
+            else if (completion.user_data == STOP)
+            {
+                // stop() signalled the eventfd
+                stop_pending = false;
+            }
+            else if (completion.user_data == TIMEOUT)
+            {
+                timeout_pending = false;
+            }
+        }
+    }
+
+    // the kernel must not write into the buffers after returning, hence
+    // cancel every operation in flight and wait for their completions
+    std::pair<bool, std::uint64_t> const operations[]
+    {
+        {read_pending[INOTIFY], INOTIFY}, {read_pending[FANOTIFY], FANOTIFY}, {stop_pending, STOP}, {timeout_pending, TIMEOUT}
+    };
+    for (auto const& [pending, operation] : operations)
+    {
+        if (pending)
+        {
+            ring.prepare_cancel(operation, CANCEL);
+        }
+    }
+
+    std::vector<std::int32_t> results {};
+    ring.complete(results);
+}
+
+
+void Collector::collect()
+{
+    priority.apply();
+
+    Trigger trigger {};
+
+    // wait for file creation events until the queue is closed once the
+    // monitor thread has finished
+    while (queue->pop(trigger))
+    {
+        // after stop(), pending events are only handled if draining, others
+        // are still taken such that the monitor thread never blocks on a
+        // full queue
+        if (!is_running.load() && !drain)
+        {
+            metrics.dropped.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        metrics.queue_wait.observe(std::chrono::steady_clock::now() - trigger.enqueued);
+        std::filesystem::path const output_file {collect_trigger(trigger)};
+        if (output_file.empty())
+        {
+            metrics.failed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (completion_callback)
+        {
+            completion_callback(trigger, output_file);
+        }
+    }
+
+    std::cout << "Collector thread finished" << std::endl;
+}
+
+
+std::filesystem::path Collector::collect_trigger(Trigger const& trigger)
+{
+    Root& root {*roots.at(trigger.root)};
+    std::filesystem::path const& output_path {root.output_path};
+
+    // create a unique archive name by hashing the path of the first created
+    // file, the sequence number separates collections of the same path, e.g.
+    // of a recreated file, which may run concurrently
+    std::filesystem::path const& file {trigger.files.front()};
+    std::string const hash
+    {
+        std::to_string(std::hash<std::string>{}(file.native())) + "."
+        + std::to_string(collection_sequence.fetch_add(1, std::memory_order_relaxed))
+    };
+
+    // every trigger uses its own directory for temporaries, such that
+    // concurrent collections do not interfere
+    std::filesystem::path const staging {output_path / std::filesystem::path {".collect." + hash}};
+    std::error_code error {};
+    std::filesystem::create_directories(staging, error);
+
+    if (error)
+    {
+        std::cerr << "Error, cannot create " << staging << ": " << error.message() << std::endl;
+        return {};
+    }
+
+    // take the file list from the index, walk the directory only if the
+    // index may be out of date, every name is stored once
+    auto start {std::chrono::steady_clock::now()};
+    PathTable files {};
+    if (indexing && root.index.valid() && trigger.directory == root.input_path)
+    {
+        root.index.files(files);
+    }
+    else
+    {
+        collect_files(trigger.directory, root.selection, files, thread_budget());
+    }
+    metrics.enumerate.observe(std::chrono::steady_clock::now() - start);
+    std::vector<std::filesystem::path> temporaries;
+
+    // files that triggered the collection may still be written, hence they
+    // are stored last, once every other file is stored
+    std::vector<std::filesystem::path> growing {};
+    if (streaming_timeout.count() > 0)
+    {
+        for (std::uint32_t entry {0}; entry < files.size(); ++entry)
+        {
+            // compare names first, paths are only assembled for candidates
+            bool const candidate
+            {
+                files.listed(entry) && std::any_of(trigger.files.begin(), trigger.files.end(), [&files, entry](std::filesystem::path const& name)
+                {
+                    return name.filename().native() == files.name(entry);
+                })
+            };
+            if (!candidate)
+            {
+                continue;
+            }
+
+            std::filesystem::path path {files.path(entry)};
+            if (std::find(trigger.files.begin(), trigger.files.end(), path) != trigger.files.end())
+            {
+                files.hide(entry);
+                growing.push_back(std::move(path));
+            }
+        }
+    }
+
+    // capture the files before anything else, archiving reads the snapshot
+    // while the files are written again, the snapshot root is part of both
+    // tables such that their indexes match
+    std::optional<PathTable> sources {};
+    if (!snapshot_directory.empty() && !root.chunk_store)
+    {
+        start = std::chrono::steady_clock::now();
+        std::filesystem::path const directory {snapshot_directory / std::filesystem::path {"snapshot." + hash}};
+        Snapshot snapshot {directory};
+        std::uint32_t const snapshot_root {files.add_root(directory.native(), false)};
+        sources = files;
+
+        for (std::uint32_t entry {0}; entry < snapshot_root; ++entry)
+        {
+            if (!files.listed(entry))
+            {
+                continue;
+            }
+            std::filesystem::path const path {files.path(entry)};
+            std::filesystem::path const captured {snapshot.add(path)};
+            if (captured != path)
+            {
+                sources->move(entry, snapshot_root, captured.filename().native());
+            }
+        }
+        metrics.snapshot.observe(std::chrono::steady_clock::now() - start);
+        temporaries.push_back(directory);
+
+        std::cout << "Snapshot of " << files.count() << " file(s) in " << directory << ": "
+                  << snapshot.count(SnapshotMethod::REFLINK) << " cloned, "
+                  << snapshot.count(SnapshotMethod::HARDLINK) << " linked, "
+                  << snapshot.count(SnapshotMethod::COPY) << " copied" << std::endl;
+    }
+
+    start = std::chrono::steady_clock::now();
+    collect_disk_usage(files, temporaries, staging, throttle.get(), thread_budget());
+    metrics.disk_usage.observe(std::chrono::steady_clock::now() - start);
+
+    std::vector<std::filesystem::path> reports {};
+    collect_triggers(trigger, reports, temporaries, staging);
+    for (auto const& report : reports)
+    {
+        files.add_root(report.native());
+    }
+    temporaries.push_back(staging);
+    start = std::chrono::steady_clock::now();
+
+    // reports of the collection are archived as they are
+    if (sources)
+    {
+        for (std::uint32_t entry {static_cast<std::uint32_t>(sources->size())}; entry < files.size(); ++entry)
+        {
+            sources->add_root(files.path(entry).native(), files.listed(entry));
+        }
+    }
+
+    if (root.chunk_store)
+    {
+        // write the manifest under a temporary name as well, chunks are
+        // complete once they are referenced
+        std::filesystem::path const manifest {output_path / std::filesystem::path {"manifest." + hash + ".txt"}};
+        std::filesystem::path const partial {manifest.native() + ".part"};
+
+        // chunks of an incomplete file would never be referenced again
+        for (auto const& follower : follow(growing))
+        {
+            while (follower->wait())
+            {
+            }
+        }
+        std::vector<std::filesystem::path> file_names {files.paths()};
+        file_names.insert(file_names.end(), growing.begin(), growing.end());
+
+        bool const stored {root.chunk_store->store(file_names, partial)};
+
+        for (auto const& temporary : temporaries)
+        {
+            std::filesystem::remove_all(temporary, error);
+        }
+
+        // a manifest referencing missing chunks cannot be rebuilt
+        if (!stored)
+        {
+            std::cerr << "Error, cannot create " << manifest << ", chunks are missing" << std::endl;
+            std::filesystem::remove(partial, error);
+            return {};
+        }
+        record_collection(start, file_names.size(), partial);
+
+        std::filesystem::rename(partial, manifest, error);
+        if (error)
+        {
+            std::cerr << "Error, cannot create " << manifest << ": " << error.message() << std::endl;
+            return {};
+        }
+        return manifest;
+    }
+
+    // write the archive under a temporary name, such that complete archives
+    // appear atomically in the output directory
+    std::filesystem::path const archive {output_path / std::filesystem::path {"archive." + hash + ".tar" + BlockCompressor::extension(compression.algorithm)}};
+    std::filesystem::path const partial {archive.native() + ".part"};
+
+    bool const stored
+    {
+        growing.empty()
+            ? store_files(files, temporaries, partial, true, compression_options(), sources ? &*sources : nullptr, throttle.get(), cache, prefetch)
+            : stream_files(files, sources ? &*sources : nullptr, growing, temporaries, partial)
+    };
+
+    // a truncated archive must not appear as a complete one
+    if (!stored)
+    {
+        std::cerr << "Error, cannot create " << archive << ", archive is incomplete" << std::endl;
+        std::filesystem::remove(partial, error);
+        return {};
+    }
+    record_collection(start, files.count() + growing.size(), partial);
+
+    std::filesystem::rename(partial, archive, error);
+    if (error)
+    {
+        std::cerr << "Error, cannot create " << archive << ": " << error.message() << std::endl;
+        return {};
+    }
+    return archive;
+}
+
+
+void Collector::record_collection
+(
+    std::chrono::steady_clock::time_point const start,
+    std::size_t const files,
+    std::filesystem::path const& output_file
+)
+{
+    metrics.archive.observe(std::chrono::steady_clock::now() - start);
+
+    std::error_code error {};
+    std::uintmax_t const size {std::filesystem::file_size(output_file, error)};
+
+    metrics.collections.fetch_add(1, std::memory_order_relaxed);
+    metrics.files.fetch_add(files, std::memory_order_relaxed);
+    metrics.bytes.fetch_add(error ? 0 : size, std::memory_order_relaxed);
+}
+
+
+bool Collector::stream_files
+(
+    PathTable const& files,
+    PathTable const* sources,
+    std::vector<std::filesystem::path> const& growing,
+    std::vector<std::filesystem::path> const& temporaries,
+    std::filesystem::path const& output_file
+)
+{
+    std::cout << "Storing collected data as tar archive in " << output_file << ", following "
+              << growing.size() << " file(s) while they are written" << std::endl;
+
+    // follow every growing file before archiving anything, such that no
+    // modification between two files is missed
+    auto const followers {follow(growing)};
+
+    TarWriter archive {output_file, compression_options()};
+    archive.set_throttle(throttle.get());
+    archive.set_cache_options(cache);
+    archive.set_prefetch(prefetch);
+
+    archive.add(files, sources);
+
+    for (std::size_t i {0}; i < growing.size(); ++i)
+    {
+        GrowingFile& follower {*followers[i]};
+        archive.add_growing(growing[i], [&follower] { return follower.wait(); });
+
+        if (!follower.closed())
+        {
+            std::cerr << growing[i] << " was not closed while following it, archived as is" << std::endl;
+        }
+    }
+
+    bool const finished {archive.finish()};
+
+    for (auto const& file : temporaries)
+    {
+        std::error_code error {};
+        std::filesystem::remove_all(file, error);
+    }
+
+    return finished;
+}
+
+
+std::vector<std::unique_ptr<GrowingFile>> Collector::follow(std::vector<std::filesystem::path> const& files) const
+{
+    // stopping ends following, unless pending collections are drained
+    std::vector<std::unique_ptr<GrowingFile>> followers {};
+    for (auto const& file : files)
+    {
+        followers.push_back(std::make_unique<GrowingFile>(file, streaming_timeout, drain ? -1 : stop_descriptor));
+    }
+    return followers;
+}
+
+
+void Collector::collect_triggers
+(
+    Trigger const& trigger,
+    std::vector<std::filesystem::path>& files,
+    std::vector<std::filesystem::path>& temporaries,
+    std::filesystem::path const& output_path
+)
+{
+    std::filesystem::path triggers {output_path / std::filesystem::path {"triggers.txt"}};
+
+    // list every file that triggered this collection, one per line
+    std::ofstream list {triggers};
+    for (auto const& file : trigger.files)
+    {
+        list << file.native() << '\n';
+    }
+    list.close();
+
+    files.push_back(triggers);
+    temporaries.push_back(triggers);
+}
+
+
+Collector::Collector()
+{
+    // by default, use one worker per CPU this process may run on
+    cpus = available_cpus();
+    workers = cpus;
+
+    stop_descriptor = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+    if (stop_descriptor < 0)
+    {
+        std::cerr << "Error while creating eventfd" << std::endl;
+    }
+}
+
+
+Collector::Collector
+(
+    std::filesystem::path const& input_path,
+    std::filesystem::path const& output_path,
+    FileSelection const selection
+) :
+    Collector {}
+{
+    add_root(input_path, output_path, selection);
+}
+
+
+Collector::~Collector()
+{
+    if (stop_descriptor >= 0)
+    {
+        close(stop_descriptor);
+    }
+}
+
+
+void Collector::add_root
+(
+    std::filesystem::path const& input_path,
+    std::filesystem::path const& output_path,
+    FileSelection const selection
+)
+{
+    auto root {std::make_unique<Root>()};
+    root->number = roots.size();
+    root->input_path = input_path;
+    root->output_path = output_path;
+    root->selection = selection;
+    roots.push_back(std::move(root));
+}
+
+
+void Collector::set_regex(std::regex const& regex)
+{
+    file_matcher = FilenameMatcher {regex};
+}
+
+
+void Collector::set_pattern(std::string const& pattern)
+{
+    file_matcher = FilenameMatcher {pattern};
+}
+
+
+void Collector::set_workers(unsigned int const workers)
+{
+    this->workers = std::max(workers, 1u);
+}
+
+
+void Collector::set_traversal_threads(unsigned int const threads)
+{
+    traversal_threads = std::max(threads, 1u);
+}
+
+
+unsigned int Collector::thread_budget() const
+{
+    // concurrent collections share the CPUs instead of each using all of them
+    return traversal_threads > 0 ? traversal_threads : std::max(cpus / workers, 1u);
+}
+
+
+CompressionOptions Collector::compression_options() const
+{
+    CompressionOptions options {compression};
+    if (options.threads == 0)
+    {
+        options.threads = std::max(cpus / workers, 1u);
+    }
+    return options;
+}
+
+
+void Collector::set_drain(bool const drain)
+{
+    this->drain = drain;
+}
+
+
+void Collector::set_coalescing_window(std::chrono::milliseconds const window)
+{
+    coalescing_window = window;
+}
+
+
+void Collector::set_indexing(bool const indexing)
+{
+    this->indexing = indexing;
+}
+
+
+void Collector::set_recursive(bool const recursive)
+{
+    this->recursive = recursive;
+}
+
+
+void Collector::set_filesystem_marks(bool const filesystem_marks)
+{
+    this->filesystem_marks = filesystem_marks;
+}
+
+
+void Collector::set_compression(CompressionOptions const& compression)
+{
+    this->compression = compression;
+}
+
+
+void Collector::set_deduplication(bool const deduplication)
+{
+    this->deduplication = deduplication;
+}
+
+
+void Collector::set_streaming(std::chrono::milliseconds const idle_timeout)
+{
+    streaming_timeout = idle_timeout;
+}
+
+
+void Collector::set_snapshot_directory(std::filesystem::path const& directory)
+{
+    snapshot_directory = directory;
+}
+
+
+void Collector::set_metrics_file(std::filesystem::path const& file)
+{
+    metrics_file = file;
+}
+
+
+void Collector::set_metrics_socket(std::filesystem::path const& socket)
+{
+    metrics_socket = socket;
+}
+
+
+void Collector::set_completion_callback(std::function<void(Trigger const&, std::filesystem::path const&)> callback)
+{
+    completion_callback = std::move(callback);
+}
+
+
+Metrics const& Collector::get_metrics() const
+{
+    return metrics;
+}
+
+
+void Collector::set_queue(fifo_ptr<Trigger> queue)
+{
+    this->queue = std::move(queue);
+}
+
+
+void Collector::set_queue_capacity(std::size_t const capacity, OverflowPolicy const policy)
+{
+    queue = std::make_unique<TriggerQueue>(capacity, policy, &metrics);
+}
+
+
+void Collector::set_throttle(std::uint64_t const bytes_per_second, std::uint64_t const operations_per_second)
+{
+    throttle = std::make_unique<Throttle>(bytes_per_second, operations_per_second);
+}
+
+
+void Collector::set_worker_priority(WorkerPriority const& priority)
+{
+    this->priority = priority;
+}
+
+
+void Collector::set_cache_options(CacheOptions const& cache)
+{
+    this->cache = cache;
+}
+
+
+void Collector::set_prefetch(PrefetchOptions const& prefetch)
+{
+    this->prefetch = prefetch;
+}
+
+
+/*
+ * For std::filesystem, the cppreference was referenced.
+ *
+ * See https://en.cppreference.com/w/cpp/filesystem,
+ *     https://en.cppreference.com/w/cpp/filesystem/path,
+ *     https://en.cppreference.com/w/cpp/filesystem/directory_iterator,
+ *     https://en.cppreference.com/w/cpp/filesystem/create_directory,
+ *     https://en.cppreference.com/w/cpp/filesystem/remove.
+ */
+
+
+std::vector<std::filesystem::path> Collector::collect_files
+(
+    std::filesystem::path const& path,
+    FileSelection const selection,
+    unsigned int const threads
+)
+{
+    PathTable files {};
+    collect_files(path, selection, files, threads);
+    return files.paths();
+}
+
+
+void Collector::collect_files
+(
+    std::filesystem::path const& path,
+    FileSelection const selection,
+    PathTable& files,
+    unsigned int const threads
+)
+{
+    std::cout << "Collecting selected files from " << path << std::endl;
+
+    std::uint32_t const root {files.add_root(path.native(), false)};
+
+    switch (selection)
+    {
+        case FileSelection::FILES:
+        {
+            // iterate through directory and select regular files only, the
+            // directory may have been removed since it triggered
+            std::error_code error {};
+            std::filesystem::directory_iterator entries {path, error};
+            for (; !error && entries != std::filesystem::directory_iterator {}; entries.increment(error))
+            {
+                std::error_code ignored {};
+                if (entries->is_regular_file(ignored))
+                {
+                    files.add(root, entries->path().filename().native());
+                }
+            }
+            if (error)
+            {
+                std::cerr << "Cannot read directory " << path << ": " << error.message() << std::endl;
+            }
+            break;
+        }
+        case FileSelection::FILES_AND_DIRECTORIES:
+        default:
+        {
+            // traverse the complete directory tree, i.e. recurse into
+            // subdirectories, in parallel, listed depth first
+            TreeWalker walker {threads};
+            walker.walk(path, files, root);
+            break;
+        }
+    }
+}
+
+
+void Collector::collect_disk_usage
+(
+    std::vector<std::filesystem::path>& files,
+    std::vector<std::filesystem::path>& temporaries,
+    std::filesystem::path const& output_path,
+    unsigned int const threads
+)
+{
+    std::filesystem::path usage {output_path / std::filesystem::path {"disk_usage.txt"}};
+
+    std::cout << "Writing disk usage information to " << usage << std::endl;
+
+    // measure all files in a single pass, instead of one du process per file
+    DiskUsageEngine engine {threads};
+    std::vector<std::optional<DiskUsage>> const usages {engine.measure(files)};
+
+    // append disk usage information to text file, formatted like `du -sh`
+    std::ofstream report {usage, std::ios::app};
+    for (std::size_t i {0}; i < files.size(); ++i)
+    {
+        if (usages[i])
+        {
+            report << DiskUsageEngine::human_readable(usages[i]->allocated) << '\t' << files[i].native() << '\n';
+        }
+    }
+    report.close();
+
+    files.push_back(usage);
+    temporaries.push_back(usage);
+}
+
+
+void Collector::collect_disk_usage
+(
+    PathTable& files,
+    std::vector<std::filesystem::path>& temporaries,
+    std::filesystem::path const& output_path,
+    Throttle* throttle,
+    unsigned int const threads
+)
+{
+    std::filesystem::path usage {output_path / std::filesystem::path {"disk_usage.txt"}};
+
+    std::cout << "Writing disk usage information to " << usage << std::endl;
+
+    DiskUsageEngine engine {threads};
+    engine.set_throttle(throttle);
+    std::vector<std::optional<DiskUsage>> const usages {engine.measure(files)};
+
+    // paths are assembled one at a time, into the same buffer
+    std::ofstream report {usage, std::ios::app};
+    std::string path {};
+    for (std::uint32_t entry {0}; entry < usages.size(); ++entry)
+    {
+        if (usages[entry])
+        {
+            files.path(entry, path);
+            report << DiskUsageEngine::human_readable(usages[entry]->allocated) << '\t' << path << '\n';
+        }
+    }
+    report.close();
+
+    files.add_root(usage.native());
+    temporaries.push_back(usage);
+}
+
+
+bool Collector::store_files
+(
+    std::vector<std::filesystem::path> const& files,
+    std::vector<std::filesystem::path> const& temporaries,
+    std::filesystem::path const& output_file,
+    bool delete_temporaries,
+    CompressionOptions const& compression
+)
+{
+    std::cout << "Storing collected data as tar archive in " << output_file << std::endl;
+
+    // stream every given file into the archive, without spawning tar
+    TarWriter archive {output_file, compression};
+
+    archive.add(files);
+
+    bool const finished {archive.finish()};
+
+    if (delete_temporaries)
+    {
+        // remove temporary files
+        for (auto const& file : temporaries)
+        {
+            std::error_code error {};
+            std::filesystem::remove_all(file, error);
+        }
+    }
+
+    return finished;
+}
+
+
+bool Collector::store_files
+(
+    PathTable const& files,
+    std::vector<std::filesystem::path> const& temporaries,
+    std::filesystem::path const& output_file,
+    bool delete_temporaries,
+    CompressionOptions const& compression,
+    PathTable const* sources,
+    Throttle* throttle,
+    CacheOptions const& cache,
+    PrefetchOptions const& prefetch
+)
+{
+    std::cout << "Storing collected data as tar archive in " << output_file << std::endl;
+
+    TarWriter archive {output_file, compression};
+    archive.set_throttle(throttle);
+    archive.set_cache_options(cache);
+    archive.set_prefetch(prefetch);
+
+    archive.add(files, sources);
+
+    bool const finished {archive.finish()};
+
+    if (delete_temporaries)
+    {
+        for (auto const& file : temporaries)
+        {
+            std::error_code error {};
+            std::filesystem::remove_all(file, error);
+        }
+    }
+
+    return finished;
+}
+
+
+void Collector::handle_file_event(int const file_descriptor)
+{
+    std::size_t const instance {file_descriptor == fanotify_descriptor ? 1u : 0u};
+    EventBuffer& buffer {event_buffers[instance]};
+
+    // repeat until interrupt signal by main thread is sent
+    while (is_running.load())
+    {
+        // read every queued event at once, if the buffer may grow that far
+        int pending {0};
+        if (ioctl(file_descriptor, FIONREAD, &pending) == 0 && pending > 0)
+        {
+            buffer.reserve(static_cast<std::size_t>(pending));
+        }
+
+        // read file creation events into buffer
+        auto const started {std::chrono::system_clock::now()};
+        ssize_t const n {read(file_descriptor, buffer.data(), buffer.size())};
+
+        if (n < 0 && errno != EAGAIN)
+        {
+            std::cerr << "Error while reading file system events."
+                  << "Please type <q> and press <RETURN> to quit"
+                  << std::endl;
+            return;
+        }
+
+        // no file creation events available, break out of loop
+        if (n <= 0)
+        {
+            break;
+        }
+
+        handle_batch(instance, static_cast<std::size_t>(n), started);
+    }
+}
+
+
+void Collector::handle_batch(std::size_t const instance, std::size_t const length, std::chrono::system_clock::time_point const started)
+{
+    EventBuffer& buffer {event_buffers[instance]};
+
+    // a requested overflow replaces the batch read, the kernel reports the
+    // overflow in place of the events it dropped
+    if (instance == 0 && overflow_requested.exchange(false))
+    {
+        inotify_event overflow {};
+        overflow.wd = -1;
+        overflow.mask = IN_Q_OVERFLOW;
+        handle_events(inotify_descriptor, (char const*) &overflow, sizeof(overflow));
+    }
+    else
+    {
+        handle_events(instance == 0 ? inotify_descriptor : fanotify_descriptor, buffer.data(), length);
+    }
+
+    // the overflow is the last event of the queue, the lost events are
+    // recovered from the file system before reading further events
+    if (overflowed[instance])
+    {
+        overflowed[instance] = false;
+        rescan(instance);
+    }
+
+    if (buffer.update(length))
+    {
+        drained[instance] = started;
+    }
+}
+
+
+void Collector::handle_events(int const file_descriptor, char const* buffer, std::size_t const length)
+{
+    events_read = std::chrono::steady_clock::now();
+
+    if (file_descriptor == fanotify_descriptor)
+    {
+        handle_fanotify_events(buffer, length);
+        return;
+    }
+
+    inotify_event const* event {};
+    std::uint32_t last_cookie {0};
+    // handle every file creation event in the buffer
+    for (char const* ptr {buffer}; ptr < buffer + length; ptr += sizeof(inotify_event) + event->len)
+    {
+        event = (inotify_event const*) ptr;
+        last_cookie = event->cookie;
+        metrics.events.fetch_add(1, std::memory_order_relaxed);
+
+        if (event->mask & IN_Q_OVERFLOW)
+        {
+            std::cerr << "inotify queue overflow, events were lost" << std::endl;
+            metrics.overflows.fetch_add(1, std::memory_order_relaxed);
+            overflowed[0] = true;
+            continue;
+        }
+
+        // the watch is gone, e.g. since its directory was deleted
+        if (event->mask & IN_IGNORED)
+        {
+            watches.remove(event->wd);
+            continue;
+        }
+
+        // the top-level watch of the path identifies the root
+        int top {-1};
+        std::filesystem::path const directory {watches.path(event->wd, top)};
+        auto const root {root_watches.find(top)};
+        if (event->len == 0 || directory.empty() || root == root_watches.end())
+        {
+            continue;
+        }
+
+        // a directory moved within the tree keeps its watches, only the
+        // entry of its top is moved
+        bool rescan {true};
+        if ((event->mask & IN_ISDIR) && (event->mask & IN_MOVED_FROM))
+        {
+            int const moved {watches.find(event->wd, event->name)};
+            if (moved >= 0)
+            {
+                watches.detach(moved);
+                moved_directories.insert_or_assign(event->cookie, moved);
+            }
+        }
+        else if ((event->mask & IN_ISDIR) && (event->mask & IN_MOVED_TO))
+        {
+            auto const moved {moved_directories.find(event->cookie)};
+            if (moved != moved_directories.end())
+            {
+                watches.add(moved->second, event->wd, event->name);
+                moved_directories.erase(moved);
+                rescan = false;
+            }
+        }
+
+        handle_change(*root->second, event->mask, directory, event->name, event->wd, rescan);
+    }
+
+    // the kernel queues both events of a move at once, directories without
+    // a counterpart left the tree, unless their counterpart is still unread
+    for (auto moved {moved_directories.begin()}; moved != moved_directories.end();)
+    {
+        if (moved->first == last_cookie)
+        {
+            ++moved;
+            continue;
+        }
+        for (int const watch : watches.remove(moved->second))
+        {
+            inotify_rm_watch(file_descriptor, watch);
         }
+        moved = moved_directories.erase(moved);
     }
 }
+
+
+void Collector::handle_fanotify_events(char const* buffer, std::size_t length)
+{
+    for
+    (
+        auto const* metadata {reinterpret_cast<fanotify_event_metadata const*>(buffer)};
+        FAN_EVENT_OK(metadata, length);
+        metadata = FAN_EVENT_NEXT(metadata, length)
+    )
+    {
+        if (metadata->vers != FANOTIFY_METADATA_VERSION)
+        {
+            std::cerr << "Error, unexpected fanotify version " << static_cast<int>(metadata->vers) << std::endl;
+            return;
+        }
+
+        metrics.events.fetch_add(1, std::memory_order_relaxed);
+
+        if (metadata->mask & FAN_Q_OVERFLOW)
+        {
+            std::cerr << "fanotify queue overflow, events were lost" << std::endl;
+            metrics.overflows.fetch_add(1, std::memory_order_relaxed);
+            overflowed[1] = true;
+            continue;
+        }
+
+        // the record holds the handle of the directory, followed by the name
+        auto const* info {reinterpret_cast<fanotify_event_info_fid const*>(metadata + 1)};
+        if (metadata->event_len < sizeof(*metadata) + sizeof(*info) + sizeof(file_handle)
+            || info->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+        {
+            continue;
+        }
+
+        auto const* handle {reinterpret_cast<file_handle const*>(info->handle)};
+        char const* name {reinterpret_cast<char const*>(handle->f_handle + handle->handle_bytes)};
+
+        std::uint64_t filesystem {0};
+        std::memcpy(&filesystem, &info->fsid, sizeof(filesystem));
+
+        auto const [root, directory] = resolve_handle(filesystem, handle, sizeof(file_handle) + handle->handle_bytes);
+
+        // moving or deleting a directory within a tree, or above it, changes
+        // cached paths, directories elsewhere on the file system do not
+        if ((metadata->mask & FAN_ONDIR) && (metadata->mask & (FAN_MOVED_FROM | FAN_DELETE)))
+        {
+            std::filesystem::path const moved {directory / std::filesystem::path {name}};
+            bool const encloses_root {std::any_of(roots.begin(), roots.end(), [&moved] (auto const& other)
+            {
+                auto const& input {other->canonical_input};
+                return std::mismatch(moved.begin(), moved.end(), input.begin(), input.end()).first == moved.end();
+            })};
+
+            if (root != nullptr || directory.empty() || encloses_root)
+            {
+                directory_handles.clear();
+            }
+        }
+
+        if (root == nullptr)
+        {
+            continue;
+        }
+
+        std::uint32_t mask {0};
+        mask |= (metadata->mask & FAN_CREATE) ? IN_CREATE : 0;
+        mask |= (metadata->mask & FAN_DELETE) ? IN_DELETE : 0;
+        mask |= (metadata->mask & FAN_MOVED_FROM) ? IN_MOVED_FROM : 0;
+        mask |= (metadata->mask & FAN_MOVED_TO) ? IN_MOVED_TO : 0;
+        mask |= (metadata->mask & FAN_ONDIR) ? IN_ISDIR : 0;
+
+        // events of the same name may be merged, the current state decides
+        // whether the entry was added or removed
+        if ((mask & (IN_CREATE | IN_MOVED_TO)) && (mask & (IN_DELETE | IN_MOVED_FROM)))
+        {
+            std::error_code error {};
+            bool const exists {std::filesystem::exists(std::filesystem::symlink_status(directory / std::filesystem::path {name}, error))};
+            mask &= exists ? ~static_cast<std::uint32_t>(IN_DELETE | IN_MOVED_FROM) : ~static_cast<std::uint32_t>(IN_MOVED_TO);
+        }
+
+        handle_change(*root, mask, directory, name);
+    }
+}
+
+
+std::pair<Collector::Root*, std::filesystem::path> Collector::resolve_handle
+(
+    std::uint64_t const filesystem,
+    void const* handle,
+    std::size_t const size
+)
+{
+    std::string key {static_cast<char const*>(handle), size};
+    key.append(reinterpret_cast<char const*>(&filesystem), sizeof(filesystem));
+
+    auto const cached {directory_handles.find(key)};
+    if (cached != directory_handles.end())
+    {
+        return cached->second;
+    }
+
+    // paths outside every input tree are cached without root, as absolute
+    // paths
+    std::pair<Root*, std::filesystem::path> result {nullptr, {}};
+
+    // any root on the same file system opens the handle
+    auto const mount {std::find_if(roots.begin(), roots.end(), [filesystem] (auto const& root)
+    {
+        return root->filesystem_mark && root->filesystem == filesystem;
+    })};
+    if (mount == roots.end())
+    {
+        return result;
+    }
+
+    int const file_descriptor
+    {
+        open_by_handle_at((*mount)->mount_descriptor, static_cast<file_handle*>(const_cast<void*>(handle)), O_PATH | O_CLOEXEC)
+    };
+    if (file_descriptor < 0)
+    {
+        // e.g. the directory was deleted already
+        return result;
+    }
+
+    std::error_code error {};
+    std::filesystem::path const resolved
+    {
+        std::filesystem::read_symlink(std::filesystem::path {"/proc/self/fd"} / std::filesystem::path {std::to_string(file_descriptor)}, error)
+    };
+    close(file_descriptor);
+
+    if (error)
+    {
+        return result;
+    }
+    result.second = resolved;
+
+    // map the path into the input tree as given, e.g. a relative path
+    for (auto const& root : roots)
+    {
+        if (!root->filesystem_mark || root->filesystem != filesystem)
+        {
+            continue;
+        }
+
+        auto const& input {root->canonical_input};
+        auto const mismatch {std::mismatch(input.begin(), input.end(), resolved.begin(), resolved.end())};
+        if (mismatch.first == input.end())
+        {
+            result.first = root.get();
+            result.second = root->input_path;
+            for (auto component {mismatch.second}; component != resolved.end(); ++component)
+            {
+                result.second /= *component;
+            }
+            break;
+        }
+    }
+
+    if (directory_handles.size() >= HANDLE_CACHE_SIZE)
+    {
+        directory_handles.clear();
+    }
+    directory_handles.emplace(std::move(key), result);
+
+    return result;
+}
+
+
+void Collector::handle_change
+(
+    Root& root,
+    std::uint32_t const mask,
+    std::filesystem::path const& directory,
+    char const* name,
+    int const watch,
+    bool const rescan
+)
+{
+    std::filesystem::path const file {directory / std::filesystem::path {name}};
+
+    if (indexing)
+    {
+        update_index(root, mask, file, directory);
+    }
+
+    // watch new directories and add their contents, i.e. entries created
+    // before the watch was in place, or moved into the tree
+    bool const is_new_directory {(mask & IN_ISDIR) && (mask & (IN_CREATE | IN_MOVED_TO))};
+    if (is_new_directory && rescan && watches_subdirectories(root))
+    {
+        watch_directory(root, file, watch);
+    }
+
+    // if the file name matches, push the file to the queue
+    if ((mask & IN_CREATE) && (recursive || directory == root.input_path) && file_matcher.match(name))
+    {
+        // a rescan after an overflow may have found the file already
+        auto const recent {recent_triggers.find(file.native())};
+        if (recent != recent_triggers.end() && recent->second.second)
+        {
+            recent->second.second = false;
+            return;
+        }
+
+        std::cout << "New matching file/directory '" << name << "' created" << std::endl;
+        add_trigger(root, file);
+    }
+}
+
+
+void Collector::rescan(std::size_t const instance)
+{
+    auto const cutoff {drained[instance] - RESCAN_SLACK};
+
+    // lost moves may have changed the paths of cached directory handles
+    if (instance == 1)
+    {
+        directory_handles.clear();
+    }
+
+    for (auto& root : roots)
+    {
+        if (root->filesystem_mark != (instance == 1))
+        {
+            continue;
+        }
+
+        std::cout << "Scanning " << root->input_path << " for files whose events were lost" << std::endl;
+        metrics.rescans.fetch_add(1, std::memory_order_relaxed);
+
+        // rebuild the index and watch directories created meanwhile, as if
+        // the root was added again
+        if (indexing)
+        {
+            root->index.invalidate();
+        }
+        watch_directory(*root, root->input_path);
+
+        recover_triggers(*root, cutoff);
+    }
+}
+
+
+void Collector::recover_triggers(Root const& root, std::chrono::system_clock::time_point const cutoff)
+{
+    auto const recover = [&] (std::filesystem::path const& file)
+    {
+        if (!file_matcher.match(file.filename().native()) || recent_triggers.count(file.native()) > 0)
+        {
+            return;
+        }
+
+        // files created before the queue was drained had their events read,
+        // the birth time is preferred, the change time is never earlier
+        struct statx status {};
+        if (statx(AT_FDCWD, file.c_str(), AT_SYMLINK_NOFOLLOW, STATX_BTIME | STATX_CTIME, &status) != 0)
+        {
+            return;
+        }
+        auto const& created {(status.stx_mask & STATX_BTIME) ? status.stx_btime : status.stx_ctime};
+        std::chrono::system_clock::time_point const time
+        {
+            std::chrono::duration_cast<std::chrono::system_clock::duration>
+            (
+                std::chrono::seconds {created.tv_sec} + std::chrono::nanoseconds {created.tv_nsec}
+            )
+        };
+        if (time < cutoff)
+        {
+            return;
+        }
+
+        std::cout << "Recovered matching file/directory " << file << " created during the overflow" << std::endl;
+        metrics.recovered.fetch_add(1, std::memory_order_relaxed);
+        add_trigger(root, file, true);
+    };
+
+    std::error_code error {};
+    if (recursive)
+    {
+        auto const options {std::filesystem::directory_options::skip_permission_denied};
+        for (std::filesystem::recursive_directory_iterator entries {root.input_path, options, error}, end {}; !error && entries != end; entries.increment(error))
+        {
+            recover(entries->path());
+        }
+    }
+    else
+    {
+        for (std::filesystem::directory_iterator entries {root.input_path, error}, end {}; !error && entries != end; entries.increment(error))
+        {
+            recover(entries->path());
+        }
+    }
+}
+
+
+int Collector::watch_directory(Root& root, std::filesystem::path const& directory, int const parent)
+{
+    // a file system mark covers every directory already
+    int watch_descriptor {0};
+
+    if (!root.filesystem_mark)
+    {
+        std::uint32_t mask {IN_CREATE | IN_ONLYDIR};
+        if (indexing || recursive)
+        {
+            mask |= IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+        }
+
+        watch_descriptor = inotify_add_watch(inotify_descriptor, directory.c_str(), mask);
+        if (watch_descriptor < 0)
+        {
+            if (errno == ENOSPC)
+            {
+                std::cerr << "Cannot watch " << directory << ", the limit of " << watches.size()
+                          << " inotify watches is reached, see /proc/sys/fs/inotify/max_user_watches" << std::endl;
+            }
+            if (indexing)
+            {
+                // without a watch, the index cannot be kept up to date
+                std::cerr << "Cannot watch " << directory << ", falling back to directory walks" << std::endl;
+                root.index.invalidate();
+            }
+            return watch_descriptor;
+        }
+
+        // a moved directory keeps its watch descriptor, hence overwrite the
+        // entry, the watch of an input directory is never moved
+        if (parent < 0)
+        {
+            if (!watches.contains(watch_descriptor))
+            {
+                watches.add_root(watch_descriptor, directory);
+            }
+        }
+        else
+        {
+            watches.add(watch_descriptor, parent, directory.filename().native());
+        }
+    }
+
+    bool const index_directory {indexing && (root.selection == FileSelection::FILES_AND_DIRECTORIES || directory == root.input_path)};
+    if (!index_directory && !watches_subdirectories(root))
+    {
+        return watch_descriptor;
+    }
+
+    if (indexing && directory == root.input_path)
+    {
+        root.index.clear();
+    }
+
+    // scan after adding the watch, such that no entry is missed
+    std::error_code error {};
+    for (std::filesystem::directory_iterator entries {directory, error}, end {}; !error && entries != end; entries.increment(error))
+    {
+        std::filesystem::directory_entry const& entry {*entries};
+        bool const is_directory {entry.is_directory(error) && !entry.is_symlink(error)};
+
+        if (index_directory && root.selection == FileSelection::FILES)
+        {
+            if (entry.is_regular_file(error))
+            {
+                root.index.add(entry.path(), false);
+            }
+        }
+        else if (index_directory)
+        {
+            root.index.add(entry.path(), is_directory);
+        }
+
+        if (is_directory && watches_subdirectories(root))
+        {
+            watch_directory(root, entry.path(), watch_descriptor);
+        }
+    }
+
+    return watch_descriptor;
+}
+
+
+bool Collector::watches_subdirectories(Root const& root) const
+{
+    // the index of the whole tree needs events of every directory as well,
+    // whose contents are scanned even if covered by a file system mark
+    return (recursive && !root.filesystem_mark) || (indexing && root.selection == FileSelection::FILES_AND_DIRECTORIES);
+}
+
+
+void Collector::report_watches() const
+{
+    std::size_t const marked
+    {
+        static_cast<std::size_t>(std::count_if(roots.begin(), roots.end(), [] (auto const& root) { return root->filesystem_mark; }))
+    };
+
+    if (marked > 0)
+    {
+        std::size_t memory {directory_handles.bucket_count() * sizeof(void*)};
+        for (auto const& [handle, entry] : directory_handles)
+        {
+            memory += sizeof(void*) + sizeof(std::pair<std::string const, std::pair<Root*, std::filesystem::path>>)
+                + handle.capacity() + entry.second.native().capacity();
+        }
+        std::cout << "Watching " << marked << " root(s) with fanotify file system marks, "
+                  << directory_handles.size() << " directory handle(s) cached in " << memory << " bytes" << std::endl;
+    }
+
+    if (marked == roots.size())
+    {
+        return;
+    }
+
+    std::size_t const count {std::max<std::size_t>(watches.size(), 1)};
+    std::cout << "Watching " << watches.size() << " director" << (watches.size() == 1 ? "y" : "ies")
+              << " of " << roots.size() - marked << " root(s) with inotify, "
+              << watches.memory() / count << " bytes per watch in user space and about "
+              << INOTIFY_WATCH_KERNEL_SIZE << " bytes per watch in the kernel ("
+              << (watches.memory() + watches.size() * INOTIFY_WATCH_KERNEL_SIZE) / 1024 << " KiB in total)" << std::endl;
+}
+
+
+void Collector::update_index(Root& root, std::uint32_t const mask, std::filesystem::path const& file, std::filesystem::path const& directory)
+{
+    if (mask & (IN_DELETE | IN_MOVED_FROM))
+    {
+        root.index.remove(file);
+        return;
+    }
+
+    if (!(mask & (IN_CREATE | IN_MOVED_TO)))
+    {
+        return;
+    }
+
+    if (root.selection == FileSelection::FILES)
+    {
+        // only regular files of the input directory itself are indexed
+        std::error_code error {};
+        if (directory == root.input_path && std::filesystem::is_regular_file(file, error))
+        {
+            root.index.add(file, false);
+        }
+        return;
+    }
+
+    if (mask & IN_MOVED_TO)
+    {
+        // replace anything that was stored under the target name before
+        root.index.remove(file);
+    }
+    root.index.add(file, (mask & IN_ISDIR) != 0);
+}
+
+
+void Collector::add_trigger(Root const& root, std::filesystem::path const& file, bool const recovered)
+{
+    // the trigger was detected when its event was read
+    auto const now {events_read};
+
+    // remember the trigger for rescans, forgetting those out of the window
+    while (!recent_order.empty() && now - recent_order.front().first > RECENT_TRIGGER_WINDOW)
+    {
+        auto const recent {recent_triggers.find(recent_order.front().second)};
+        if (recent != recent_triggers.end() && recent->second.first == recent_order.front().first)
+        {
+            recent_triggers.erase(recent);
+        }
+        recent_order.pop_front();
+    }
+    recent_triggers.insert_or_assign(file.native(), std::make_pair(now, recovered));
+    recent_order.emplace_back(now, file.native());
+
+    if (coalescing_window.count() <= 0)
+    {
+        enqueue(Trigger {file.parent_path(), {file}, now, {}, root.number});
+        return;
+    }
+
+    // merge with the pending trigger of the same directory, if any
+    auto [entry, inserted] = pending_triggers.try_emplace(file.parent_path());
+    if (inserted)
+    {
+        entry->second.directory = file.parent_path();
+        entry->second.detected = now;
+        entry->second.root = root.number;
+    }
+    entry->second.files.push_back(file);
+}
+
+
+void Collector::enqueue(Trigger&& trigger)
+{
+    trigger.enqueued = std::chrono::steady_clock::now();
+    metrics.detection.observe(trigger.enqueued - trigger.detected);
+    metrics.triggers.fetch_add(1, std::memory_order_relaxed);
+
+    queue->push(std::move(trigger));
+}
+
+
+int Collector::flush_triggers(bool const all)
+{
+    auto const now {std::chrono::steady_clock::now()};
+    auto next {std::chrono::steady_clock::time_point::max()};
+
+    for (auto entry {pending_triggers.begin()}; entry != pending_triggers.end();)
+    {
+        auto const deadline {entry->second.detected + coalescing_window};
+
+        if (all || deadline <= now)
+        {
+            std::cout << "Collecting " << entry->second.files.size() << " coalesced trigger(s) in "
+                      << entry->first << std::endl;
+            enqueue(std::move(entry->second));
+            entry = pending_triggers.erase(entry);
+        }
+        else
+        {
+            next = std::min(next, deadline);
+            ++entry;
+        }
+    }
+
+    if (next == std::chrono::steady_clock::time_point::max())
+    {
+        return -1;
+    }
+
+    // round up, such that the window has closed when poll() returns
+    auto const timeout {std::chrono::ceil<std::chrono::milliseconds>(next - now)};
+    return static_cast<int>(timeout.count());
+}
@@ -13,20 +13,65 @@
 #pragma once
 
 
+#include "block_compressor.h"
+#include "chunk_store.h"
+#include "directory_index.h"
+#include "event_buffer.h"
 #include "fifo.h"
+#include "filename_matcher.h"
+#include "growing_file.h"
+#include "metrics.h"
+#include "path_table.h"
+#include "tar_writer.h"
+#include "throttle.h"
+#include "trigger_queue.h"
+#include "watch_table.h"
 
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <filesystem>
 #include <functional>
+#include <map>
+#include <memory>
 #include <regex>
+#include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 
 
 constexpr int BUFFER_SIZE = 1024;
-constexpr int CACHE_LINE_SIZE = 64;
+
+/**
+ * @brief Maximum number of directory handles of fanotify events whose paths
+ * are cached
+ *
+ */
+constexpr std::size_t HANDLE_CACHE_SIZE = 4096;
+
+/**
+ * @brief Interval in which the metrics file is rewritten
+ *
+ */
+constexpr std::chrono::seconds METRICS_INTERVAL {5};
+
+/**
+ * @brief Files created this long before the event queue was last drained
+ * are scanned again after an overflow, since creation times are coarse
+ *
+ */
+constexpr std::chrono::seconds RESCAN_SLACK {1};
+
+/**
+ * @brief Triggers are remembered this long, such that a rescan does not
+ * trigger a file twice
+ *
+ */
+constexpr std::chrono::seconds RECENT_TRIGGER_WINDOW {60};
 
 
 /**
@@ -51,13 +96,16 @@ enum class FileSelection
 
 /**
  * @brief Class controlling the monitoring and data collection within a given
- * directory.
+ * set of directories.
  *
- * The collector class starts and stops two worker threads.
- * One worker is tasked with monitoring the input directory for file creation
- * events while the other worker collects data upon arrival of file creation
- * events.
- * The collected data is then stored as tar archive in the output directory.
+ * The collector class starts and stops its worker threads.
+ * One worker is tasked with monitoring the input directories (roots) for file
+ * creation events while a pool of workers collects data upon arrival of file
+ * creation events, one event per worker at a time.
+ * All roots share a single inotify instance, a single event loop and the
+ * pool of workers.
+ * The collected data is then stored as tar archive in the output directory
+ * of the root.
  *
  */
 class Collector
@@ -67,14 +115,34 @@ public:
      * @brief Monitor the input directory for file creation events and collect
      * data upon event trigger.
      *
-     * The name of the created file has to match the `file_regex`.
-     * This method starts and stops the two worker threads.
+     * The name of the created file has to match the `file_matcher`.
+     * This method starts and stops the worker threads.
+     * It returns once <q> is read from stdin or `stop` is called.
      *
      */
     void monitor_and_collect();
 
     /**
-     * @brief Monitor file creation events in the input directory
+     * @brief Request all worker threads to stop, waking them up immediately
+     *
+     * `monitor_and_collect` returns once the worker threads have finished.
+     * This method may be called from any thread.
+     *
+     */
+    void stop();
+
+    /**
+     * @brief Lose the next batch of inotify events as if the kernel queue
+     * overflowed, e.g. to test the recovery without lowering the system-wide
+     * `max_queued_events`
+     *
+     * This method may be called from any thread.
+     *
+     */
+    void simulate_overflow();
+
+    /**
+     * @brief Monitor file creation events in the input directories
      *
      */
     void monitor();
@@ -87,7 +155,14 @@ public:
     void collect();
 
     /**
-     * @brief Construct a new Collector object
+     * @brief Construct a new Collector object without input roots, which are
+     * added by `add_root`
+     *
+     */
+    Collector();
+
+    /**
+     * @brief Construct a new Collector object monitoring a single input root
      *
      * @param input_path Directory to monitor
      * @param output_path Directory to store collected data in
@@ -100,13 +175,317 @@ public:
         FileSelection const selection
     );
 
+    /**
+     * @brief Destroy the Collector object
+     *
+     */
+    ~Collector();
+
+    Collector(Collector const&) = delete;
+    Collector& operator=(Collector const&) = delete;
+
+    /**
+     * @brief Add a further directory to monitor
+     *
+     * Roots must not overlap, i.e. no root may lie within another one.
+     * Must be called before `monitor_and_collect`.
+     *
+     * @param input_path Directory to monitor
+     * @param output_path Directory to store collected data of this root in
+     * @param selection Data collection mode of this root
+     */
+    void add_root
+    (
+        std::filesystem::path const& input_path,
+        std::filesystem::path const& output_path,
+        FileSelection const selection
+    );
+
     /**
      * @brief Configure the regex used for matching file names
      *
+     * A custom regex is always matched with std::regex.
+     *
      * @param regex Regex matched against during file creation events
      */
     void set_regex(std::regex const& regex);
 
+    /**
+     * @brief Configure the pattern used for matching file names
+     *
+     * The default pattern is matched with a DFA, any other pattern with
+     * std::regex.
+     *
+     * @see FilenameMatcher
+     *
+     * @param pattern Pattern matched against during file creation events
+     */
+    void set_pattern(std::string const& pattern);
+
+    /**
+     * @brief Configure the number of collector threads
+     *
+     * By default, one collector thread per CPU in the affinity mask of the
+     * process is started.
+     * Must be called before `monitor_and_collect`.
+     *
+     * @param workers Number of collector threads
+     */
+    void set_workers(unsigned int const workers);
+
+    /**
+     * @brief Configure the number of threads traversing the directory tree of
+     * a collection in `FILES_AND_DIRECTORIES` mode, and measuring its disk
+     * usage
+     *
+     * By default, the CPUs in the affinity mask of the process are shared
+     * among the collector threads, e.g. 2 traversal threads per collection
+     * with 4 collector threads on 8 CPUs, such that concurrent collections
+     * do not oversubscribe the CPUs.
+     *
+     * @param threads Number of traversal threads
+     */
+    void set_traversal_threads(unsigned int const threads);
+
+    /**
+     * @brief Configure whether pending file creation events are still
+     * collected after `stop` was requested
+     *
+     * @param drain true to collect pending events, false to discard them
+     */
+    void set_drain(bool const drain);
+
+    /**
+     * @brief Configure the window in which file creation events of the same
+     * directory are coalesced into a single collection
+     *
+     * The window opens with the first event of a directory, a window of zero
+     * collects every event separately (default).
+     * Must be called before `monitor_and_collect`.
+     *
+     * @param window Length of the coalescing window
+     */
+    void set_coalescing_window(std::chrono::milliseconds const window);
+
+    /**
+     * @brief Configure whether the input directory is indexed
+     *
+     * The index is seeded by a single scan and kept up to date from inotify
+     * events, such that collections take the file list from memory instead of
+     * walking the input directory (default).
+     * Must be called before `monitor_and_collect`.
+     *
+     * @param indexing true to index the input directory, false to walk it
+     */
+    void set_indexing(bool const indexing);
+
+    /**
+     * @brief Configure whether the whole input tree is monitored
+     *
+     * If enabled, matching files created in any subdirectory trigger a
+     * collection of that subdirectory, and directories are watched as they
+     * are created, moved and deleted.
+     * Otherwise, only files created in the input directory itself trigger
+     * collections (default).
+     * Must be called before `monitor_and_collect`.
+     *
+     * @param recursive true to monitor the whole tree, false for the input
+     * directory only
+     */
+    void set_recursive(bool const recursive);
+
+    /**
+     * @brief Configure whether the whole tree is monitored by a single
+     * fanotify mark on its file system, if privileges allow
+     *
+     * A file system mark is not limited by the number of inotify watches, but
+     * does not cover other file systems mounted below the input directory.
+     * Without the CAP_SYS_ADMIN capability, every directory is watched with
+     * inotify instead.
+     * Enabled by default, only used if monitoring recursively.
+     *
+     * @param filesystem_marks true to try fanotify, false to use inotify only
+     */
+    void set_filesystem_marks(bool const filesystem_marks);
+
+    /**
+     * @brief Configure the compression of output archives, which are named
+     * `archive.<hash>.tar.zst` or `archive.<hash>.tar.lz4` if compressed
+     *
+     * If the number of threads is 0, every archive is compressed by the
+     * collection's share of the CPUs, like the traversal threads.
+     *
+     * @param compression Algorithm, level and number of threads
+     */
+    void set_compression(CompressionOptions const& compression);
+
+    /**
+     * @brief Configure whether collected data is deduplicated
+     *
+     * If enabled, file contents are stored in the content-addressed chunk
+     * store `<output_path>/chunks` and every collection writes a manifest
+     * `manifest.<hash>.txt` instead of an archive, from which `rebuild`
+     * restores the archive.
+     * Must be called before `monitor_and_collect`.
+     *
+     * @see ChunkStore
+     *
+     * @param deduplication true to write manifests, false to write archives
+     */
+    void set_deduplication(bool const deduplication);
+
+    /**
+     * @brief Configure whether files that triggered a collection are archived
+     * while they are still being written
+     *
+     * If enabled, every other collected file is archived right away, while
+     * the triggering files are followed until their writer closes them or
+     * they are not modified for the idle timeout, and appended as they grow.
+     * Archiving thus overlaps with writing, e.g. with dumping a large core.
+     * Manifests of the chunk store are written once the files are complete.
+     * A timeout of zero disables streaming (default).
+     *
+     * @see GrowingFile
+     *
+     * @param idle_timeout Time without modification after which a file is
+     * considered complete
+     */
+    void set_streaming(std::chrono::milliseconds const idle_timeout);
+
+    /**
+     * @brief Configure whether the collected files are captured in a
+     * snapshot before they are archived
+     *
+     * If enabled, every collection first clones, links or copies its regular
+     * files into a directory of its own below `directory`, and archives and
+     * compresses the snapshot instead of the input directory.
+     * The input directory is thus only read for the short time of taking the
+     * snapshot, and the archive is consistent even if files are rewritten or
+     * rotated meanwhile.
+     * `directory` should be on the file system of the input directories, but
+     * outside of them, such that files are cloned or linked rather than
+     * copied.
+     * Chunk stores read the input directory, since they skip unchanged files
+     * by their inode. An empty path disables snapshots (default).
+     *
+     * @see Snapshot
+     *
+     * @param directory Directory holding the snapshots of the collections
+     */
+    void set_snapshot_directory(std::filesystem::path const& directory);
+
+    /**
+     * @brief Configure the queue passing triggers from the monitor thread to
+     * the collector threads, e.g. a `lockfree_fifo`
+     *
+     * Must be called before `monitor_and_collect`.
+     *
+     * @param queue Queue replacing the default `blocking_fifo`
+     */
+    void set_queue(fifo_ptr<Trigger> queue);
+
+    /**
+     * @brief Bound the queue of triggers, replacing it by a TriggerQueue
+     * counting its decisions in the metrics
+     *
+     * By default, the queue is unbounded.
+     * Must be called before `monitor_and_collect`.
+     *
+     * @see TriggerQueue
+     *
+     * @param capacity Maximum number of queued triggers per lane
+     * @param policy Handling of new triggers while the queue is full
+     */
+    void set_queue_capacity(std::size_t const capacity, OverflowPolicy const policy);
+
+    /**
+     * @brief Limit the bandwidth and I/O operations of every collection,
+     * shared by all collector threads
+     *
+     * Reading files into archives or chunk stores and measuring their disk
+     * usage take their tokens from the same buckets.
+     *
+     * @see Throttle
+     *
+     * @param bytes_per_second Bytes read per second, 0 for no limit
+     * @param operations_per_second I/O operations per second, 0 for no limit
+     */
+    void set_throttle(std::uint64_t const bytes_per_second, std::uint64_t const operations_per_second);
+
+    /**
+     * @brief Configure the CPU and I/O priorities of the collector threads,
+     * e.g. to yield to the production service
+     *
+     * Must be called before `monitor_and_collect`.
+     *
+     * @param priority Priorities applied by every collector thread
+     */
+    void set_worker_priority(WorkerPriority const& priority);
+
+    /**
+     * @brief Configure how archived files are read with respect to the page
+     * cache, such that collections do not evict the working set of the
+     * production service
+     *
+     * @see CacheOptions
+     *
+     * @param cache Cache-neutral reads and `O_DIRECT` threshold
+     */
+    void set_cache_options(CacheOptions const& cache);
+
+    /**
+     * @brief Read the files of every archive ahead with several threads while
+     * a single writer adds them in order, e.g. to keep a fast device busy
+     *
+     * @see Prefetcher
+     *
+     * @param prefetch Number of reader threads and memory limit per archive
+     */
+    void set_prefetch(PrefetchOptions const& prefetch);
+
+    /**
+     * @brief Configure a file the metrics are written to every
+     * `METRICS_INTERVAL` and when stopping, e.g. for the textfile collector
+     * of the Prometheus node exporter
+     *
+     * Must be called before `monitor_and_collect`.
+     *
+     * @see Metrics
+     *
+     * @param file File path, empty to disable (default)
+     */
+    void set_metrics_file(std::filesystem::path const& file);
+
+    /**
+     * @brief Configure a unix socket serving the metrics, every connection
+     * receives the current metrics in the Prometheus text format
+     *
+     * Must be called before `monitor_and_collect`.
+     *
+     * @param socket Socket path, empty to disable (default)
+     */
+    void set_metrics_socket(std::filesystem::path const& socket);
+
+    /**
+     * @brief Configure a function called by the collector threads whenever a
+     * collection is complete, e.g. to measure latencies without polling the
+     * output directory
+     *
+     * Must be called before `monitor_and_collect`.
+     *
+     * @param callback Function receiving the collected trigger and the
+     * archive or manifest written, an empty path if the collection failed
+     */
+    void set_completion_callback(std::function<void(Trigger const&, std::filesystem::path const&)> callback);
+
+    /**
+     * @brief Get the metrics of the data collection, which are updated while
+     * monitoring
+     *
+     * @return Metrics of every stage
+     */
+    Metrics const& get_metrics() const;
+
     /**
      * @brief Collect files in a specified directory, depending on the selection
      * mode
@@ -115,23 +494,89 @@ public:
      *
      * @param path Directory to collect files from
      * @param selection File selection mode
+     * @param threads Number of threads traversing a directory tree
      * @return Resulting list of file paths
      */
     static std::vector<std::filesystem::path> collect_files
     (
         std::filesystem::path const& path,
-        FileSelection const selection
+        FileSelection const selection,
+        unsigned int const threads = 1
+    );
+
+    /**
+     * @brief Collect files in a specified directory into a path table, which
+     * stores names instead of complete paths
+     *
+     * The directory itself is added as unlisted root.
+     * Directory trees are traversed by a TreeWalker.
+     *
+     * @see TreeWalker
+     *
+     * @param path Directory to collect files from
+     * @param selection File selection mode
+     * @param files Table to append the collected files to
+     * @param threads Number of threads traversing a directory tree
+     */
+    static void collect_files
+    (
+        std::filesystem::path const& path,
+        FileSelection const selection,
+        PathTable& files,
+        unsigned int const threads = 1
     );
 
     /**
      * @brief Collect disk usage information from a given list of files
      *
+     * Sizes are measured in-process by a DiskUsageEngine and reported like
+     * `du -sh` reports them.
+     *
+     * @param files Files to collect disk usage information from
+     * @param temporaries List of temporary files
+     * @param output_path Output directory for disk usage information
+     * @param threads Number of threads walking directory trees, one per
+     * available CPU by default
+     */
+    static void collect_disk_usage
+    (
+        std::vector<std::filesystem::path>& files,
+        std::vector<std::filesystem::path>& temporaries,
+        std::filesystem::path const& output_path,
+        unsigned int const threads = available_cpus()
+    );
+
+    /**
+     * @brief Collect disk usage information of the listed entries of a path
+     * table, appending the report to the table
+     *
      * @param files Files to collect disk usage information from
      * @param temporaries List of temporary files
      * @param output_path Output directory for disk usage information
+     * @param throttle Rate limit of the `statx` calls, none by default
+     * @param threads Number of threads walking directory trees, one per
+     * available CPU by default
      */
     static void collect_disk_usage
     (
+        PathTable& files,
+        std::vector<std::filesystem::path>& temporaries,
+        std::filesystem::path const& output_path,
+        Throttle* throttle = nullptr,
+        unsigned int const threads = available_cpus()
+    );
+
+    /**
+     * @brief Write the list of files that triggered a collection
+     *
+     * @param trigger Trigger to list the files of
+     * @param files Files to append the list to
+     * @param temporaries List of temporary files
+     * @param output_path Output directory for the list
+     */
+    static void collect_triggers
+    (
+        Trigger const& trigger,
         std::vector<std::filesystem::path>& files,
         std::vector<std::filesystem::path>& temporaries,
         std::filesystem::path const& output_path
@@ -140,38 +585,216 @@ public:
     /**
      * @brief Store a given list of files as a tar archive
      *
+     * The archive is written in-process by a TarWriter.
+     * Directories are stored as plain directory entries, their contents have to
+     * be part of `files` themselves (as returned by `collect_files`).
+     *
      * @param files Files to store in the archive
      * @param temporaries Temporary files to delete
      * @param output_file  Given file path of the archive
      * @param delete_temporaries Determines whether temporaries are deleted
+     * @param compression Compression of the archive, none by default
+     * @return true if the archive was written completely, false otherwise
      */
-    static void store_files
+    static bool store_files
     (
         std::vector<std::filesystem::path> const& files,
         std::vector<std::filesystem::path> const& temporaries,
         std::filesystem::path const& output_file,
-        bool delete_temporaries = true
+        bool delete_temporaries = true,
+        CompressionOptions const& compression = {}
+    );
+
+    /**
+     * @brief Store the listed entries of a path table as a tar archive
+     *
+     * @param files Files to store in the archive, by their member names
+     * @param temporaries Temporary files to delete
+     * @param output_file  Given file path of the archive
+     * @param delete_temporaries Determines whether temporaries are deleted
+     * @param compression Compression of the archive, none by default
+     * @param sources Files to read instead, by the same indexes, e.g.
+     * snapshots, or `nullptr` to read `files`
+     * @param throttle Rate limit of reading the files, none by default
+     * @param cache Reading of the files with respect to the page cache,
+     * through the cache by default
+     * @param prefetch Reader threads reading the files ahead, none by default
+     * @return true if the archive was written completely, false otherwise
+     */
+    static bool store_files
+    (
+        PathTable const& files,
+        std::vector<std::filesystem::path> const& temporaries,
+        std::filesystem::path const& output_file,
+        bool delete_temporaries = true,
+        CompressionOptions const& compression = {},
+        PathTable const* sources = nullptr,
+        Throttle* throttle = nullptr,
+        CacheOptions const& cache = {},
+        PrefetchOptions const& prefetch = {}
     );
 
 
 private:
+    // monitored directory tree with its own output directory and index
+    struct Root
+    {
+        std::size_t number {0};
+        std::filesystem::path input_path {};
+        std::filesystem::path output_path {};
+        FileSelection selection {FileSelection::FILES};
+
+        // index of the input directory, maintained by the monitor thread
+        DirectoryIndex index {};
+
+        // watch of the input directory, or fanotify mark of its file system
+        int watch {-1};
+        bool filesystem_mark {false};
+        int mount_descriptor {-1};
+        std::uint64_t filesystem {0};
+        std::filesystem::path canonical_input {};
+
+        ChunkStore* chunk_store {nullptr};
+    };
+
+    void export_metrics();
+    void monitor_poll();
+    void monitor_ring();
     void handle_file_event(int const file_descriptor);
+    void handle_batch(std::size_t const instance, std::size_t const length, std::chrono::system_clock::time_point const started);
+    void handle_events(int const file_descriptor, char const* buffer, std::size_t const length);
+    void handle_fanotify_events(char const* buffer, std::size_t length);
+    void handle_change
+    (
+        Root& root,
+        std::uint32_t const mask,
+        std::filesystem::path const& directory,
+        char const* name,
+        int const watch = -1,
+        bool const rescan = true
+    );
+    bool mark_filesystem(Root& root);
+    std::pair<Root*, std::filesystem::path> resolve_handle(std::uint64_t const filesystem, void const* handle, std::size_t const size);
+    int watch_directory(Root& root, std::filesystem::path const& directory, int const parent = -1);
+    bool watches_subdirectories(Root const& root) const;
+    void report_watches() const;
+    void update_index(Root& root, std::uint32_t const mask, std::filesystem::path const& file, std::filesystem::path const& directory);
+    void rescan(std::size_t const instance);
+    void recover_triggers(Root const& root, std::chrono::system_clock::time_point const cutoff);
+    void add_trigger(Root const& root, std::filesystem::path const& file, bool const recovered = false);
+    void enqueue(Trigger&& trigger);
+    int flush_triggers(bool const all = false);
+    std::filesystem::path collect_trigger(Trigger const& trigger);
+    unsigned int thread_budget() const;
+    CompressionOptions compression_options() const;
+    void record_collection
+    (
+        std::chrono::steady_clock::time_point const start,
+        std::size_t const files,
+        std::filesystem::path const& output_file
+    );
+    bool stream_files
+    (
+        PathTable const& files,
+        PathTable const* sources,
+        std::vector<std::filesystem::path> const& growing,
+        std::vector<std::filesystem::path> const& temporaries,
+        std::filesystem::path const& output_file
+    );
+    std::vector<std::unique_ptr<GrowingFile>> follow(std::vector<std::filesystem::path> const& files) const;
 
 private:
-    std::filesystem::path input_path {};
-    std::filesystem::path output_path {};
-    FileSelection selection;
+    std::vector<std::unique_ptr<Root>> roots {};
 
-    std::regex file_regex {"core\\.[a-zA-Z]+(\\.[a-f0-9]+)+\\.lz4"};
+    FilenameMatcher file_matcher {};
 
     std::thread monitor_thread {};
-    std::thread collector_thread {};
+    std::vector<std::thread> collector_threads {};
+
+    // CPUs in the affinity mask, shared by the collector threads, the
+    // threads of a collection default to a share of them if 0
+    unsigned int cpus {1};
+    unsigned int workers {1};
+    unsigned int traversal_threads {0};
+    bool drain {false};
+
+    CompressionOptions compression {};
+
+    // one store per output directory, shared by all collector threads if
+    // deduplicating
+    bool deduplication {false};
+    std::map<std::filesystem::path, std::unique_ptr<ChunkStore>> chunk_stores {};
 
-    fifo_ptr<std::filesystem::path> queue
+    // triggering files are followed while they are written if positive
+    std::chrono::milliseconds streaming_timeout {0};
+
+    // collections archive snapshots below this directory if not empty
+    std::filesystem::path snapshot_directory {};
+
+    // rate limits of reading the input, shared by all collector threads,
+    // and the priorities these threads run at
+    std::unique_ptr<Throttle> throttle {std::make_unique<Throttle>()};
+    WorkerPriority priority {};
+
+    // archived files are read without polluting the page cache if set
+    CacheOptions cache {};
+
+    // files of archives are read ahead by this many threads if positive
+    PrefetchOptions prefetch {};
+
+    bool indexing {true};
+
+    // watches of all input trees in a single inotify instance, owned by the
+    // monitor thread, top-level watches map to their roots
+    int inotify_descriptor {-1};
+    bool recursive {false};
+    WatchTable watches {};
+    std::unordered_map<int, Root*> root_watches {};
+    std::unordered_map<std::uint32_t, int> moved_directories {};
+
+    // fanotify marks on the file systems of the input trees instead of
+    // inotify watches, events carry handles of their directories
+    int fanotify_descriptor {-1};
+    bool filesystem_marks {true};
+    std::unordered_map<std::string, std::pair<Root*, std::filesystem::path>> directory_handles {};
+
+    // batched reads of the inotify and the fanotify instance, in this order,
+    // the time each instance last drained its queue, and whether an
+    // overflow lost events since then
+    EventBuffer event_buffers[2] {};
+    std::chrono::system_clock::time_point drained[2] {};
+    bool overflowed[2] {false, false};
+    std::atomic<bool> overflow_requested {false};
+
+    // triggers of the last `RECENT_TRIGGER_WINDOW`, in order, marked if a
+    // rescan found their file before its event arrived
+    std::unordered_map<std::string, std::pair<std::chrono::steady_clock::time_point, bool>> recent_triggers {};
+    std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> recent_order {};
+
+    // triggers within their coalescing window, owned by the monitor thread
+    std::chrono::milliseconds coalescing_window {0};
+    std::map<std::filesystem::path, Trigger> pending_triggers {};
+    std::chrono::steady_clock::time_point events_read {};
+
+    fifo_ptr<Trigger> queue
     {
-        std::make_unique<blocking_fifo<std::filesystem::path>>()
+        std::make_unique<blocking_fifo<Trigger>>()
     };
 
+    // lock-free counters of every stage, exported by a thread of its own
+    Metrics metrics {};
+    std::filesystem::path metrics_file {};
+    std::filesystem::path metrics_socket {};
+    std::thread metrics_thread {};
+
+    std::function<void(Trigger const&, std::filesystem::path const&)> completion_callback {};
+
+    // number of the next collection, part of the names of its output files
+    std::atomic<std::uint64_t> collection_sequence {0};
+
+    // eventfd signalled by stop(), wakes up every wait of the collector
+    int stop_descriptor {-1};
+
     alignas(CACHE_LINE_SIZE) std::atomic<bool> is_running {true};
 
 };
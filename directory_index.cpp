@@ -0,0 +1,114 @@
+/**
+ * @file directory_index.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of an in-memory index of a monitored directory
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "directory_index.h"
+
+#include <algorithm>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+
+void DirectoryIndex::add(std::filesystem::path const& path, bool const is_directory)
+{
+    std::unique_lock<std::shared_mutex> lock {mutex};
+    entries.insert_or_assign(path.native(), is_directory);
+}
+
+
+void DirectoryIndex::remove(std::filesystem::path const& path)
+{
+    std::string const prefix {path.native() + "/"};
+
+    std::unique_lock<std::shared_mutex> lock {mutex};
+    entries.erase(path.native());
+
+    // entries below a directory are stored contiguously after its prefix
+    auto const first {entries.lower_bound(prefix)};
+    auto last {first};
+    while (last != entries.end() && last->first.compare(0, prefix.size(), prefix) == 0)
+    {
+        ++last;
+    }
+    entries.erase(first, last);
+}
+
+
+void DirectoryIndex::clear()
+{
+    std::unique_lock<std::shared_mutex> lock {mutex};
+    entries.clear();
+    is_valid = true;
+}
+
+
+void DirectoryIndex::invalidate()
+{
+    std::unique_lock<std::shared_mutex> lock {mutex};
+    is_valid = false;
+}
+
+
+bool DirectoryIndex::valid() const
+{
+    std::shared_lock<std::shared_mutex> lock {mutex};
+    return is_valid;
+}
+
+
+std::vector<std::filesystem::path> DirectoryIndex::files() const
+{
+    std::shared_lock<std::shared_mutex> lock {mutex};
+
+    std::vector<std::filesystem::path> result {};
+    result.reserve(entries.size());
+    for (auto const& entry : entries)
+    {
+        result.emplace_back(entry.first);
+    }
+    return result;
+}
+
+
+void DirectoryIndex::files(PathTable& table) const
+{
+    std::shared_lock<std::shared_mutex> lock {mutex};
+
+    // entries are sorted, hence every indexed directory precedes its contents
+    std::unordered_map<std::string_view, std::uint32_t> directories {};
+    for (auto const& [path, is_directory] : entries)
+    {
+        std::string_view const entry {path};
+        std::size_t const separator {entry.rfind('/')};
+        std::string_view const parent {separator == std::string_view::npos ? std::string_view {} : entry.substr(0, std::max<std::size_t>(separator, 1))};
+        std::string_view const name {separator == std::string_view::npos ? entry : entry.substr(separator + 1)};
+
+        auto directory {directories.find(parent)};
+        if (directory == directories.end())
+        {
+            directory = directories.emplace(parent, table.add_root(parent, false)).first;
+        }
+
+        std::uint32_t const index {table.add(directory->second, name)};
+        if (is_directory)
+        {
+            directories.emplace(entry, index);
+        }
+    }
+}
+
+
+std::size_t DirectoryIndex::size() const
+{
+    std::shared_lock<std::shared_mutex> lock {mutex};
+    return entries.size();
+}
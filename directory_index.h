@@ -0,0 +1,101 @@
+/**
+ * @file directory_index.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of an in-memory index of a monitored directory
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include "path_table.h"
+
+#include <filesystem>
+#include <map>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief In-memory index of the entries of a monitored directory tree.
+ *
+ * The index is seeded by a single scan and kept up to date from file system
+ * events afterwards, such that listing the tree does not touch the file
+ * system.
+ * Entries are kept sorted by path, hence parents precede their contents.
+ * The index may be read and modified concurrently.
+ *
+ */
+class DirectoryIndex
+{
+public:
+    /**
+     * @brief Add an entry to the index, adding an existing entry again has no
+     * effect
+     *
+     * @param path Path of the entry
+     * @param is_directory Whether the entry is a directory
+     */
+    void add(std::filesystem::path const& path, bool const is_directory);
+
+    /**
+     * @brief Remove an entry from the index, including all entries below it
+     *
+     * @param path Path of the entry
+     */
+    void remove(std::filesystem::path const& path);
+
+    /**
+     * @brief Remove all entries and mark the index as valid
+     *
+     */
+    void clear();
+
+    /**
+     * @brief Mark the index as out of date, e.g. if events were lost
+     *
+     */
+    void invalidate();
+
+    /**
+     * @brief Checks whether the index reflects the monitored tree
+     *
+     * @return true if the index is up to date, false otherwise
+     */
+    bool valid() const;
+
+    /**
+     * @brief Get a snapshot of all entries of the index
+     *
+     * @return List of paths, sorted
+     */
+    std::vector<std::filesystem::path> files() const;
+
+    /**
+     * @brief Append a snapshot of all entries of the index to a path table
+     *
+     * The directories of entries which are not indexed themselves, e.g. the
+     * input directory, are added as unlisted roots.
+     *
+     * @param table Table to append the entries to, sorted
+     */
+    void files(PathTable& table) const;
+
+    /**
+     * @brief Get the number of entries of the index
+     *
+     * @return number of entries
+     */
+    std::size_t size() const;
+
+private:
+    mutable std::shared_mutex mutex {};
+    std::map<std::string, bool> entries {};
+    bool is_valid {false};
+};
@@ -0,0 +1,692 @@
+/**
+ * @file disk_usage.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of an in-process disk usage engine
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "disk_usage.h"
+#include "io_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+
+/*
+ * For statx, the man page was referenced.
+ *
+ * See https://man7.org/linux/man-pages/man2/statx.2.html.
+ *
+ * Sizes are formatted like coreutils' du -h, which rounds up to the next
+ * tenth (below 10) or unit (otherwise) of powers of 1024.
+ */
+
+
+namespace
+{
+    constexpr unsigned int STATX_MASK = STATX_TYPE | STATX_NLINK | STATX_INO | STATX_SIZE | STATX_BLOCKS;
+
+    // split directory trees until every thread has this many trees to walk
+    constexpr std::size_t TASKS_PER_THREAD = 4;
+    constexpr int MAX_EXPANSION_DEPTH = 8;
+
+    // directory entries queried per io_uring submission
+    constexpr std::size_t ENTRIES_PER_BATCH = IO_RING_ENTRIES;
+
+    // entries of a path table assembled and queried at once
+    constexpr std::size_t STATUS_BATCH_SIZE = 4096;
+
+
+    /**
+     * @brief Normalize a path such that it can be compared against paths built
+     * during directory walks
+     *
+     */
+    std::string key(std::filesystem::path const& path)
+    {
+        std::string result {path.lexically_normal().native()};
+        while (result.size() > 1 && result.back() == '/')
+        {
+            result.pop_back();
+        }
+        return result;
+    }
+
+
+    /**
+     * @brief Query a batch of directory entries with io_uring and invoke a
+     * callback for every accessible entry, in order
+     *
+     */
+    void visit_entries
+    (
+        IoRing* ring,
+        int const directory_descriptor,
+        std::string const& path,
+        std::vector<std::string> const& names,
+        std::function<void(int const, char const*, struct statx const&)> const& callback
+    )
+    {
+        if (names.empty())
+        {
+            return;
+        }
+
+        std::vector<char const*> pointers {};
+        pointers.reserve(names.size());
+        for (auto const& name : names)
+        {
+            pointers.push_back(name.c_str());
+        }
+
+        std::vector<struct statx> statuses {};
+        std::vector<std::int32_t> results {};
+        if (!ring->statx_all(directory_descriptor, pointers, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_MASK, statuses, results))
+        {
+            // the ring failed, query the batch one by one
+            for (std::size_t i {0}; i < names.size(); ++i)
+            {
+                results[i] = statx(directory_descriptor, pointers[i], AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_MASK, &statuses[i]) == 0 ? 0 : -errno;
+            }
+        }
+
+        for (std::size_t i {0}; i < names.size(); ++i)
+        {
+            if (results[i] < 0)
+            {
+                std::cerr << "Cannot access " << path << "/" << names[i] << ": " << std::strerror(-results[i]) << std::endl;
+                continue;
+            }
+
+            callback(directory_descriptor, pointers[i], statuses[i]);
+        }
+    }
+
+
+    /**
+     * @brief Invoke a callback for every entry of an open directory, the
+     * directory descriptor is taken over and closed
+     *
+     */
+    void for_each_entry
+    (
+        int const directory_descriptor,
+        std::string const& path,
+        Throttle* throttle,
+        std::function<void(int const, char const*, struct statx const&)> const& callback
+    )
+    {
+        DIR* directory {fdopendir(directory_descriptor)};
+        if (!directory)
+        {
+            std::cerr << "Cannot read directory " << path << ": " << std::strerror(errno) << std::endl;
+            close(directory_descriptor);
+            return;
+        }
+
+        IoRing* ring {IoRing::local()};
+        std::vector<std::string> names {};
+
+        while (dirent const* entry {readdir(directory)})
+        {
+            if (std::strcmp(entry->d_name, ".") == 0 || std::strcmp(entry->d_name, "..") == 0)
+            {
+                continue;
+            }
+
+            // with io_uring, query the entries in batches of one system call
+            if (ring)
+            {
+                names.emplace_back(entry->d_name);
+                if (names.size() == ENTRIES_PER_BATCH)
+                {
+                    if (throttle)
+                    {
+                        throttle->acquire(0, names.size());
+                    }
+                    visit_entries(ring, directory_descriptor, path, names, callback);
+                    names.clear();
+                }
+                continue;
+            }
+
+            if (throttle)
+            {
+                throttle->acquire(0);
+            }
+            struct statx status {};
+            if (statx(directory_descriptor, entry->d_name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_MASK, &status) != 0)
+            {
+                std::cerr << "Cannot access " << path << "/" << entry->d_name << ": " << std::strerror(errno) << std::endl;
+                continue;
+            }
+
+            callback(directory_descriptor, entry->d_name, status);
+        }
+
+        if (throttle && !names.empty())
+        {
+            throttle->acquire(0, names.size());
+        }
+        visit_entries(ring, directory_descriptor, path, names, callback);
+
+        closedir(directory);
+    }
+
+
+    /**
+     * @brief Append an entry name to a directory path
+     *
+     */
+    std::string join(std::string const& path, char const* name)
+    {
+        return path.back() == '/' ? path + name : path + "/" + name;
+    }
+
+
+    DiskUsage& operator+=(DiskUsage& lhs, DiskUsage const& rhs)
+    {
+        lhs.allocated += rhs.allocated;
+        lhs.apparent += rhs.apparent;
+        return lhs;
+    }
+}
+
+
+DiskUsageEngine::DiskUsageEngine(unsigned int const threads) :
+    threads {std::max(threads, 1u)}
+{
+}
+
+
+std::vector<std::optional<DiskUsage>> DiskUsageEngine::measure(std::vector<std::filesystem::path> const& paths)
+{
+    std::vector<std::optional<DiskUsage>> result(paths.size());
+    std::vector<std::string> directories {};
+
+    // query all listed paths at once if io_uring is available
+    std::vector<char const*> names {};
+    names.reserve(paths.size());
+    for (auto const& path : paths)
+    {
+        names.push_back(path.c_str());
+    }
+
+    std::vector<struct statx> statuses {};
+    std::vector<std::int32_t> results {};
+    query(names, statuses, results);
+
+    // measure files directly, collect directories for the tree walk
+    for (std::size_t i {0}; i < paths.size(); ++i)
+    {
+        struct statx const& status {statuses[i]};
+        if (results[i] < 0)
+        {
+            std::cerr << "Cannot access " << paths[i] << ": " << std::strerror(-results[i]) << std::endl;
+            continue;
+        }
+
+        if (S_ISDIR(status.stx_mode))
+        {
+            directories.push_back(key(paths[i]));
+        }
+        else
+        {
+            result[i] = DiskUsage {status.stx_blocks * 512, status.stx_size};
+        }
+    }
+
+    std::unordered_map<std::string, DiskUsage> const directory_usage {measure_directories(directories)};
+
+    for (std::size_t i {0}; i < paths.size(); ++i)
+    {
+        if (!result[i])
+        {
+            auto const usage {directory_usage.find(key(paths[i]))};
+            if (usage != directory_usage.end())
+            {
+                result[i] = usage->second;
+            }
+        }
+    }
+
+    return result;
+}
+
+
+std::vector<std::optional<DiskUsage>> DiskUsageEngine::measure(PathTable const& paths)
+{
+    std::vector<std::optional<DiskUsage>> result(paths.size());
+    std::vector<std::string> directories {};
+    std::vector<std::uint32_t> directory_entries {};
+
+    // only a batch of paths and their statuses is held at once
+    std::vector<std::string> batch(STATUS_BATCH_SIZE);
+    std::vector<std::uint32_t> entries {};
+    std::vector<char const*> names {};
+    std::vector<struct statx> statuses {};
+    std::vector<std::int32_t> results {};
+
+    for (std::uint32_t entry {0}; entry < paths.size() || !entries.empty();)
+    {
+        if (entry < paths.size() && entries.size() < STATUS_BATCH_SIZE)
+        {
+            if (paths.listed(entry))
+            {
+                paths.path(entry, batch[entries.size()]);
+                entries.push_back(entry);
+            }
+            ++entry;
+            continue;
+        }
+
+        names.clear();
+        for (std::size_t i {0}; i < entries.size(); ++i)
+        {
+            names.push_back(batch[i].c_str());
+        }
+        query(names, statuses, results);
+
+        for (std::size_t i {0}; i < entries.size(); ++i)
+        {
+            if (results[i] < 0)
+            {
+                std::cerr << "Cannot access " << batch[i] << ": " << std::strerror(-results[i]) << std::endl;
+            }
+            else if (S_ISDIR(statuses[i].stx_mode))
+            {
+                directories.push_back(key(batch[i]));
+                directory_entries.push_back(entries[i]);
+            }
+            else
+            {
+                result[entries[i]] = DiskUsage {statuses[i].stx_blocks * 512, statuses[i].stx_size};
+            }
+        }
+        entries.clear();
+    }
+
+    // walking sorts the directories, hence keep their keys
+    std::vector<std::string> keys {directories};
+    std::unordered_map<std::string, DiskUsage> const directory_usage {measure_directories(directories)};
+
+    for (std::size_t i {0}; i < keys.size(); ++i)
+    {
+        auto const usage {directory_usage.find(keys[i])};
+        if (usage != directory_usage.end())
+        {
+            result[directory_entries[i]] = usage->second;
+        }
+    }
+
+    return result;
+}
+
+
+void DiskUsageEngine::query(std::vector<char const*> const& names, std::vector<struct statx>& statuses, std::vector<std::int32_t>& results)
+{
+    if (throttle)
+    {
+        throttle->acquire(0, names.size());
+    }
+
+    IoRing* ring {IoRing::local()};
+    if (!ring || !ring->statx_all(AT_FDCWD, names, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_MASK, statuses, results))
+    {
+        statuses.assign(names.size(), {});
+        results.assign(names.size(), 0);
+        for (std::size_t i {0}; i < names.size(); ++i)
+        {
+            results[i] = statx(AT_FDCWD, names[i], AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, STATX_MASK, &statuses[i]) == 0 ? 0 : -errno;
+        }
+    }
+}
+
+
+std::unordered_map<std::string, DiskUsage> DiskUsageEngine::measure_directories(std::vector<std::string>& directories)
+{
+    // only walk directories which are not contained in another listed directory
+    std::unordered_set<std::string> const listed {directories.begin(), directories.end()};
+    std::sort(directories.begin(), directories.end());
+    directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+
+    std::vector<Node> nodes {};
+    for (auto const& directory : directories)
+    {
+        bool nested {false};
+        for (std::size_t end {directory.rfind('/')}; end != std::string::npos && end > 0 && !nested; end = directory.rfind('/', end - 1))
+        {
+            nested = listed.count(directory.substr(0, end)) > 0;
+        }
+        if (!nested)
+        {
+            nodes.push_back(Node {directory});
+        }
+    }
+    std::size_t const roots {nodes.size()};
+    std::vector<Totals> totals(threads);
+
+    // split large trees into sub-trees until there is enough parallel work
+    std::vector<std::size_t> tasks(roots);
+    for (std::size_t i {0}; i < roots; ++i)
+    {
+        tasks[i] = i;
+    }
+
+    for (int depth {0}; threads > 1 && depth < MAX_EXPANSION_DEPTH && tasks.size() < TASKS_PER_THREAD * threads; ++depth)
+    {
+        std::vector<std::size_t> next {};
+        bool split {false};
+
+        for (std::size_t const task : tasks)
+        {
+            split = expand(task, nodes, totals[0]) || split;
+            if (nodes[task].expanded)
+            {
+                next.insert(next.end(), nodes[task].children.begin(), nodes[task].children.end());
+            }
+            else
+            {
+                next.push_back(task);
+            }
+        }
+
+        tasks = std::move(next);
+        if (!split)
+        {
+            break;
+        }
+    }
+
+    // walk the remaining sub-trees in parallel
+    std::atomic<std::size_t> next_task {0};
+
+    auto const worker = [&](std::size_t const id)
+    {
+        for (std::size_t i {next_task++}; i < tasks.size(); i = next_task++)
+        {
+            Node& node {nodes[tasks[i]]};
+            int const directory_descriptor {open(node.path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)};
+            if (directory_descriptor < 0)
+            {
+                std::cerr << "Cannot open directory " << node.path << ": " << std::strerror(errno) << std::endl;
+                continue;
+            }
+            node.own = walk(directory_descriptor, node.path, totals[id]);
+        }
+    };
+
+    std::vector<std::thread> workers {};
+    for (std::size_t id {1}; id < std::min<std::size_t>(threads, tasks.size()); ++id)
+    {
+        workers.emplace_back(worker, id);
+    }
+    worker(0);
+    for (auto& thread : workers)
+    {
+        thread.join();
+    }
+
+    // combine split trees bottom-up
+    for (std::size_t i {0}; i < roots; ++i)
+    {
+        accumulate(i, nodes, totals[0]);
+    }
+
+    std::unordered_map<std::string, DiskUsage> directory_usage {};
+    std::map<std::pair<dev_t, ino_t>, std::vector<Link const*>> links {};
+    for (auto const& thread_totals : totals)
+    {
+        directory_usage.insert(thread_totals.directories.begin(), thread_totals.directories.end());
+        for (auto const& link : thread_totals.links)
+        {
+            links[{link.device, link.inode}].push_back(&link);
+        }
+    }
+
+    // count hard linked files only once per directory, like `du -s` does
+    for (auto const& [inode, occurrences] : links)
+    {
+        if (occurrences.size() < 2)
+        {
+            continue;
+        }
+
+        std::unordered_map<std::string, std::uint64_t> counts {};
+        for (Link const* link : occurrences)
+        {
+            for (std::string directory {link->parent}; directory_usage.count(directory) > 0;)
+            {
+                ++counts[directory];
+                std::size_t const end {directory.rfind('/')};
+                if (end == std::string::npos || end == 0)
+                {
+                    break;
+                }
+                directory.erase(end);
+            }
+        }
+
+        DiskUsage const& usage {occurrences.front()->usage};
+        for (auto const& [directory, count] : counts)
+        {
+            DiskUsage& total {directory_usage[directory]};
+            total.allocated -= (count - 1) * usage.allocated;
+            total.apparent -= (count - 1) * usage.apparent;
+        }
+    }
+
+    return directory_usage;
+}
+
+
+std::string DiskUsageEngine::human_readable(std::uint64_t const bytes)
+{
+    static char const units[] {"KMGTPE"};
+
+    if (bytes < 1024)
+    {
+        return std::to_string(bytes);
+    }
+
+    unsigned int exponent {1};
+    while (exponent < 6 && bytes >> (10 * (exponent + 1)) > 0)
+    {
+        ++exponent;
+    }
+
+    for (;; ++exponent)
+    {
+        unsigned __int128 const divisor {static_cast<unsigned __int128>(1) << (10 * exponent)};
+
+        // round up to tenths while the result stays below 10
+        unsigned __int128 const tenths {(static_cast<unsigned __int128>(bytes) * 10 + divisor - 1) / divisor};
+        if (tenths < 100)
+        {
+            return std::to_string(static_cast<unsigned int>(tenths / 10)) + "."
+                 + std::to_string(static_cast<unsigned int>(tenths % 10)) + units[exponent - 1];
+        }
+
+        unsigned __int128 const whole {(bytes + divisor - 1) / divisor};
+        if (whole < 1024 || exponent == 6)
+        {
+            return std::to_string(static_cast<std::uint64_t>(whole)) + units[exponent - 1];
+        }
+    }
+}
+
+
+void DiskUsageEngine::set_throttle(Throttle* throttle)
+{
+    this->throttle = throttle;
+}
+
+
+DiskUsage DiskUsageEngine::walk(int const directory_descriptor, std::string const& path, Totals& totals)
+{
+    // directories being walked, from the top down to the current one, with
+    // their subdirectories still to walk and the usage of these if they
+    // cannot be opened
+    struct Frame
+    {
+        std::string path {};
+        DiskUsage total {};
+        std::vector<std::pair<std::string, DiskUsage>> subdirectories {};
+    };
+
+    // an explicit stack instead of recursion, every directory is closed once
+    // it is listed, such that deep trees neither exhaust the stack nor the
+    // file descriptors
+    std::vector<Frame> stack {};
+    auto const list = [&](int const descriptor, std::string&& directory)
+    {
+        Frame frame {std::move(directory)};
+
+        struct statx status {};
+        if (statx(descriptor, "", AT_EMPTY_PATH, STATX_MASK, &status) == 0)
+        {
+            add(frame.total, status, frame.path, totals);
+        }
+
+        for_each_entry(descriptor, frame.path, throttle, [&](int const, char const* name, struct statx const& status)
+        {
+            if (S_ISDIR(status.stx_mode))
+            {
+                frame.subdirectories.emplace_back(name, DiskUsage {status.stx_blocks * 512, status.stx_size});
+            }
+            else
+            {
+                add(frame.total, status, frame.path, totals);
+            }
+        });
+
+        stack.push_back(std::move(frame));
+    };
+
+    list(directory_descriptor, std::string {path});
+
+    for (;;)
+    {
+        Frame& frame {stack.back()};
+        if (frame.subdirectories.empty())
+        {
+            totals.directories.emplace_back(frame.path, frame.total);
+            DiskUsage const total {frame.total};
+            stack.pop_back();
+
+            if (stack.empty())
+            {
+                return total;
+            }
+            stack.back().total += total;
+            continue;
+        }
+
+        auto [name, usage] = std::move(frame.subdirectories.back());
+        frame.subdirectories.pop_back();
+
+        std::string child_path {join(frame.path, name.c_str())};
+        int const child {open(child_path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)};
+        if (child < 0)
+        {
+            std::cerr << "Cannot open directory " << child_path << ": " << std::strerror(errno) << std::endl;
+            frame.total += usage;
+            continue;
+        }
+        list(child, std::move(child_path));
+    }
+}
+
+
+bool DiskUsageEngine::expand(std::size_t const index, std::vector<Node>& nodes, Totals& totals)
+{
+    std::string const path {nodes[index].path};
+
+    int const directory_descriptor {open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)};
+    if (directory_descriptor < 0)
+    {
+        return false;
+    }
+
+    DiskUsage own {};
+    std::vector<std::size_t> children {};
+
+    struct statx status {};
+    if (statx(directory_descriptor, "", AT_EMPTY_PATH, STATX_MASK, &status) == 0)
+    {
+        add(own, status, path, totals);
+    }
+
+    for_each_entry(directory_descriptor, path, throttle, [&](int const, char const* name, struct statx const& status)
+    {
+        if (S_ISDIR(status.stx_mode))
+        {
+            children.push_back(nodes.size());
+            nodes.push_back(Node {join(path, name)});
+        }
+        else
+        {
+            add(own, status, path, totals);
+        }
+    });
+
+    nodes[index].own = own;
+    nodes[index].children = std::move(children);
+    nodes[index].expanded = true;
+
+    return !nodes[index].children.empty();
+}
+
+
+DiskUsage DiskUsageEngine::accumulate(std::size_t const index, std::vector<Node>& nodes, Totals& totals)
+{
+    if (!nodes[index].expanded)
+    {
+        return nodes[index].own;
+    }
+
+    DiskUsage total {nodes[index].own};
+    for (std::size_t const child : nodes[index].children)
+    {
+        total += accumulate(child, nodes, totals);
+    }
+
+    totals.directories.emplace_back(nodes[index].path, total);
+    return total;
+}
+
+
+void DiskUsageEngine::add(DiskUsage& usage, struct statx const& status, std::string const& parent, Totals& totals)
+{
+    usage.allocated += status.stx_blocks * 512;
+    usage.apparent += status.stx_size;
+
+    // remember hard linked files, duplicates are subtracted after the walk
+    if (!S_ISDIR(status.stx_mode) && status.stx_nlink > 1)
+    {
+        totals.links.push_back(Link
+        {
+            makedev(status.stx_dev_major, status.stx_dev_minor),
+            status.stx_ino,
+            DiskUsage {status.stx_blocks * 512, status.stx_size},
+            parent
+        });
+    }
+}
@@ -0,0 +1,143 @@
+/**
+ * @file disk_usage.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of an in-process disk usage engine
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include "path_table.h"
+#include "throttle.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+/**
+ * @brief Disk usage of a file or directory tree
+ *
+ */
+struct DiskUsage
+{
+    /**
+     * @brief Allocated size in bytes, as reported by `du`
+     *
+     */
+    std::uint64_t allocated {0};
+
+    /**
+     * @brief Apparent size in bytes, as reported by `du --apparent-size`
+     *
+     */
+    std::uint64_t apparent {0};
+};
+
+
+/**
+ * @brief Engine computing allocated and apparent sizes of files and directory
+ * trees in a single pass, using `statx`.
+ *
+ * Every listed path is measured as `du -s` would measure it.
+ * Directory trees are walked only once, even if nested directories are listed
+ * as well, and disjoint sub-trees are walked in parallel.
+ * Within every listed directory, hard linked files are counted once.
+ *
+ */
+class DiskUsageEngine
+{
+public:
+    /**
+     * @brief Construct a new DiskUsageEngine object
+     *
+     * @param threads Number of threads walking directory trees in parallel,
+     * one per available CPU by default
+     */
+    explicit DiskUsageEngine(unsigned int const threads = available_cpus());
+
+    /**
+     * @brief Measure the disk usage of a given list of paths
+     *
+     * @param paths Files and directories to measure
+     * @return Disk usage of every given path, in the same order, or nothing if
+     * the path cannot be accessed
+     */
+    std::vector<std::optional<DiskUsage>> measure(std::vector<std::filesystem::path> const& paths);
+
+    /**
+     * @brief Measure the disk usage of the listed entries of a path table,
+     * assembling and querying their paths in batches
+     *
+     * @param paths Files and directories to measure
+     * @return Disk usage of every listed entry, by index, or nothing if the
+     * entry cannot be accessed or is not listed
+     */
+    std::vector<std::optional<DiskUsage>> measure(PathTable const& paths);
+
+    /**
+     * @brief Format a number of bytes like `du -h` does, i.e. rounded up to
+     * powers of 1024 with a single decimal below 10
+     *
+     * @param bytes Number of bytes
+     * @return Human-readable size, e.g. "4.0K"
+     */
+    static std::string human_readable(std::uint64_t const bytes);
+
+    /**
+     * @brief Limit the rate of `statx` calls, every entry counts as an I/O
+     * operation
+     *
+     * @param throttle Token buckets shared with other stages, nullptr for no
+     * limit
+     */
+    void set_throttle(Throttle* throttle);
+
+private:
+    struct Node
+    {
+        std::string path {};
+        DiskUsage own {};
+        std::vector<std::size_t> children {};
+        bool expanded {false};
+    };
+
+    struct Link
+    {
+        dev_t device {0};
+        ino_t inode {0};
+        DiskUsage usage {};
+        std::string parent {};
+    };
+
+    struct Totals
+    {
+        std::vector<std::pair<std::string, DiskUsage>> directories {};
+        std::vector<Link> links {};
+    };
+
+    void query(std::vector<char const*> const& names, std::vector<struct statx>& statuses, std::vector<std::int32_t>& results);
+    std::unordered_map<std::string, DiskUsage> measure_directories(std::vector<std::string>& directories);
+    DiskUsage walk(int const directory_descriptor, std::string const& path, Totals& totals);
+    bool expand(std::size_t const index, std::vector<Node>& nodes, Totals& totals);
+    DiskUsage accumulate(std::size_t const index, std::vector<Node>& nodes, Totals& totals);
+    static void add(DiskUsage& usage, struct statx const& status, std::string const& parent, Totals& totals);
+
+private:
+    unsigned int threads {1};
+    Throttle* throttle {nullptr};
+};
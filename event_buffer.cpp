@@ -0,0 +1,84 @@
+/**
+ * @file event_buffer.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of an adaptively sized buffer for file system events
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "event_buffer.h"
+
+#include <algorithm>
+
+
+namespace
+{
+    // consecutive reads filling less than an eighth of the buffer, after
+    // which it is halved
+    constexpr unsigned int SHRINK_READS = 64;
+}
+
+
+EventBuffer::EventBuffer()
+{
+    resize(EVENT_BUFFER_MIN_SIZE);
+}
+
+
+char* EventBuffer::data()
+{
+    return reinterpret_cast<char*>(storage.data());
+}
+
+
+std::size_t EventBuffer::size() const
+{
+    return storage.size() * sizeof(std::uint64_t);
+}
+
+
+void EventBuffer::reserve(std::size_t const pending)
+{
+    std::size_t size {this->size()};
+    while (size < pending && size < EVENT_BUFFER_MAX_SIZE)
+    {
+        size *= 2;
+    }
+    resize(size);
+}
+
+
+bool EventBuffer::update(std::size_t const filled)
+{
+    std::size_t const size {this->size()};
+    bool const drained {filled + EVENT_MAX_SIZE <= size};
+
+    // a full buffer leaves further events queued, read more at once
+    if (!drained)
+    {
+        underused = 0;
+        resize(std::min(size * 2, EVENT_BUFFER_MAX_SIZE));
+    }
+    else if (filled < size / 8 && size > EVENT_BUFFER_MIN_SIZE && ++underused >= SHRINK_READS)
+    {
+        underused = 0;
+        resize(size / 2);
+    }
+    else if (filled >= size / 8)
+    {
+        underused = 0;
+    }
+
+    return drained;
+}
+
+
+void EventBuffer::resize(std::size_t const size)
+{
+    storage.resize(size / sizeof(std::uint64_t));
+    storage.shrink_to_fit();
+}
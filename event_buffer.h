@@ -0,0 +1,87 @@
+/**
+ * @file event_buffer.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of an adaptively sized buffer for file system events
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+constexpr std::size_t EVENT_BUFFER_MIN_SIZE = 1 << 12;
+constexpr std::size_t EVENT_BUFFER_MAX_SIZE = 1 << 18;
+
+/**
+ * @brief Upper bound of the size of a single inotify or fanotify event,
+ * including its name
+ *
+ */
+constexpr std::size_t EVENT_MAX_SIZE = 1024;
+
+
+/**
+ * @brief Buffer for batched reads of inotify and fanotify events, which
+ * grows while reads fill it and shrinks while they leave most of it unused.
+ *
+ * A read returns as many queued events as fit into the buffer, hence a read
+ * leaving room for another event has drained the queue of the kernel.
+ * The buffer is aligned for both kinds of events and must not be resized
+ * while a read into it is in flight.
+ *
+ */
+class EventBuffer
+{
+public:
+    /**
+     * @brief Construct a new EventBuffer object of the minimum size
+     *
+     */
+    EventBuffer();
+
+    /**
+     * @brief Get the buffer to read into
+     *
+     * @return pointer to `size()` bytes
+     */
+    char* data();
+
+    /**
+     * @brief Get the current size of the buffer
+     *
+     * @return number of bytes
+     */
+    std::size_t size() const;
+
+    /**
+     * @brief Grow the buffer to hold a number of pending bytes at once, e.g.
+     * as reported by `FIONREAD`, up to the maximum size
+     *
+     * @param pending Number of bytes queued by the kernel
+     */
+    void reserve(std::size_t const pending);
+
+    /**
+     * @brief Adapt the size to the number of bytes the last read returned
+     *
+     * @param filled Number of bytes read
+     * @return true if the read drained the queue, false otherwise
+     */
+    bool update(std::size_t const filled);
+
+private:
+    void resize(std::size_t const size);
+
+private:
+    std::vector<std::uint64_t> storage {};
+    unsigned int underused {0};
+};
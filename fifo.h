@@ -1,7 +1,7 @@
 /**
  * @file fifo.h
  * @author Max Beddies (max dot beddies at t dash online dot de)
- * @brief Implementation of a blocking fifo queue for concurrent use
+ * @brief Implementation of fifo queues for concurrent use
  * @version 0.1
  * @date 2022-08-24
  *
@@ -13,18 +13,28 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
 #include <memory>
 #include <mutex>
+#include <new>
 #include <queue>
+#include <thread>
+#include <type_traits>
+
+
+constexpr int CACHE_LINE_SIZE = 64;
 
 
 /**
- * @brief fifo queue with synchronized access
+ * @brief interface of fifo queues for concurrent use
  *
  * @tparam T value type of the queue
  */
 template <typename T>
-class blocking_fifo
+class fifo
 {
 public:
     using value_type = T;
@@ -33,13 +43,131 @@ public:
     using size_type = std::size_t;
 
 
+    virtual ~fifo() = default;
+
+
+    /**
+     * @brief removes an element from the front of the queue, the queue must
+     * not be empty
+     *
+     * @return the removed element
+     */
+    virtual value_type
+    pop() = 0;
+
+
+    /**
+     * @brief removes an element from the front of the queue, waiting until
+     * an element is available or the queue is closed
+     *
+     * @param item receives the removed element
+     * @return true if an element was removed, false if the queue was closed
+     */
+    virtual bool
+    pop(reference item) = 0;
+
+
+    /**
+     * @brief removes an element from the front of the queue, waiting until
+     * an element is available, the queue is closed or the timeout expires
+     *
+     * @param item receives the removed element
+     * @param timeout maximum time to wait for an element
+     * @return true if an element was removed, false otherwise
+     */
+    template <typename Rep, typename Period>
+    bool
+    pop(reference item, std::chrono::duration<Rep, Period> const& timeout)
+    {
+        return pop_for(item, std::chrono::ceil<std::chrono::nanoseconds>(timeout));
+    }
+
+
+    /**
+     * @brief inserts an element at the end of the queue and wakes up a
+     * waiting consumer
+     *
+     * @param item the element to insert
+     */
+    virtual void
+    push(const_reference item) = 0;
+
+
+    /**
+     * @brief query the front of the queue without removal
+     *
+     * @return first element of the queue
+     */
+    virtual value_type
+    front() = 0;
+
+
+    /**
+     * @brief checks whether the queue is empty
+     *
+     * @return true if the queue is empty, false otherwise
+     */
+    virtual bool
+    empty() = 0;
+
+
+    /**
+     * @brief get the size of the queue
+     *
+     * @return size of the queue
+     */
+    virtual size_type
+    size() = 0;
+
+
+    /**
+     * @brief closes the queue, waking up all waiting consumers
+     *
+     * Remaining elements can still be removed, waiting for further elements
+     * returns immediately.
+     */
+    virtual void
+    close() = 0;
+
+
+    /**
+     * @brief checks whether the queue was closed
+     *
+     * @return true if the queue was closed, false otherwise
+     */
+    virtual bool
+    closed() = 0;
+
+protected:
+
+    virtual bool
+    pop_for(reference item, std::chrono::nanoseconds const timeout) = 0;
+};
+
+
+/**
+ * @brief fifo queue with synchronized access
+ *
+ * @tparam T value type of the queue
+ */
+template <typename T>
+class blocking_fifo : public fifo<T>
+{
+public:
+    using typename fifo<T>::value_type;
+    using typename fifo<T>::reference;
+    using typename fifo<T>::const_reference;
+    using typename fifo<T>::size_type;
+    using fifo<T>::pop;
+
+
     /**
      * @brief removes an element from the front of the queue
      *
      * @return the removed element
      */
     value_type
-    pop()
+    pop() override
     {
         std::lock_guard<std::mutex> lock {_mtx};
 
@@ -51,15 +179,66 @@ public:
 
 
     /**
-     * @brief inserts an element at the end of the queue
+     * @brief removes an element from the front of the queue, waiting until
+     * an element is available or the queue is closed
+     *
+     * @param item receives the removed element
+     * @return true if an element was removed, false if the queue was closed
+     */
+    bool
+    pop(reference item) override
+    {
+        std::unique_lock<std::mutex> lock {_mtx};
+        _cv.wait(lock, [this] { return !_container->empty() || _closed; });
+
+        return pop_locked(item);
+    }
+
+
+    /**
+     * @brief inserts an element at the end of the queue and wakes up a
+     * waiting consumer
      *
      * @param item the element to insert
      */
     void
-    push(const_reference item)
+    push(const_reference item) override
+    {
+        {
+            std::lock_guard<std::mutex> lock {_mtx};
+            _container->push(item);
+        }
+        _cv.notify_one();
+    }
+
+
+    /**
+     * @brief closes the queue, waking up all waiting consumers
+     *
+     * Remaining elements can still be removed, waiting for further elements
+     * returns immediately.
+     */
+    void
+    close() override
+    {
+        {
+            std::lock_guard<std::mutex> lock {_mtx};
+            _closed = true;
+        }
+        _cv.notify_all();
+    }
+
+
+    /**
+     * @brief checks whether the queue was closed
+     *
+     * @return true if the queue was closed, false otherwise
+     */
+    bool
+    closed() override
     {
         std::lock_guard<std::mutex> lock {_mtx};
-        _container->push(item);
+        return _closed;
     }
 
 
@@ -69,7 +248,7 @@ public:
      * @return first element of the queue
      */
     value_type
-    front()
+    front() override
     {
         std::lock_guard<std::mutex> lock {_mtx};
 
@@ -83,7 +262,7 @@ public:
      * @return true if the queue is empty, false otherwise
      */
     bool
-    empty()
+    empty() override
     {
         std::lock_guard<std::mutex> lock {_mtx};
         return _container->empty();
@@ -96,7 +275,7 @@ public:
      * @return size of the queue
      */
     size_type
-    size()
+    size() override
     {
         std::lock_guard<std::mutex> lock {_mtx};
         return _container->size();
@@ -112,11 +291,458 @@ public:
         _container = std::make_unique<std::queue<value_type>>();
     }
 
+protected:
+
+    bool
+    pop_for(reference item, std::chrono::nanoseconds const timeout) override
+    {
+        std::unique_lock<std::mutex> lock {_mtx};
+        _cv.wait_for(lock, timeout, [this] { return !_container->empty() || _closed; });
+
+        return pop_locked(item);
+    }
+
 private:
 
+    bool
+    pop_locked(reference item)
+    {
+        if (_container->empty())
+        {
+            return false;
+        }
+
+        item = std::move(_container->front());
+        _container->pop();
+
+        return true;
+    }
+
     std::unique_ptr<std::queue<value_type>> _container;
     std::mutex _mtx;
+    std::condition_variable _cv;
+    bool _closed {false};
 };
 
+
+
+/**
+ * @brief bounded lock-free fifo queue for multiple producers and consumers
+ *
+ * Ring buffer of cells carrying a sequence number each, as described by
+ * Dmitry Vyukov.
+ * Producers and consumers only synchronize on the cells they claim, the
+ * enqueue and dequeue positions reside on separate cache lines.
+ * A mutex and condition variables are only used to put threads to sleep if
+ * the queue is full or empty, and only touched if threads are sleeping.
+ *
+ * See https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ *
+ * @tparam T value type of the queue
+ */
+template <typename T>
+class lockfree_fifo : public fifo<T>
+{
+public:
+    using typename fifo<T>::value_type;
+    using typename fifo<T>::reference;
+    using typename fifo<T>::const_reference;
+    using typename fifo<T>::size_type;
+    using fifo<T>::pop;
+
+
+    /**
+     * @brief removes an element from the front of the queue, the queue must
+     * not be empty
+     *
+     * @return the removed element
+     */
+    value_type
+    pop() override
+    {
+        value_type result {};
+        while (!try_pop(result))
+        {
+            std::this_thread::yield();
+        }
+
+        notify_producers();
+        return result;
+    }
+
+
+    /**
+     * @brief removes an element from the front of the queue, waiting until
+     * an element is available or the queue is closed
+     *
+     * @param item receives the removed element
+     * @return true if an element was removed, false if the queue was closed
+     */
+    bool
+    pop(reference item) override
+    {
+        if (!try_pop(item))
+        {
+            std::unique_lock<std::mutex> lock {_mtx};
+            _pop_waiters.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            bool const popped {wait_pop(lock, item)};
+
+            _pop_waiters.fetch_sub(1);
+            if (!popped)
+            {
+                return false;
+            }
+        }
+
+        notify_producers();
+        return true;
+    }
+
+
+    /**
+     * @brief inserts an element at the end of the queue and wakes up a
+     * waiting consumer, waiting while the queue is full
+     *
+     * If the queue is closed while waiting, the element is discarded.
+     *
+     * @param item the element to insert
+     */
+    void
+    push(const_reference item) override
+    {
+        if (!try_push(item))
+        {
+            std::unique_lock<std::mutex> lock {_mtx};
+            _push_waiters.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            _not_full.wait(lock, [this, &item] { return try_push(item) || _closed.load(); });
+
+            _push_waiters.fetch_sub(1);
+        }
+
+        notify_consumers();
+    }
+
+
+    /**
+     * @brief inserts an element at the end of the queue without waiting
+     *
+     * @param item the element to insert
+     * @return true if the element was inserted, false if the queue is full
+     */
+    bool
+    try_push(const_reference item)
+    {
+        cell* target {nullptr};
+        size_type position {_enqueue_position.load(std::memory_order_relaxed)};
+
+        for (;;)
+        {
+            target = &_cells[position & _mask];
+            size_type const sequence {target->sequence.load(std::memory_order_acquire)};
+            auto const difference {static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position)};
+
+            if (difference == 0)
+            {
+                if (_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = _enqueue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        new (&target->storage) value_type(item);
+        target->sequence.store(position + 1, std::memory_order_release);
+
+        return true;
+    }
+
+
+    /**
+     * @brief removes an element from the front of the queue without waiting
+     *
+     * @param item receives the removed element
+     * @return true if an element was removed, false if the queue is empty
+     */
+    bool
+    try_pop(reference item)
+    {
+        cell* target {nullptr};
+        size_type position {_dequeue_position.load(std::memory_order_relaxed)};
+
+        for (;;)
+        {
+            target = &_cells[position & _mask];
+            size_type const sequence {target->sequence.load(std::memory_order_acquire)};
+            auto const difference {static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1)};
+
+            if (difference == 0)
+            {
+                if (_dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (difference < 0)
+            {
+                return false;
+            }
+            else
+            {
+                position = _dequeue_position.load(std::memory_order_relaxed);
+            }
+        }
+
+        value_type* value {std::launder(reinterpret_cast<value_type*>(&target->storage))};
+        item = std::move(*value);
+        value->~value_type();
+        target->sequence.store(position + _mask + 1, std::memory_order_release);
+
+        return true;
+    }
+
+
+    /**
+     * @brief closes the queue, waking up all waiting consumers and producers
+     *
+     * Remaining elements can still be removed, waiting for further elements
+     * returns immediately. Producers waiting on a full queue return without
+     * inserting their element.
+     */
+    void
+    close() override
+    {
+        {
+            std::lock_guard<std::mutex> lock {_mtx};
+            _closed.store(true);
+        }
+        _not_empty.notify_all();
+        _not_full.notify_all();
+    }
+
+
+    /**
+     * @brief checks whether the queue was closed
+     *
+     * @return true if the queue was closed, false otherwise
+     */
+    bool
+    closed() override
+    {
+        return _closed.load();
+    }
+
+
+    /**
+     * @brief query the front of the queue without removal, must not be used
+     * concurrently with consumers
+     *
+     * @return first element of the queue
+     */
+    value_type
+    front() override
+    {
+        size_type const position {_dequeue_position.load(std::memory_order_acquire)};
+        cell const& target {_cells[position & _mask]};
+
+        while (target.sequence.load(std::memory_order_acquire) != position + 1)
+        {
+            std::this_thread::yield();
+        }
+
+        return *std::launder(reinterpret_cast<value_type const*>(&target.storage));
+    }
+
+
+    /**
+     * @brief checks whether the queue is empty
+     *
+     * @return true if the queue is empty, false otherwise
+     */
+    bool
+    empty() override
+    {
+        return size() == 0;
+    }
+
+
+    /**
+     * @brief get the size of the queue, which is approximate while
+     * producers or consumers are active
+     *
+     * @return size of the queue
+     */
+    size_type
+    size() override
+    {
+        size_type const dequeued {_dequeue_position.load(std::memory_order_acquire)};
+        size_type const enqueued {_enqueue_position.load(std::memory_order_acquire)};
+
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+
+    /**
+     * @brief get the maximum number of elements in the queue
+     *
+     * @return capacity of the queue
+     */
+    size_type
+    capacity() const
+    {
+        return _mask + 1;
+    }
+
+
+    /**
+     * @brief Construct a new lock-free fifo
+     *
+     * @param capacity maximum number of elements, rounded up to a power of two
+     */
+    explicit lockfree_fifo(size_type const capacity = 1024)
+    {
+        size_type size {2};
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+
+        _mask = size - 1;
+        _cells = std::make_unique<cell[]>(size);
+
+        for (size_type i {0}; i < size; ++i)
+        {
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+
+    ~lockfree_fifo() override
+    {
+        value_type item {};
+        while (try_pop(item))
+        {
+            continue;
+        }
+    }
+
+
+    lockfree_fifo(lockfree_fifo const&) = delete;
+    lockfree_fifo& operator=(lockfree_fifo const&) = delete;
+
+protected:
+
+    bool
+    pop_for(reference item, std::chrono::nanoseconds const timeout) override
+    {
+        if (!try_pop(item))
+        {
+            std::unique_lock<std::mutex> lock {_mtx};
+            _pop_waiters.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            bool const popped {wait_pop(lock, item, std::chrono::steady_clock::now() + timeout)};
+
+            _pop_waiters.fetch_sub(1);
+            if (!popped)
+            {
+                return false;
+            }
+        }
+
+        notify_producers();
+        return true;
+    }
+
+private:
+
+    struct alignas(CACHE_LINE_SIZE) cell
+    {
+        std::atomic<size_type> sequence {0};
+        std::aligned_storage_t<sizeof(value_type), alignof(value_type)> storage;
+    };
+
+
+    bool
+    wait_pop
+    (
+        std::unique_lock<std::mutex>& lock,
+        reference item,
+        std::chrono::steady_clock::time_point const deadline = std::chrono::steady_clock::time_point::max()
+    )
+    {
+        for (;;)
+        {
+            if (try_pop(item))
+            {
+                return true;
+            }
+            if (_closed.load())
+            {
+                return false;
+            }
+            if (deadline == std::chrono::steady_clock::time_point::max())
+            {
+                _not_empty.wait(lock);
+            }
+            else if (_not_empty.wait_until(lock, deadline) == std::cv_status::timeout)
+            {
+                return try_pop(item);
+            }
+        }
+    }
+
+
+    void
+    notify_consumers()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_pop_waiters.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock {_mtx};
+            _not_empty.notify_one();
+        }
+    }
+
+
+    void
+    notify_producers()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (_push_waiters.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock {_mtx};
+            _not_full.notify_one();
+        }
+    }
+
+
+    std::unique_ptr<cell[]> _cells;
+    size_type _mask {0};
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_type> _enqueue_position {0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_type> _dequeue_position {0};
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_type> _pop_waiters {0};
+    std::atomic<size_type> _push_waiters {0};
+    std::atomic<bool> _closed {false};
+
+    std::mutex _mtx;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+};
+
+
 template <typename T>
-using fifo_ptr = std::unique_ptr<blocking_fifo<T>>;
+using fifo_ptr = std::unique_ptr<fifo<T>>;
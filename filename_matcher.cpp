@@ -0,0 +1,239 @@
+/**
+ * @file filename_matcher.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a file name matcher for trigger files
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "filename_matcher.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+
+/*
+ * For the SSE4.2 string instructions, the Intel intrinsics guide was
+ * referenced.
+ *
+ * See https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html#techs=SSE4_2.
+ */
+
+
+namespace
+{
+    /**
+     * @brief States of the DFA for `core\.[a-zA-Z]+(\.[a-f0-9]+)+\.lz4`
+     *
+     */
+    enum State : std::uint8_t
+    {
+        START,          // expecting "core"
+        C,
+        CO,
+        COR,
+        CORE,           // expecting '.'
+        NAME_START,     // expecting the first letter of the name
+        NAME,           // within the name, letters or '.'
+        HEX_START,      // expecting the first digit of a hex group
+        HEX,            // within a hex group, digits or '.'
+        HEX_OR_SUFFIX,  // expecting a new hex group or "lz4"
+        L,
+        LZ,
+        ACCEPT,         // complete match, nothing may follow
+        REJECT,
+        STATES
+    };
+
+    using Transitions = std::array<std::array<std::uint8_t, 256>, STATES>;
+
+
+    constexpr bool is_letter(int const c)
+    {
+        return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z');
+    }
+
+
+    constexpr bool is_hex(int const c)
+    {
+        return ('a' <= c && c <= 'f') || ('0' <= c && c <= '9');
+    }
+
+
+    /**
+     * @brief Generate the transition table of the DFA
+     *
+     */
+    constexpr Transitions make_transitions()
+    {
+        Transitions table {};
+
+        for (std::size_t state {0}; state < STATES; ++state)
+        {
+            for (int c {0}; c < 256; ++c)
+            {
+                table[state][c] = REJECT;
+            }
+        }
+
+        table[START]['c'] = C;
+        table[C]['o'] = CO;
+        table[CO]['r'] = COR;
+        table[COR]['e'] = CORE;
+        table[CORE]['.'] = NAME_START;
+
+        for (int c {0}; c < 256; ++c)
+        {
+            if (is_letter(c))
+            {
+                table[NAME_START][c] = NAME;
+                table[NAME][c] = NAME;
+            }
+            if (is_hex(c))
+            {
+                table[HEX_START][c] = HEX;
+                table[HEX][c] = HEX;
+                table[HEX_OR_SUFFIX][c] = HEX;
+            }
+        }
+
+        table[NAME]['.'] = HEX_START;
+        table[HEX]['.'] = HEX_OR_SUFFIX;
+
+        // 'l' is no hex digit, hence the suffix is unambiguous
+        table[HEX_OR_SUFFIX]['l'] = L;
+        table[L]['z'] = LZ;
+        table[LZ]['4'] = ACCEPT;
+
+        return table;
+    }
+
+
+    constexpr Transitions TRANSITIONS {make_transitions()};
+
+
+    /**
+     * @brief Run the DFA character by character
+     *
+     */
+    constexpr bool match_scalar(std::string_view const name)
+    {
+        std::uint8_t state {START};
+        for (char const c : name)
+        {
+            state = TRANSITIONS[state][static_cast<unsigned char>(c)];
+        }
+        return state == ACCEPT;
+    }
+
+
+    static_assert(match_scalar("core.ServiceName.3057.57dd721409bc4ab4b38a3c33a36a608a.3717.1647975805000000.lz4"));
+    static_assert(match_scalar("core.Service.0.lz4"));
+    static_assert(!match_scalar("core.Service.lz4"));
+    static_assert(!match_scalar("core.Service.0.lz4.tmp"));
+
+
+#ifdef __SSE4_2__
+    /**
+     * @brief Count the leading characters of `data` within two given
+     * character ranges, looking at up to 16 characters
+     *
+     */
+    std::size_t span_ranges(char const* data, char const* ranges)
+    {
+        __m128i const set {_mm_loadu_si128(reinterpret_cast<__m128i const*>(ranges))};
+        __m128i const chunk {_mm_loadu_si128(reinterpret_cast<__m128i const*>(data))};
+
+        // index of the first character outside of all ranges, 16 if none
+        return static_cast<std::size_t>(_mm_cmpestri
+        (
+            set, 4, chunk, 16,
+            _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT
+        ));
+    }
+
+
+    // pairs of inclusive character ranges, padded to 16 bytes for the loads
+    alignas(16) char const LETTER_RANGES[16] {'a', 'z', 'A', 'Z'};
+    alignas(16) char const HEX_RANGES[16] {'a', 'f', '0', '9'};
+#endif
+}
+
+
+FilenameMatcher::FilenameMatcher(std::regex const& regex) :
+    regex {regex}
+{
+}
+
+
+FilenameMatcher::FilenameMatcher(std::string const& pattern)
+{
+    if (pattern != DEFAULT_PATTERN)
+    {
+        regex = std::regex {pattern};
+    }
+}
+
+
+bool FilenameMatcher::match(std::string_view const name) const
+{
+    if (regex)
+    {
+        return std::regex_match(name.begin(), name.end(), *regex);
+    }
+    return match_default(name);
+}
+
+
+bool FilenameMatcher::uses_regex() const
+{
+    return regex.has_value();
+}
+
+
+bool FilenameMatcher::match_default(std::string_view const name)
+{
+#ifdef __SSE4_2__
+    std::uint8_t state {START};
+    std::size_t position {0};
+
+    while (position < name.size())
+    {
+        // skip runs of letters or hex digits in blocks of 16 characters
+        if (position + 16 <= name.size() && (state == NAME || state == HEX))
+        {
+            std::size_t const span
+            {
+                state == NAME
+                    ? span_ranges(name.data() + position, LETTER_RANGES)
+                    : span_ranges(name.data() + position, HEX_RANGES)
+            };
+            position += span;
+            if (span == 16)
+            {
+                continue;
+            }
+        }
+
+        state = TRANSITIONS[state][static_cast<unsigned char>(name[position])];
+        if (state == REJECT)
+        {
+            return false;
+        }
+        ++position;
+    }
+
+    return state == ACCEPT;
+#else
+    return match_scalar(name);
+#endif
+}
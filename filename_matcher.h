@@ -0,0 +1,87 @@
+/**
+ * @file filename_matcher.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a file name matcher for trigger files
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+
+
+/**
+ * @brief Matcher deciding whether a created file triggers data collection.
+ *
+ * The default trigger grammar `core\.[a-zA-Z]+(\.[a-f0-9]+)+\.lz4` is matched
+ * by a hand-built DFA whose transition table is generated at compile time.
+ * Runs of letters and hexadecimal digits are skipped 16 bytes at a time with
+ * SSE4.2 string instructions, if available.
+ * Any other pattern is matched with `std::regex` as a fallback.
+ *
+ */
+class FilenameMatcher
+{
+public:
+    /**
+     * @brief Pattern of the default trigger grammar
+     *
+     */
+    static constexpr std::string_view DEFAULT_PATTERN {"core\\.[a-zA-Z]+(\\.[a-f0-9]+)+\\.lz4"};
+
+    /**
+     * @brief Construct a new FilenameMatcher object for the default grammar
+     *
+     */
+    FilenameMatcher() = default;
+
+    /**
+     * @brief Construct a new FilenameMatcher object for a custom regex
+     *
+     * @param regex Regex matched against file names
+     */
+    explicit FilenameMatcher(std::regex const& regex);
+
+    /**
+     * @brief Construct a new FilenameMatcher object for a pattern, using the
+     * DFA if the pattern is the default grammar and std::regex otherwise
+     *
+     * @param pattern ECMAScript regex pattern
+     */
+    explicit FilenameMatcher(std::string const& pattern);
+
+    /**
+     * @brief Match a file name against the configured grammar
+     *
+     * @param name File name, without any directories
+     * @return true if the complete name matches, false otherwise
+     */
+    bool match(std::string_view const name) const;
+
+    /**
+     * @brief Checks whether the std::regex fallback is used
+     *
+     * @return true if a custom regex is matched, false if the DFA is used
+     */
+    bool uses_regex() const;
+
+    /**
+     * @brief Match a file name against the default grammar using the DFA
+     *
+     * @param name File name, without any directories
+     * @return true if the complete name matches, false otherwise
+     */
+    static bool match_default(std::string_view const name);
+
+private:
+    std::optional<std::regex> regex {};
+};
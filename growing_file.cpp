@@ -0,0 +1,90 @@
+/**
+ * @file growing_file.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a follower of files which are still being written
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "growing_file.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+
+GrowingFile::GrowingFile(std::filesystem::path const& path, std::chrono::milliseconds const idle_timeout, int const stop_descriptor) :
+    idle_timeout {idle_timeout},
+    stop_descriptor {stop_descriptor}
+{
+    inotify_descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (inotify_descriptor < 0 || inotify_add_watch(inotify_descriptor, path.c_str(), IN_MODIFY | IN_CLOSE_WRITE | IN_DELETE_SELF) < 0)
+    {
+        std::cerr << "Cannot follow " << path << ": " << std::strerror(errno) << std::endl;
+        complete = true;
+    }
+}
+
+
+GrowingFile::~GrowingFile()
+{
+    if (inotify_descriptor >= 0)
+    {
+        close(inotify_descriptor);
+    }
+}
+
+
+bool GrowingFile::wait()
+{
+    if (complete)
+    {
+        return false;
+    }
+
+    pollfd descriptors[2] {{inotify_descriptor, POLLIN, 0}, {stop_descriptor, POLLIN, 0}};
+    int const ready {poll(descriptors, stop_descriptor >= 0 ? 2 : 1, static_cast<int>(idle_timeout.count()))};
+
+    if (ready < 0 && errno == EINTR)
+    {
+        return true;
+    }
+    if (ready <= 0 || (descriptors[1].revents & POLLIN))
+    {
+        complete = true;
+        return false;
+    }
+
+    // several modifications are reported at once, any close completes the file
+    alignas(inotify_event) char buffer[4096];
+    for (ssize_t length {read(inotify_descriptor, buffer, sizeof(buffer))}; length > 0; length = read(inotify_descriptor, buffer, sizeof(buffer)))
+    {
+        for (char* position {buffer}; position < buffer + length;)
+        {
+            auto const* event {reinterpret_cast<inotify_event const*>(position)};
+            if (event->mask & (IN_CLOSE_WRITE | IN_DELETE_SELF | IN_IGNORED))
+            {
+                was_closed = true;
+                complete = true;
+            }
+            position += sizeof(inotify_event) + event->len;
+        }
+    }
+
+    return !complete;
+}
+
+
+bool GrowingFile::closed() const
+{
+    return was_closed;
+}
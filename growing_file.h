@@ -0,0 +1,75 @@
+/**
+ * @file growing_file.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a follower of files which are still being written
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <chrono>
+#include <filesystem>
+
+
+/**
+ * @brief Follower of a file which is still being written, e.g. a core dump
+ * triggering a collection right after its creation.
+ *
+ * An inotify instance of its own reports every modification of the file and
+ * its writer closing it.
+ * If the writer closed the file before the follower was created, no event
+ * arrives, hence the file is considered complete once it was not modified
+ * for the idle timeout.
+ *
+ */
+class GrowingFile
+{
+public:
+    /**
+     * @brief Construct a new GrowingFile object, watching the file
+     *
+     * @param path File to follow
+     * @param idle_timeout Time without modification after which the file is
+     * considered complete
+     * @param stop_descriptor Descriptor which becomes readable to stop
+     * following, e.g. an eventfd, or -1
+     */
+    GrowingFile(std::filesystem::path const& path, std::chrono::milliseconds const idle_timeout, int const stop_descriptor = -1);
+
+    /**
+     * @brief Destroy the GrowingFile object
+     *
+     */
+    ~GrowingFile();
+
+    GrowingFile(GrowingFile const&) = delete;
+    GrowingFile& operator=(GrowingFile const&) = delete;
+
+    /**
+     * @brief Wait until the file was modified or is complete
+     *
+     * @return true if the file was modified, false once it was closed after
+     * writing, was idle for the idle timeout, or following was stopped
+     */
+    bool wait();
+
+    /**
+     * @brief Checks whether the writer closed the file
+     *
+     * @return true if the file was closed after writing, false otherwise
+     */
+    bool closed() const;
+
+private:
+    std::chrono::milliseconds idle_timeout {0};
+    int stop_descriptor {-1};
+    int inotify_descriptor {-1};
+    bool complete {false};
+    bool was_closed {false};
+};
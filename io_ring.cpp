@@ -0,0 +1,538 @@
+/**
+ * @file io_ring.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a minimal io_uring submission and completion ring
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "io_ring.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/*
+ * The ring setup and the memory ordering of head and tail follow the
+ * io_uring_setup and io_uring_enter man pages as well as the liburing
+ * sources.
+ *
+ * See https://man7.org/linux/man-pages/man2/io_uring_setup.2.html,
+ *     https://man7.org/linux/man-pages/man2/io_uring_enter.2.html
+ * and https://github.com/axboe/liburing.
+ */
+
+
+namespace
+{
+    std::atomic<bool> enabled {true};
+
+
+    int io_uring_setup(unsigned int const entries, io_uring_params* parameters)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_setup, entries, parameters));
+    }
+
+
+    int io_uring_enter(int const descriptor, unsigned int const submit, unsigned int const wait, unsigned int const flags)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_enter, descriptor, submit, wait, flags, nullptr, 0));
+    }
+
+
+    int io_uring_register(int const descriptor, unsigned int const opcode, void* argument, unsigned int const count)
+    {
+        return static_cast<int>(syscall(__NR_io_uring_register, descriptor, opcode, argument, count));
+    }
+
+
+    unsigned int load_acquire(unsigned int const* value)
+    {
+        return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+    }
+
+
+    void store_release(unsigned int* value, unsigned int const update)
+    {
+        __atomic_store_n(value, update, __ATOMIC_RELEASE);
+    }
+
+
+    /**
+     * @brief Probe the operations the collector relies on
+     *
+     */
+    bool probe()
+    {
+        io_uring_params parameters {};
+        int const descriptor {io_uring_setup(4, &parameters)};
+        if (descriptor < 0)
+        {
+            return false;
+        }
+
+        // the probe is followed by one entry per operation code
+        constexpr std::size_t OPERATIONS = 256;
+        std::vector<char> storage(sizeof(io_uring_probe) + OPERATIONS * sizeof(io_uring_probe_op));
+        auto* operations {reinterpret_cast<io_uring_probe*>(storage.data())};
+
+        bool result {io_uring_register(descriptor, IORING_REGISTER_PROBE, operations, OPERATIONS) == 0};
+        close(descriptor);
+
+        for (int const operation : {IORING_OP_READ, IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_STATX, IORING_OP_POLL_ADD, IORING_OP_TIMEOUT, IORING_OP_ASYNC_CANCEL})
+        {
+            result = result
+                && operation <= operations->last_op
+                && (operations->ops[operation].flags & IO_URING_OP_SUPPORTED);
+        }
+        return result;
+    }
+}
+
+
+IoRing::IoRing(unsigned int const entries)
+{
+    io_uring_params parameters {};
+    ring_descriptor = io_uring_setup(entries, &parameters);
+
+    if (ring_descriptor < 0)
+    {
+        return;
+    }
+
+    submission_ring_size = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned int);
+    completion_ring_size = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+    entries_size = parameters.sq_entries * sizeof(io_uring_sqe);
+
+    // both rings share a single mapping on kernels since 5.4
+    if (parameters.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        submission_ring_size = std::max(submission_ring_size, completion_ring_size);
+        completion_ring_size = 0;
+    }
+
+    submission_ring = mmap(nullptr, submission_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_descriptor, IORING_OFF_SQ_RING);
+    completion_ring = completion_ring_size == 0
+        ? submission_ring
+        : mmap(nullptr, completion_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_descriptor, IORING_OFF_CQ_RING);
+    this->entries = mmap(nullptr, entries_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_descriptor, IORING_OFF_SQES);
+
+    if (submission_ring == MAP_FAILED || completion_ring == MAP_FAILED || this->entries == MAP_FAILED)
+    {
+        if (submission_ring != MAP_FAILED)
+        {
+            munmap(submission_ring, submission_ring_size);
+        }
+        if (completion_ring_size != 0 && completion_ring != MAP_FAILED)
+        {
+            munmap(completion_ring, completion_ring_size);
+        }
+        if (this->entries != MAP_FAILED)
+        {
+            munmap(this->entries, entries_size);
+        }
+        submission_ring = completion_ring = this->entries = nullptr;
+        close(ring_descriptor);
+        ring_descriptor = -1;
+        return;
+    }
+
+    char* const submission {static_cast<char*>(submission_ring)};
+    submission_head = reinterpret_cast<unsigned int*>(submission + parameters.sq_off.head);
+    submission_tail = reinterpret_cast<unsigned int*>(submission + parameters.sq_off.tail);
+    submission_mask = *reinterpret_cast<unsigned int*>(submission + parameters.sq_off.ring_mask);
+    submission_entries = parameters.sq_entries;
+    submission_array = reinterpret_cast<unsigned int*>(submission + parameters.sq_off.array);
+
+    char* const completion {static_cast<char*>(completion_ring)};
+    completion_head = reinterpret_cast<unsigned int*>(completion + parameters.cq_off.head);
+    completion_tail = reinterpret_cast<unsigned int*>(completion + parameters.cq_off.tail);
+    completion_mask = *reinterpret_cast<unsigned int*>(completion + parameters.cq_off.ring_mask);
+    completions = completion + parameters.cq_off.cqes;
+
+    tail = submitted = *submission_tail;
+}
+
+
+IoRing::~IoRing()
+{
+    if (ring_descriptor < 0)
+    {
+        return;
+    }
+
+    munmap(entries, entries_size);
+    if (completion_ring_size != 0)
+    {
+        munmap(completion_ring, completion_ring_size);
+    }
+    munmap(submission_ring, submission_ring_size);
+    close(ring_descriptor);
+}
+
+
+bool IoRing::supported()
+{
+    static bool const result {probe()};
+    return result;
+}
+
+
+bool IoRing::available()
+{
+    return enabled.load() && supported();
+}
+
+
+void IoRing::set_enabled(bool const enabled)
+{
+    ::enabled.store(enabled);
+}
+
+
+IoRing* IoRing::local()
+{
+    if (!available())
+    {
+        return nullptr;
+    }
+
+    thread_local IoRing ring {};
+    return ring.is_open() ? &ring : nullptr;
+}
+
+
+bool IoRing::is_open() const
+{
+    return ring_descriptor >= 0;
+}
+
+
+unsigned int IoRing::capacity() const
+{
+    return submission_entries;
+}
+
+
+unsigned int IoRing::in_flight() const
+{
+    return pending;
+}
+
+
+void* IoRing::prepare()
+{
+    // the kernel consumes entries up to the submission head
+    if (!is_open() || tail - load_acquire(submission_head) >= submission_entries)
+    {
+        return nullptr;
+    }
+
+    unsigned int const index {tail & submission_mask};
+    auto* entry {static_cast<io_uring_sqe*>(entries) + index};
+    std::memset(entry, 0, sizeof(io_uring_sqe));
+    submission_array[index] = index;
+
+    ++tail;
+    ++pending;
+    return entry;
+}
+
+
+bool IoRing::prepare_read(int const file_descriptor, void* buffer, unsigned int const length, std::uint64_t const offset, std::uint64_t const user_data)
+{
+    auto* entry {static_cast<io_uring_sqe*>(prepare())};
+    if (!entry)
+    {
+        return false;
+    }
+
+    entry->opcode = IORING_OP_READ;
+    entry->fd = file_descriptor;
+    entry->addr = reinterpret_cast<std::uint64_t>(buffer);
+    entry->len = length;
+    entry->off = offset;
+    entry->user_data = user_data;
+    return true;
+}
+
+
+bool IoRing::prepare_openat(int const directory_descriptor, char const* path, int const flags, std::uint64_t const user_data)
+{
+    auto* entry {static_cast<io_uring_sqe*>(prepare())};
+    if (!entry)
+    {
+        return false;
+    }
+
+    entry->opcode = IORING_OP_OPENAT;
+    entry->fd = directory_descriptor;
+    entry->addr = reinterpret_cast<std::uint64_t>(path);
+    entry->open_flags = static_cast<std::uint32_t>(flags);
+    entry->user_data = user_data;
+    return true;
+}
+
+
+bool IoRing::prepare_close(int const file_descriptor, std::uint64_t const user_data)
+{
+    auto* entry {static_cast<io_uring_sqe*>(prepare())};
+    if (!entry)
+    {
+        return false;
+    }
+
+    entry->opcode = IORING_OP_CLOSE;
+    entry->fd = file_descriptor;
+    entry->user_data = user_data;
+    return true;
+}
+
+
+bool IoRing::prepare_statx(int const directory_descriptor, char const* path, int const flags, unsigned int const mask, struct statx* status, std::uint64_t const user_data)
+{
+    auto* entry {static_cast<io_uring_sqe*>(prepare())};
+    if (!entry)
+    {
+        return false;
+    }
+
+    entry->opcode = IORING_OP_STATX;
+    entry->fd = directory_descriptor;
+    entry->addr = reinterpret_cast<std::uint64_t>(path);
+    entry->len = mask;
+    entry->off = reinterpret_cast<std::uint64_t>(status);
+    entry->statx_flags = static_cast<std::uint32_t>(flags);
+    entry->user_data = user_data;
+    return true;
+}
+
+
+bool IoRing::prepare_poll(int const file_descriptor, short const events, std::uint64_t const user_data)
+{
+    auto* entry {static_cast<io_uring_sqe*>(prepare())};
+    if (!entry)
+    {
+        return false;
+    }
+
+    entry->opcode = IORING_OP_POLL_ADD;
+    entry->fd = file_descriptor;
+    entry->poll_events = static_cast<std::uint16_t>(events);
+    entry->user_data = user_data;
+    return true;
+}
+
+
+bool IoRing::prepare_timeout(std::chrono::nanoseconds const duration, std::uint64_t const user_data)
+{
+    auto* entry {static_cast<io_uring_sqe*>(prepare())};
+    if (!entry)
+    {
+        return false;
+    }
+
+    // layout of struct __kernel_timespec
+    timeout_duration[0] = std::chrono::duration_cast<std::chrono::seconds>(duration).count();
+    timeout_duration[1] = (duration % std::chrono::seconds {1}).count();
+
+    entry->opcode = IORING_OP_TIMEOUT;
+    entry->fd = -1;
+    entry->addr = reinterpret_cast<std::uint64_t>(timeout_duration);
+    entry->len = 1;
+    entry->user_data = user_data;
+    return true;
+}
+
+
+bool IoRing::prepare_cancel(std::uint64_t const target, std::uint64_t const user_data)
+{
+    auto* entry {static_cast<io_uring_sqe*>(prepare())};
+    if (!entry)
+    {
+        return false;
+    }
+
+    entry->opcode = IORING_OP_ASYNC_CANCEL;
+    entry->fd = -1;
+    entry->addr = target;
+    entry->user_data = user_data;
+    return true;
+}
+
+
+int IoRing::submit(unsigned int const wait)
+{
+    if (!is_open())
+    {
+        return -EBADF;
+    }
+
+    // publish the prepared entries to the kernel
+    store_release(submission_tail, tail);
+
+    unsigned int const count {tail - submitted};
+    int const result {io_uring_enter(ring_descriptor, count, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0)};
+
+    if (result < 0)
+    {
+        return -errno;
+    }
+
+    submitted += static_cast<unsigned int>(result);
+    return result;
+}
+
+
+bool IoRing::next(Completion& completion)
+{
+    if (!is_open())
+    {
+        return false;
+    }
+
+    unsigned int const head {*completion_head};
+    if (head == load_acquire(completion_tail))
+    {
+        return false;
+    }
+
+    auto const* entry {static_cast<io_uring_cqe const*>(completions) + (head & completion_mask)};
+    completion.user_data = entry->user_data;
+    completion.result = entry->res;
+
+    // hand the entry back to the kernel
+    store_release(completion_head, head + 1);
+    --pending;
+    return true;
+}
+
+
+bool IoRing::complete(std::vector<std::int32_t>& results)
+{
+    Completion completion {};
+
+    while (pending > 0)
+    {
+        while (next(completion))
+        {
+            if (completion.user_data < results.size())
+            {
+                results[completion.user_data] = completion.result;
+            }
+        }
+
+        if (pending == 0)
+        {
+            break;
+        }
+
+        int const result {submit(1)};
+        if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY)
+        {
+            // operations in flight still write into buffers of the caller,
+            // which may reuse or free them once this returns
+            cancel_all();
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void IoRing::cancel_all()
+{
+    // user data of the cancellation, not an index of any results
+    constexpr std::uint64_t CANCEL {static_cast<std::uint64_t>(-1)};
+
+    Completion completion {};
+    bool cancelled {false};
+
+    // entries the kernel rejected never complete, only those submitted are
+    // waited for then
+    bool rejected {false};
+    auto const in_kernel = [this, &rejected] { return pending - (rejected ? tail - submitted : 0); };
+
+    while (in_kernel() > 0)
+    {
+        while (next(completion))
+        {
+        }
+
+        if (in_kernel() == 0)
+        {
+            break;
+        }
+
+        // cancel every operation at once, kernels without this flag fail the
+        // cancellation, their operations are waited for instead
+        if (!cancelled && !rejected)
+        {
+            auto* entry {static_cast<io_uring_sqe*>(prepare())};
+            if (entry)
+            {
+                entry->opcode = IORING_OP_ASYNC_CANCEL;
+                entry->fd = -1;
+                entry->cancel_flags = IORING_ASYNC_CANCEL_ALL | IORING_ASYNC_CANCEL_ANY;
+                entry->user_data = CANCEL;
+                cancelled = true;
+            }
+        }
+
+        int result {rejected ? 0 : submit(1)};
+        if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY)
+        {
+            rejected = true;
+        }
+        if (rejected)
+        {
+            result = io_uring_enter(ring_descriptor, 0, 1, IORING_ENTER_GETEVENTS) < 0 ? -errno : 0;
+        }
+        if (result < 0 && result != -EINTR && result != -EAGAIN && result != -EBUSY)
+        {
+            std::cerr << "Error while waiting for io_uring operations: " << std::strerror(-result) << std::endl;
+            return;
+        }
+    }
+}
+
+
+bool IoRing::statx_all
+(
+    int const directory_descriptor,
+    std::vector<char const*> const& names,
+    int const flags,
+    unsigned int const mask,
+    std::vector<struct statx>& statuses,
+    std::vector<std::int32_t>& results
+)
+{
+    statuses.assign(names.size(), {});
+    results.assign(names.size(), 0);
+
+    for (std::size_t i {0}; i < names.size(); ++i)
+    {
+        // the submission queue is full, complete the current batch first
+        if (!prepare_statx(directory_descriptor, names[i], flags, mask, &statuses[i], i))
+        {
+            if (!complete(results) || !prepare_statx(directory_descriptor, names[i], flags, mask, &statuses[i], i))
+            {
+                return false;
+            }
+        }
+    }
+    return complete(results);
+}
@@ -0,0 +1,257 @@
+/**
+ * @file io_ring.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a minimal io_uring submission and completion ring
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <sys/stat.h>
+
+
+constexpr unsigned int IO_RING_ENTRIES = 64;
+
+
+/**
+ * @brief Minimal io_uring instance, set up with the raw system calls such that
+ * no library is required.
+ *
+ * Operations are prepared into the submission queue and handed to the kernel
+ * in a single `io_uring_enter` call, i.e. a batch of N operations costs one
+ * system call instead of N.
+ * A ring must only be used by one thread at a time.
+ *
+ * Callers check `available()` and fall back to plain system calls otherwise,
+ * e.g. on kernels older than 5.6 or where io_uring is disabled.
+ *
+ */
+class IoRing
+{
+public:
+    /**
+     * @brief Result of a completed operation
+     *
+     */
+    struct Completion
+    {
+        std::uint64_t user_data {0};
+        std::int32_t result {0};
+    };
+
+    /**
+     * @brief Construct a new IoRing object
+     *
+     * @param entries Size of the submission queue, rounded up to a power of 2
+     */
+    explicit IoRing(unsigned int const entries = IO_RING_ENTRIES);
+
+    /**
+     * @brief Destroy the IoRing object, cancelling operations in flight
+     *
+     */
+    ~IoRing();
+
+    IoRing(IoRing const&) = delete;
+    IoRing& operator=(IoRing const&) = delete;
+
+    /**
+     * @brief Checks whether the kernel supports every operation used by the
+     * collector, probed once per process
+     *
+     * @return true if io_uring can be used, false otherwise
+     */
+    static bool supported();
+
+    /**
+     * @brief Checks whether io_uring is supported and not disabled with
+     * `set_enabled`
+     *
+     * @return true if io_uring should be used, false otherwise
+     */
+    static bool available();
+
+    /**
+     * @brief Enable or disable io_uring for the whole process, e.g. to use
+     * the poll and plain system call fallback (enabled by default)
+     *
+     * @param enabled true to use io_uring where supported, false otherwise
+     */
+    static void set_enabled(bool const enabled);
+
+    /**
+     * @brief Get a ring owned by the calling thread, e.g. for batches of
+     * `statx` calls of a directory walk
+     *
+     * @return ring of the calling thread, or nothing if io_uring is not
+     * available
+     */
+    static IoRing* local();
+
+    /**
+     * @brief Checks whether the ring was set up successfully
+     *
+     * @return true if operations can be submitted, false otherwise
+     */
+    bool is_open() const;
+
+    /**
+     * @brief Get the size of the submission queue
+     *
+     * @return number of operations which can be prepared at once
+     */
+    unsigned int capacity() const;
+
+    /**
+     * @brief Get the number of prepared operations which have not completed yet
+     *
+     * @return number of operations in flight
+     */
+    unsigned int in_flight() const;
+
+    /**
+     * @brief Prepare a `read` of a file, at the current file position if
+     * `offset` is -1
+     *
+     * @return true if prepared, false if the submission queue is full
+     */
+    bool prepare_read(int const file_descriptor, void* buffer, unsigned int const length, std::uint64_t const offset, std::uint64_t const user_data);
+
+    /**
+     * @brief Prepare an `openat`, the result is the new file descriptor
+     *
+     * @return true if prepared, false if the submission queue is full
+     */
+    bool prepare_openat(int const directory_descriptor, char const* path, int const flags, std::uint64_t const user_data);
+
+    /**
+     * @brief Prepare a `close` of a file descriptor
+     *
+     * @return true if prepared, false if the submission queue is full
+     */
+    bool prepare_close(int const file_descriptor, std::uint64_t const user_data);
+
+    /**
+     * @brief Prepare a `statx`, `status` must stay valid until completion
+     *
+     * @return true if prepared, false if the submission queue is full
+     */
+    bool prepare_statx(int const directory_descriptor, char const* path, int const flags, unsigned int const mask, struct statx* status, std::uint64_t const user_data);
+
+    /**
+     * @brief Prepare a one-shot `poll` of a file descriptor, the result is
+     * the mask of ready events
+     *
+     * @return true if prepared, false if the submission queue is full
+     */
+    bool prepare_poll(int const file_descriptor, short const events, std::uint64_t const user_data);
+
+    /**
+     * @brief Prepare a timeout completing with `-ETIME` after a given
+     * duration, at most one timeout may be in flight
+     *
+     * @return true if prepared, false if the submission queue is full
+     */
+    bool prepare_timeout(std::chrono::nanoseconds const duration, std::uint64_t const user_data);
+
+    /**
+     * @brief Prepare the cancellation of an operation in flight, which then
+     * completes with `-ECANCELED`
+     *
+     * @param target User data of the operation to cancel
+     * @return true if prepared, false if the submission queue is full
+     */
+    bool prepare_cancel(std::uint64_t const target, std::uint64_t const user_data);
+
+    /**
+     * @brief Submit all prepared operations
+     *
+     * @param wait Number of completions to wait for
+     * @return number of submitted operations, or -errno on failure
+     */
+    int submit(unsigned int const wait = 0);
+
+    /**
+     * @brief Take the next completion, without waiting
+     *
+     * @param completion Completion taken from the completion queue
+     * @return true if a completion was available, false otherwise
+     */
+    bool next(Completion& completion);
+
+    /**
+     * @brief Submit all prepared operations and wait for all of them to
+     * complete, storing the result of every operation at the index given by
+     * its user data
+     *
+     * @param results Results, indexed by user data
+     * @return true on success, false if the kernel rejected the batch, after
+     * cancelling and waiting for every operation in flight
+     */
+    bool complete(std::vector<std::int32_t>& results);
+
+    /**
+     * @brief Call `statx` for a list of names relative to a directory,
+     * submitting up to `capacity()` calls at once
+     *
+     * @param directory_descriptor Directory the names are relative to
+     * @param names Names, or paths, to query
+     * @param flags Flags of `statx`, e.g. `AT_SYMLINK_NOFOLLOW`
+     * @param mask Fields to query
+     * @param statuses Results of `statx`, one per name
+     * @param results 0 or -errno, one per name
+     * @return true on success, false if the ring failed
+     */
+    bool statx_all
+    (
+        int const directory_descriptor,
+        std::vector<char const*> const& names,
+        int const flags,
+        unsigned int const mask,
+        std::vector<struct statx>& statuses,
+        std::vector<std::int32_t>& results
+    );
+
+private:
+    void* prepare();
+    void cancel_all();
+
+private:
+    int ring_descriptor {-1};
+
+    void* submission_ring {nullptr};
+    std::size_t submission_ring_size {0};
+    void* completion_ring {nullptr};
+    std::size_t completion_ring_size {0};
+    void* entries {nullptr};
+    std::size_t entries_size {0};
+
+    unsigned int* submission_head {nullptr};
+    unsigned int* submission_tail {nullptr};
+    unsigned int submission_mask {0};
+    unsigned int submission_entries {0};
+    unsigned int* submission_array {nullptr};
+
+    unsigned int* completion_head {nullptr};
+    unsigned int* completion_tail {nullptr};
+    unsigned int completion_mask {0};
+    void* completions {nullptr};
+
+    // locally prepared, but not yet submitted entries
+    unsigned int tail {0};
+    unsigned int submitted {0};
+    unsigned int pending {0};
+
+    // storage of the duration of a timeout in flight
+    std::int64_t timeout_duration[2] {};
+};
@@ -11,49 +11,337 @@
 
 
 #include "collector.h"
+#include "io_ring.h"
 
-#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <getopt.h>
 
 
 void print_usage(std::string const& name)
 {
     std::cout << "Usage: " << name
-        << " INPUT_PATH OUTPUT_PATH ( -f | -d )"
-        << std::endl;
+        << " [ INPUT_PATH OUTPUT_PATH ]... ( -f | -d ) [ -R ROOTS ] [ -j WORKERS ] [ -W THREADS ] [ -w WINDOW ] [ -D ] [ -P ]" << std::endl
+        << "    [ -c METHOD ] [ -l LEVEL ] [ -t THREADS ] [ -s ] [ -r [ -I ] ] [ -S IDLE ]" << std::endl
+        << "    [ -m METRICS_FILE ] [ -u METRICS_SOCKET ] [ -T SNAPSHOT_DIR ] [ -Q CAPACITY [ -O POLICY ] ]" << std::endl
+        << "    [ -B RATE ] [ -i IOPS ] [ -p CLASS ] [ -n NICE ] [ -e ] [ -C ] [ -x SIZE ]" << std::endl
+        << "    [ -a READERS [ -M MEMORY ] ]"
+        << std::endl
+        << "  Every pair of paths adds an input directory and the output directory of its data." << std::endl
+        << "  -f          collect regular files only" << std::endl
+        << "  -d          collect files and directories, recursively" << std::endl
+        << "  -R ROOTS    add the input directories listed in file ROOTS, one per line:" << std::endl
+        << "              INPUT_PATH OUTPUT_PATH [ -f | -d ]" << std::endl
+        << "  -j WORKERS  number of collector threads (default: number of CPUs)" << std::endl
+        << "  -W THREADS  number of threads traversing and measuring a collected directory tree (default: number of CPUs / WORKERS)" << std::endl
+        << "  -w WINDOW   coalesce events of a directory within WINDOW milliseconds (default: 0)" << std::endl
+        << "  -D          collect pending events before quitting" << std::endl
+        << "  -P          use poll() and plain system calls instead of io_uring" << std::endl
+        << "  -c METHOD   compress archives with zstd or lz4 (default: none)" << std::endl
+        << "  -l LEVEL    compression level (default: default level of the algorithm)" << std::endl
+        << "  -t THREADS  number of compression threads per archive (default: number of CPUs / WORKERS)" << std::endl
+        << "  -s          store deduplicated chunks and manifests instead of archives, see rebuild" << std::endl
+        << "  -r          monitor the whole input tree, collecting the directory of the created file" << std::endl
+        << "  -I          watch every directory with inotify instead of a fanotify file system mark" << std::endl
+        << "  -S IDLE     archive triggering files while they are written, until closed or idle for IDLE milliseconds" << std::endl
+        << "  -m FILE     write metrics in the Prometheus text format to FILE every few seconds" << std::endl
+        << "  -u SOCKET   serve metrics in the Prometheus text format on the unix socket SOCKET" << std::endl
+        << "  -T DIR      archive snapshots of the collected files, cloned, linked or copied into DIR" << std::endl
+        << "  -Q CAPACITY bound the queue of pending collections, a first trigger per service is queued ahead" << std::endl
+        << "  -O POLICY   if the queue is full: block, drop-oldest, drop-newest or coalesce (default: block)" << std::endl
+        << "  -B RATE     read at most RATE bytes per second for archives and disk usage, e.g. 20M (default: no limit)" << std::endl
+        << "  -i IOPS     issue at most IOPS read and stat operations per second (default: no limit)" << std::endl
+        << "  -p CLASS    I/O priority of collector threads: idle, best-effort or best-effort:LEVEL (0-7)" << std::endl
+        << "  -n NICE     add NICE to the nice value of collector threads" << std::endl
+        << "  -e          schedule collector threads with SCHED_IDLE" << std::endl
+        << "  -C          read archived files cache-neutrally, dropping the pages the collection brought in" << std::endl
+        << "  -x SIZE     read archived files of at least SIZE bytes, e.g. 64M, with O_DIRECT" << std::endl
+        << "  -a READERS  number of threads reading archived files ahead of the writer (default: 0)" << std::endl
+        << "  -M MEMORY   memory of the files read ahead per archive, e.g. 256M (default: 64M)" << std::endl;
+}
+
+
+/**
+ * @brief Read the input directories listed in a file
+ *
+ * Empty lines and lines starting with # are ignored.
+ *
+ * @param file File listing one input directory per line
+ * @param roots Input path, output path and selection of every directory,
+ * without selection if the line does not specify one
+ * @return true on success, false otherwise
+ */
+bool read_roots
+(
+    std::filesystem::path const& file,
+    std::vector<std::tuple<std::filesystem::path, std::filesystem::path, std::optional<FileSelection>>>& roots
+)
+{
+    std::ifstream input {file};
+    if (!input)
+    {
+        std::cerr << "Cannot read " << file << std::endl;
+        return false;
+    }
+
+    for (std::string line {}; std::getline(input, line);)
+    {
+        std::istringstream fields {line};
+        std::string input_path {};
+        std::string output_path {};
+        std::string selection {};
+
+        if (!(fields >> input_path) || input_path.front() == '#')
+        {
+            continue;
+        }
+
+        fields >> output_path >> selection;
+        if (output_path.empty() || (!selection.empty() && selection != "-f" && selection != "-d"))
+        {
+            std::cerr << "Malformed line in " << file << ": " << line << std::endl;
+            return false;
+        }
+
+        std::optional<FileSelection> root_selection {};
+        if (!selection.empty())
+        {
+            root_selection = selection == "-f" ? FileSelection::FILES : FileSelection::FILES_AND_DIRECTORIES;
+        }
+        roots.emplace_back(input_path, output_path, root_selection);
+    }
+
+    return true;
 }
 
 
 int main(int argc, char** argv)
 {
-    if (argc != 4)
+    std::optional<FileSelection> selection {};
+    unsigned int workers {0};
+    unsigned int traversal_threads {0};
+    long window {0};
+    bool drain {false};
+    bool deduplication {false};
+    bool recursive {false};
+    bool filesystem_marks {true};
+    long idle_timeout {0};
+    std::filesystem::path metrics_file {};
+    std::filesystem::path metrics_socket {};
+    std::filesystem::path snapshot_directory {};
+    std::size_t queue_capacity {0};
+    OverflowPolicy overflow_policy {OverflowPolicy::BLOCK};
+    std::uint64_t bytes_per_second {0};
+    std::uint64_t operations_per_second {0};
+    WorkerPriority priority {};
+    CacheOptions cache {};
+    PrefetchOptions prefetch {};
+    CompressionOptions compression {};
+    std::vector<std::tuple<std::filesystem::path, std::filesystem::path, std::optional<FileSelection>>> roots {};
+
+    int option {};
+    while ((option = getopt(argc, argv, "fdR:j:W:w:DPc:l:t:srIS:m:u:T:Q:O:B:i:p:n:eCx:a:M:")) != -1)
+    {
+        switch (option)
+        {
+            case 'f':
+                selection = FileSelection::FILES;
+                break;
+            case 'd':
+                selection = FileSelection::FILES_AND_DIRECTORIES;
+                break;
+            case 'R':
+                if (!read_roots(std::filesystem::path {optarg}, roots))
+                {
+                    return -1;
+                }
+                break;
+            case 'j':
+                workers = static_cast<unsigned int>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'W':
+                traversal_threads = static_cast<unsigned int>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'w':
+                window = std::strtol(optarg, nullptr, 10);
+                break;
+            case 'D':
+                drain = true;
+                break;
+            case 'P':
+                IoRing::set_enabled(false);
+                break;
+            case 'c':
+            {
+                std::optional<Compression> const algorithm {BlockCompressor::parse(optarg)};
+                if (!algorithm || !BlockCompressor::supported(*algorithm))
+                {
+                    std::cerr << "Compression algorithm '" << optarg << "' is not available" << std::endl;
+                    return -1;
+                }
+                compression.algorithm = *algorithm;
+                break;
+            }
+            case 'l':
+                compression.level = static_cast<int>(std::strtol(optarg, nullptr, 10));
+                break;
+            case 't':
+                compression.threads = static_cast<unsigned int>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 's':
+                deduplication = true;
+                break;
+            case 'r':
+                recursive = true;
+                break;
+            case 'I':
+                filesystem_marks = false;
+                break;
+            case 'S':
+                idle_timeout = std::strtol(optarg, nullptr, 10);
+                break;
+            case 'm':
+                metrics_file = optarg;
+                break;
+            case 'u':
+                metrics_socket = optarg;
+                break;
+            case 'T':
+                snapshot_directory = optarg;
+                break;
+            case 'Q':
+                queue_capacity = static_cast<std::size_t>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'O':
+            {
+                std::optional<OverflowPolicy> const policy {TriggerQueue::parse(optarg)};
+                if (!policy)
+                {
+                    std::cerr << "Overflow policy '" << optarg << "' is unknown" << std::endl;
+                    return -1;
+                }
+                overflow_policy = *policy;
+                break;
+            }
+            case 'B':
+            {
+                std::optional<std::uint64_t> const rate {Throttle::parse(optarg)};
+                if (!rate)
+                {
+                    std::cerr << "Rate '" << optarg << "' is malformed" << std::endl;
+                    return -1;
+                }
+                bytes_per_second = *rate;
+                break;
+            }
+            case 'i':
+                operations_per_second = std::strtoull(optarg, nullptr, 10);
+                break;
+            case 'p':
+                if (!priority.parse_io_class(optarg))
+                {
+                    std::cerr << "I/O priority '" << optarg << "' is unknown" << std::endl;
+                    return -1;
+                }
+                break;
+            case 'n':
+                priority.nice = static_cast<int>(std::strtol(optarg, nullptr, 10));
+                break;
+            case 'e':
+                priority.idle_scheduling = true;
+                break;
+            case 'C':
+                cache.neutral = true;
+                break;
+            case 'x':
+            {
+                std::optional<std::uint64_t> const size {Throttle::parse(optarg)};
+                if (!size)
+                {
+                    std::cerr << "Size '" << optarg << "' is malformed" << std::endl;
+                    return -1;
+                }
+                cache.direct_threshold = *size;
+                break;
+            }
+            case 'a':
+                prefetch.readers = static_cast<unsigned int>(std::strtoul(optarg, nullptr, 10));
+                break;
+            case 'M':
+            {
+                std::optional<std::uint64_t> const memory {Throttle::parse(optarg)};
+                if (!memory || *memory == 0)
+                {
+                    std::cerr << "Memory '" << optarg << "' is malformed" << std::endl;
+                    return -1;
+                }
+                prefetch.memory = *memory;
+                break;
+            }
+            default:
+                print_usage(std::string{argv[0]});
+                return -1;
+        }
+    }
+
+    if ((argc - optind) % 2 != 0 || (argc == optind && roots.empty()))
     {
         print_usage(std::string{argv[0]});
         return -1;
     }
 
-    FileSelection selection;
+    for (int i {optind}; i < argc; i += 2)
+    {
+        roots.emplace_back(argv[i], argv[i + 1], std::nullopt);
+    }
+
+    Collector c {};
 
-    if (std::strcmp(argv[3], "-f") == 0)
+    // every input directory needs a selection, given per line or as default
+    for (auto const& [input_path, output_path, root_selection] : roots)
     {
-        selection = FileSelection::FILES;
+        if (!root_selection && !selection)
+        {
+            print_usage(std::string{argv[0]});
+            return -1;
+        }
+        c.add_root(input_path, output_path, root_selection.value_or(selection.value_or(FileSelection::FILES)));
     }
-    else if (std::strcmp(argv[3], "-d") == 0)
+
+    if (workers > 0)
     {
-        selection = FileSelection::FILES_AND_DIRECTORIES;
+        c.set_workers(workers);
     }
-    else
+    if (traversal_threads > 0)
     {
-        print_usage(std::string{argv[0]});
-        return -1;
+        c.set_traversal_threads(traversal_threads);
     }
-
-    Collector c
+    c.set_coalescing_window(std::chrono::milliseconds {window});
+    c.set_drain(drain);
+    c.set_compression(compression);
+    c.set_deduplication(deduplication);
+    c.set_recursive(recursive);
+    c.set_filesystem_marks(filesystem_marks);
+    c.set_streaming(std::chrono::milliseconds {idle_timeout});
+    c.set_metrics_file(metrics_file);
+    c.set_metrics_socket(metrics_socket);
+    c.set_snapshot_directory(snapshot_directory);
+    if (queue_capacity > 0)
     {
-        std::filesystem::path {argv[1]},
-        std::filesystem::path {argv[2]},
-        selection
-    };
+        c.set_queue_capacity(queue_capacity, overflow_policy);
+    }
+    c.set_throttle(bytes_per_second, operations_per_second);
+    c.set_worker_priority(priority);
+    c.set_cache_options(cache);
+    c.set_prefetch(prefetch);
 
     c.monitor_and_collect();
 
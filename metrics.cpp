@@ -0,0 +1,137 @@
+/**
+ * @file metrics.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of the metrics of a data collector
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+
+/*
+ * Metrics are written in the Prometheus text exposition format.
+ *
+ * See https://prometheus.io/docs/instrumenting/exposition_formats/.
+ */
+
+
+namespace
+{
+    void write_counter(std::ostream& output, std::string const& name, std::string const& help, std::uint64_t const value)
+    {
+        output << "# HELP " << name << ' ' << help << '\n'
+               << "# TYPE " << name << " counter\n"
+               << name << ' ' << value << '\n';
+    }
+}
+
+
+void Histogram::observe(std::chrono::nanoseconds const duration)
+{
+    std::uint64_t const nanoseconds {static_cast<std::uint64_t>(std::max<std::int64_t>(duration.count(), 0))};
+    // rounded up, such that a duration just above a bound is not counted in
+    // its bucket
+    std::uint64_t const microseconds {(nanoseconds + 999) / 1000};
+
+    // index of the smallest bound 4^i µs not below the duration
+    std::size_t index {0};
+    if (microseconds > 1)
+    {
+        std::size_t const bits {static_cast<std::size_t>(64 - __builtin_clzll(microseconds - 1))};
+        index = std::min((bits + 1) / 2, HISTOGRAM_BUCKETS);
+    }
+
+    buckets[index].fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(nanoseconds, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+std::uint64_t Histogram::count() const
+{
+    return total.load(std::memory_order_relaxed);
+}
+
+
+void Histogram::write(std::ostream& output, std::string const& name, std::string const& help) const
+{
+    output << "# HELP " << name << ' ' << help << '\n'
+           << "# TYPE " << name << " histogram\n";
+
+    // Prometheus buckets are cumulative
+    std::uint64_t cumulative {0};
+    double bound {1e-6};
+    for (std::size_t i {0}; i < HISTOGRAM_BUCKETS; ++i, bound *= 4)
+    {
+        cumulative += buckets[i].load(std::memory_order_relaxed);
+        output << name << "_bucket{le=\"" << bound << "\"} " << cumulative << '\n';
+    }
+    cumulative += buckets[HISTOGRAM_BUCKETS].load(std::memory_order_relaxed);
+    output << name << "_bucket{le=\"+Inf\"} " << cumulative << '\n'
+           << name << "_sum " << static_cast<double>(sum.load(std::memory_order_relaxed)) / 1e9 << '\n'
+           << name << "_count " << cumulative << '\n';
+}
+
+
+void Metrics::write(std::ostream& output, std::size_t const queue_depth) const
+{
+    write_counter(output, "collector_events_total", "File system events read.", events.load(std::memory_order_relaxed));
+    write_counter(output, "collector_overflows_total", "Overflows of the kernel event queue, losing events.", overflows.load(std::memory_order_relaxed));
+    write_counter(output, "collector_rescans_total", "Input trees scanned again after an overflow.", rescans.load(std::memory_order_relaxed));
+    write_counter(output, "collector_recovered_triggers_total", "Triggers of lost events, found by rescans.", recovered.load(std::memory_order_relaxed));
+    write_counter(output, "collector_triggers_total", "Triggers pushed onto the queue.", triggers.load(std::memory_order_relaxed));
+    write_counter(output, "collector_triggers_prioritized_total", "First triggers of a service, queued in the priority lane.", prioritized.load(std::memory_order_relaxed));
+    write_counter(output, "collector_triggers_dropped_total", "Triggers discarded without collecting them.", dropped.load(std::memory_order_relaxed));
+    write_counter(output, "collector_queue_dropped_oldest_total", "Queued triggers discarded by a full queue.", dropped_oldest.load(std::memory_order_relaxed));
+    write_counter(output, "collector_queue_dropped_newest_total", "New triggers rejected by a full queue.", dropped_newest.load(std::memory_order_relaxed));
+    write_counter(output, "collector_queue_coalesced_total", "New triggers merged into a queued trigger by a full queue.", coalesced.load(std::memory_order_relaxed));
+    write_counter(output, "collector_queue_blocked_total", "Pushes that waited for room in a full queue.", blocked.load(std::memory_order_relaxed));
+    write_counter(output, "collector_collections_total", "Completed collections.", collections.load(std::memory_order_relaxed));
+    write_counter(output, "collector_collections_failed_total", "Collections without an archive or manifest.", failed.load(std::memory_order_relaxed));
+    write_counter(output, "collector_files_total", "Files stored in archives or chunk stores.", files.load(std::memory_order_relaxed));
+    write_counter(output, "collector_output_bytes_total", "Bytes of the written archives and manifests.", bytes.load(std::memory_order_relaxed));
+
+    output << "# HELP collector_queue_depth Triggers waiting for a collector thread.\n"
+           << "# TYPE collector_queue_depth gauge\n"
+           << "collector_queue_depth " << queue_depth << '\n';
+
+    detection.write(output, "collector_detection_seconds", "Time from the first event of a trigger to enqueueing it.");
+    queue_wait.write(output, "collector_queue_wait_seconds", "Time a trigger waited in the queue.");
+    enumerate.write(output, "collector_enumerate_seconds", "Time to list the files to collect.");
+    snapshot.write(output, "collector_snapshot_seconds", "Time to take the snapshot of the collected files.");
+    disk_usage.write(output, "collector_disk_usage_seconds", "Time to measure the disk usage of the collected files.");
+    archive.write(output, "collector_archive_seconds", "Time to write the archive or manifest.");
+}
+
+
+bool Metrics::write(std::filesystem::path const& file, std::size_t const queue_depth) const
+{
+    // the node exporter must never read a partially written file
+    std::filesystem::path const partial {file.native() + ".part"};
+
+    std::ofstream output {partial};
+    write(output, queue_depth);
+    output.close();
+
+    std::error_code error {};
+    if (output)
+    {
+        std::filesystem::rename(partial, file, error);
+    }
+    if (!output || error)
+    {
+        std::cerr << "Error while writing metrics to " << file << std::endl;
+        std::filesystem::remove(partial, error);
+        return false;
+    }
+    return true;
+}
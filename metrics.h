@@ -0,0 +1,240 @@
+/**
+ * @file metrics.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of the metrics of a data collector
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include "fifo.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <string>
+
+
+/**
+ * @brief Number of finite histogram buckets, the upper bounds grow by a
+ * factor of 4 from 1 µs to about 67 s
+ *
+ */
+constexpr std::size_t HISTOGRAM_BUCKETS = 14;
+
+
+/**
+ * @brief Histogram of durations with fixed exponential buckets.
+ *
+ * Observing is lock-free and wait-free, it increments three counters with
+ * relaxed atomics, such that it may be used on hot paths of any thread.
+ * Readers may see the counters of an observation in progress only partially.
+ *
+ */
+class Histogram
+{
+public:
+    /**
+     * @brief Record a duration
+     *
+     * @param duration Duration to record, negative durations count as zero
+     */
+    void observe(std::chrono::nanoseconds const duration);
+
+    /**
+     * @brief Get the number of recorded durations
+     *
+     * @return number of durations
+     */
+    std::uint64_t count() const;
+
+    /**
+     * @brief Write the histogram in the Prometheus text format, in seconds
+     *
+     * @param output Stream to write to
+     * @param name Name of the metric
+     * @param help Description of the metric
+     */
+    void write(std::ostream& output, std::string const& name, std::string const& help) const;
+
+private:
+    // the last bucket counts durations above every bound
+    std::array<std::atomic<std::uint64_t>, HISTOGRAM_BUCKETS + 1> buckets {};
+    std::atomic<std::uint64_t> sum {0};
+    std::atomic<std::uint64_t> total {0};
+};
+
+
+/**
+ * @brief Counters and histograms of every stage of the data collection.
+ *
+ * The monitor thread and the collector threads update the counters of their
+ * stages with relaxed atomics, in separate cache lines.
+ * Counters only ever increase, rates like files per second are left to the
+ * consumer of the metrics, e.g. Prometheus.
+ *
+ */
+struct Metrics
+{
+    /**
+     * @brief File system events read by the monitor thread
+     *
+     */
+    alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> events {0};
+
+    /**
+     * @brief Overflows of the event queue of the kernel, every overflow lost
+     * an unknown number of events
+     *
+     */
+    std::atomic<std::uint64_t> overflows {0};
+
+    /**
+     * @brief Input trees scanned again after an overflow
+     *
+     */
+    std::atomic<std::uint64_t> rescans {0};
+
+    /**
+     * @brief Triggers of files whose events were lost, found by rescans
+     *
+     */
+    std::atomic<std::uint64_t> recovered {0};
+
+    /**
+     * @brief Triggers pushed onto the queue
+     *
+     */
+    std::atomic<std::uint64_t> triggers {0};
+
+    /**
+     * @brief Triggers of a service seen for the first time, pushed onto the
+     * priority lane of a bounded queue
+     *
+     */
+    std::atomic<std::uint64_t> prioritized {0};
+
+    /**
+     * @brief Queued triggers discarded by a full bounded queue to admit a new
+     * one, also counted as dropped
+     *
+     */
+    std::atomic<std::uint64_t> dropped_oldest {0};
+
+    /**
+     * @brief New triggers rejected by a full bounded queue, also counted as
+     * dropped
+     *
+     */
+    std::atomic<std::uint64_t> dropped_newest {0};
+
+    /**
+     * @brief New triggers merged into a queued trigger of the same service
+     * and directory by a full bounded queue
+     *
+     */
+    std::atomic<std::uint64_t> coalesced {0};
+
+    /**
+     * @brief Pushes that waited for room in a full bounded queue, blocking
+     * the monitor thread
+     *
+     */
+    std::atomic<std::uint64_t> blocked {0};
+
+    /**
+     * @brief Time from the first event of a trigger to pushing it onto the
+     * queue, including the coalescing window
+     *
+     */
+    Histogram detection {};
+
+    /**
+     * @brief Triggers discarded without collecting them, e.g. when stopping
+     *
+     */
+    alignas(CACHE_LINE_SIZE) std::atomic<std::uint64_t> dropped {0};
+
+    /**
+     * @brief Completed collections
+     *
+     */
+    std::atomic<std::uint64_t> collections {0};
+
+    /**
+     * @brief Collections that did not produce an archive or manifest
+     *
+     */
+    std::atomic<std::uint64_t> failed {0};
+
+    /**
+     * @brief Files stored in archives or chunk stores
+     *
+     */
+    std::atomic<std::uint64_t> files {0};
+
+    /**
+     * @brief Bytes of the written archives and manifests
+     *
+     */
+    std::atomic<std::uint64_t> bytes {0};
+
+    /**
+     * @brief Time a trigger waited in the queue for a collector thread
+     *
+     */
+    Histogram queue_wait {};
+
+    /**
+     * @brief Time to list the files to collect
+     *
+     */
+    Histogram enumerate {};
+
+    /**
+     * @brief Time to take the snapshot of the collected files, i.e. the time
+     * the input directory is read
+     *
+     */
+    Histogram snapshot {};
+
+    /**
+     * @brief Time to measure the disk usage of the collected files
+     *
+     */
+    Histogram disk_usage {};
+
+    /**
+     * @brief Time to write the archive or manifest
+     *
+     */
+    Histogram archive {};
+
+    /**
+     * @brief Write every metric in the Prometheus text format
+     *
+     * @param output Stream to write to
+     * @param queue_depth Current number of triggers in the queue
+     */
+    void write(std::ostream& output, std::size_t const queue_depth) const;
+
+    /**
+     * @brief Write every metric into a file for the textfile collector of the
+     * Prometheus node exporter, replacing the file atomically
+     *
+     * @param file File path, e.g. ending in `.prom`
+     * @param queue_depth Current number of triggers in the queue
+     * @return true on success, false otherwise
+     */
+    bool write(std::filesystem::path const& file, std::size_t const queue_depth) const;
+};
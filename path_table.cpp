@@ -0,0 +1,146 @@
+/**
+ * @file path_table.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a compact table of the paths of a collection
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "path_table.h"
+
+
+std::uint32_t PathTable::add_root(std::string_view const path, bool const listed)
+{
+    return add(NONE, path, listed);
+}
+
+
+std::uint32_t PathTable::add(std::uint32_t const parent, std::string_view const name, bool const listed)
+{
+    Entry entry {};
+    entry.parent = parent;
+    entry.offset = append(name);
+    entry.length = static_cast<std::uint32_t>(name.size());
+    entry.is_listed = listed ? 1 : 0;
+
+    entries.push_back(entry);
+    listed_entries += listed ? 1 : 0;
+    return static_cast<std::uint32_t>(entries.size() - 1);
+}
+
+
+void PathTable::move(std::uint32_t const entry, std::uint32_t const parent, std::string_view const name)
+{
+    // the previous name remains unused in the arena
+    entries[entry].parent = parent;
+    entries[entry].offset = append(name);
+    entries[entry].length = static_cast<std::uint32_t>(name.size());
+}
+
+
+void PathTable::hide(std::uint32_t const entry)
+{
+    if (entries[entry].is_listed)
+    {
+        entries[entry].is_listed = 0;
+        --listed_entries;
+    }
+}
+
+
+bool PathTable::listed(std::uint32_t const entry) const
+{
+    return entries[entry].is_listed != 0;
+}
+
+
+std::string_view PathTable::name(std::uint32_t const entry) const
+{
+    return std::string_view {names}.substr(entries[entry].offset, entries[entry].length);
+}
+
+
+void PathTable::path(std::uint32_t const entry, std::string& result) const
+{
+    // measure the path first, such that it is assembled back to front in
+    // place, without intermediate strings
+    std::size_t length {0};
+    for (std::uint32_t current {entry}; current != NONE; current = entries[current].parent)
+    {
+        length += entries[current].length + (separated(current) ? 1 : 0);
+    }
+
+    result.resize(length);
+    std::size_t end {length};
+    for (std::uint32_t current {entry}; current != NONE; current = entries[current].parent)
+    {
+        Entry const& item {entries[current]};
+        end -= item.length;
+        names.copy(result.data() + end, item.length, item.offset);
+        if (separated(current))
+        {
+            result[--end] = '/';
+        }
+    }
+}
+
+
+std::filesystem::path PathTable::path(std::uint32_t const entry) const
+{
+    std::string result {};
+    path(entry, result);
+    return std::filesystem::path {std::move(result)};
+}
+
+
+std::vector<std::filesystem::path> PathTable::paths() const
+{
+    std::vector<std::filesystem::path> result {};
+    result.reserve(listed_entries);
+    for (std::uint32_t entry {0}; entry < entries.size(); ++entry)
+    {
+        if (listed(entry))
+        {
+            result.push_back(path(entry));
+        }
+    }
+    return result;
+}
+
+
+std::size_t PathTable::size() const
+{
+    return entries.size();
+}
+
+
+std::size_t PathTable::count() const
+{
+    return listed_entries;
+}
+
+
+std::size_t PathTable::memory() const
+{
+    return entries.capacity() * sizeof(Entry) + names.capacity();
+}
+
+
+bool PathTable::separated(std::uint32_t const entry) const
+{
+    // roots like "/" end with a separator already
+    std::uint32_t const parent {entries[entry].parent};
+    return parent != NONE && entries[parent].length > 0 && names[entries[parent].offset + entries[parent].length - 1] != '/';
+}
+
+
+std::uint32_t PathTable::append(std::string_view const name)
+{
+    std::size_t const offset {names.size()};
+    names.append(name);
+    return static_cast<std::uint32_t>(offset);
+}
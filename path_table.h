@@ -0,0 +1,159 @@
+/**
+ * @file path_table.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a compact table of the paths of a collection
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/**
+ * @brief Compact list of the paths of a collection, e.g. of a tree with
+ * millions of entries.
+ *
+ * Every entry stores the index of its parent and its name only, names are
+ * kept back to back in a single arena, hence an entry takes 12 bytes plus its
+ * name instead of a heap allocated complete path.
+ * Roots hold complete paths, e.g. the directory a tree was listed from.
+ * Entries are listed in the order they were added, parents which are not
+ * part of the collection themselves are added unlisted.
+ * Paths are assembled on demand.
+ *
+ */
+class PathTable
+{
+public:
+    /**
+     * @brief Parent of roots
+     *
+     */
+    static constexpr std::uint32_t NONE {std::numeric_limits<std::uint32_t>::max()};
+
+    /**
+     * @brief Add an entry holding a complete path
+     *
+     * @param path Path of the entry
+     * @param listed Whether the entry is part of the collection
+     * @return Index of the entry
+     */
+    std::uint32_t add_root(std::string_view const path, bool const listed = true);
+
+    /**
+     * @brief Add an entry below another entry
+     *
+     * @param parent Index of the parent entry
+     * @param name Name of the entry within its parent
+     * @param listed Whether the entry is part of the collection
+     * @return Index of the entry
+     */
+    std::uint32_t add(std::uint32_t const parent, std::string_view const name, bool const listed = true);
+
+    /**
+     * @brief Move an entry below another parent, under another name
+     *
+     * @param entry Index of the entry, which must not be a parent
+     * @param parent Index of the new parent
+     * @param name New name of the entry
+     */
+    void move(std::uint32_t const entry, std::uint32_t const parent, std::string_view const name);
+
+    /**
+     * @brief Remove an entry from the collection, it remains a parent
+     *
+     * @param entry Index of the entry
+     */
+    void hide(std::uint32_t const entry);
+
+    /**
+     * @brief Checks whether an entry is part of the collection
+     *
+     * @param entry Index of the entry
+     * @return true if the entry is listed, false otherwise
+     */
+    bool listed(std::uint32_t const entry) const;
+
+    /**
+     * @brief Get the name of an entry, the complete path of roots
+     *
+     * @param entry Index of the entry
+     * @return Name, valid until the next entry is added or moved
+     */
+    std::string_view name(std::uint32_t const entry) const;
+
+    /**
+     * @brief Assemble the path of an entry
+     *
+     * @param entry Index of the entry
+     * @param result Receives the path, reusing its capacity
+     */
+    void path(std::uint32_t const entry, std::string& result) const;
+
+    /**
+     * @brief Assemble the path of an entry
+     *
+     * @param entry Index of the entry
+     * @return Path of the entry
+     */
+    std::filesystem::path path(std::uint32_t const entry) const;
+
+    /**
+     * @brief Assemble the paths of all listed entries
+     *
+     * @return Paths, in order
+     */
+    std::vector<std::filesystem::path> paths() const;
+
+    /**
+     * @brief Get the number of entries, listed or not, i.e. the bound of
+     * their indexes
+     *
+     * @return number of entries
+     */
+    std::size_t size() const;
+
+    /**
+     * @brief Get the number of listed entries
+     *
+     * @return number of entries
+     */
+    std::size_t count() const;
+
+    /**
+     * @brief Estimate the memory used by the table
+     *
+     * @return number of bytes
+     */
+    std::size_t memory() const;
+
+private:
+    struct Entry
+    {
+        std::uint32_t parent {NONE};
+        std::uint32_t offset {0};
+        std::uint32_t length : 31;
+        std::uint32_t is_listed : 1;
+    };
+
+    bool separated(std::uint32_t const entry) const;
+    std::uint32_t append(std::string_view const name);
+
+private:
+    std::vector<Entry> entries {};
+    std::string names {};
+    std::size_t listed_entries {0};
+};
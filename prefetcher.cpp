@@ -0,0 +1,244 @@
+/**
+ * @file prefetcher.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a pipelined read-ahead of archived files
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "prefetcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+
+Prefetcher::Prefetcher
+(
+    std::size_t const count,
+    std::function<std::filesystem::path(std::size_t)> source,
+    PrefetchOptions const& options,
+    Throttle* throttle
+) :
+    count {count},
+    source {std::move(source)},
+    memory {std::max<std::uint64_t>(options.memory, PREFETCH_MIN_BUFFER)},
+    file_limit {std::min(options.file_limit > 0 ? options.file_limit : options.memory / 4, memory)},
+    throttle {throttle},
+    slots(PREFETCH_WINDOW)
+{
+    for (unsigned int reader {0}; reader < std::max(options.readers, 1u); ++reader)
+    {
+        readers.emplace_back(&Prefetcher::read, this);
+    }
+}
+
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        stopping = true;
+    }
+    changed.notify_all();
+
+    for (auto& reader : readers)
+    {
+        reader.join();
+    }
+}
+
+
+Prefetcher::File const& Prefetcher::take()
+{
+    std::unique_lock<std::mutex> lock {mutex};
+    Slot& slot {slots[consumed % PREFETCH_WINDOW]};
+    if (!slot.ready)
+    {
+        ++stalled_files;
+        changed.wait(lock, [&slot] { return slot.ready; });
+    }
+    return slot.file;
+}
+
+
+void Prefetcher::release()
+{
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        Slot& slot {slots[consumed % PREFETCH_WINDOW]};
+        if (slot.buffer.data)
+        {
+            idle[slot.buffer.capacity].push_back(std::move(slot.buffer));
+        }
+        slot = Slot {};
+        ++consumed;
+    }
+    changed.notify_all();
+}
+
+
+std::uint64_t Prefetcher::prefetched() const
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return read_files;
+}
+
+
+std::uint64_t Prefetcher::stalls() const
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return stalled_files;
+}
+
+
+std::uint64_t Prefetcher::peak_memory() const
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return peak;
+}
+
+
+void Prefetcher::read()
+{
+    for (;;)
+    {
+        std::size_t index {0};
+        {
+            std::unique_lock<std::mutex> lock {mutex};
+            changed.wait(lock, [this] { return stopping || next == count || next < consumed + PREFETCH_WINDOW; });
+            if (stopping || next == count)
+            {
+                return;
+            }
+            index = next++;
+        }
+
+        read_file(index, slots[index % PREFETCH_WINDOW]);
+    }
+}
+
+
+void Prefetcher::read_file(std::size_t const index, Slot& slot)
+{
+    std::filesystem::path const path {source(index)};
+
+    File file {};
+    if (statx(AT_FDCWD, path.c_str(), AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS, &file.status) != 0)
+    {
+        file.result = -errno;
+    }
+
+    std::uint64_t const size {file.status.stx_size};
+    std::size_t capacity {0};
+    if (file.result == 0 && S_ISREG(file.status.stx_mode) && size > 0 && size <= file_limit)
+    {
+        capacity = PREFETCH_MIN_BUFFER;
+        while (capacity < size)
+        {
+            capacity <<= 1;
+        }
+    }
+
+    // buffers are taken in order, files without one only pass their turn on
+    Buffer buffer {};
+    {
+        std::unique_lock<std::mutex> lock {mutex};
+        changed.wait(lock, [&]
+        {
+            return stopping || (turn == index && (capacity == 0 || capacity > memory || acquire(capacity, buffer)));
+        });
+        if (stopping)
+        {
+            return;
+        }
+        ++turn;
+    }
+    changed.notify_all();
+
+    if (buffer.data)
+    {
+        int const file_descriptor {open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)};
+        if (throttle && file_descriptor >= 0)
+        {
+            throttle->acquire(size);
+        }
+
+        // read up to the queried size, the writer reports open and read
+        // errors when it reads the file itself
+        std::uint64_t length {0};
+        bool complete {file_descriptor >= 0};
+        while (complete && length < size)
+        {
+            ssize_t const n {::read(file_descriptor, buffer.data.get() + length, static_cast<std::size_t>(size - length))};
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n <= 0)
+            {
+                complete = n == 0;
+                break;
+            }
+            length += static_cast<std::uint64_t>(n);
+        }
+        if (file_descriptor >= 0)
+        {
+            close(file_descriptor);
+        }
+
+        if (complete)
+        {
+            file.contents = buffer.data.get();
+            file.length = length;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        slot.file = file;
+        slot.buffer = std::move(buffer);
+        slot.ready = true;
+        read_files += file.contents ? 1 : 0;
+    }
+    changed.notify_all();
+}
+
+
+bool Prefetcher::acquire(std::size_t const capacity, Buffer& buffer)
+{
+    auto& same {idle[capacity]};
+    if (!same.empty())
+    {
+        buffer = std::move(same.back());
+        same.pop_back();
+        return true;
+    }
+
+    // free idle buffers of other sizes until the new one fits
+    for (auto& [size, buffers] : idle)
+    {
+        while (!buffers.empty() && allocated + capacity > memory)
+        {
+            allocated -= size;
+            buffers.pop_back();
+        }
+    }
+    if (allocated + capacity > memory)
+    {
+        return false;
+    }
+
+    buffer.data.reset(new char[capacity]);
+    buffer.capacity = capacity;
+    allocated += capacity;
+    peak = std::max(peak, allocated);
+    return true;
+}
@@ -0,0 +1,229 @@
+/**
+ * @file prefetcher.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a pipelined read-ahead of archived files
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include "throttle.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+
+/**
+ * @brief Smallest buffer of the pool, smaller files are read into buffers of
+ * this size
+ *
+ */
+constexpr std::size_t PREFETCH_MIN_BUFFER = 4096;
+
+/**
+ * @brief Largest number of files read ahead of the writer, bounding the
+ * bookkeeping for many tiny files
+ *
+ */
+constexpr std::size_t PREFETCH_WINDOW = 1024;
+
+
+/**
+ * @brief Number of reader threads and memory of a pipelined archive stage
+ *
+ */
+struct PrefetchOptions
+{
+    /**
+     * @brief Number of threads reading files ahead of the writer, 0 to read
+     * every file when it is written
+     *
+     */
+    unsigned int readers {0};
+
+    /**
+     * @brief Largest amount of memory held by the buffers, idle or in use
+     *
+     */
+    std::uint64_t memory {64 << 20};
+
+    /**
+     * @brief Largest file read ahead, larger files are left to the writer,
+     * 0 for a quarter of `memory`
+     *
+     */
+    std::uint64_t file_limit {0};
+};
+
+
+/**
+ * @brief Pipelined read-ahead of a list of files by a pool of threads, for a
+ * single consumer taking them in order, e.g. an archive writer.
+ *
+ * Readers claim the files in order, query their status and read regular
+ * files up to the file limit entirely into a buffer of a pool, such that
+ * several reads are in flight at once while the consumer writes the previous
+ * files.
+ * The pool rounds buffers up to powers of two and keeps released buffers for
+ * reuse, all buffers together never exceed the memory limit, idle buffers of
+ * other sizes are freed to make room.
+ * Buffers are taken in the order of the files, hence the file the consumer
+ * waits for is never blocked by later files holding the memory.
+ *
+ */
+class Prefetcher
+{
+public:
+    /**
+     * @brief File as read ahead
+     *
+     */
+    struct File
+    {
+        /**
+         * @brief 0 if the status was queried, the negated error number
+         * otherwise
+         *
+         */
+        int result {0};
+
+        struct statx status {};
+
+        /**
+         * @brief Contents of the file, `nullptr` if it was not read ahead,
+         * e.g. because it is no regular file, too large or could not be read
+         *
+         */
+        char const* contents {nullptr};
+
+        /**
+         * @brief Number of bytes read, less than the size if the file shrank
+         *
+         */
+        std::uint64_t length {0};
+    };
+
+    /**
+     * @brief Construct a new Prefetcher object, starting its readers
+     *
+     * @param count Number of files
+     * @param source Path of the file by its index, called by the readers
+     * @param options Number of readers and memory limits
+     * @param throttle Rate limit of reading the files, none by default
+     */
+    Prefetcher
+    (
+        std::size_t const count,
+        std::function<std::filesystem::path(std::size_t)> source,
+        PrefetchOptions const& options,
+        Throttle* throttle = nullptr
+    );
+
+    /**
+     * @brief Destroy the Prefetcher object, stopping its readers
+     *
+     */
+    ~Prefetcher();
+
+    Prefetcher(Prefetcher const&) = delete;
+    Prefetcher& operator=(Prefetcher const&) = delete;
+
+    /**
+     * @brief Wait for the next file in order
+     *
+     * The file stays valid until `release` is called, which must happen
+     * before the next file is taken.
+     *
+     * @return next file
+     */
+    File const& take();
+
+    /**
+     * @brief Return the buffer of the file taken last to the pool
+     *
+     */
+    void release();
+
+    /**
+     * @brief Get the number of files read ahead so far
+     *
+     * @return number of files
+     */
+    std::uint64_t prefetched() const;
+
+    /**
+     * @brief Get the number of files the consumer had to wait for
+     *
+     * @return number of files
+     */
+    std::uint64_t stalls() const;
+
+    /**
+     * @brief Get the largest amount of memory held by the buffers
+     *
+     * @return number of bytes
+     */
+    std::uint64_t peak_memory() const;
+
+private:
+    struct Buffer
+    {
+        std::unique_ptr<char[]> data {};
+        std::size_t capacity {0};
+    };
+
+    struct Slot
+    {
+        File file {};
+        Buffer buffer {};
+        bool ready {false};
+    };
+
+    void read();
+    void read_file(std::size_t const index, Slot& slot);
+    bool acquire(std::size_t const capacity, Buffer& buffer);
+
+private:
+    std::size_t count {0};
+    std::function<std::filesystem::path(std::size_t)> source {};
+    std::uint64_t memory {0};
+    std::uint64_t file_limit {0};
+    Throttle* throttle {nullptr};
+
+    mutable std::mutex mutex {};
+    std::condition_variable changed {};
+    bool stopping {false};
+
+    // files are claimed at `next`, take their buffers at `turn` and are
+    // consumed at `consumed`, all in order
+    std::size_t next {0};
+    std::size_t turn {0};
+    std::size_t consumed {0};
+    std::vector<Slot> slots {};
+
+    // idle buffers by capacity, and the capacity of all buffers
+    std::map<std::size_t, std::vector<Buffer>> idle {};
+    std::uint64_t allocated {0};
+    std::uint64_t peak {0};
+
+    std::uint64_t read_files {0};
+    std::uint64_t stalled_files {0};
+
+    std::vector<std::thread> readers {};
+};
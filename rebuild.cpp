@@ -0,0 +1,42 @@
+/**
+ * @file rebuild.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Rebuild a tar archive from a manifest of the chunk store
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "chunk_store.h"
+
+#include <iostream>
+
+
+void print_usage(std::string const& name)
+{
+    std::cout << "Usage: " << name << " MANIFEST OUTPUT_FILE [ CHUNKS ]" << std::endl
+        << "  MANIFEST     manifest written by the collector with -s" << std::endl
+        << "  OUTPUT_FILE  tar archive to write" << std::endl
+        << "  CHUNKS       chunk directory (default: chunks next to MANIFEST)" << std::endl;
+}
+
+
+int main(int argc, char** argv)
+{
+    if (argc != 3 && argc != 4)
+    {
+        print_usage(std::string{argv[0]});
+        return -1;
+    }
+
+    std::filesystem::path const manifest {argv[1]};
+    std::filesystem::path const chunks
+    {
+        argc == 4 ? std::filesystem::path {argv[3]} : manifest.parent_path() / std::filesystem::path {"chunks"}
+    };
+
+    return ChunkStore::rebuild(manifest, chunks, std::filesystem::path {argv[2]}) ? 0 : 1;
+}
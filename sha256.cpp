@@ -0,0 +1,176 @@
+/**
+ * @file sha256.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of the SHA-256 hash function
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "sha256.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+/*
+ * The implementation follows FIPS 180-4, section 6.2.
+ *
+ * See https://nvlpubs.nist.gov/nistpubs/FIPS/NIST.FIPS.180-4.pdf.
+ */
+
+
+namespace
+{
+    constexpr std::uint32_t ROUND_CONSTANTS[64]
+    {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+    };
+
+
+    constexpr std::uint32_t rotate(std::uint32_t const value, int const bits)
+    {
+        return (value >> bits) | (value << (32 - bits));
+    }
+}
+
+
+void Sha256::update(void const* data, std::size_t size)
+{
+    auto const* bytes {static_cast<std::uint8_t const*>(data)};
+    length += size;
+
+    // complete a partially filled block first
+    if (buffered > 0)
+    {
+        std::size_t const chunk {std::min(size, buffer.size() - buffered)};
+        std::memcpy(buffer.data() + buffered, bytes, chunk);
+        buffered += chunk;
+        bytes += chunk;
+        size -= chunk;
+
+        if (buffered < buffer.size())
+        {
+            return;
+        }
+        compress(buffer.data());
+        buffered = 0;
+    }
+
+    // hash complete blocks in place
+    for (; size >= buffer.size(); bytes += buffer.size(), size -= buffer.size())
+    {
+        compress(bytes);
+    }
+
+    std::memcpy(buffer.data(), bytes, size);
+    buffered = size;
+}
+
+
+Sha256::Digest Sha256::finish()
+{
+    std::uint64_t const bits {length * 8};
+
+    // pad with a single one bit, zeros and the message length in bits
+    std::uint8_t padding[72] {0x80};
+    std::size_t const zeros {(buffered < 56 ? 56 : 120) - buffered};
+    for (int i {0}; i < 8; ++i)
+    {
+        padding[zeros + static_cast<std::size_t>(i)] = static_cast<std::uint8_t>(bits >> (56 - 8 * i));
+    }
+    update(padding, zeros + 8);
+
+    Digest digest {};
+    for (std::size_t i {0}; i < state.size(); ++i)
+    {
+        for (std::size_t j {0}; j < 4; ++j)
+        {
+            digest[4 * i + j] = static_cast<std::uint8_t>(state[i] >> (24 - 8 * j));
+        }
+    }
+    return digest;
+}
+
+
+std::string Sha256::hex(void const* data, std::size_t size)
+{
+    Sha256 hash {};
+    hash.update(data, size);
+    return hex(hash.finish());
+}
+
+
+std::string Sha256::hex(Digest const& digest)
+{
+    static char const digits[] {"0123456789abcdef"};
+
+    std::string result {};
+    result.reserve(2 * digest.size());
+    for (std::uint8_t const byte : digest)
+    {
+        result += digits[byte >> 4];
+        result += digits[byte & 15];
+    }
+    return result;
+}
+
+
+void Sha256::compress(std::uint8_t const* block)
+{
+    std::uint32_t schedule[64];
+    for (int i {0}; i < 16; ++i)
+    {
+        schedule[i] = static_cast<std::uint32_t>(block[4 * i]) << 24
+            | static_cast<std::uint32_t>(block[4 * i + 1]) << 16
+            | static_cast<std::uint32_t>(block[4 * i + 2]) << 8
+            | static_cast<std::uint32_t>(block[4 * i + 3]);
+    }
+    for (int i {16}; i < 64; ++i)
+    {
+        std::uint32_t const s0 {rotate(schedule[i - 15], 7) ^ rotate(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3)};
+        std::uint32_t const s1 {rotate(schedule[i - 2], 17) ^ rotate(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10)};
+        schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+    }
+
+    std::uint32_t a {state[0]}, b {state[1]}, c {state[2]}, d {state[3]};
+    std::uint32_t e {state[4]}, f {state[5]}, g {state[6]}, h {state[7]};
+
+    for (int i {0}; i < 64; ++i)
+    {
+        std::uint32_t const s1 {rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)};
+        std::uint32_t const choice {(e & f) ^ (~e & g)};
+        std::uint32_t const t1 {h + s1 + choice + ROUND_CONSTANTS[i] + schedule[i]};
+        std::uint32_t const s0 {rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)};
+        std::uint32_t const majority {(a & b) ^ (a & c) ^ (b & c)};
+        std::uint32_t const t2 {s0 + majority};
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
@@ -0,0 +1,76 @@
+/**
+ * @file sha256.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of the SHA-256 hash function
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+/**
+ * @brief Incremental SHA-256 as specified by FIPS 180-4, used to address
+ * chunks by their contents without depending on a crypto library
+ *
+ */
+class Sha256
+{
+public:
+    using Digest = std::array<std::uint8_t, 32>;
+
+    /**
+     * @brief Hash further data
+     *
+     * @param data Data to hash
+     * @param size Number of bytes
+     */
+    void update(void const* data, std::size_t size);
+
+    /**
+     * @brief Finish hashing, the object must not be updated afterwards
+     *
+     * @return Digest of all hashed data
+     */
+    Digest finish();
+
+    /**
+     * @brief Hash a block of data at once
+     *
+     * @param data Data to hash
+     * @param size Number of bytes
+     * @return Digest as lower-case hexadecimal string
+     */
+    static std::string hex(void const* data, std::size_t size);
+
+    /**
+     * @brief Format a digest as lower-case hexadecimal string
+     *
+     * @param digest Digest to format
+     * @return 64 hexadecimal characters
+     */
+    static std::string hex(Digest const& digest);
+
+private:
+    void compress(std::uint8_t const* block);
+
+private:
+    std::array<std::uint32_t, 8> state
+    {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    std::array<std::uint8_t, 64> buffer {};
+    std::size_t buffered {0};
+    std::uint64_t length {0};
+};
@@ -0,0 +1,196 @@
+/**
+ * @file snapshot.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of point-in-time snapshots of collected files
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "snapshot.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace
+{
+    /**
+     * @brief Copy the contents of a file in the kernel, with a buffered copy
+     * as fallback
+     *
+     */
+    bool copy_contents(int const input, int const output, std::uint64_t remaining)
+    {
+        bool in_kernel {true};
+        std::vector<char> buffer {};
+
+        while (remaining > 0)
+        {
+            ssize_t n {-1};
+            if (in_kernel)
+            {
+                n = copy_file_range(input, nullptr, output, nullptr, remaining, 0);
+                if (n < 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+                {
+                    in_kernel = false;
+                    continue;
+                }
+            }
+            else
+            {
+                buffer.resize(1 << 20);
+                n = read(input, buffer.data(), std::min<std::uint64_t>(remaining, buffer.size()));
+                if (n > 0 && write(output, buffer.data(), static_cast<std::size_t>(n)) != n)
+                {
+                    return false;
+                }
+            }
+
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (n < 0)
+            {
+                return false;
+            }
+            // the file shrank, the snapshot keeps what is left
+            if (n == 0)
+            {
+                break;
+            }
+            remaining -= static_cast<std::uint64_t>(n);
+        }
+        return true;
+    }
+}
+
+
+Snapshot::Snapshot(std::filesystem::path const& directory) :
+    directory {directory}
+{
+}
+
+
+std::filesystem::path Snapshot::add(std::filesystem::path const& source)
+{
+    std::error_code error {};
+    if (!std::filesystem::is_regular_file(std::filesystem::symlink_status(source, error)))
+    {
+        return source;
+    }
+
+    if (!created)
+    {
+        std::filesystem::create_directories(directory, error);
+        if (error)
+        {
+            std::cerr << "Error, cannot create snapshot directory " << directory << ": " << error.message() << std::endl;
+            return source;
+        }
+        created = true;
+    }
+
+    // flat names by order, such that no directories are recreated
+    std::filesystem::path const target {directory / std::filesystem::path {std::to_string(next++)}};
+    std::optional<SnapshotMethod> const method {capture(source, target)};
+    if (!method)
+    {
+        std::cerr << "Cannot snapshot " << source << ", archiving it in place" << std::endl;
+        return source;
+    }
+
+    ++counts[static_cast<std::size_t>(*method)];
+    return target;
+}
+
+
+std::size_t Snapshot::count(SnapshotMethod const method) const
+{
+    return counts[static_cast<std::size_t>(method)];
+}
+
+
+std::optional<SnapshotMethod> Snapshot::capture(std::filesystem::path const& source, std::filesystem::path const& target)
+{
+    int const input {open(source.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)};
+    if (input < 0)
+    {
+        return std::nullopt;
+    }
+
+    struct stat status {};
+    if (fstat(input, &status) != 0 || !S_ISREG(status.st_mode))
+    {
+        close(input);
+        return std::nullopt;
+    }
+
+    std::optional<SnapshotMethod> method {};
+    int output {open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR)};
+
+    if (output >= 0 && ioctl(output, FICLONE, input) == 0)
+    {
+        method = SnapshotMethod::REFLINK;
+    }
+    else if (output >= 0 && static_cast<std::uint64_t>(status.st_size) > SNAPSHOT_COPY_LIMIT)
+    {
+        // the link replaces the empty target, across file systems large
+        // files are copied as well
+        close(output);
+        output = -1;
+        unlink(target.c_str());
+
+        if (link(source.c_str(), target.c_str()) == 0)
+        {
+            method = SnapshotMethod::HARDLINK;
+        }
+        else
+        {
+            output = open(target.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        }
+    }
+
+    if (!method && output >= 0 && copy_contents(input, output, static_cast<std::uint64_t>(status.st_size)))
+    {
+        method = SnapshotMethod::COPY;
+    }
+
+    // clones and copies are new inodes, archived with the metadata of the
+    // captured file, only root can keep its owner
+    if (output >= 0)
+    {
+        if (method)
+        {
+            timespec const times[2] {status.st_atim, status.st_mtim};
+            bool const owned {geteuid() != 0 || fchown(output, status.st_uid, status.st_gid) == 0};
+            if (!owned || fchmod(output, status.st_mode & 07777) != 0)
+            {
+                std::cerr << "Cannot keep the owner and mode of " << source << " in its snapshot: " << std::strerror(errno) << std::endl;
+            }
+            futimens(output, times);
+        }
+        close(output);
+    }
+    close(input);
+
+    if (!method)
+    {
+        unlink(target.c_str());
+    }
+    return method;
+}
@@ -0,0 +1,115 @@
+/**
+ * @file snapshot.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of point-in-time snapshots of collected files
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+
+/**
+ * @brief Files up to this size are copied rather than hard linked, if they
+ * cannot be cloned
+ *
+ */
+constexpr std::uint64_t SNAPSHOT_COPY_LIMIT = 1 << 22;
+
+
+/**
+ * @brief How a file was captured by a snapshot
+ *
+ */
+enum class SnapshotMethod
+{
+    /**
+     * @brief Clone sharing the extents of the file (`FICLONE`), e.g. on
+     * btrfs or XFS, later writes to the file are not visible
+     *
+     */
+    REFLINK,
+
+    /**
+     * @brief Hard link to the inode of a large file, which survives deletion,
+     * renaming and rotation, but not writes in place
+     *
+     */
+    HARDLINK,
+
+    /**
+     * @brief Copy of the contents
+     *
+     */
+    COPY
+};
+
+
+/**
+ * @brief Point-in-time snapshot of the files of a collection in a private
+ * directory, such that archiving reads the snapshot instead of the input
+ * directory, which services keep writing to.
+ *
+ * Regular files are cloned where the file system supports it, otherwise
+ * small files are copied and large files hard linked, copying across file
+ * systems.
+ * Clones and copies keep the mode, owner and times of their files.
+ * Anything else, e.g. directories, has no contents to capture and is read
+ * from the input directory.
+ * Snapshots are named by their order, the directory is removed by the owner.
+ *
+ */
+class Snapshot
+{
+public:
+    /**
+     * @brief Construct a new Snapshot object
+     *
+     * @param directory Directory to capture files in, created if necessary,
+     * ideally on the file system of the files
+     */
+    explicit Snapshot(std::filesystem::path const& directory);
+
+    /**
+     * @brief Capture a file
+     *
+     * @param source File to capture
+     * @return Path of the snapshot, or `source` itself if it is no regular
+     * file or cannot be captured
+     */
+    std::filesystem::path add(std::filesystem::path const& source);
+
+    /**
+     * @brief Get the number of files captured with a method
+     *
+     * @param method Method of capturing
+     * @return number of files
+     */
+    std::size_t count(SnapshotMethod const method) const;
+
+    /**
+     * @brief Capture a single regular file
+     *
+     * @param source File to capture
+     * @param target Path of the snapshot, which must not exist
+     * @return Method used, or nothing if the file was not captured
+     */
+    static std::optional<SnapshotMethod> capture(std::filesystem::path const& source, std::filesystem::path const& target);
+
+private:
+    std::filesystem::path directory {};
+    bool created {false};
+    std::size_t next {0};
+    std::array<std::size_t, 3> counts {};
+};
@@ -0,0 +1,1246 @@
+/**
+ * @file tar_writer.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a streaming tar archive writer
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "tar_writer.h"
+#include "io_ring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+#include <fcntl.h>
+#include <grp.h>
+#include <pwd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+
+/*
+ * The archive layout follows the POSIX ustar and pax interchange formats.
+ *
+ * See https://pubs.opengroup.org/onlinepubs/9699919799/utilities/pax.html
+ * and https://www.gnu.org/software/tar/manual/html_node/Standard.html.
+ *
+ * For in-kernel copies, the copy_file_range man page was referenced.
+ *
+ * See https://man7.org/linux/man-pages/man2/copy_file_range.2.html.
+ */
+
+
+namespace
+{
+    // GNU tar pads archives to a multiple of its default record size
+    constexpr std::size_t TAR_RECORD_SIZE = 20 * TAR_BLOCK_SIZE;
+
+    // largest values representable in the numeric ustar fields
+    constexpr std::uint64_t MAX_OCTAL_7 = 07777777;
+    constexpr std::uint64_t MAX_OCTAL_11 = 077777777777;
+
+    // decimal digits of the largest file size
+    constexpr std::size_t MAX_SIZE_DIGITS = 20;
+
+    // bytes of a growing file copied at once, below the limit of a single
+    // copy_file_range call
+    constexpr std::uint64_t GROWING_COPY_SIZE = 1 << 30;
+
+
+    /**
+     * @brief Write a zero-terminated octal number into a header field
+     *
+     */
+    void write_octal(char* field, std::size_t length, std::uint64_t value)
+    {
+        field[length - 1] = '\0';
+        for (std::size_t i {length - 1}; i-- > 0;)
+        {
+            field[i] = static_cast<char>('0' + (value & 7));
+            value >>= 3;
+        }
+    }
+
+
+    /**
+     * @brief Copy a string into a header field, truncating if necessary
+     *
+     */
+    void write_string(char* field, std::size_t length, std::string const& value)
+    {
+        std::memcpy(field, value.data(), std::min(length, value.size()));
+    }
+
+
+    /**
+     * @brief Create a single pax record of the form "<length> <key>=<value>\n"
+     *
+     */
+    std::string pax_record(std::string const& key, std::string const& value)
+    {
+        // the length prefix counts its own digits, hence iterate to a fixpoint
+        std::size_t const payload {key.size() + value.size() + 3};
+        std::size_t length {payload + 1};
+        while (std::to_string(length).size() + payload != length)
+        {
+            length = std::to_string(length).size() + payload;
+        }
+        return std::to_string(length) + " " + key + "=" + value + "\n";
+    }
+
+
+    /**
+     * @brief Derive the member name from a path like GNU tar does, i.e. strip
+     * leading slashes
+     *
+     */
+    std::string member_name(std::filesystem::path const& name)
+    {
+        std::string result {name.generic_string()};
+        result.erase(0, result.find_first_not_of('/'));
+        return result;
+    }
+
+
+    /**
+     * @brief Split a member name into ustar prefix and name fields
+     *
+     * @return true if the name fits into the ustar fields, false otherwise
+     */
+    bool split_name(std::string const& name, std::string& prefix, std::string& suffix)
+    {
+        if (name.size() <= 100)
+        {
+            prefix.clear();
+            suffix = name;
+            return true;
+        }
+
+        // the separating slash is part of neither field
+        for (std::size_t position {name.find('/')}; position != std::string::npos; position = name.find('/', position + 1))
+        {
+            if (position <= 155 && name.size() - position - 1 <= 100 && position + 1 < name.size())
+            {
+                prefix = name.substr(0, position);
+                suffix = name.substr(position + 1);
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+
+/**
+ * @brief Window over the part of a file being read in cache-neutral mode.
+ *
+ * Which pages of the file are cached is checked with `mincore` before it is
+ * read, since readahead runs ahead of the reads by up to their size, once the
+ * read position leaves a window, only the pages of the window that were not
+ * cached are dropped, i.e. the pages brought in by the read.
+ * Reads must not cross the end of the window, see `limit`.
+ *
+ */
+class TarWriter::CacheWindow
+{
+public:
+    CacheWindow(int const file_descriptor, bool const enabled) :
+        descriptor {file_descriptor},
+        enabled {enabled}
+    {
+        if (!enabled)
+        {
+            return;
+        }
+
+        off_t const offset {lseek(descriptor, 0, SEEK_CUR)};
+        position = offset > 0 ? static_cast<std::uint64_t>(offset) : 0;
+        begin = position - position % page_size;
+        dropped = begin;
+        end = begin + CACHE_WINDOW_SIZE;
+
+        struct stat status {};
+        std::uint64_t const size {fstat(descriptor, &status) == 0 ? static_cast<std::uint64_t>(status.st_size) : 0};
+        for (std::uint64_t window {begin}; window < size; window += CACHE_WINDOW_SIZE)
+        {
+            record(window);
+        }
+
+        posix_fadvise(descriptor, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    ~CacheWindow()
+    {
+        if (enabled)
+        {
+            drop();
+        }
+    }
+
+    CacheWindow(CacheWindow const&) = delete;
+    CacheWindow& operator=(CacheWindow const&) = delete;
+
+    /**
+     * @brief Limit the length of the next read to the end of the window
+     *
+     */
+    std::uint64_t limit(std::uint64_t const length) const
+    {
+        return enabled ? std::min(length, end - position) : length;
+    }
+
+    /**
+     * @brief Advance the read position, moving the window once it is read
+     *
+     */
+    void advance(std::uint64_t const length)
+    {
+        if (!enabled)
+        {
+            return;
+        }
+
+        position += length;
+        if (position >= end)
+        {
+            drop();
+            end += CACHE_WINDOW_SIZE;
+        }
+    }
+
+private:
+    // append the resident pages of the window at offset, none if unknown
+    // such that they are dropped
+    void record(std::uint64_t const offset)
+    {
+        std::vector<unsigned char> pages(CACHE_WINDOW_SIZE / page_size);
+        void* const mapping {mmap(nullptr, CACHE_WINDOW_SIZE, PROT_READ, MAP_SHARED, descriptor, static_cast<off_t>(offset))};
+        if (mapping != MAP_FAILED)
+        {
+            if (mincore(mapping, CACHE_WINDOW_SIZE, pages.data()) != 0)
+            {
+                std::fill(pages.begin(), pages.end(), 0);
+            }
+            munmap(mapping, CACHE_WINDOW_SIZE);
+        }
+
+        for (unsigned char const page : pages)
+        {
+            resident.push_back(page & 1);
+        }
+    }
+
+    // drop the pages read since the last drop, the last page is read
+    // completely unless the file continues
+    void drop()
+    {
+        std::uint64_t const first {(dropped - begin) / page_size};
+        std::uint64_t const last {(std::min(position, end) - begin + page_size - 1) / page_size};
+        std::uint64_t run {first};
+        for (std::uint64_t page {first}; page <= last; ++page)
+        {
+            bool const keep {page == last || (page < resident.size() && resident[page])};
+            if (keep && page > run)
+            {
+                posix_fadvise(descriptor, static_cast<off_t>(begin + run * page_size), static_cast<off_t>((page - run) * page_size), POSIX_FADV_DONTNEED);
+            }
+            if (keep)
+            {
+                run = page + 1;
+            }
+        }
+        dropped = begin + last * page_size;
+    }
+
+private:
+    int descriptor {-1};
+    bool enabled {false};
+    std::uint64_t const page_size {static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE))};
+
+    std::uint64_t position {0};
+    std::uint64_t begin {0};
+    std::uint64_t dropped {0};
+    std::uint64_t end {0};
+
+    // one flag per page from `begin`, a bit each
+    std::vector<bool> resident {};
+};
+
+
+TarWriter::TarWriter(std::filesystem::path const& output_file, CompressionOptions const& compression) :
+    output_file {output_file},
+    buffer(TAR_BUFFER_SIZE)
+{
+    output_descriptor = open(output_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (output_descriptor < 0)
+    {
+        std::cerr << "Error, cannot create archive " << output_file << ": "
+                  << std::strerror(errno) << std::endl;
+        failed = true;
+        return;
+    }
+
+    if (compression.algorithm != Compression::NONE)
+    {
+        compressor = std::make_unique<BlockCompressor>(output_descriptor, compression);
+    }
+}
+
+
+TarWriter::~TarWriter()
+{
+    if (output_descriptor >= 0)
+    {
+        finish();
+    }
+}
+
+
+bool TarWriter::is_open() const
+{
+    return output_descriptor >= 0 && !failed;
+}
+
+
+bool TarWriter::add(std::filesystem::path const& source)
+{
+    return add(source, source);
+}
+
+
+bool TarWriter::add(std::filesystem::path const& source, std::filesystem::path const& name)
+{
+    if (!is_open())
+    {
+        return false;
+    }
+
+    struct statx status {};
+    if (statx(AT_FDCWD, source.c_str(), AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS, &status) != 0)
+    {
+        std::cerr << "Cannot stat " << source << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    return add(source, name, status, nullptr, 0);
+}
+
+
+std::size_t TarWriter::add(std::vector<std::filesystem::path> const& sources)
+{
+    return add(sources, sources);
+}
+
+
+std::size_t TarWriter::add(std::vector<std::filesystem::path> const& sources, std::vector<std::filesystem::path> const& names)
+{
+    if (prefetch.readers > 0)
+    {
+        return add_prefetched
+        (
+            sources.size(),
+            [&sources](std::size_t const i) { return sources[i]; },
+            [&names](std::size_t const i) { return names[i]; }
+        );
+    }
+
+    std::size_t added {0};
+
+    IoRing* ring {IoRing::local()};
+    if (!ring)
+    {
+        for (std::size_t i {0}; i < sources.size(); ++i)
+        {
+            added += add(sources[i], names[i]) ? 1 : 0;
+        }
+        return added;
+    }
+
+    std::vector<char> contents {};
+
+    for (std::size_t first {0}; first < sources.size() && is_open(); first += TAR_BATCH_SIZE)
+    {
+        std::size_t const count {std::min(TAR_BATCH_SIZE, sources.size() - first)};
+
+        std::vector<char const*> paths {};
+        for (std::size_t i {0}; i < count; ++i)
+        {
+            paths.push_back(sources[first + i].c_str());
+        }
+
+        // query the whole batch with one system call
+        std::vector<struct statx> statuses {};
+        std::vector<std::int32_t> results {};
+        if (!ring->statx_all(AT_FDCWD, paths, AT_SYMLINK_NOFOLLOW, STATX_BASIC_STATS, statuses, results))
+        {
+            for (std::size_t i {0}; i < count; ++i)
+            {
+                added += add(sources[first + i], names[first + i]) ? 1 : 0;
+            }
+            continue;
+        }
+
+        // open the small regular files of the batch, read and close them
+        // with one system call each, large files are copied in-kernel anyway
+        std::vector<std::int32_t> descriptors(count, -1);
+        for (std::size_t i {0}; i < count; ++i)
+        {
+            if (results[i] == 0 && S_ISREG(statuses[i].stx_mode) && statuses[i].stx_size > 0 && statuses[i].stx_size < TAR_COPY_THRESHOLD)
+            {
+                ring->prepare_openat(AT_FDCWD, paths[i], O_RDONLY | O_NOFOLLOW | O_CLOEXEC, i);
+            }
+        }
+        ring->complete(descriptors);
+
+        std::vector<std::size_t> offsets(count + 1, 0);
+        for (std::size_t i {0}; i < count; ++i)
+        {
+            offsets[i + 1] = offsets[i] + (descriptors[i] >= 0 ? static_cast<std::size_t>(statuses[i].stx_size) : 0);
+        }
+        contents.resize(offsets[count]);
+
+        if (throttle)
+        {
+            std::uint64_t const opened {static_cast<std::uint64_t>(std::count_if(descriptors.begin(), descriptors.end(), [](std::int32_t const descriptor) { return descriptor >= 0; }))};
+            throttle->acquire(offsets[count], opened);
+        }
+
+        std::vector<std::int32_t> lengths(count, -1);
+        for (std::size_t i {0}; i < count; ++i)
+        {
+            if (descriptors[i] >= 0)
+            {
+                ring->prepare_read(descriptors[i], contents.data() + offsets[i], static_cast<unsigned int>(offsets[i + 1] - offsets[i]), 0, i);
+            }
+        }
+        ring->complete(lengths);
+
+        std::vector<std::int32_t> closed(count, 0);
+        for (std::size_t i {0}; i < count; ++i)
+        {
+            if (descriptors[i] >= 0 && !ring->prepare_close(descriptors[i], i))
+            {
+                close(descriptors[i]);
+            }
+        }
+        ring->complete(closed);
+
+        for (std::size_t i {0}; i < count; ++i)
+        {
+            std::filesystem::path const& source {sources[first + i]};
+            std::filesystem::path const& name {names[first + i]};
+
+            if (results[i] < 0)
+            {
+                std::cerr << "Cannot stat " << source << ": " << std::strerror(-results[i]) << std::endl;
+                continue;
+            }
+
+            // anything not read ahead, including failed reads, is added as usual
+            bool const read {descriptors[i] >= 0 && lengths[i] >= 0};
+            if (!read && S_ISREG(statuses[i].stx_mode) && statuses[i].stx_size > 0 && statuses[i].stx_size < TAR_COPY_THRESHOLD)
+            {
+                added += add(source, name) ? 1 : 0;
+                continue;
+            }
+
+            added += add(source, name, statuses[i], read ? contents.data() + offsets[i] : nullptr, read ? static_cast<std::uint64_t>(lengths[i]) : 0) ? 1 : 0;
+        }
+    }
+
+    return added;
+}
+
+
+std::size_t TarWriter::add(PathTable const& names, PathTable const* sources)
+{
+    // the readers assemble the paths themselves, the pipeline is not
+    // restarted for every batch
+    if (prefetch.readers > 0)
+    {
+        std::vector<std::uint32_t> entries {};
+        for (std::uint32_t entry {0}; entry < names.size(); ++entry)
+        {
+            if (names.listed(entry))
+            {
+                entries.push_back(entry);
+            }
+        }
+
+        return add_prefetched
+        (
+            entries.size(),
+            [&](std::size_t const i) { return (sources ? *sources : names).path(entries[i]); },
+            [&](std::size_t const i) { return names.path(entries[i]); }
+        );
+    }
+
+    std::size_t added {0};
+    std::vector<std::filesystem::path> batch_names {};
+    std::vector<std::filesystem::path> batch_sources {};
+
+    // only a batch of paths is assembled at once
+    for (std::uint32_t entry {0}; entry < names.size() && is_open(); ++entry)
+    {
+        if (names.listed(entry))
+        {
+            batch_names.push_back(names.path(entry));
+            batch_sources.push_back(sources ? sources->path(entry) : batch_names.back());
+        }
+
+        if (batch_names.size() == TAR_BATCH_SIZE || (entry + 1 == names.size() && !batch_names.empty()))
+        {
+            added += add(batch_sources, batch_names);
+            batch_names.clear();
+            batch_sources.clear();
+        }
+    }
+    return added;
+}
+
+
+std::size_t TarWriter::add_prefetched
+(
+    std::size_t const count,
+    std::function<std::filesystem::path(std::size_t)> const& source,
+    std::function<std::filesystem::path(std::size_t)> const& name
+)
+{
+    // files read cache-neutrally or directly are left to the writer
+    PrefetchOptions options {prefetch};
+    std::uint64_t limit {options.file_limit > 0 ? options.file_limit : options.memory / 4};
+    if (cache.neutral)
+    {
+        limit = std::min<std::uint64_t>(limit, TAR_COPY_THRESHOLD - 1);
+    }
+    if (cache.direct_threshold > 0)
+    {
+        limit = std::min(limit, cache.direct_threshold - 1);
+    }
+    options.file_limit = std::max<std::uint64_t>(limit, 1);
+
+    Prefetcher prefetcher {count, source, options, throttle};
+
+    std::size_t added {0};
+    for (std::size_t i {0}; i < count && is_open(); ++i)
+    {
+        Prefetcher::File const& file {prefetcher.take()};
+        if (file.result < 0)
+        {
+            std::cerr << "Cannot stat " << source(i) << ": " << std::strerror(-file.result) << std::endl;
+        }
+        else
+        {
+            // anything not read ahead is read by the writer as usual
+            added += add(source(i), name(i), file.status, file.contents, file.length) ? 1 : 0;
+        }
+        prefetcher.release();
+    }
+    return added;
+}
+
+
+bool TarWriter::add(Header const& header, std::vector<std::filesystem::path> const& parts)
+{
+    if (!is_open())
+    {
+        return false;
+    }
+
+    std::uint64_t const begin {written};
+    write_header(header);
+
+    std::uint64_t remaining {header.type == '0' ? header.size : 0};
+    for (auto const& part : parts)
+    {
+        int const file_descriptor {open(part.c_str(), O_RDONLY | O_CLOEXEC)};
+        if (file_descriptor < 0)
+        {
+            std::cerr << "Cannot open " << part << ": " << std::strerror(errno) << std::endl;
+            break;
+        }
+
+        struct stat status {};
+        std::uint64_t const size {fstat(file_descriptor, &status) == 0 ? static_cast<std::uint64_t>(status.st_size) : 0};
+        std::uint64_t const chunk {std::min(size, remaining)};
+        remaining -= chunk - copy_contents(file_descriptor, chunk);
+        close(file_descriptor);
+    }
+
+    bool const complete {remaining == 0};
+    if (!complete && !failed)
+    {
+        std::cerr << header.name << ": " << remaining << " bytes missing; padding with zeros" << std::endl;
+        write_zeros(remaining);
+    }
+    write_padding();
+
+    if (compressor && written > begin)
+    {
+        members.push_back(ArchiveMember {header.name, begin, written});
+    }
+    return complete && !failed;
+}
+
+
+bool TarWriter::add_growing(std::filesystem::path const& source, std::function<bool()> const& wait_for_data)
+{
+    if (!is_open())
+    {
+        return false;
+    }
+
+    // compressed blocks cannot be patched once they are written
+    if (compressor)
+    {
+        while (wait_for_data())
+        {
+        }
+        return add(source);
+    }
+
+    int const file_descriptor {open(source.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)};
+    if (file_descriptor < 0)
+    {
+        std::cerr << "Cannot open " << source << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat status {};
+    if (fstat(file_descriptor, &status) != 0 || !S_ISREG(status.st_mode))
+    {
+        close(file_descriptor);
+        return add(source);
+    }
+
+    Header header {};
+    header.name = member_name(source);
+    header.mode = status.st_mode & 07777;
+    header.uid = status.st_uid;
+    header.gid = status.st_gid;
+    header.size = static_cast<std::uint64_t>(status.st_size);
+    header.mtime = status.st_mtime;
+
+    // the header has to reach the archive before it can be patched
+    flush();
+    std::uint64_t const begin {written};
+    std::string const blocks {format_header(header, true)};
+    write(blocks.data(), blocks.size());
+
+    // copy whatever is there, then wait for the writer to append more
+    std::uint64_t copied {0};
+    for (bool more {true}; !failed;)
+    {
+        std::uint64_t const remaining {copy_contents(file_descriptor, GROWING_COPY_SIZE)};
+        copied += GROWING_COPY_SIZE - remaining;
+        if (remaining == 0)
+        {
+            continue;
+        }
+        if (!more)
+        {
+            break;
+        }
+        more = wait_for_data();
+    }
+
+    if (fstat(file_descriptor, &status) == 0)
+    {
+        header.mtime = status.st_mtime;
+    }
+    close(file_descriptor);
+
+    write_padding();
+    flush();
+
+    header.size = copied;
+    std::string const final_blocks {format_header(header, true)};
+    if (!failed && (final_blocks.size() != blocks.size()
+        || pwrite(output_descriptor, final_blocks.data(), final_blocks.size(), static_cast<off_t>(begin)) != static_cast<ssize_t>(final_blocks.size())))
+    {
+        std::cerr << "Error while updating the size of " << header.name << " in archive " << output_file << std::endl;
+        failed = true;
+    }
+    return !failed;
+}
+
+
+bool TarWriter::add
+(
+    std::filesystem::path const& source,
+    std::filesystem::path const& name,
+    struct statx const& status,
+    char const* contents,
+    std::uint64_t const length
+)
+{
+    std::uint64_t const begin {written};
+    bool const result {add_member(source, name, status, contents, length)};
+
+    // remember where the member is stored, including its pax header
+    if (compressor && written > begin)
+    {
+        members.push_back(ArchiveMember {member_name(name), begin, written});
+    }
+    return result;
+}
+
+
+bool TarWriter::add_member
+(
+    std::filesystem::path const& source,
+    std::filesystem::path const& name,
+    struct statx const& status,
+    char const* contents,
+    std::uint64_t const length
+)
+{
+    if (!is_open())
+    {
+        return false;
+    }
+
+    Header header {};
+    header.name = member_name(name);
+    header.mode = status.stx_mode & 07777;
+    header.uid = status.stx_uid;
+    header.gid = status.stx_gid;
+    header.mtime = status.stx_mtime.tv_sec;
+
+    switch (status.stx_mode & S_IFMT)
+    {
+        case S_IFREG:
+        {
+            // store further links to an already archived inode as hard links
+            dev_t const device {makedev(status.stx_dev_major, status.stx_dev_minor)};
+            if (status.stx_nlink > 1)
+            {
+                auto const [link, inserted] = hard_links.try_emplace({device, status.stx_ino}, header.name);
+                if (!inserted)
+                {
+                    header.type = '1';
+                    header.link_name = link->second;
+                    write_header(header);
+                    return !failed;
+                }
+            }
+
+            header.type = '0';
+            header.size = status.stx_size;
+
+            // contents which were read ahead are written from memory
+            if (contents)
+            {
+                write_header(header);
+                write(contents, static_cast<std::size_t>(length));
+                if (length < header.size)
+                {
+                    std::cerr << header.name << ": file shrank by " << header.size - length << " bytes; padding with zeros" << std::endl;
+                    write_zeros(header.size - length);
+                }
+                write_padding();
+                return !failed;
+            }
+
+            // large files bypass the page cache if configured, unless the
+            // file system does not support direct reads
+            int file_descriptor {-1};
+            bool const direct {cache.direct_threshold > 0 && header.size >= cache.direct_threshold};
+            if (direct)
+            {
+                file_descriptor = open(source.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC | O_DIRECT);
+            }
+            if (file_descriptor < 0)
+            {
+                file_descriptor = open(source.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+            }
+            if (file_descriptor < 0)
+            {
+                std::cerr << "Cannot open " << source << ": " << std::strerror(errno) << std::endl;
+                hard_links.erase({device, status.stx_ino});
+                return false;
+            }
+
+            write_header(header);
+            write_contents(file_descriptor, header.size, header.name, direct && (fcntl(file_descriptor, F_GETFL) & O_DIRECT) != 0);
+            close(file_descriptor);
+            return !failed;
+        }
+        case S_IFDIR:
+        {
+            header.type = '5';
+            if (!header.name.empty() && header.name.back() != '/')
+            {
+                header.name += '/';
+            }
+            break;
+        }
+        case S_IFLNK:
+        {
+            std::vector<char> target(static_cast<std::size_t>(status.stx_size) + 1);
+            ssize_t const length {readlink(source.c_str(), target.data(), target.size())};
+            if (length < 0)
+            {
+                std::cerr << "Cannot read link " << source << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            header.type = '2';
+            header.link_name.assign(target.data(), static_cast<std::size_t>(length));
+            break;
+        }
+        case S_IFCHR:
+        case S_IFBLK:
+        {
+            header.type = S_ISCHR(status.stx_mode) ? '3' : '4';
+            header.device_major = status.stx_rdev_major;
+            header.device_minor = status.stx_rdev_minor;
+            break;
+        }
+        case S_IFIFO:
+        {
+            header.type = '6';
+            break;
+        }
+        default:
+        {
+            std::cerr << source << ": socket ignored" << std::endl;
+            return false;
+        }
+    }
+
+    write_header(header);
+    return !failed;
+}
+
+
+bool TarWriter::finish()
+{
+    if (output_descriptor < 0)
+    {
+        return false;
+    }
+
+    // end-of-archive marker of two zero blocks, padded to a full record
+    write_zeros(2 * TAR_BLOCK_SIZE);
+    write_zeros((TAR_RECORD_SIZE - written % TAR_RECORD_SIZE) % TAR_RECORD_SIZE);
+    flush();
+
+    if (compressor && !failed && !compressor->finish(members))
+    {
+        failed = true;
+    }
+    compressor.reset();
+
+    if (close(output_descriptor) != 0 && !failed)
+    {
+        std::cerr << "Error while closing archive " << output_file << ": "
+                  << std::strerror(errno) << std::endl;
+        failed = true;
+    }
+    output_descriptor = -1;
+
+    return !failed;
+}
+
+
+std::uint64_t TarWriter::bytes_written() const
+{
+    return written;
+}
+
+
+void TarWriter::set_throttle(Throttle* throttle)
+{
+    this->throttle = throttle;
+}
+
+
+void TarWriter::set_cache_options(CacheOptions const& cache)
+{
+    this->cache = cache;
+}
+
+
+void TarWriter::set_prefetch(PrefetchOptions const& prefetch)
+{
+    this->prefetch = prefetch;
+}
+
+
+void TarWriter::write_header(Header const& header)
+{
+    std::string const blocks {format_header(header)};
+    write(blocks.data(), blocks.size());
+}
+
+
+std::string TarWriter::format_header(Header const& header, bool const fixed_size)
+{
+    std::string records {};
+    std::string prefix {};
+    std::string name {};
+
+    if (!split_name(header.name, prefix, name))
+    {
+        records += pax_record("path", header.name);
+        prefix.clear();
+        name = header.name.substr(0, 100);
+    }
+    if (header.link_name.size() > 100)
+    {
+        records += pax_record("linkpath", header.link_name);
+    }
+    if (fixed_size)
+    {
+        // zero-padded to the digits of the largest size, such that the final
+        // size of a growing file fits into the same blocks
+        std::string const digits {std::to_string(header.size)};
+        records += pax_record("size", std::string(MAX_SIZE_DIGITS - digits.size(), '0') + digits);
+    }
+    else if (header.size > MAX_OCTAL_11)
+    {
+        records += pax_record("size", std::to_string(header.size));
+    }
+    if (header.uid > MAX_OCTAL_7)
+    {
+        records += pax_record("uid", std::to_string(header.uid));
+    }
+    if (header.gid > MAX_OCTAL_7)
+    {
+        records += pax_record("gid", std::to_string(header.gid));
+    }
+    if (header.mtime < 0 || static_cast<std::uint64_t>(header.mtime) > MAX_OCTAL_11)
+    {
+        records += pax_record("mtime", std::to_string(header.mtime));
+    }
+
+    std::string result {};
+    if (!records.empty())
+    {
+        result = format_pax_header(name, records);
+    }
+
+    char block[TAR_BLOCK_SIZE] {};
+
+    write_string(block, 100, name);
+    write_octal(block + 100, 8, header.mode);
+    write_octal(block + 108, 8, std::min<std::uint64_t>(header.uid, MAX_OCTAL_7));
+    write_octal(block + 116, 8, std::min<std::uint64_t>(header.gid, MAX_OCTAL_7));
+    write_octal(block + 124, 12, std::min<std::uint64_t>(header.size, MAX_OCTAL_11));
+    write_octal(block + 136, 12, std::clamp<std::int64_t>(header.mtime, 0, MAX_OCTAL_11));
+    block[156] = header.type;
+    write_string(block + 157, 100, header.link_name);
+    std::memcpy(block + 257, "ustar\0" "00", 8);
+    write_string(block + 265, 32, user_name(header.uid));
+    write_string(block + 297, 32, group_name(header.gid));
+    if (header.type == '3' || header.type == '4')
+    {
+        write_octal(block + 329, 8, header.device_major);
+        write_octal(block + 337, 8, header.device_minor);
+    }
+    write_string(block + 345, 155, prefix);
+
+    // the checksum is computed with the checksum field filled with spaces
+    std::memset(block + 148, ' ', 8);
+    unsigned int checksum {0};
+    for (char const c : block)
+    {
+        checksum += static_cast<unsigned char>(c);
+    }
+    write_octal(block + 148, 7, checksum);
+
+    result.append(block, TAR_BLOCK_SIZE);
+    return result;
+}
+
+
+std::string TarWriter::format_pax_header(std::string const& name, std::string const& records)
+{
+    Header header {};
+    header.name = "PaxHeaders/" + name.substr(0, 89);
+    header.type = 'x';
+    header.mode = 0644;
+    header.size = records.size();
+
+    std::string result {format_header(header)};
+    result += records;
+    result.resize(result.size() + (TAR_BLOCK_SIZE - records.size() % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE, '\0');
+    return result;
+}
+
+
+bool TarWriter::write_contents(int const file_descriptor, std::uint64_t const size, std::string const& name, bool const direct)
+{
+    std::uint64_t const remaining {direct ? copy_direct(file_descriptor, size) : copy_contents(file_descriptor, size)};
+
+    if (remaining > 0 && !failed)
+    {
+        // the file shrank while being read, keep the archive consistent
+        std::cerr << name << ": file shrank by " << remaining << " bytes; padding with zeros" << std::endl;
+        write_zeros(remaining);
+        write_padding();
+        return false;
+    }
+
+    write_padding();
+    return !failed;
+}
+
+
+std::uint64_t TarWriter::copy_contents(int const file_descriptor, std::uint64_t remaining)
+{
+    CacheWindow window {file_descriptor, cache.neutral && remaining >= TAR_COPY_THRESHOLD};
+
+    // large files are copied in-kernel, bypassing the buffer, unless the
+    // archive is compressed
+    if (remaining >= TAR_COPY_THRESHOLD && !compressor)
+    {
+        flush();
+        if (!failed)
+        {
+            copy_range(file_descriptor, remaining, window);
+        }
+    }
+
+    // buffered copy of small files and fallback for copy_file_range
+    while (remaining > 0 && !failed)
+    {
+        if (buffered == buffer.size())
+        {
+            flush();
+            continue;
+        }
+
+        std::size_t const chunk {static_cast<std::size_t>(window.limit(std::min<std::uint64_t>(remaining, buffer.size() - buffered)))};
+        if (throttle)
+        {
+            throttle->acquire(chunk);
+        }
+        ssize_t const n {read(file_descriptor, buffer.data() + buffered, chunk)};
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+
+        window.advance(static_cast<std::uint64_t>(n));
+        buffered += static_cast<std::size_t>(n);
+        written += static_cast<std::uint64_t>(n);
+        remaining -= static_cast<std::uint64_t>(n);
+    }
+
+    return remaining;
+}
+
+
+std::uint64_t TarWriter::copy_direct(int const file_descriptor, std::uint64_t remaining)
+{
+    // direct reads need an aligned buffer, offsets and sizes
+    if (direct_buffer.empty())
+    {
+        direct_buffer.resize(TAR_BUFFER_SIZE + DIRECT_ALIGNMENT);
+    }
+    void* pointer {direct_buffer.data()};
+    std::size_t space {direct_buffer.size()};
+    char* const aligned {static_cast<char*>(std::align(DIRECT_ALIGNMENT, TAR_BUFFER_SIZE, pointer, space))};
+
+    while (remaining > 0 && !failed)
+    {
+        // the tail of the file is read in whole blocks, only these are charged
+        std::size_t const request
+        {
+            static_cast<std::size_t>(std::min<std::uint64_t>((remaining + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT, TAR_BUFFER_SIZE))
+        };
+        if (throttle)
+        {
+            throttle->acquire(request);
+        }
+        ssize_t const n {read(file_descriptor, aligned, request)};
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n < 0 && errno == EINVAL)
+        {
+            // the file system accepted O_DIRECT but refuses the read, read
+            // the rest through the page cache
+            int const flags {fcntl(file_descriptor, F_GETFL)};
+            if (flags >= 0 && fcntl(file_descriptor, F_SETFL, flags & ~O_DIRECT) == 0)
+            {
+                return copy_contents(file_descriptor, remaining);
+            }
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+
+        // the file may have grown since it was listed
+        std::uint64_t const length {std::min(static_cast<std::uint64_t>(n), remaining)};
+        write(aligned, static_cast<std::size_t>(length));
+        remaining -= length;
+    }
+
+    return remaining;
+}
+
+
+bool TarWriter::copy_range(int const file_descriptor, std::uint64_t& remaining, CacheWindow& window)
+{
+    while (remaining > 0)
+    {
+        // throttled copies are split, such that no single call is paid long
+        // after it completed
+        std::uint64_t length {window.limit(remaining)};
+        if (throttle && throttle->limited())
+        {
+            length = std::min(length, THROTTLE_CHUNK_SIZE);
+            throttle->acquire(length);
+        }
+        ssize_t const n {copy_file_range(file_descriptor, nullptr, output_descriptor, nullptr, length, 0)};
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // unsupported for this pair of files, let the caller fall back
+            return false;
+        }
+        if (n == 0)
+        {
+            break;
+        }
+
+        window.advance(static_cast<std::uint64_t>(n));
+        written += static_cast<std::uint64_t>(n);
+        remaining -= static_cast<std::uint64_t>(n);
+    }
+    return true;
+}
+
+
+void TarWriter::write_padding()
+{
+    write_zeros((TAR_BLOCK_SIZE - written % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+}
+
+
+void TarWriter::write_zeros(std::uint64_t size)
+{
+    static char const zeros[TAR_BLOCK_SIZE] {};
+
+    while (size > 0 && !failed)
+    {
+        std::size_t const chunk {static_cast<std::size_t>(std::min<std::uint64_t>(size, TAR_BLOCK_SIZE))};
+        write(zeros, chunk);
+        size -= chunk;
+    }
+}
+
+
+void TarWriter::write(void const* data, std::size_t size)
+{
+    char const* bytes {static_cast<char const*>(data)};
+
+    while (size > 0 && !failed)
+    {
+        if (buffered == buffer.size())
+        {
+            flush();
+        }
+
+        std::size_t const chunk {std::min(size, buffer.size() - buffered)};
+        std::memcpy(buffer.data() + buffered, bytes, chunk);
+
+        buffered += chunk;
+        written += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+
+void TarWriter::flush()
+{
+    if (compressor)
+    {
+        failed = failed || !compressor->write(buffer.data(), buffered);
+        buffered = 0;
+        return;
+    }
+
+    std::size_t offset {0};
+
+    while (offset < buffered && !failed)
+    {
+        ssize_t const n {::write(output_descriptor, buffer.data() + offset, buffered - offset)};
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            std::cerr << "Error while writing archive " << output_file << ": "
+                      << std::strerror(errno) << std::endl;
+            failed = true;
+            break;
+        }
+
+        offset += static_cast<std::size_t>(n);
+    }
+
+    buffered = 0;
+}
+
+
+std::string const& TarWriter::user_name(uid_t const uid)
+{
+    auto [entry, inserted] = user_names.try_emplace(uid);
+    if (inserted)
+    {
+        passwd result {};
+        passwd* pointer {nullptr};
+        std::vector<char> storage(4096);
+        if (getpwuid_r(uid, &result, storage.data(), storage.size(), &pointer) == 0 && pointer)
+        {
+            entry->second = pointer->pw_name;
+        }
+    }
+    return entry->second;
+}
+
+
+std::string const& TarWriter::group_name(gid_t const gid)
+{
+    auto [entry, inserted] = group_names.try_emplace(gid);
+    if (inserted)
+    {
+        group result {};
+        group* pointer {nullptr};
+        std::vector<char> storage(4096);
+        if (getgrgid_r(gid, &result, storage.data(), storage.size(), &pointer) == 0 && pointer)
+        {
+            entry->second = pointer->gr_name;
+        }
+    }
+    return entry->second;
+}
@@ -0,0 +1,316 @@
+/**
+ * @file tar_writer.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a streaming tar archive writer
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include "block_compressor.h"
+#include "path_table.h"
+#include "prefetcher.h"
+#include "throttle.h"
+
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+constexpr std::size_t TAR_BLOCK_SIZE = 512;
+constexpr std::size_t TAR_BUFFER_SIZE = 1 << 20;
+constexpr std::size_t TAR_COPY_THRESHOLD = 1 << 16;
+constexpr std::size_t TAR_BATCH_SIZE = 64;
+
+/**
+ * @brief Amount of a file read between two drops of the pages behind the read
+ * position in cache-neutral mode
+ *
+ */
+constexpr std::uint64_t CACHE_WINDOW_SIZE = 8 << 20;
+
+/**
+ * @brief Alignment of the buffer, offsets and sizes of `O_DIRECT` reads,
+ * sufficient for the logical block size of common devices
+ *
+ */
+constexpr std::size_t DIRECT_ALIGNMENT = 4096;
+
+
+/**
+ * @brief How a TarWriter reads files with respect to the page cache
+ *
+ */
+struct CacheOptions
+{
+    /**
+     * @brief Read files of `TAR_COPY_THRESHOLD` bytes or more with
+     * `POSIX_FADV_SEQUENTIAL` readahead, dropping the pages behind the read
+     * position with `POSIX_FADV_DONTNEED`, except those cached before
+     *
+     */
+    bool neutral {false};
+
+    /**
+     * @brief Read files of at least this size with `O_DIRECT`, bypassing the
+     * page cache, 0 to never
+     *
+     */
+    std::uint64_t direct_threshold {0};
+};
+
+
+/**
+ * @brief Writer producing ustar archives, with pax extended headers where the
+ * ustar format is insufficient (long names, files larger than 8 GiB).
+ *
+ * Entries are streamed into the output archive directly.
+ * Small files are read into an internal buffer, large files are copied
+ * in-kernel with `copy_file_range` (falling back to buffered copies).
+ * Directories are stored as directory entries only, i.e. their contents are
+ * NOT added recursively.
+ * Optionally, the archive is compressed on the fly in parallel blocks, see
+ * `BlockCompressor`.
+ * Lists of files are added in batches: if io_uring is available, the `statx`,
+ * `openat`, `read` and `close` calls of a batch are submitted at once.
+ * Alternatively, reader threads read the files of a list ahead while the
+ * writer adds them in order, see `Prefetcher`.
+ *
+ */
+class TarWriter
+{
+public:
+    /**
+     * @brief Metadata of an archive member, `type` is the ustar type flag
+     *
+     */
+    struct Header
+    {
+        std::string name {};
+        std::string link_name {};
+        char type {'0'};
+        mode_t mode {0};
+        uid_t uid {0};
+        gid_t gid {0};
+        std::uint64_t size {0};
+        std::int64_t mtime {0};
+        unsigned int device_major {0};
+        unsigned int device_minor {0};
+    };
+
+    /**
+     * @brief Construct a new TarWriter object, creating the output archive
+     *
+     * @param output_file File path of the archive
+     * @param compression Compression of the archive, none by default
+     */
+    explicit TarWriter(std::filesystem::path const& output_file, CompressionOptions const& compression = {});
+
+    /**
+     * @brief Destroy the TarWriter object, finishing the archive if necessary
+     *
+     */
+    ~TarWriter();
+
+    TarWriter(TarWriter const&) = delete;
+    TarWriter& operator=(TarWriter const&) = delete;
+
+    /**
+     * @brief Checks whether the output archive was opened successfully
+     *
+     * @return true if the archive is writable, false otherwise
+     */
+    bool is_open() const;
+
+    /**
+     * @brief Add a file to the archive, using its path as member name
+     *
+     * @param source File to add
+     * @return true on success, false if the file was skipped
+     */
+    bool add(std::filesystem::path const& source);
+
+    /**
+     * @brief Add a file to the archive under a given member name
+     *
+     * @param source File to add
+     * @param name Member name within the archive
+     * @return true on success, false if the file was skipped
+     */
+    bool add(std::filesystem::path const& source, std::filesystem::path const& name);
+
+    /**
+     * @brief Add a member with given metadata, whose contents are the
+     * concatenation of the given files, e.g. chunks of a chunk store
+     *
+     * @param header Metadata of the member, the size must match the parts
+     * @param parts Files holding the contents of the member, in order
+     * @return true on success, false otherwise
+     */
+    bool add(Header const& header, std::vector<std::filesystem::path> const& parts);
+
+    /**
+     * @brief Add a regular file which is still being written, e.g. a core
+     * dump, copying its contents as they arrive
+     *
+     * The header is written with a fixed-width pax size record and patched
+     * with the final size once the file is complete, i.e. the archive must
+     * not be compressed to overlap copying with writing. A compressed
+     * archive waits for the file to be complete and adds it like `add` does.
+     *
+     * @param source File to add, using its path as member name
+     * @param wait_for_data Blocks until the file grew, returns false once it
+     * is complete
+     * @return true on success, false otherwise
+     */
+    bool add_growing(std::filesystem::path const& source, std::function<bool()> const& wait_for_data);
+
+    /**
+     * @brief Add a list of files to the archive, in order, using their paths
+     * as member names
+     *
+     * @param sources Files to add
+     * @return number of added files
+     */
+    std::size_t add(std::vector<std::filesystem::path> const& sources);
+
+    /**
+     * @brief Add a list of files to the archive, in order, under other member
+     * names, e.g. snapshots of the files under their original paths
+     *
+     * @param sources Files to add
+     * @param names Member name of every file, as many as `sources`
+     * @return number of added files
+     */
+    std::size_t add(std::vector<std::filesystem::path> const& sources, std::vector<std::filesystem::path> const& names);
+
+    /**
+     * @brief Add the listed entries of a path table to the archive, in order,
+     * assembling their paths in batches
+     *
+     * @param names Member names of the files to add
+     * @param sources Files to read instead, by the same indexes, e.g.
+     * snapshots, or `nullptr` to read the files by their member names
+     * @return number of added files
+     */
+    std::size_t add(PathTable const& names, PathTable const* sources = nullptr);
+
+    /**
+     * @brief Write the end-of-archive marker and close the archive
+     *
+     * @return true on success, false otherwise
+     */
+    bool finish();
+
+    /**
+     * @brief Get the number of bytes written to the archive so far
+     *
+     * @return number of bytes written
+     */
+    std::uint64_t bytes_written() const;
+
+    /**
+     * @brief Limit the rate the contents of added files are read at
+     *
+     * @param throttle Token buckets shared with other stages, nullptr for no
+     * limit
+     */
+    void set_throttle(Throttle* throttle);
+
+    /**
+     * @brief Configure how added files are read with respect to the page
+     * cache, e.g. such that archiving large cores does not evict the working
+     * set of other processes
+     *
+     * @param cache Cache-neutral reads and `O_DIRECT` threshold
+     */
+    void set_cache_options(CacheOptions const& cache);
+
+    /**
+     * @brief Read the files of lists ahead with several threads, such that
+     * several reads are in flight while the archive is written
+     *
+     * Files read cache-neutrally or with `O_DIRECT` are left to the writer.
+     *
+     * @param prefetch Number of reader threads, 0 to not read ahead, and
+     * memory limits
+     */
+    void set_prefetch(PrefetchOptions const& prefetch);
+
+private:
+    class CacheWindow;
+
+    bool add
+    (
+        std::filesystem::path const& source,
+        std::filesystem::path const& name,
+        struct statx const& status,
+        char const* contents,
+        std::uint64_t const length
+    );
+    bool add_member
+    (
+        std::filesystem::path const& source,
+        std::filesystem::path const& name,
+        struct statx const& status,
+        char const* contents,
+        std::uint64_t const length
+    );
+    std::size_t add_prefetched
+    (
+        std::size_t const count,
+        std::function<std::filesystem::path(std::size_t)> const& source,
+        std::function<std::filesystem::path(std::size_t)> const& name
+    );
+    void write_header(Header const& header);
+    std::string format_header(Header const& header, bool const fixed_size = false);
+    std::string format_pax_header(std::string const& name, std::string const& records);
+    bool write_contents(int const file_descriptor, std::uint64_t const size, std::string const& name, bool const direct = false);
+    std::uint64_t copy_contents(int const file_descriptor, std::uint64_t remaining);
+    std::uint64_t copy_direct(int const file_descriptor, std::uint64_t remaining);
+    bool copy_range(int const file_descriptor, std::uint64_t& remaining, CacheWindow& window);
+    void write_padding();
+    void write_zeros(std::uint64_t size);
+    void write(void const* data, std::size_t size);
+    void flush();
+
+    std::string const& user_name(uid_t const uid);
+    std::string const& group_name(gid_t const gid);
+
+private:
+    std::filesystem::path output_file {};
+    int output_descriptor {-1};
+    bool failed {false};
+    Throttle* throttle {nullptr};
+    CacheOptions cache {};
+    std::vector<char> direct_buffer {};
+    PrefetchOptions prefetch {};
+
+    std::vector<char> buffer {};
+    std::size_t buffered {0};
+    std::uint64_t written {0};
+
+    // offsets of the members, for the index of compressed archives
+    std::unique_ptr<BlockCompressor> compressor {};
+    std::vector<ArchiveMember> members {};
+
+    std::map<std::pair<dev_t, ino_t>, std::string> hard_links {};
+    std::map<uid_t, std::string> user_names {};
+    std::map<gid_t, std::string> group_names {};
+};
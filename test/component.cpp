@@ -13,10 +13,52 @@
 #include <gtest/gtest.h>
 
 #include "../collector.h"
+#include "../io_ring.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
 #include <fstream>
+#include <mutex>
+#include <set>
 
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
+
+// archives are named after the hash of the path of their first trigger and
+// the sequence number of their collection
+static std::filesystem::path find_archive
+(
+    std::filesystem::path const& directory,
+    std::string const& trigger,
+    std::string const& extension = ".tar"
+)
+{
+    std::string const prefix {"archive." + std::to_string(std::hash<std::string>{}(trigger)) + "."};
+
+    std::error_code error {};
+    for (auto const& entry : std::filesystem::directory_iterator {directory, error})
+    {
+        std::string const name {entry.path().filename().native()};
+        if (name.size() > prefix.size() + extension.size() && name.compare(0, prefix.size(), prefix) == 0
+            && name.compare(name.size() - extension.size(), extension.size(), extension) == 0
+            && name.find_first_not_of("0123456789", prefix.size()) == name.size() - extension.size())
+        {
+            return entry.path();
+        }
+    }
+    return {};
+}
+
+
+/**
+ * @brief Collector monitoring `sandbox` and archiving to `sandbox_output` in
+ * a thread of its own, derived fixtures change its configuration, every
+ * completed collection is recorded
+ *
+ */
 class ComponentTest : public ::testing::Test
 {
 protected:
@@ -26,20 +68,28 @@ protected:
 
         fs::create_directory("sandbox");
         fs::create_directory("sandbox_output");
+        prepare();
 
-        collector = std::make_unique<Collector>
-        (
-            fs::path {"sandbox"},
-            fs::path {"sandbox_output"},
-            FileSelection::FILES
-        );
+        collector = std::make_unique<Collector>();
+        configure(*collector);
+        collector->set_completion_callback([this](Trigger const& trigger, fs::path const& output)
+        {
+            std::lock_guard<std::mutex> lock {completion_mutex};
+            completions.emplace_back(trigger, output);
+            completion_condition.notify_all();
+        });
 
         worker = std::thread {&ComponentTest::run, this};
     }
 
     virtual void TearDown()
     {
-        worker.join();
+        // tests may stop the collector themselves
+        if (worker.joinable())
+        {
+            collector->stop();
+            worker.join();
+        }
 
         namespace fs = std::filesystem;
 
@@ -47,14 +97,53 @@ protected:
         fs::remove_all("sandbox_output");
     }
 
+    /**
+     * @brief Create the input of the test before the collector is started
+     *
+     */
+    virtual void prepare()
+    {
+    }
+
+    /**
+     * @brief Configure the collector before it is started, by default a
+     * single root collecting files
+     *
+     */
+    virtual void configure(Collector& collector)
+    {
+        collector.add_root(std::filesystem::path {"sandbox"}, std::filesystem::path {"sandbox_output"}, FileSelection::FILES);
+    }
+
     void run()
     {
         collector->monitor_and_collect();
     }
 
+    /**
+     * @brief Wait until a number of collections has completed
+     *
+     * @return the triggers and output files of the completed collections, in
+     * order of completion, even if fewer completed within the timeout
+     */
+    std::vector<std::pair<Trigger, std::filesystem::path>> wait_for_completions
+    (
+        std::size_t const count,
+        std::chrono::seconds const timeout = std::chrono::seconds {10}
+    )
+    {
+        std::unique_lock<std::mutex> lock {completion_mutex};
+        completion_condition.wait_for(lock, timeout, [this, count] { return completions.size() >= count; });
+        return completions;
+    }
+
 protected:
     std::unique_ptr<Collector> collector {nullptr};
     std::thread worker;
+
+    std::mutex completion_mutex {};
+    std::condition_variable completion_condition {};
+    std::vector<std::pair<Trigger, std::filesystem::path>> completions {};
 };
 
 
@@ -67,14 +156,439 @@ protected:
 
 TEST_F(ComponentTest, DataCollectionTest2)
 {
+    // give the monitor thread time to watch and index the input directory
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
     std::system("touch sandbox/core.service.0.lz4");
-    std::string hash {std::to_string(std::hash<std::string>{}("core.service.0.lz4"))};
 
-    using namespace std::chrono_literals;
     std::this_thread::sleep_for(3s);
 
-    EXPECT_TRUE(std::filesystem::exists(std::filesystem::path {"sandbox_output/archive." + hash + ".tar"}));
+    EXPECT_FALSE(find_archive("sandbox_output", "sandbox/core.service.0.lz4").empty());
 
     // char* buffer = {"q\n"};
     // write(STDIN_FILENO, buffer, 2);
 }
+
+
+class CoalescingTest : public ComponentTest
+{
+protected:
+    void configure(Collector& collector) override
+    {
+        ComponentTest::configure(collector);
+
+        using namespace std::chrono_literals;
+        collector.set_coalescing_window(1s);
+    }
+};
+
+
+TEST_F(CoalescingTest, DataCollectionTest)
+{
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    std::system("touch sandbox/core.service.0.lz4 sandbox/core.service.1.lz4 sandbox/core.service.2.lz4");
+
+    std::this_thread::sleep_for(3s);
+
+    // a single archive records all triggering files
+    std::size_t archives {0};
+    for (auto const& entry : std::filesystem::directory_iterator {"sandbox_output"})
+    {
+        archives += entry.path().extension() == ".tar";
+    }
+    EXPECT_EQ(archives, 1);
+
+    std::string const archive {find_archive("sandbox_output", "sandbox/core.service.0.lz4")};
+    ASSERT_FALSE(archive.empty());
+
+    std::system(std::string {"tar -xOf " + archive + " --wildcards '*/triggers.txt' > sandbox/triggers.txt"}.c_str());
+
+    std::ifstream list {"sandbox/triggers.txt"};
+    std::vector<std::string> triggers {};
+    for (std::string line {}; std::getline(list, line);)
+    {
+        triggers.push_back(line);
+    }
+
+    EXPECT_EQ(triggers, (std::vector<std::string> {"sandbox/core.service.0.lz4", "sandbox/core.service.1.lz4", "sandbox/core.service.2.lz4"}));
+}
+
+
+class DrainTest : public ComponentTest
+{
+protected:
+    void configure(Collector& collector) override
+    {
+        ComponentTest::configure(collector);
+
+        using namespace std::chrono_literals;
+        collector.set_coalescing_window(10s);
+        collector.set_drain(true);
+    }
+};
+
+
+TEST_F(DrainTest, DataCollectionTest)
+{
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    std::system("touch sandbox/core.service.0.lz4");
+    std::this_thread::sleep_for(300ms);
+
+    // the coalescing window is still open, stopping hands the trigger over
+    collector->stop();
+    worker.join();
+
+    EXPECT_FALSE(find_archive("sandbox_output", "sandbox/core.service.0.lz4").empty());
+    EXPECT_EQ(collector->get_metrics().dropped.load(), 0);
+}
+
+
+class RecursiveTest : public ComponentTest, public ::testing::WithParamInterface<bool>
+{
+protected:
+    void prepare() override
+    {
+        std::filesystem::create_directories("sandbox/a/b");
+    }
+
+    void configure(Collector& collector) override
+    {
+        ComponentTest::configure(collector);
+
+        collector.set_recursive(true);
+        collector.set_filesystem_marks(GetParam());
+    }
+};
+
+
+TEST_P(RecursiveTest, DataCollectionTest)
+{
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    // existing, created and moved directories are monitored
+    std::system("mkdir -p sandbox/new/deep && touch sandbox/a/b/core.first.0.lz4");
+    std::this_thread::sleep_for(100ms);
+    std::system("touch sandbox/new/deep/core.second.0.lz4 && mv sandbox/a sandbox/moved");
+    std::this_thread::sleep_for(100ms);
+    std::system("touch sandbox/moved/b/core.third.0.lz4");
+
+    std::this_thread::sleep_for(3s);
+
+    for (std::string const name : {"sandbox/a/b/core.first.0.lz4", "sandbox/new/deep/core.second.0.lz4", "sandbox/moved/b/core.third.0.lz4"})
+    {
+        EXPECT_FALSE(find_archive("sandbox_output", name).empty()) << name;
+    }
+
+    // the archive holds the directory of the created file
+    std::string const archive {find_archive("sandbox_output", "sandbox/moved/b/core.third.0.lz4")};
+    std::system(std::string {"tar -tf " + archive + " > sandbox_output/members.txt"}.c_str());
+
+    std::ifstream list {"sandbox_output/members.txt"};
+    std::vector<std::string> members {};
+    for (std::string line {}; std::getline(list, line);)
+    {
+        members.push_back(line);
+    }
+    EXPECT_NE(std::find(members.begin(), members.end(), "sandbox/moved/b/core.third.0.lz4"), members.end());
+}
+
+
+INSTANTIATE_TEST_SUITE_P(Watches, RecursiveTest, ::testing::Values(false, true));
+
+
+class MultipleRootsTest : public ComponentTest, public ::testing::WithParamInterface<bool>
+{
+protected:
+    void prepare() override
+    {
+        namespace fs = std::filesystem;
+
+        fs::create_directories("sandbox/first/dir");
+        fs::create_directories("sandbox/second/dir");
+        fs::create_directories("sandbox_output/first");
+        fs::create_directories("sandbox_output/second");
+        std::ofstream {"sandbox/first/dir/file"};
+        std::ofstream {"sandbox/second/dir/file"};
+
+        IoRing::set_enabled(GetParam());
+    }
+
+    void configure(Collector& collector) override
+    {
+        namespace fs = std::filesystem;
+
+        collector.add_root(fs::path {"sandbox/first"}, fs::path {"sandbox_output/first"}, FileSelection::FILES);
+        collector.add_root(fs::path {"sandbox/second"}, fs::path {"sandbox_output/second"}, FileSelection::FILES_AND_DIRECTORIES);
+    }
+
+    void TearDown() override
+    {
+        ComponentTest::TearDown();
+
+        IoRing::set_enabled(true);
+    }
+};
+
+
+TEST_P(MultipleRootsTest, DataCollectionTest)
+{
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    std::system("touch sandbox/first/core.first.0.lz4 sandbox/second/core.second.0.lz4");
+
+    std::this_thread::sleep_for(3s);
+
+    // every root stores its archives in its own output directory, using its
+    // own selection
+    for (std::string const root : {"first", "second"})
+    {
+        std::string const archive {find_archive("sandbox_output/" + root, "sandbox/" + root + "/core." + root + ".0.lz4")};
+        ASSERT_FALSE(archive.empty()) << root;
+
+        std::system(std::string {"tar -tf " + archive + " > sandbox_output/members.txt"}.c_str());
+
+        std::ifstream list {"sandbox_output/members.txt"};
+        std::vector<std::string> members {};
+        for (std::string line {}; std::getline(list, line);)
+        {
+            members.push_back(line);
+        }
+
+        bool const nested {std::find(members.begin(), members.end(), "sandbox/" + root + "/dir/file") != members.end()};
+        EXPECT_EQ(nested, root == "second") << root;
+    }
+}
+
+
+INSTANTIATE_TEST_SUITE_P(EventLoops, MultipleRootsTest, ::testing::Values(false, true));
+
+
+class StreamingTest : public ComponentTest
+{
+protected:
+    void prepare() override
+    {
+        std::ofstream {"sandbox/file"} << "hello";
+    }
+
+    void configure(Collector& collector) override
+    {
+        ComponentTest::configure(collector);
+
+        collector.set_streaming(std::chrono::milliseconds {1000});
+    }
+};
+
+
+TEST_F(StreamingTest, DataCollectionTest)
+{
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    // the core is written in pieces for about two seconds
+    std::thread writer
+    {
+        []
+        {
+            std::system("for i in 1 2 3 4 5; do head -c 300000 /dev/urandom; sleep 0.4; done > sandbox/core.service.0.lz4");
+        }
+    };
+
+    // archiving starts while the core is written, the archive is complete
+    // once the core is closed
+    std::this_thread::sleep_for(1s);
+    EXPECT_FALSE(find_archive("sandbox_output", "sandbox/core.service.0.lz4", ".tar.part").empty());
+    EXPECT_TRUE(find_archive("sandbox_output", "sandbox/core.service.0.lz4").empty());
+
+    writer.join();
+    std::this_thread::sleep_for(500ms);
+
+    std::string const archive {find_archive("sandbox_output", "sandbox/core.service.0.lz4")};
+    ASSERT_FALSE(archive.empty());
+    EXPECT_EQ(std::system(std::string {"tar -xOf " + archive + " sandbox/core.service.0.lz4 | cmp -s - sandbox/core.service.0.lz4"}.c_str()), 0);
+    EXPECT_EQ(std::system(std::string {"tar -xOf " + archive + " sandbox/file | grep -q hello"}.c_str()), 0);
+}
+
+
+class MetricsTest : public ComponentTest
+{
+protected:
+    void configure(Collector& collector) override
+    {
+        ComponentTest::configure(collector);
+
+        collector.set_metrics_file(std::filesystem::path {"sandbox_output/collector.prom"});
+        collector.set_metrics_socket(std::filesystem::path {"sandbox_output/metrics.sock"});
+    }
+};
+
+
+TEST_F(MetricsTest, DataCollectionTest)
+{
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    std::system("echo hello > sandbox/file; touch sandbox/core.service.0.lz4");
+
+    std::this_thread::sleep_for(2s);
+
+    // every connection to the socket receives the current metrics
+    for (int i {0}; i < 2; ++i)
+    {
+        int const connection {socket(AF_UNIX, SOCK_STREAM, 0)};
+        sockaddr_un address {};
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, "sandbox_output/metrics.sock");
+        ASSERT_EQ(connect(connection, reinterpret_cast<sockaddr const*>(&address), sizeof(address)), 0);
+
+        std::string text {};
+        char buffer[4096];
+        for (ssize_t n {read(connection, buffer, sizeof(buffer))}; n > 0; n = read(connection, buffer, sizeof(buffer)))
+        {
+            text.append(buffer, static_cast<std::size_t>(n));
+        }
+        close(connection);
+
+        EXPECT_NE(text.find("\ncollector_collections_total 1\n"), std::string::npos);
+        EXPECT_NE(text.find("\ncollector_archive_seconds_count 1\n"), std::string::npos);
+    }
+
+    EXPECT_EQ(collector->get_metrics().triggers.load(), 1);
+    EXPECT_EQ(collector->get_metrics().files.load(), 4);
+    EXPECT_GT(collector->get_metrics().bytes.load(), 0);
+
+    collector->stop();
+    worker.join();
+
+    // the metrics file is written when stopping, the socket is removed
+    std::ifstream file {"sandbox_output/collector.prom"};
+    std::string const text {std::istreambuf_iterator<char> {file}, std::istreambuf_iterator<char> {}};
+    EXPECT_NE(text.find("collector_triggers_total 1\n"), std::string::npos);
+    EXPECT_NE(text.find("collector_queue_depth 0\n"), std::string::npos);
+    EXPECT_FALSE(std::filesystem::exists(std::filesystem::path {"sandbox_output/metrics.sock"}));
+}
+
+
+/**
+ * @brief Several collector workers reporting completions concurrently
+ *
+ */
+class CompletionTest : public ComponentTest
+{
+protected:
+    void configure(Collector& collector) override
+    {
+        ComponentTest::configure(collector);
+        collector.set_workers(4);
+    }
+};
+
+TEST_F(CompletionTest, DataCollectionTest)
+{
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    // a burst of triggers, completion is signalled instead of waited for
+    for (int i {0}; i < 20; ++i)
+    {
+        std::ofstream {"sandbox/core.service." + std::to_string(i) + ".lz4"};
+    }
+
+    auto const completed {wait_for_completions(20)};
+    ASSERT_EQ(completed.size(), 20);
+    for (auto const& [trigger, archive] : completed)
+    {
+        EXPECT_EQ(trigger.files.size(), 1);
+        EXPECT_TRUE(std::filesystem::exists(archive)) << archive;
+    }
+}
+
+
+/**
+ * @brief Collector watching with inotify, whose queue overflows on request
+ *
+ */
+class OverflowTest : public ComponentTest
+{
+protected:
+    void configure(Collector& collector) override
+    {
+        ComponentTest::configure(collector);
+        collector.set_filesystem_marks(false);
+    }
+};
+
+TEST_F(OverflowTest, DataCollectionTest)
+{
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    // every trigger of the burst is collected once, whether its event was
+    // lost with the first batch or recovered twice
+    collector->simulate_overflow();
+    std::system("bash -c 'touch sandbox/file.{1..500} sandbox/core.service.{1..20}.lz4'");
+
+    auto const completed {wait_for_completions(20, 20s)};
+    std::set<std::filesystem::path> triggered {};
+    for (auto const& [trigger, archive] : completed)
+    {
+        for (auto const& file : trigger.files)
+        {
+            EXPECT_TRUE(triggered.insert(file).second) << file << " triggered twice";
+        }
+    }
+    EXPECT_EQ(triggered.size(), 20);
+    EXPECT_GT(collector->get_metrics().overflows.load(), 0);
+    EXPECT_GT(collector->get_metrics().rescans.load(), 0);
+}
+
+
+/**
+ * @brief Collector archiving snapshots of the collected files
+ *
+ */
+class SnapshotTest : public ComponentTest
+{
+protected:
+    void TearDown() override
+    {
+        ComponentTest::TearDown();
+        std::filesystem::remove_all("sandbox_snapshots");
+    }
+
+    void prepare() override
+    {
+        std::filesystem::create_directory("sandbox_snapshots");
+        std::ofstream {"sandbox/log"} << "hello";
+    }
+
+    void configure(Collector& collector) override
+    {
+        ComponentTest::configure(collector);
+        collector.set_snapshot_directory("sandbox_snapshots");
+    }
+};
+
+TEST_F(SnapshotTest, DataCollectionTest)
+{
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(100ms);
+
+    std::ofstream {"sandbox/core.service.0.lz4"};
+
+    auto const completed {wait_for_completions(1)};
+    ASSERT_EQ(completed.size(), 1);
+    auto const& archive {completed.front().second};
+
+    // members keep the paths of the input directory, snapshots are removed
+    EXPECT_EQ(std::system(std::string {"tar -xOf " + archive.native() + " sandbox/log | grep -q hello"}.c_str()), 0);
+    EXPECT_TRUE(std::filesystem::is_empty("sandbox_snapshots"));
+    EXPECT_GT(collector->get_metrics().snapshot.count(), 0);
+}
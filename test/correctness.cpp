@@ -12,11 +12,40 @@
 
 #include <gtest/gtest.h>
 
+#include "../block_compressor.h"
+#include "../chunk_store.h"
 #include "../collector.h"
-
+#include "../directory_index.h"
+#include "../disk_usage.h"
+#include "../event_buffer.h"
+#include "../filename_matcher.h"
+#include "../io_ring.h"
+#include "../metrics.h"
+#include "../path_table.h"
+#include "../prefetcher.h"
+#include "../sha256.h"
+#include "../snapshot.h"
+#include "../tar_writer.h"
+#include "../throttle.h"
+#include "../tree_walker.h"
+#include "../trigger_queue.h"
+#include "../watch_table.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <filesystem>
 #include <fstream>
 #include <regex>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 
 constexpr std::string_view REGEX {"core\\.[a-zA-Z]+(\\.[a-f0-9]+)+\\.lz4"};
@@ -126,6 +155,47 @@ TEST(RegexTest, HexGroupTest4)
 }
 
 
+TEST(MatcherTest, DefaultGrammarTest)
+{
+    // the DFA has to agree with the regex on every name
+    std::vector<std::string> const files
+    {
+        "core.Service.0.lz4", "c.Service.0.lz4", "CORE.Service.0.lz4", ".Service.0.lz4",
+        "core.aAzZ.0.lz4", "core.ServiceName0123.0.lz4", "core..0.lz4", "core.Service.0.lz",
+        "core.Service.0.LZ4", "core.Service.0.", "coreService.0.lz4", "coreService0lz4",
+        "core.Service.0lz4", "core.Service.g.lz4", "core.Service..lz4", "core.Service.0.0.lz4",
+        "core.Service.0.0.0.0.0.0.0.0.0.0.lz4", "core.Service.0.lz4.tmp", "core.Service.lz4",
+        "core.ServiceName.3057.57dd721409bc4ab4b38a3c33a36a608a.3717.1647975805000000.lz4",
+        "core.ServiceName.3057.57dd721409bc4ab4b38a3c33a36a608A.3717.1647975805000000.lz4",
+        "core.ServiceNameWhichIsLongerThanSixteenCharacters.0123456789abcdef0123.lz4",
+        "core.ServiceNameWhichIsLonger1ThanSixteenCharacters.0123456789abcdef0123.lz4",
+        "core.Service.0123456789abcdef0123456789abcdeg.lz4",
+        "core.Service.0123456789abcdef0123456789abcdef.lz4",
+        "core.Service.0123456789abcdef.lz4", "core.Service.0123456789abcdef0.lz4",
+        std::string {"core.Service.0.lz4\0", 19}, ""
+    };
+
+    std::regex const regex {std::string {REGEX}};
+    FilenameMatcher const matcher {};
+
+    EXPECT_FALSE(matcher.uses_regex());
+    for (auto const& file : files)
+    {
+        EXPECT_EQ(matcher.match(file), std::regex_match(file, regex)) << file;
+    }
+}
+
+TEST(MatcherTest, PatternTest)
+{
+    EXPECT_FALSE(FilenameMatcher {std::string {REGEX}}.uses_regex());
+
+    FilenameMatcher const matcher {std::string {"dump\\.[0-9]+"}};
+
+    EXPECT_TRUE(matcher.uses_regex());
+    EXPECT_TRUE(matcher.match("dump.42"));
+    EXPECT_FALSE(matcher.match("core.Service.0.lz4"));
+}
+
 
 TEST(FileCollectionTest, FilesTest1)
 {
@@ -156,6 +226,15 @@ TEST(FileCollectionTest, FilesTest2)
     fs::remove_all("sandbox");
 }
 
+TEST(FileCollectionTest, MissingDirectoryTest)
+{
+    namespace fs = std::filesystem;
+
+    // a triggering directory may vanish before it is collected
+    EXPECT_TRUE(Collector::collect_files(fs::path {"sandbox/missing"}, FileSelection::FILES).empty());
+    EXPECT_TRUE(Collector::collect_files(fs::path {"sandbox/missing"}, FileSelection::FILES_AND_DIRECTORIES).empty());
+}
+
 TEST(FileCollectionTest, FilesAndDirectoriesTest1)
 {
     namespace fs = std::filesystem;
@@ -184,6 +263,40 @@ TEST(FileCollectionTest, FilesAndDirectoriesTest2)
     fs::remove_all("sandbox");
 }
 
+TEST(FileCollectionTest, TreeWalkerTest)
+{
+    namespace fs = std::filesystem;
+
+    fs::create_directories("sandbox/a/b/c");
+    fs::create_directories("sandbox/d");
+    fs::create_directories("sandbox/e");
+    for (int i {0}; i < 50; ++i)
+    {
+        std::ofstream {"sandbox/a/b/file_" + std::to_string(i)};
+        fs::create_directory("sandbox/e/dir_" + std::to_string(i));
+        std::ofstream {"sandbox/e/dir_" + std::to_string(i) + "/file"};
+    }
+    fs::create_directory_symlink("a", "sandbox/link");
+
+    // the parallel traversal lists the same entries in the same order, and
+    // does not follow the link
+    std::vector<fs::path> expected {};
+    for (auto const& entry : fs::recursive_directory_iterator {"sandbox"})
+    {
+        expected.push_back(entry.path());
+    }
+
+    PathTable files {};
+    TreeWalker walker {4};
+    EXPECT_TRUE(walker.walk(fs::path {"sandbox"}, files, files.add_root("sandbox", false)));
+
+    EXPECT_EQ(files.paths(), expected);
+    EXPECT_EQ(walker.directories(), 56);
+    EXPECT_EQ(Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES_AND_DIRECTORIES, 2), expected);
+
+    fs::remove_all("sandbox");
+}
+
 TEST(DiskUsageTest, DiskUsageTest1)
 {
     namespace fs = std::filesystem;
@@ -203,6 +316,219 @@ TEST(DiskUsageTest, DiskUsageTest1)
     fs::remove_all("sandbox_output");
 }
 
+TEST(DiskUsageTest, DiskUsageTest2)
+{
+    namespace fs = std::filesystem;
+
+    fs::create_directories("sandbox/dir/dir");
+    fs::create_directory("sandbox_output");
+    std::system("head -c 5000 /dev/zero > sandbox/file");
+    std::system("head -c 70000 /dev/zero > sandbox/dir/dir/file");
+    fs::create_hard_link("sandbox/dir/dir/file", "sandbox/dir/link");
+
+    auto files = Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES_AND_DIRECTORIES);
+    std::vector<fs::path> temporaries {};
+
+    // the report has to match the output of du -sh for every file
+    for (auto const& file : files)
+    {
+        std::system(std::string {"du -sh " + file.native() + " >> sandbox_output/expected.txt"}.c_str());
+    }
+
+    Collector::collect_disk_usage(files, temporaries, fs::path {"sandbox_output"});
+
+    std::ifstream report {"sandbox_output/disk_usage.txt"};
+    std::ifstream reference {"sandbox_output/expected.txt"};
+    std::string const actual {std::istreambuf_iterator<char> {report}, std::istreambuf_iterator<char> {}};
+    std::string const expected {std::istreambuf_iterator<char> {reference}, std::istreambuf_iterator<char> {}};
+
+    EXPECT_EQ(actual, expected);
+
+    fs::remove_all("sandbox");
+    fs::remove_all("sandbox_output");
+}
+
+TEST(DiskUsageTest, DeepTreeTest)
+{
+    namespace fs = std::filesystem;
+
+    fs::path deepest {"sandbox"};
+    for (int i {0}; i < 300; ++i)
+    {
+        deepest /= "d";
+    }
+    fs::create_directories(deepest);
+    fs::create_directory("sandbox_output");
+    std::system(std::string {"head -c 5000 /dev/zero > " + deepest.native() + "/file"}.c_str());
+    std::system("du -sh sandbox > sandbox_output/expected.txt");
+
+    // the tree is deeper than the number of descriptors the walk may open
+    rlimit previous {};
+    getrlimit(RLIMIT_NOFILE, &previous);
+    rlimit limit {previous};
+    limit.rlim_cur = 64;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    std::vector<fs::path> files {fs::path {"sandbox"}};
+    std::vector<fs::path> temporaries {};
+    Collector::collect_disk_usage(files, temporaries, fs::path {"sandbox_output"});
+
+    setrlimit(RLIMIT_NOFILE, &previous);
+
+    std::ifstream report {"sandbox_output/disk_usage.txt"};
+    std::ifstream reference {"sandbox_output/expected.txt"};
+    std::string const actual {std::istreambuf_iterator<char> {report}, std::istreambuf_iterator<char> {}};
+    std::string const expected {std::istreambuf_iterator<char> {reference}, std::istreambuf_iterator<char> {}};
+
+    EXPECT_EQ(actual, expected);
+
+    fs::remove_all("sandbox");
+    fs::remove_all("sandbox_output");
+}
+
+TEST(DiskUsageTest, PathTableTest)
+{
+    namespace fs = std::filesystem;
+
+    fs::create_directories("sandbox/dir/dir");
+    fs::create_directories("sandbox_output/table");
+    std::system("head -c 5000 /dev/zero > sandbox/file");
+    std::system("head -c 70000 /dev/zero > sandbox/dir/dir/file");
+
+    // a path table yields the same report as a list of paths
+    auto files = Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES_AND_DIRECTORIES);
+    PathTable table {};
+    Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES_AND_DIRECTORIES, table);
+    std::vector<fs::path> temporaries {};
+
+    Collector::collect_disk_usage(files, temporaries, fs::path {"sandbox_output"});
+    Collector::collect_disk_usage(table, temporaries, fs::path {"sandbox_output/table"});
+
+    std::ifstream report {"sandbox_output/table/disk_usage.txt"};
+    std::ifstream reference {"sandbox_output/disk_usage.txt"};
+    std::string const actual {std::istreambuf_iterator<char> {report}, std::istreambuf_iterator<char> {}};
+    std::string const expected {std::istreambuf_iterator<char> {reference}, std::istreambuf_iterator<char> {}};
+
+    EXPECT_EQ(actual, expected);
+    EXPECT_EQ(table.count(), files.size());
+    EXPECT_EQ(table.path(table.size() - 1), fs::path {"sandbox_output/table/disk_usage.txt"});
+
+    fs::remove_all("sandbox");
+    fs::remove_all("sandbox_output");
+}
+
+TEST(DiskUsageTest, HumanReadableTest)
+{
+    EXPECT_EQ(DiskUsageEngine::human_readable(0), "0");
+    EXPECT_EQ(DiskUsageEngine::human_readable(512), "512");
+    EXPECT_EQ(DiskUsageEngine::human_readable(4096), "4.0K");
+    EXPECT_EQ(DiskUsageEngine::human_readable(4097), "4.1K");
+    EXPECT_EQ(DiskUsageEngine::human_readable(12288), "12K");
+    EXPECT_EQ(DiskUsageEngine::human_readable(1048575), "1.0M");
+    EXPECT_EQ(DiskUsageEngine::human_readable(3 * 1073741824ULL), "3.0G");
+}
+
+TEST(DirectoryIndexTest, DirectoryIndexTest1)
+{
+    DirectoryIndex index {};
+    EXPECT_FALSE(index.valid());
+
+    index.clear();
+    index.add("sandbox/a", true);
+    index.add("sandbox/a/b", false);
+    index.add("sandbox/a-b", false);
+    index.add("sandbox/a/c", true);
+    index.add("sandbox/a/c/d", false);
+    index.add("sandbox/a/b", false);
+
+    EXPECT_TRUE(index.valid());
+    EXPECT_EQ(index.size(), 5);
+
+    index.remove("sandbox/a");
+    std::vector<std::filesystem::path> expected {"sandbox/a-b"};
+    EXPECT_EQ(index.files(), expected);
+
+    index.invalidate();
+    EXPECT_FALSE(index.valid());
+}
+
+TEST(DirectoryIndexTest, DirectoryIndexTest2)
+{
+    DirectoryIndex index {};
+    index.clear();
+    index.add("sandbox/a", true);
+    index.add("sandbox/a/b", false);
+    index.add("sandbox/a.b", false);
+    index.add("sandbox/a/c", true);
+    index.add("sandbox/a/c/d", false);
+
+    // the input directory becomes an unlisted root of the table
+    PathTable table {};
+    index.files(table);
+    EXPECT_EQ(table.paths(), index.files());
+    EXPECT_EQ(table.size(), 6);
+    EXPECT_FALSE(table.listed(0));
+    EXPECT_EQ(table.name(0), "sandbox");
+}
+
+TEST(PathTableTest, PathTableTest1)
+{
+    PathTable table {};
+    std::uint32_t const root {table.add_root("/var/dumps", false)};
+    std::uint32_t const directory {table.add(root, "service")};
+    std::uint32_t const core {table.add(directory, "core.service.0.lz4")};
+    std::uint32_t const top {table.add_root("/", false)};
+    std::uint32_t const file {table.add(top, "file")};
+
+    EXPECT_EQ(table.size(), 5);
+    EXPECT_EQ(table.count(), 3);
+    EXPECT_EQ(table.path(core), std::filesystem::path {"/var/dumps/service/core.service.0.lz4"});
+    EXPECT_EQ(table.path(file), std::filesystem::path {"/file"});
+    EXPECT_EQ(table.name(core), "core.service.0.lz4");
+
+    // hidden entries remain parents, moved entries keep their index
+    table.hide(directory);
+    EXPECT_EQ(table.count(), 2);
+    EXPECT_EQ(table.path(core), std::filesystem::path {"/var/dumps/service/core.service.0.lz4"});
+    table.move(core, top, "0");
+    std::vector<std::filesystem::path> const expected {"/0", "/file"};
+    EXPECT_EQ(table.paths(), expected);
+
+    std::string path {};
+    table.path(directory, path);
+    EXPECT_EQ(path, "/var/dumps/service");
+}
+
+TEST(WatchTableTest, WatchTableTest1)
+{
+    WatchTable watches {};
+    watches.add_root(1, "sandbox");
+    watches.add(2, 1, "a");
+    watches.add(3, 2, "b");
+    watches.add(4, 3, "c");
+    watches.add(5, 1, "d");
+
+    EXPECT_EQ(watches.size(), 5);
+    EXPECT_EQ(watches.path(4), std::filesystem::path {"sandbox/a/b/c"});
+    EXPECT_EQ(watches.find(1, "a"), 2);
+    EXPECT_EQ(watches.find(1, "b"), -1);
+    EXPECT_GT(watches.memory(), 0);
+
+    // a moved directory takes its subtree along
+    watches.detach(2);
+    EXPECT_TRUE(watches.path(4).empty());
+    watches.add(2, 5, "e");
+    EXPECT_EQ(watches.path(4), std::filesystem::path {"sandbox/d/e/b/c"});
+    EXPECT_EQ(watches.find(1, "a"), -1);
+
+    std::vector<int> removed {watches.remove(5)};
+    std::sort(removed.begin(), removed.end());
+    EXPECT_EQ(removed, (std::vector<int> {2, 3, 4, 5}));
+    EXPECT_EQ(watches.size(), 1);
+    EXPECT_FALSE(watches.contains(4));
+}
+
+
 TEST(ArchiveTest, ArchiveTest1)
 {
     namespace fs = std::filesystem;
@@ -264,3 +590,818 @@ TEST(ArchiveTest, ArchiveTest3)
     fs::remove_all("sandbox");
     fs::remove_all("sandbox_output");
 }
+
+TEST(ArchiveTest, ArchiveTest4)
+{
+    namespace fs = std::filesystem;
+
+    std::string const directory {"sandbox/" + std::string(120, 'd')};
+    std::string const file {directory + "/" + std::string(90, 'f')};
+
+    fs::create_directories(directory);
+    fs::create_directory("sandbox_output");
+
+    std::system(std::string {"echo \"hello\" > " + file}.c_str());
+
+    std::vector<fs::path> files {fs::path {directory}, fs::path {file}};
+    std::vector<fs::path> temporaries {};
+
+    Collector::store_files(files, temporaries, fs::path {"sandbox_output/archive.tar"}, false);
+
+    std::system("cd sandbox_output && tar -xf archive.tar");
+
+    EXPECT_TRUE(fs::exists(fs::path {"sandbox_output"} / fs::path {file}));
+    EXPECT_EQ(fs::file_size(fs::path {"sandbox_output"} / fs::path {file}), 6);
+
+    fs::remove_all("sandbox");
+    fs::remove_all("sandbox_output");
+}
+
+TEST(ArchiveTest, ArchiveTest5)
+{
+    namespace fs = std::filesystem;
+
+    // more files than fit into a single batch, including a hard link
+    fs::create_directories("sandbox/dir");
+    fs::create_directory("sandbox_output");
+    for (int i {0}; i < 100; ++i)
+    {
+        std::ofstream {"sandbox/dir/file" + std::to_string(i)} << std::string(static_cast<std::size_t>(i) * 100, 'x');
+    }
+    std::system("head -c 70000 /dev/zero > sandbox/large");
+    fs::create_hard_link("sandbox/dir/file1", "sandbox/link");
+
+    auto files = Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES_AND_DIRECTORIES);
+
+    // archives written with and without io_uring have to be identical
+    {
+        TarWriter archive {"sandbox_output/ring.tar"};
+        EXPECT_EQ(archive.add(files), files.size());
+    }
+    IoRing::set_enabled(false);
+    {
+        TarWriter archive {"sandbox_output/plain.tar"};
+        EXPECT_EQ(archive.add(files), files.size());
+    }
+    IoRing::set_enabled(true);
+
+    std::ifstream ring {"sandbox_output/ring.tar", std::ios::binary};
+    std::ifstream plain {"sandbox_output/plain.tar", std::ios::binary};
+    std::string const actual {std::istreambuf_iterator<char> {ring}, std::istreambuf_iterator<char> {}};
+    std::string const expected {std::istreambuf_iterator<char> {plain}, std::istreambuf_iterator<char> {}};
+
+    EXPECT_EQ(actual, expected);
+
+    fs::remove_all("sandbox");
+    fs::remove_all("sandbox_output");
+}
+
+
+TEST(ArchiveTest, PrefetchTest)
+{
+    namespace fs = std::filesystem;
+
+    // files of many sizes, a file larger than the prefetched files, a
+    // symbolic link and a hard link, read ahead within little memory
+    fs::create_directories("sandbox/dir");
+    fs::create_directory("sandbox_output");
+    for (int i {0}; i < 200; ++i)
+    {
+        std::ofstream {"sandbox/dir/file" + std::to_string(i)} << std::string(static_cast<std::size_t>(i * i) * 7, 'x');
+    }
+    std::system("head -c 700000 /dev/urandom > sandbox/large");
+    fs::create_symlink("dir/file3", "sandbox/symlink");
+    fs::create_hard_link("sandbox/dir/file150", "sandbox/link");
+
+    auto files = Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES_AND_DIRECTORIES);
+
+    // archives written with and without readers have to be identical
+    {
+        TarWriter archive {"sandbox_output/prefetched.tar"};
+        archive.set_prefetch(PrefetchOptions {3, 1 << 20, 0});
+        EXPECT_EQ(archive.add(files), files.size());
+    }
+    {
+        TarWriter archive {"sandbox_output/plain.tar"};
+        EXPECT_EQ(archive.add(files), files.size());
+    }
+
+    std::ifstream prefetched {"sandbox_output/prefetched.tar", std::ios::binary};
+    std::ifstream plain {"sandbox_output/plain.tar", std::ios::binary};
+    std::string const actual {std::istreambuf_iterator<char> {prefetched}, std::istreambuf_iterator<char> {}};
+    std::string const expected {std::istreambuf_iterator<char> {plain}, std::istreambuf_iterator<char> {}};
+
+    EXPECT_EQ(actual, expected);
+
+    fs::remove_all("sandbox");
+    fs::remove_all("sandbox_output");
+}
+
+TEST(ArchiveTest, GrowingFileTest)
+{
+    namespace fs = std::filesystem;
+
+    fs::create_directory("sandbox");
+    fs::create_directory("sandbox_output");
+
+    std::ofstream core {"sandbox/core"};
+    core << std::string(1000, 'a') << std::flush;
+
+    // the file grows every time the writer waits for data
+    {
+        TarWriter archive {"sandbox_output/archive.tar"};
+        int waits {0};
+        EXPECT_TRUE(archive.add_growing(fs::path {"sandbox/core"}, [&]
+        {
+            core << std::string(100000, static_cast<char>('b' + waits)) << std::flush;
+            return ++waits < 3;
+        }));
+        EXPECT_EQ(waits, 3);
+    }
+    core.close();
+
+    std::system("cd sandbox_output && tar -xf archive.tar");
+
+    EXPECT_EQ(fs::file_size(fs::path {"sandbox_output/sandbox/core"}), 301000);
+    EXPECT_EQ(std::system("cmp -s sandbox/core sandbox_output/sandbox/core"), 0);
+
+    fs::remove_all("sandbox");
+    fs::remove_all("sandbox_output");
+}
+
+
+TEST(CompressionTest, ExtractTest)
+{
+    namespace fs = std::filesystem;
+
+    fs::create_directories("sandbox/dir");
+    fs::create_directory("sandbox_output");
+    for (int i {0}; i < 20; ++i)
+    {
+        std::ofstream {"sandbox/dir/file" + std::to_string(i)} << std::string(static_cast<std::size_t>(i) * 1000, static_cast<char>('a' + i));
+    }
+
+    auto files = Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES_AND_DIRECTORIES);
+
+    for (Compression const algorithm : {Compression::ZSTD, Compression::LZ4})
+    {
+        if (!BlockCompressor::supported(algorithm))
+        {
+            continue;
+        }
+
+        // small blocks, such that members span several frames
+        CompressionOptions options {};
+        options.algorithm = algorithm;
+        options.threads = 4;
+        options.block_size = 4096;
+
+        {
+            TarWriter archive {"sandbox_output/archive.tar" + BlockCompressor::extension(algorithm), options};
+            EXPECT_EQ(archive.add(files), files.size());
+            EXPECT_TRUE(archive.finish());
+        }
+
+        // a single member can be pulled out of the compressed archive
+        EXPECT_TRUE(BlockCompressor::extract("sandbox_output/archive.tar" + BlockCompressor::extension(algorithm), "sandbox/dir/file13", "sandbox_output/member.tar"));
+        EXPECT_FALSE(BlockCompressor::extract("sandbox_output/archive.tar" + BlockCompressor::extension(algorithm), "sandbox/dir/missing", "sandbox_output/missing.tar"));
+
+        fs::create_directory("sandbox_output/extracted");
+        std::system("cd sandbox_output/extracted && tar -xf ../member.tar");
+
+        std::ifstream member {"sandbox_output/extracted/sandbox/dir/file13"};
+        std::string const actual {std::istreambuf_iterator<char> {member}, std::istreambuf_iterator<char> {}};
+        EXPECT_EQ(actual, std::string(13000, 'n'));
+        EXPECT_FALSE(fs::exists("sandbox_output/extracted/sandbox/dir/file12"));
+
+        fs::remove_all("sandbox_output/extracted");
+    }
+
+    fs::remove_all("sandbox");
+    fs::remove_all("sandbox_output");
+}
+
+
+TEST(ChunkStoreTest, Sha256Test)
+{
+    std::string const message {"abc"};
+    std::string const long_message(1000000, 'a');
+
+    EXPECT_EQ(Sha256::hex("", 0), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(Sha256::hex(message.data(), message.size()), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    EXPECT_EQ(Sha256::hex(long_message.data(), long_message.size()), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+
+    // hashing in pieces gives the same digest
+    Sha256 hash {};
+    for (std::size_t i {0}; i < long_message.size(); i += 999)
+    {
+        hash.update(long_message.data() + i, std::min<std::size_t>(999, long_message.size() - i));
+    }
+    EXPECT_EQ(Sha256::hex(hash.finish()), Sha256::hex(long_message.data(), long_message.size()));
+}
+
+TEST(ChunkStoreTest, RebuildTest)
+{
+    namespace fs = std::filesystem;
+
+    fs::create_directories("sandbox/dir with space");
+    fs::create_directory("sandbox_output");
+    std::ofstream {"sandbox/dir with space/small"} << "hello";
+    std::system("head -c 3000000 /dev/urandom > sandbox/large");
+    fs::create_symlink("large", "sandbox/symlink");
+
+    auto files = Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES_AND_DIRECTORIES);
+
+    ChunkStore store {"sandbox_output"};
+    ASSERT_TRUE(store.store(files, "sandbox_output/manifest.1.txt"));
+    EXPECT_EQ(store.bytes_skipped(), 0);
+    EXPECT_EQ(store.bytes_stored(), 3000005);
+
+    // the rebuilt archive equals an archive written directly
+    {
+        TarWriter archive {"sandbox_output/expected.tar"};
+        EXPECT_EQ(archive.add(files), files.size());
+    }
+    ASSERT_TRUE(ChunkStore::rebuild("sandbox_output/manifest.1.txt", "sandbox_output/chunks", "sandbox_output/actual.tar"));
+
+    std::ifstream expected_file {"sandbox_output/expected.tar", std::ios::binary};
+    std::ifstream actual_file {"sandbox_output/actual.tar", std::ios::binary};
+    std::string const expected {std::istreambuf_iterator<char> {expected_file}, std::istreambuf_iterator<char> {}};
+    std::string const actual {std::istreambuf_iterator<char> {actual_file}, std::istreambuf_iterator<char> {}};
+    EXPECT_EQ(actual, expected);
+
+    // unchanged files are skipped, an appended file only stores its last chunk
+    std::system("head -c 1000 /dev/urandom >> sandbox/large");
+    ASSERT_TRUE(store.store(files, "sandbox_output/manifest.2.txt"));
+    EXPECT_EQ(store.bytes_skipped(), 5);
+    EXPECT_EQ(store.bytes_stored(), 3000005 + 3001000 - 2 * CHUNK_SIZE);
+
+    // collections of other files keep the cache
+    ASSERT_TRUE(store.store({fs::path {"sandbox/dir with space/small"}}, "sandbox_output/manifest.3.txt"));
+    ASSERT_TRUE(store.store(files, "sandbox_output/manifest.4.txt"));
+    EXPECT_EQ(store.bytes_skipped(), 15 + 3001000);
+    EXPECT_EQ(store.bytes_stored(), 3000005 + 3001000 - 2 * CHUNK_SIZE);
+
+    // files beyond the limit of the cache are read again, but their chunks
+    // are not stored twice
+    ChunkStore bounded {"sandbox_output", 2};
+    ASSERT_TRUE(bounded.store({fs::path {"sandbox/large"}}, "sandbox_output/manifest.6.txt"));
+    ASSERT_TRUE(bounded.store({fs::path {"sandbox/large"}}, "sandbox_output/manifest.7.txt"));
+    EXPECT_EQ(bounded.bytes_skipped(), 0);
+    EXPECT_EQ(bounded.bytes_stored(), 0);
+
+    // corrupted entries are reported instead of aborting
+    std::ofstream {"sandbox_output/manifest.5.txt"} << "collector-manifest 1\n0 420 0 0 0 0 0 0 bad%Z - -\n";
+    EXPECT_FALSE(ChunkStore::rebuild("sandbox_output/manifest.5.txt", "sandbox_output/chunks", "sandbox_output/corrupted.tar"));
+
+    fs::remove_all("sandbox");
+    fs::remove_all("sandbox_output");
+}
+
+
+TEST(MetricsTest, HistogramTest)
+{
+    using namespace std::chrono_literals;
+
+    Histogram histogram {};
+    histogram.observe(0ns);
+    histogram.observe(1001ns);
+    histogram.observe(3us);
+    histogram.observe(4us);
+    histogram.observe(4001ns);
+    histogram.observe(5us);
+    histogram.observe(2h);
+
+    std::ostringstream text {};
+    histogram.write(text, "test_seconds", "Test.");
+    std::string const output {text.str()};
+
+    // buckets are cumulative, bounds grow by a factor of 4 from 1 µs and are
+    // exact to the nanosecond
+    EXPECT_EQ(histogram.count(), 7);
+    EXPECT_NE(output.find("# TYPE test_seconds histogram\n"), std::string::npos);
+    EXPECT_NE(output.find("test_seconds_bucket{le=\"1e-06\"} 1\n"), std::string::npos);
+    EXPECT_NE(output.find("test_seconds_bucket{le=\"4e-06\"} 4\n"), std::string::npos);
+    EXPECT_NE(output.find("test_seconds_bucket{le=\"1.6e-05\"} 6\n"), std::string::npos);
+    EXPECT_NE(output.find("test_seconds_bucket{le=\"67.1089\"} 6\n"), std::string::npos);
+    EXPECT_NE(output.find("test_seconds_bucket{le=\"+Inf\"} 7\n"), std::string::npos);
+    EXPECT_NE(output.find("test_seconds_count 7\n"), std::string::npos);
+}
+
+
+TEST(IoRingTest, StatxTest)
+{
+    if (!IoRing::supported())
+    {
+        GTEST_SKIP() << "io_uring is not supported";
+    }
+
+    IoRing ring {4};
+    ASSERT_TRUE(ring.is_open());
+
+    // more names than fit into the submission queue, including a missing one
+    std::vector<char const*> names {"/", "/tmp", "/proc", "/dev/null", "/missing", "/etc"};
+    std::vector<struct statx> statuses {};
+    std::vector<std::int32_t> results {};
+
+    ASSERT_TRUE(ring.statx_all(AT_FDCWD, names, AT_SYMLINK_NOFOLLOW, STATX_INO, statuses, results));
+    EXPECT_EQ(ring.in_flight(), 0);
+
+    for (std::size_t i {0}; i < names.size(); ++i)
+    {
+        struct statx expected {};
+        int const result {statx(AT_FDCWD, names[i], AT_SYMLINK_NOFOLLOW, STATX_INO, &expected) == 0 ? 0 : -errno};
+
+        EXPECT_EQ(results[i], result) << names[i];
+        EXPECT_EQ(statuses[i].stx_ino, expected.stx_ino) << names[i];
+    }
+}
+
+
+TEST(FifoTest, TimeoutTest)
+{
+    blocking_fifo<int> queue {};
+    int item {0};
+
+    using namespace std::chrono_literals;
+    EXPECT_FALSE(queue.pop(item, 10ms));
+
+    queue.push(1);
+    EXPECT_TRUE(queue.pop(item, 10ms));
+    EXPECT_EQ(item, 1);
+}
+
+TEST(FifoTest, WakeupTest)
+{
+    blocking_fifo<int> queue {};
+    int item {0};
+
+    std::thread producer {[&queue] { queue.push(2); }};
+    EXPECT_TRUE(queue.pop(item));
+    EXPECT_EQ(item, 2);
+
+    producer.join();
+}
+
+TEST(FifoTest, CloseTest)
+{
+    blocking_fifo<int> queue {};
+    int item {0};
+
+    queue.push(3);
+    std::thread closer {[&queue] { queue.close(); }};
+    closer.join();
+
+    // remaining elements are still available after closing
+    EXPECT_TRUE(queue.pop(item));
+    EXPECT_EQ(item, 3);
+    EXPECT_FALSE(queue.pop(item));
+    EXPECT_TRUE(queue.closed());
+}
+
+TEST(LockfreeFifoTest, OrderTest)
+{
+    lockfree_fifo<std::string> queue {3};
+    std::string item {};
+
+    EXPECT_EQ(queue.capacity(), 4);
+    EXPECT_TRUE(queue.empty());
+
+    for (int i {0}; i < 4; ++i)
+    {
+        EXPECT_TRUE(queue.try_push(std::to_string(i)));
+    }
+    EXPECT_FALSE(queue.try_push("full"));
+    EXPECT_EQ(queue.size(), 4);
+    EXPECT_EQ(queue.front(), "0");
+
+    for (int i {0}; i < 4; ++i)
+    {
+        EXPECT_TRUE(queue.try_pop(item));
+        EXPECT_EQ(item, std::to_string(i));
+    }
+    EXPECT_FALSE(queue.try_pop(item));
+
+    using namespace std::chrono_literals;
+    EXPECT_FALSE(queue.pop(item, 10ms));
+}
+
+TEST(LockfreeFifoTest, ConcurrencyTest)
+{
+    constexpr int PRODUCERS {4};
+    constexpr int CONSUMERS {4};
+    constexpr int ITEMS {100000};
+
+    // a small capacity makes producers as well as consumers wait
+    fifo_ptr<int> queue {std::make_unique<lockfree_fifo<int>>(8)};
+    std::atomic<long long> sum {0};
+    std::atomic<int> count {0};
+
+    std::vector<std::thread> threads {};
+    for (int i {0}; i < CONSUMERS; ++i)
+    {
+        threads.emplace_back([&]
+        {
+            int item {0};
+            while (queue->pop(item))
+            {
+                sum += item;
+                ++count;
+            }
+        });
+    }
+    for (int i {0}; i < PRODUCERS; ++i)
+    {
+        threads.emplace_back([&, i]
+        {
+            for (int j {i}; j < ITEMS; j += PRODUCERS)
+            {
+                queue->push(j);
+            }
+        });
+    }
+
+    for (int i {CONSUMERS}; i < CONSUMERS + PRODUCERS; ++i)
+    {
+        threads[i].join();
+    }
+    while (!queue->empty())
+    {
+        std::this_thread::yield();
+    }
+    queue->close();
+    for (int i {0}; i < CONSUMERS; ++i)
+    {
+        threads[i].join();
+    }
+
+    EXPECT_EQ(count.load(), ITEMS);
+    EXPECT_EQ(sum.load(), static_cast<long long>(ITEMS) * (ITEMS - 1) / 2);
+}
+
+TEST(LockfreeFifoTest, CloseTest)
+{
+    lockfree_fifo<int> queue {2};
+    int item {0};
+
+    EXPECT_TRUE(queue.try_push(1));
+    EXPECT_TRUE(queue.try_push(2));
+
+    // the producer blocks on the full queue until it is closed
+    std::atomic<bool> returned {false};
+    std::thread producer {[&queue, &returned]
+    {
+        queue.push(3);
+        returned = true;
+    }};
+
+    using namespace std::chrono_literals;
+    std::this_thread::sleep_for(20ms);
+    EXPECT_FALSE(returned.load());
+
+    queue.close();
+    producer.join();
+    EXPECT_TRUE(returned.load());
+
+    EXPECT_TRUE(queue.pop(item));
+    EXPECT_EQ(item, 1);
+    EXPECT_TRUE(queue.pop(item));
+    EXPECT_EQ(item, 2);
+    EXPECT_FALSE(queue.pop(item));
+}
+
+
+TEST(TriggerQueueTest, PolicyTest)
+{
+    auto const trigger = [](std::string const& directory, std::string const& file)
+    {
+        return Trigger {directory, {std::filesystem::path {directory} / file}, {}, {}, 0};
+    };
+
+    // the first trigger of every service takes the priority lane, repeats
+    // fill the regular lane of two triggers
+    Metrics metrics {};
+    TriggerQueue oldest {2, OverflowPolicy::DROP_OLDEST, &metrics};
+    for (int i {0}; i < 4; ++i)
+    {
+        oldest.push(trigger("a", "core.A." + std::to_string(i) + ".lz4"));
+    }
+    oldest.push(trigger("b", "core.B.0.lz4"));
+
+    EXPECT_EQ(TriggerQueue::service(oldest.front()), "A");
+    EXPECT_EQ(oldest.pop().files.front().filename(), "core.A.0.lz4");
+    EXPECT_EQ(oldest.pop().files.front().filename(), "core.B.0.lz4");
+    EXPECT_EQ(oldest.pop().files.front().filename(), "core.A.2.lz4");
+    EXPECT_EQ(oldest.pop().files.front().filename(), "core.A.3.lz4");
+    EXPECT_TRUE(oldest.empty());
+    EXPECT_EQ(metrics.prioritized, 2);
+    EXPECT_EQ(metrics.dropped_oldest, 1);
+
+    // once its triggers are popped, a service takes the priority lane again
+    oldest.push(trigger("a", "core.A.4.lz4"));
+    oldest.push(trigger("a", "core.A.5.lz4"));
+    oldest.push(trigger("b", "core.B.1.lz4"));
+    EXPECT_EQ(oldest.pop().files.front().filename(), "core.A.4.lz4");
+    EXPECT_EQ(oldest.pop().files.front().filename(), "core.B.1.lz4");
+    EXPECT_EQ(oldest.pop().files.front().filename(), "core.A.5.lz4");
+    EXPECT_EQ(metrics.prioritized, 4);
+
+    TriggerQueue newest {1, OverflowPolicy::DROP_NEWEST, &metrics};
+    newest.push(trigger("a", "core.A.0.lz4"));
+    newest.push(trigger("a", "core.A.1.lz4"));
+    newest.push(trigger("a", "core.A.2.lz4"));
+    newest.pop();
+    EXPECT_EQ(newest.pop().files.front().filename(), "core.A.1.lz4");
+    EXPECT_EQ(metrics.dropped_newest, 1);
+
+    // full queues merge repeats into a queued trigger of the directory
+    TriggerQueue coalescing {1, OverflowPolicy::COALESCE, &metrics};
+    coalescing.push(trigger("a", "core.A.0.lz4"));
+    coalescing.push(trigger("a", "core.A.1.lz4"));
+    coalescing.push(trigger("a", "core.A.2.lz4"));
+    coalescing.push(trigger("c", "core.A.3.lz4"));
+    coalescing.pop();
+    EXPECT_EQ(coalescing.pop().files.size(), 2);
+    EXPECT_TRUE(coalescing.empty());
+    EXPECT_EQ(metrics.coalesced, 1);
+    EXPECT_EQ(metrics.dropped_newest, 2);
+    EXPECT_EQ(metrics.dropped, 3);
+}
+
+TEST(TriggerQueueTest, BlockTest)
+{
+    Metrics metrics {};
+    TriggerQueue queue {1, OverflowPolicy::BLOCK, &metrics};
+    queue.push(Trigger {"a", {"a/core.A.0.lz4"}, {}, {}, 0});
+    queue.push(Trigger {"a", {"a/core.A.1.lz4"}, {}, {}, 0});
+
+    // the producer waits until a trigger is popped, or the queue is closed
+    std::thread producer {[&queue]
+    {
+        queue.push(Trigger {"a", {"a/core.A.2.lz4"}, {}, {}, 0});
+        queue.push(Trigger {"a", {"a/core.A.3.lz4"}, {}, {}, 0});
+    }};
+    while (metrics.blocked < 1)
+    {
+        std::this_thread::yield();
+    }
+    Trigger item {};
+    EXPECT_TRUE(queue.pop(item));
+    EXPECT_TRUE(queue.pop(item));
+    EXPECT_EQ(item.files.front().filename(), "core.A.1.lz4");
+
+    while (metrics.blocked < 2)
+    {
+        std::this_thread::yield();
+    }
+    queue.close();
+    producer.join();
+
+    EXPECT_EQ(queue.size(), 1);
+    EXPECT_EQ(metrics.dropped, 1);
+}
+
+TEST(ThrottleTest, RateTest)
+{
+    EXPECT_EQ(Throttle::parse("20M"), 20u << 20);
+    EXPECT_EQ(Throttle::parse("512"), 512u);
+    EXPECT_FALSE(Throttle::parse("fast"));
+    EXPECT_FALSE(Throttle::parse("1T"));
+    EXPECT_FALSE(Throttle::parse("-1"));
+    EXPECT_FALSE(Throttle::parse(" 1"));
+    EXPECT_FALSE(Throttle::parse("17179869184G"));
+    EXPECT_EQ(Throttle::parse("17179869183G"), 17179869183ull << 30);
+
+    Throttle unlimited {};
+    EXPECT_FALSE(unlimited.limited());
+
+    // a second worth of tokens is free, anything beyond waits for the rate
+    Throttle operations {0, 100};
+    auto const start {std::chrono::steady_clock::now()};
+    operations.acquire(0, 100);
+    operations.acquire(0, 20);
+    auto const elapsed {std::chrono::steady_clock::now() - start};
+
+    EXPECT_GE(elapsed, std::chrono::milliseconds {190});
+    EXPECT_LT(elapsed, std::chrono::milliseconds {1000});
+    EXPECT_GE(operations.waited(), std::chrono::milliseconds {190});
+}
+
+TEST(ThrottleTest, ArchiveTest)
+{
+    namespace fs = std::filesystem;
+
+    fs::create_directory("sandbox");
+    std::system("head -c 3145728 /dev/urandom > sandbox/file");
+
+    // 3 MiB at 2 MiB/s, a second worth of which is free
+    PathTable files {};
+    Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES, files);
+    Throttle throttle {2 << 20, 0};
+    auto const start {std::chrono::steady_clock::now()};
+    Collector::store_files(files, {}, fs::path {"sandbox.tar"}, false, {}, nullptr, &throttle);
+
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds {450});
+    EXPECT_EQ(std::system("tar -xOf sandbox.tar sandbox/file | cmp -s - sandbox/file"), 0);
+
+    fs::remove_all("sandbox");
+    fs::remove("sandbox.tar");
+}
+
+TEST(ThrottleTest, PriorityTest)
+{
+    WorkerPriority priority {};
+    EXPECT_TRUE(priority.parse_io_class("best-effort:6"));
+    EXPECT_EQ(priority.io_level, 6);
+    EXPECT_FALSE(priority.parse_io_class("realtime"));
+    EXPECT_TRUE(priority.parse_io_class("idle"));
+    priority.nice = 3;
+
+    // priorities apply to the calling thread only
+    int const nice {getpriority(PRIO_PROCESS, 0)};
+    std::thread worker {[&priority, nice]
+    {
+        EXPECT_TRUE(priority.apply());
+        EXPECT_EQ(getpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid))), std::min(nice + 3, 19));
+        EXPECT_EQ(syscall(SYS_ioprio_get, 1, 0) >> 13, 3);
+    }};
+    worker.join();
+
+    EXPECT_EQ(getpriority(PRIO_PROCESS, 0), nice);
+}
+
+TEST(CacheTest, NeutralTest)
+{
+    namespace fs = std::filesystem;
+
+    // resident pages of a file, one flag per page
+    auto const residency {[](fs::path const& file)
+    {
+        std::vector<unsigned char> pages {};
+        int const file_descriptor {open(file.c_str(), O_RDONLY)};
+        std::size_t const size {static_cast<std::size_t>(fs::file_size(file))};
+        void* const mapping {mmap(nullptr, size, PROT_READ, MAP_SHARED, file_descriptor, 0)};
+        if (mapping != MAP_FAILED)
+        {
+            pages.resize((size + sysconf(_SC_PAGESIZE) - 1) / sysconf(_SC_PAGESIZE));
+            mincore(mapping, size, pages.data());
+            munmap(mapping, size);
+        }
+        close(file_descriptor);
+        return pages;
+    }};
+
+    fs::create_directory("sandbox");
+    std::system("head -c 20971520 /dev/urandom > sandbox/file && sync sandbox/file");
+
+    // only the first MiB is cached when the collection starts
+    {
+        int const file_descriptor {open("sandbox/file", O_RDONLY)};
+        posix_fadvise(file_descriptor, 0, 0, POSIX_FADV_DONTNEED);
+        std::vector<char> buffer(1 << 20);
+        EXPECT_EQ(pread(file_descriptor, buffer.data(), buffer.size(), 0), 1 << 20);
+        close(file_descriptor);
+    }
+
+    PathTable files {};
+    Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES, files);
+    Collector::store_files(files, {}, fs::path {"sandbox.tar"}, false, {}, nullptr, nullptr, CacheOptions {true, 0});
+
+    // the pages cached before, up to the readahead of the first read, are
+    // kept, the others are dropped
+    std::vector<unsigned char> const pages {residency("sandbox/file")};
+    std::size_t const page_size {static_cast<std::size_t>(sysconf(_SC_PAGESIZE))};
+    ASSERT_EQ(pages.size(), (20 << 20) / page_size);
+    EXPECT_EQ(std::count_if(pages.begin(), pages.begin() + (1 << 20) / page_size, [](unsigned char page) { return page & 1; }), (1 << 20) / page_size);
+    EXPECT_EQ(std::count_if(pages.begin() + (2 << 20) / page_size, pages.end(), [](unsigned char page) { return page & 1; }), 0);
+
+    // reading the file for the comparison caches it
+    EXPECT_EQ(std::system("tar -xOf sandbox.tar sandbox/file | cmp -s - sandbox/file"), 0);
+
+    fs::remove_all("sandbox");
+    fs::remove("sandbox.tar");
+}
+
+TEST(CacheTest, DirectTest)
+{
+    namespace fs = std::filesystem;
+
+    // the odd size leaves a partial block at the end of the direct reads
+    fs::create_directory("sandbox");
+    std::system("head -c 3000001 /dev/urandom > sandbox/large && head -c 1000 /dev/urandom > sandbox/small");
+
+    PathTable files {};
+    Collector::collect_files(fs::path {"sandbox"}, FileSelection::FILES, files);
+    Collector::store_files(files, {}, fs::path {"sandbox.tar"}, false, {}, nullptr, nullptr, CacheOptions {false, 1 << 20});
+
+    EXPECT_EQ(std::system("tar -xOf sandbox.tar sandbox/large | cmp -s - sandbox/large"), 0);
+    EXPECT_EQ(std::system("tar -xOf sandbox.tar sandbox/small | cmp -s - sandbox/small"), 0);
+
+    fs::remove_all("sandbox");
+    fs::remove("sandbox.tar");
+}
+
+TEST(PrefetcherTest, MemoryTest)
+{
+    namespace fs = std::filesystem;
+
+    fs::create_directory("sandbox");
+    std::vector<fs::path> files {};
+    for (int i {0}; i < 64; ++i)
+    {
+        files.emplace_back("sandbox/file" + std::to_string(i));
+        std::ofstream {files.back()} << std::string(static_cast<std::size_t>(i) * 2000 + 1, static_cast<char>('a' + i % 26));
+    }
+    files.emplace_back("sandbox/missing");
+
+    // the slow consumer lets the readers run into the memory limit
+    Prefetcher prefetcher {files.size(), [&files](std::size_t const i) { return files[i]; }, PrefetchOptions {4, 512 << 10, 0}};
+    for (std::size_t i {0}; i < files.size(); ++i)
+    {
+        Prefetcher::File const& file {prefetcher.take()};
+        if (i + 1 == files.size())
+        {
+            EXPECT_EQ(file.result, -ENOENT);
+            EXPECT_EQ(file.contents, nullptr);
+        }
+        else
+        {
+            ASSERT_NE(file.contents, nullptr);
+            EXPECT_EQ(std::string(file.contents, file.length), std::string(i * 2000 + 1, static_cast<char>('a' + i % 26)));
+        }
+        prefetcher.release();
+        std::this_thread::sleep_for(std::chrono::milliseconds {1});
+    }
+
+    EXPECT_EQ(prefetcher.prefetched(), 64u);
+    EXPECT_LE(prefetcher.peak_memory(), 512u << 10);
+
+    fs::remove_all("sandbox");
+}
+
+TEST(EventBufferTest, AdaptTest)
+{
+    EventBuffer buffer {};
+    EXPECT_EQ(buffer.size(), EVENT_BUFFER_MIN_SIZE);
+
+    // full reads double the buffer up to its maximum
+    EXPECT_FALSE(buffer.update(buffer.size()));
+    EXPECT_EQ(buffer.size(), 2 * EVENT_BUFFER_MIN_SIZE);
+    buffer.reserve(10 * EVENT_BUFFER_MAX_SIZE);
+    EXPECT_EQ(buffer.size(), EVENT_BUFFER_MAX_SIZE);
+    EXPECT_FALSE(buffer.update(buffer.size() - 100));
+    EXPECT_EQ(buffer.size(), EVENT_BUFFER_MAX_SIZE);
+
+    // a read leaving room for another event drained the queue, many small
+    // reads shrink the buffer again
+    int reads {0};
+    while (buffer.size() == EVENT_BUFFER_MAX_SIZE && reads < 1000)
+    {
+        EXPECT_TRUE(buffer.update(100));
+        ++reads;
+    }
+    EXPECT_EQ(buffer.size(), EVENT_BUFFER_MAX_SIZE / 2);
+    EXPECT_GT(reads, 1);
+
+    // a single large read resets the count of small reads
+    EXPECT_TRUE(buffer.update(buffer.size() / 2));
+    EXPECT_TRUE(buffer.update(100));
+    EXPECT_EQ(buffer.size(), EVENT_BUFFER_MAX_SIZE / 2);
+}
+
+
+TEST(SnapshotTest, CaptureTest)
+{
+    namespace fs = std::filesystem;
+
+    fs::create_directory("sandbox");
+    std::ofstream {"sandbox/log"} << "before";
+    fs::permissions("sandbox/log", fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read);
+    fs::last_write_time("sandbox/log", fs::file_time_type {} + std::chrono::hours {24 * 365 * 40});
+
+    // small files are cloned or copied, later writes do not change them
+    Snapshot snapshot {"sandbox/snapshot"};
+    fs::path const captured {snapshot.add("sandbox/log")};
+    EXPECT_EQ(captured, fs::path {"sandbox/snapshot/0"});
+    EXPECT_EQ(snapshot.count(SnapshotMethod::REFLINK) + snapshot.count(SnapshotMethod::COPY), 1);
+
+    std::ofstream {"sandbox/log"} << "after, rewritten";
+
+    std::string contents {};
+    std::ifstream {captured} >> contents;
+    EXPECT_EQ(contents, "before");
+    EXPECT_EQ(fs::status(captured).permissions(), fs::perms::owner_read | fs::perms::owner_write | fs::perms::group_read);
+    EXPECT_EQ(fs::last_write_time(captured), fs::file_time_type {} + std::chrono::hours {24 * 365 * 40});
+
+    // large files are linked unless cloned, anything else is not captured
+    std::ofstream {"sandbox/core"} << std::string(SNAPSHOT_COPY_LIMIT + 1, 'c');
+    fs::create_directory("sandbox/directory");
+    std::size_t const copied {snapshot.count(SnapshotMethod::COPY)};
+    EXPECT_EQ(snapshot.add("sandbox/core"), fs::path {"sandbox/snapshot/1"});
+    EXPECT_EQ(snapshot.count(SnapshotMethod::COPY), copied);
+    EXPECT_EQ(fs::file_size("sandbox/snapshot/1"), SNAPSHOT_COPY_LIMIT + 1);
+    EXPECT_EQ(snapshot.add("sandbox/directory"), fs::path {"sandbox/directory"});
+    EXPECT_EQ(snapshot.add("sandbox/missing"), fs::path {"sandbox/missing"});
+
+    fs::remove_all("sandbox");
+}
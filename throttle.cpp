@@ -0,0 +1,233 @@
+/**
+ * @file throttle.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of I/O rate limits and priorities of collections
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "throttle.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/*
+ * For I/O priorities, the ioprio_set man page was referenced, glibc provides
+ * no wrapper.
+ *
+ * See https://man7.org/linux/man-pages/man2/ioprio_set.2.html.
+ */
+
+
+namespace
+{
+    constexpr int IOPRIO_WHO_PROCESS {1};
+    constexpr int IOPRIO_CLASS_SHIFT {13};
+    constexpr int IOPRIO_CLASS_BE {2};
+    constexpr int IOPRIO_CLASS_IDLE {3};
+}
+
+
+Throttle::Throttle(std::uint64_t const bytes_per_second, std::uint64_t const operations_per_second) :
+    bytes {static_cast<double>(bytes_per_second), static_cast<double>(bytes_per_second)},
+    operations {static_cast<double>(operations_per_second), static_cast<double>(operations_per_second)},
+    updated {std::chrono::steady_clock::now()}
+{
+}
+
+
+void Throttle::acquire(std::uint64_t const bytes, std::uint64_t const operations)
+{
+    if (!limited())
+    {
+        return;
+    }
+
+    double wait {0};
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        auto const now {std::chrono::steady_clock::now()};
+        double const elapsed {std::chrono::duration<double> {now - updated}.count()};
+        updated = now;
+
+        wait = std::max(take(this->bytes, elapsed, bytes), take(this->operations, elapsed, operations));
+    }
+
+    if (wait > 0)
+    {
+        auto const duration {std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double> {wait})};
+        waiting.fetch_add(static_cast<std::uint64_t>(duration.count()), std::memory_order_relaxed);
+        std::this_thread::sleep_for(duration);
+    }
+}
+
+
+bool Throttle::limited() const
+{
+    return bytes.rate > 0 || operations.rate > 0;
+}
+
+
+std::chrono::nanoseconds Throttle::waited() const
+{
+    return std::chrono::nanoseconds {waiting.load(std::memory_order_relaxed)};
+}
+
+
+std::optional<std::uint64_t> Throttle::parse(std::string const& value)
+{
+    // std::stoull skips whitespace and wraps negative numbers around
+    if (value.empty() || !std::isdigit(static_cast<unsigned char>(value.front())))
+    {
+        return std::nullopt;
+    }
+
+    std::size_t end {0};
+    std::uint64_t rate {0};
+    try
+    {
+        rate = std::stoull(value, &end);
+    }
+    catch (std::exception const&)
+    {
+        return std::nullopt;
+    }
+
+    std::string const suffix {value.substr(end)};
+    unsigned int shift {0};
+    if (suffix == "K" || suffix == "k")
+    {
+        shift = 10;
+    }
+    else if (suffix == "M")
+    {
+        shift = 20;
+    }
+    else if (suffix == "G")
+    {
+        shift = 30;
+    }
+    else if (!suffix.empty())
+    {
+        return std::nullopt;
+    }
+
+    if (rate > std::numeric_limits<std::uint64_t>::max() >> shift)
+    {
+        return std::nullopt;
+    }
+    return rate << shift;
+}
+
+
+double Throttle::take(Bucket& bucket, double const elapsed, std::uint64_t const amount)
+{
+    if (bucket.rate <= 0)
+    {
+        return 0;
+    }
+
+    // refill up to one second worth of tokens, then go into debt if needed
+    bucket.tokens = std::min(bucket.rate, bucket.tokens + elapsed * bucket.rate);
+    bucket.tokens -= static_cast<double>(amount);
+    return bucket.tokens < 0 ? -bucket.tokens / bucket.rate : 0;
+}
+
+
+bool WorkerPriority::apply() const
+{
+    bool result {true};
+
+    // on Linux, all of these apply to the calling thread only
+    if (io_class != IoClass::UNCHANGED)
+    {
+        int const value
+        {
+            io_class == IoClass::IDLE
+                ? IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT
+                : (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | std::clamp(io_level, 0, 7)
+        };
+        if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, value) != 0)
+        {
+            std::cerr << "Cannot set I/O priority: " << std::strerror(errno) << std::endl;
+            result = false;
+        }
+    }
+
+    if (idle_scheduling)
+    {
+        sched_param const parameters {};
+        if (sched_setscheduler(0, SCHED_IDLE, &parameters) != 0)
+        {
+            std::cerr << "Cannot set SCHED_IDLE: " << std::strerror(errno) << std::endl;
+            result = false;
+        }
+    }
+
+    if (nice != 0)
+    {
+        auto const thread {static_cast<id_t>(syscall(SYS_gettid))};
+        errno = 0;
+        int const current {getpriority(PRIO_PROCESS, thread)};
+        if ((current == -1 && errno != 0) || setpriority(PRIO_PROCESS, thread, current + nice) != 0)
+        {
+            std::cerr << "Cannot set nice value: " << std::strerror(errno) << std::endl;
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+
+bool WorkerPriority::parse_io_class(std::string const& value)
+{
+    if (value == "idle")
+    {
+        io_class = IoClass::IDLE;
+        return true;
+    }
+
+    std::string const prefix {"best-effort"};
+    if (value.compare(0, prefix.size(), prefix) != 0)
+    {
+        return false;
+    }
+    io_class = IoClass::BEST_EFFORT;
+    if (value.size() == prefix.size())
+    {
+        return true;
+    }
+    if (value.size() != prefix.size() + 2 || value[prefix.size()] != ':' || value.back() < '0' || value.back() > '7')
+    {
+        return false;
+    }
+    io_level = value.back() - '0';
+    return true;
+}
+
+
+unsigned int available_cpus()
+{
+    cpu_set_t cpus {};
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) == 0)
+    {
+        return std::max(static_cast<unsigned int>(CPU_COUNT(&cpus)), 1u);
+    }
+    return std::max(std::thread::hardware_concurrency(), 1u);
+}
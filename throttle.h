@@ -0,0 +1,192 @@
+/**
+ * @file throttle.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of I/O rate limits and priorities of collections
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+
+
+/**
+ * @brief Largest amount of bytes a throttled copy transfers at once, such that
+ * waits stay short and evenly spread
+ *
+ */
+constexpr std::uint64_t THROTTLE_CHUNK_SIZE = 1 << 20;
+
+
+/**
+ * @brief Token buckets limiting the bytes and the I/O operations per second
+ * of every stage sharing them.
+ *
+ * Either bucket holds up to one second worth of tokens.
+ * Callers take the tokens of an operation before issuing it and sleep while
+ * the buckets are in debt, hence a request larger than a bucket is admitted
+ * and paid for by the following requests, which keeps the long-term rate
+ * exact for any request size.
+ * A rate of 0 does not limit its bucket.
+ * The buckets may be shared by several threads, they are served in the order
+ * they took their tokens.
+ *
+ */
+class Throttle
+{
+public:
+    /**
+     * @brief Construct a new Throttle object
+     *
+     * @param bytes_per_second Rate of bytes, 0 for no limit
+     * @param operations_per_second Rate of I/O operations, 0 for no limit
+     */
+    explicit Throttle(std::uint64_t const bytes_per_second = 0, std::uint64_t const operations_per_second = 0);
+
+    /**
+     * @brief Take the tokens of an operation, waiting until the rates allow
+     * it
+     *
+     * @param bytes Number of bytes to transfer
+     * @param operations Number of I/O operations
+     */
+    void acquire(std::uint64_t const bytes, std::uint64_t const operations = 1);
+
+    /**
+     * @brief Checks whether any rate is limited
+     *
+     * @return true if acquiring may wait, false otherwise
+     */
+    bool limited() const;
+
+    /**
+     * @brief Get the total time callers waited for tokens
+     *
+     * @return waiting time
+     */
+    std::chrono::nanoseconds waited() const;
+
+    /**
+     * @brief Parse a rate with an optional binary suffix, e.g. "20M"
+     *
+     * @param value Decimal number followed by nothing, K, M or G
+     * @return rate, or nothing if the value is malformed or too large
+     */
+    static std::optional<std::uint64_t> parse(std::string const& value);
+
+private:
+    struct Bucket
+    {
+        double rate {0};
+        double tokens {0};
+    };
+
+    static double take(Bucket& bucket, double const elapsed, std::uint64_t const amount);
+
+private:
+    std::mutex mutex {};
+    Bucket bytes {};
+    Bucket operations {};
+    std::chrono::steady_clock::time_point updated {};
+    std::atomic<std::uint64_t> waiting {0};
+};
+
+
+/**
+ * @brief I/O scheduling class of the collector threads, see `ioprio_set(2)`
+ *
+ */
+enum class IoClass
+{
+    /**
+     * @brief Keep the class of the process
+     *
+     */
+    UNCHANGED,
+
+    /**
+     * @brief Served like other processes, at a priority level from 0
+     * (highest) to 7
+     *
+     */
+    BEST_EFFORT,
+
+    /**
+     * @brief Only served while no other process needs the disk
+     *
+     */
+    IDLE
+};
+
+
+/**
+ * @brief CPU and I/O priorities of the collector threads, lowered such that
+ * collections yield to the production service on the same machine.
+ *
+ * Threads started by a collector thread, e.g. compression or traversal
+ * threads, inherit its priorities.
+ *
+ */
+struct WorkerPriority
+{
+    /**
+     * @brief I/O scheduling class, only honoured by I/O schedulers that
+     * support classes, e.g. BFQ
+     *
+     */
+    IoClass io_class {IoClass::UNCHANGED};
+
+    /**
+     * @brief Level within the best-effort class, 0 (highest) to 7
+     *
+     */
+    int io_level {4};
+
+    /**
+     * @brief Schedule the threads with `SCHED_IDLE`, i.e. only on otherwise
+     * idle CPUs
+     *
+     */
+    bool idle_scheduling {false};
+
+    /**
+     * @brief Nice value added to the threads, 0 keeps their priority
+     *
+     */
+    int nice {0};
+
+    /**
+     * @brief Apply the priorities to the calling thread
+     *
+     * @return true on success, false if any priority could not be set
+     */
+    bool apply() const;
+
+    /**
+     * @brief Parse an I/O priority
+     *
+     * @param value "idle", "best-effort" or "best-effort:LEVEL"
+     * @return true if the value was valid, false otherwise
+     */
+    bool parse_io_class(std::string const& value);
+};
+
+
+/**
+ * @brief Get the number of CPUs the calling thread may run on, respecting its
+ * affinity mask, e.g. of `taskset` or a cgroup cpuset
+ *
+ * @return number of CPUs, at least 1
+ */
+unsigned int available_cpus();
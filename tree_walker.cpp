@@ -0,0 +1,301 @@
+/**
+ * @file tree_walker.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a parallel traversal of directory trees
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "tree_walker.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <thread>
+#include <tuple>
+#include <utility>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace
+{
+    /**
+     * @brief Directory entry as returned by the `getdents64` system call
+     *
+     */
+    struct LinuxDirent64
+    {
+        std::uint64_t d_ino;
+        std::int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[];
+    };
+
+
+    constexpr std::uint32_t NONE {PathTable::NONE};
+
+
+    bool is_dot(char const* name)
+    {
+        return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+    }
+}
+
+
+TreeWalker::TreeWalker(unsigned int const threads) :
+    threads {std::max(threads, 1u)},
+    queues(this->threads)
+{
+}
+
+
+bool TreeWalker::walk(std::filesystem::path const& path, PathTable& files, std::uint32_t const root)
+{
+    read_directories = 0;
+    stolen_directories = 0;
+    queried_types = 0;
+    failed = false;
+
+    Directory top {};
+    top.path = path.native();
+    top.top = true;
+    queues[0].directories.push_back(&top);
+    pending = 1;
+    queued = 1;
+
+    // the calling thread takes part in the traversal as first thread
+    std::vector<std::thread> helpers {};
+    for (std::size_t thread {1}; thread < threads; ++thread)
+    {
+        helpers.emplace_back(&TreeWalker::work, this, thread);
+    }
+    work(0);
+    for (auto& helper : helpers)
+    {
+        helper.join();
+    }
+
+    merge(top, files, root);
+    return !failed;
+}
+
+
+std::uint64_t TreeWalker::directories() const
+{
+    return read_directories;
+}
+
+
+std::uint64_t TreeWalker::steals() const
+{
+    return stolen_directories;
+}
+
+
+std::uint64_t TreeWalker::stats() const
+{
+    return queried_types;
+}
+
+
+void TreeWalker::work(std::size_t const thread)
+{
+    std::vector<char> buffer(DIRECTORY_BUFFER_SIZE);
+
+    // pending counts queued directories and those being read, whose
+    // subdirectories are queued before it is decremented
+    for (;;)
+    {
+        Directory* const directory {take(thread)};
+        if (directory)
+        {
+            read(*directory, thread, buffer);
+            if (--pending == 0)
+            {
+                wake();
+            }
+            continue;
+        }
+
+        // sleep instead of spinning while another thread reads a large
+        // directory, the CPU belongs to the monitored processes
+        std::unique_lock<std::mutex> lock {idle_mutex};
+        idle.wait(lock, [this] { return pending == 0 || queued > 0; });
+        if (pending == 0)
+        {
+            return;
+        }
+    }
+}
+
+
+void TreeWalker::wake()
+{
+    // the mutex orders the change of the counters before any waiting
+    // thread checks them, such that no wakeup is lost
+    {
+        std::lock_guard<std::mutex> lock {idle_mutex};
+    }
+    idle.notify_all();
+}
+
+
+TreeWalker::Directory* TreeWalker::take(std::size_t const thread)
+{
+    {
+        std::lock_guard<std::mutex> lock {queues[thread].mutex};
+        auto& own {queues[thread].directories};
+        if (!own.empty())
+        {
+            Directory* const directory {own.back()};
+            own.pop_back();
+            --queued;
+            return directory;
+        }
+    }
+
+    for (std::size_t i {1}; i < threads; ++i)
+    {
+        Queue& victim {queues[(thread + i) % threads]};
+        std::lock_guard<std::mutex> lock {victim.mutex};
+        if (!victim.directories.empty())
+        {
+            Directory* const directory {victim.directories.front()};
+            victim.directories.pop_front();
+            --queued;
+            ++stolen_directories;
+            return directory;
+        }
+    }
+    return nullptr;
+}
+
+
+void TreeWalker::read(Directory& directory, std::size_t const thread, std::vector<char>& buffer)
+{
+    // only the top directory may be a symbolic link, below it the
+    // subdirectories are known not to be links unless replaced meanwhile
+    int const flags {O_RDONLY | O_DIRECTORY | O_CLOEXEC | (directory.top ? 0 : O_NOFOLLOW)};
+    int const directory_descriptor {open(directory.path.c_str(), flags)};
+    if (directory_descriptor < 0)
+    {
+        std::cerr << "Cannot read directory " << directory.path << ": " << std::strerror(errno) << std::endl;
+        failed = true;
+        return;
+    }
+    ++read_directories;
+
+    std::string const prefix {directory.path.empty() || directory.path.back() == '/' ? directory.path : directory.path + '/'};
+    std::vector<Directory*> found {};
+
+    for (;;)
+    {
+        long const length {syscall(SYS_getdents64, directory_descriptor, buffer.data(), buffer.size())};
+        if (length < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (length < 0)
+        {
+            std::cerr << "Cannot read directory " << directory.path << ": " << std::strerror(errno) << std::endl;
+            failed = true;
+        }
+        if (length <= 0)
+        {
+            break;
+        }
+
+        for (long offset {0}; offset < length;)
+        {
+            auto const* const entry {reinterpret_cast<LinuxDirent64 const*>(buffer.data() + offset)};
+            offset += entry->d_reclen;
+
+            if (is_dot(entry->d_name))
+            {
+                continue;
+            }
+
+            bool is_directory {entry->d_type == DT_DIR};
+            if (entry->d_type == DT_UNKNOWN)
+            {
+                struct stat status {};
+                ++queried_types;
+                is_directory = fstatat(directory_descriptor, entry->d_name, &status, AT_SYMLINK_NOFOLLOW) == 0
+                    && S_ISDIR(status.st_mode);
+            }
+
+            std::uint32_t subdirectory {NONE};
+            if (is_directory)
+            {
+                subdirectory = static_cast<std::uint32_t>(directory.subdirectories.size());
+                directory.subdirectories.push_back(std::make_unique<Directory>());
+                directory.subdirectories.back()->path = prefix + entry->d_name;
+                found.push_back(directory.subdirectories.back().get());
+            }
+
+            directory.entries.emplace_back(static_cast<std::uint32_t>(directory.names.size()), subdirectory);
+            directory.names.append(entry->d_name);
+            directory.names.push_back('\0');
+        }
+    }
+    close(directory_descriptor);
+
+    // queue the subdirectories at once, in reverse, such that this thread
+    // continues with the first one and others steal the last ones
+    if (!found.empty())
+    {
+        pending += found.size();
+        {
+            std::lock_guard<std::mutex> lock {queues[thread].mutex};
+            queues[thread].directories.insert(queues[thread].directories.end(), found.rbegin(), found.rend());
+            queued += found.size();
+        }
+
+        // only idle threads are woken, this thread continues by itself
+        if (threads > 1 && found.size() > 1)
+        {
+            wake();
+        }
+    }
+}
+
+
+void TreeWalker::merge(Directory& directory, PathTable& files, std::uint32_t const root)
+{
+    // depth first, every directory is followed by its contents like
+    // `recursive_directory_iterator` lists them, listings are released as
+    // soon as they are merged
+    std::vector<std::tuple<Directory*, std::size_t, std::uint32_t>> stack {{&directory, 0, root}};
+    while (!stack.empty())
+    {
+        auto& [current, next, parent] = stack.back();
+        if (next == current->entries.size())
+        {
+            stack.pop_back();
+            if (!stack.empty())
+            {
+                Directory& above {*std::get<0>(stack.back())};
+                above.subdirectories[above.entries[std::get<1>(stack.back()) - 1].second].reset();
+            }
+            continue;
+        }
+
+        auto const [offset, subdirectory] = current->entries[next++];
+        std::uint32_t const entry {files.add(parent, std::string_view {current->names.c_str() + offset})};
+        if (subdirectory != NONE)
+        {
+            stack.emplace_back(current->subdirectories[subdirectory].get(), 0, entry);
+        }
+    }
+}
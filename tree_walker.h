@@ -0,0 +1,140 @@
+/**
+ * @file tree_walker.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a parallel traversal of directory trees
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include "path_table.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+/**
+ * @brief Size of the buffer every thread reads directory entries into with a
+ * single `getdents64` call
+ *
+ */
+constexpr std::size_t DIRECTORY_BUFFER_SIZE = 32 * 1024;
+
+
+/**
+ * @brief Traversal of a directory tree by a pool of threads, listing the same
+ * entries in the same order as `std::filesystem::recursive_directory_iterator`.
+ *
+ * Every thread owns a queue of directories, it pushes the subdirectories it
+ * finds and takes the most recent one itself, idle threads steal the oldest
+ * directory of another thread, i.e. the largest pending subtree, or sleep
+ * until a directory is queued or the traversal has finished.
+ * Entries are read in bulk with `getdents64`, their type is taken from
+ * `d_type`, only file systems that do not report it cost a `fstatat` per
+ * entry.
+ * Symbolic links are listed but not followed.
+ * Every directory keeps its own listing, the listings are merged into a
+ * `PathTable` once the traversal has finished.
+ *
+ */
+class TreeWalker
+{
+public:
+    /**
+     * @brief Construct a new TreeWalker object
+     *
+     * @param threads Number of threads, including the calling thread
+     */
+    explicit TreeWalker(unsigned int const threads = 1);
+
+    /**
+     * @brief List a directory tree, recursively
+     *
+     * Directories that cannot be read are listed without their contents.
+     *
+     * @param path Directory to list
+     * @param files Table to append the entries below `path` to
+     * @param root Entry of `path` within `files`
+     * @return true if every directory was read, false otherwise
+     */
+    bool walk(std::filesystem::path const& path, PathTable& files, std::uint32_t const root);
+
+    /**
+     * @brief Get the number of directories read by the last traversal
+     *
+     * @return number of directories
+     */
+    std::uint64_t directories() const;
+
+    /**
+     * @brief Get the number of directories of the last traversal taken from
+     * the queue of another thread
+     *
+     * @return number of directories
+     */
+    std::uint64_t steals() const;
+
+    /**
+     * @brief Get the number of entries of the last traversal whose type had to
+     * be queried with `fstatat`
+     *
+     * @return number of entries
+     */
+    std::uint64_t stats() const;
+
+private:
+    struct Directory
+    {
+        std::string path {};
+        bool top {false};
+
+        // names back to back, each terminated by a null character, and per
+        // entry the offset of its name and the index of its listing within
+        // `subdirectories` or `NONE`
+        std::string names {};
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> entries {};
+        std::vector<std::unique_ptr<Directory>> subdirectories {};
+    };
+
+    struct Queue
+    {
+        std::mutex mutex {};
+        std::deque<Directory*> directories {};
+    };
+
+    void work(std::size_t const thread);
+    void wake();
+    Directory* take(std::size_t const thread);
+    void read(Directory& directory, std::size_t const thread, std::vector<char>& buffer);
+    void merge(Directory& directory, PathTable& files, std::uint32_t const root);
+
+private:
+    unsigned int threads {1};
+
+    std::vector<Queue> queues {};
+    std::atomic<std::uint64_t> pending {0};
+
+    // idle threads wait for queued directories or the end of the traversal
+    std::atomic<std::uint64_t> queued {0};
+    std::mutex idle_mutex {};
+    std::condition_variable idle {};
+
+    std::atomic<std::uint64_t> read_directories {0};
+    std::atomic<std::uint64_t> stolen_directories {0};
+    std::atomic<std::uint64_t> queried_types {0};
+    std::atomic<bool> failed {false};
+};
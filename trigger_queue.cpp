@@ -0,0 +1,255 @@
+/**
+ * @file trigger_queue.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a bounded queue of collection triggers
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "trigger_queue.h"
+
+#include <algorithm>
+#include <utility>
+
+
+TriggerQueue::TriggerQueue(std::size_t const capacity, OverflowPolicy const policy, Metrics* metrics) :
+    limit {std::max<std::size_t>(capacity, 1)},
+    policy {policy},
+    metrics {metrics}
+{
+}
+
+
+std::optional<OverflowPolicy> TriggerQueue::parse(std::string const& name)
+{
+    if (name == "block")
+    {
+        return OverflowPolicy::BLOCK;
+    }
+    if (name == "drop-oldest")
+    {
+        return OverflowPolicy::DROP_OLDEST;
+    }
+    if (name == "drop-newest")
+    {
+        return OverflowPolicy::DROP_NEWEST;
+    }
+    if (name == "coalesce")
+    {
+        return OverflowPolicy::COALESCE;
+    }
+    return std::nullopt;
+}
+
+
+std::string TriggerQueue::service(Trigger const& trigger)
+{
+    if (trigger.files.empty())
+    {
+        return {};
+    }
+
+    std::string const name {trigger.files.front().filename().native()};
+    std::size_t const begin {name.find('.')};
+    if (begin == std::string::npos)
+    {
+        return name;
+    }
+    return name.substr(begin + 1, name.find('.', begin + 1) - begin - 1);
+}
+
+
+Trigger TriggerQueue::pop()
+{
+    std::lock_guard<std::mutex> lock {mutex};
+
+    Trigger result {};
+    pop_locked(result);
+    return result;
+}
+
+
+bool TriggerQueue::pop(Trigger& item)
+{
+    std::unique_lock<std::mutex> lock {mutex};
+    not_empty.wait(lock, [this] { return !priority.empty() || !triggers.empty() || is_closed; });
+
+    return pop_locked(item);
+}
+
+
+void TriggerQueue::push(Trigger const& item)
+{
+    {
+        std::unique_lock<std::mutex> lock {mutex};
+
+        // a service without queued triggers bypasses the regular lane
+        std::string const name {service(item)};
+        if (services.find(name) == services.end() && priority.size() < limit)
+        {
+            priority.push_back(item);
+            services.emplace(name, 1);
+            count(&Metrics::prioritized);
+            lock.unlock();
+            not_empty.notify_one();
+            return;
+        }
+
+        if (triggers.size() >= limit)
+        {
+            switch (policy)
+            {
+                case OverflowPolicy::BLOCK:
+                {
+                    count(&Metrics::blocked);
+                    not_full.wait(lock, [this] { return triggers.size() < limit || is_closed; });
+                    if (triggers.size() >= limit)
+                    {
+                        count(&Metrics::dropped);
+                        return;
+                    }
+                    break;
+                }
+                case OverflowPolicy::DROP_OLDEST:
+                {
+                    release(triggers.front());
+                    triggers.pop_front();
+                    count(&Metrics::dropped_oldest);
+                    count(&Metrics::dropped);
+                    break;
+                }
+                case OverflowPolicy::COALESCE:
+                {
+                    // the most recent trigger of the service is the most
+                    // likely to still cover the same directory
+                    auto const queued
+                    {
+                        std::find_if(triggers.rbegin(), triggers.rend(), [&](Trigger const& trigger)
+                        {
+                            return trigger.directory == item.directory && service(trigger) == name;
+                        })
+                    };
+                    if (queued != triggers.rend())
+                    {
+                        queued->files.insert(queued->files.end(), item.files.begin(), item.files.end());
+                        count(&Metrics::coalesced);
+                        return;
+                    }
+                    count(&Metrics::dropped_newest);
+                    count(&Metrics::dropped);
+                    return;
+                }
+                case OverflowPolicy::DROP_NEWEST:
+                default:
+                {
+                    count(&Metrics::dropped_newest);
+                    count(&Metrics::dropped);
+                    return;
+                }
+            }
+        }
+
+        triggers.push_back(item);
+        ++services[name];
+    }
+    not_empty.notify_one();
+}
+
+
+Trigger TriggerQueue::front()
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return priority.empty() ? triggers.front() : priority.front();
+}
+
+
+bool TriggerQueue::empty()
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return priority.empty() && triggers.empty();
+}
+
+
+std::size_t TriggerQueue::size()
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return priority.size() + triggers.size();
+}
+
+
+void TriggerQueue::close()
+{
+    {
+        std::lock_guard<std::mutex> lock {mutex};
+        is_closed = true;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+}
+
+
+bool TriggerQueue::closed()
+{
+    std::lock_guard<std::mutex> lock {mutex};
+    return is_closed;
+}
+
+
+std::size_t TriggerQueue::capacity() const
+{
+    return limit;
+}
+
+
+bool TriggerQueue::pop_for(Trigger& item, std::chrono::nanoseconds const timeout)
+{
+    std::unique_lock<std::mutex> lock {mutex};
+    not_empty.wait_for(lock, timeout, [this] { return !priority.empty() || !triggers.empty() || is_closed; });
+
+    return pop_locked(item);
+}
+
+
+bool TriggerQueue::pop_locked(Trigger& item)
+{
+    if (!priority.empty())
+    {
+        item = std::move(priority.front());
+        priority.pop_front();
+        release(item);
+        return true;
+    }
+    if (triggers.empty())
+    {
+        return false;
+    }
+
+    item = std::move(triggers.front());
+    triggers.pop_front();
+    release(item);
+    not_full.notify_one();
+    return true;
+}
+
+
+void TriggerQueue::release(Trigger const& trigger)
+{
+    auto const queued {services.find(service(trigger))};
+    if (queued != services.end() && --queued->second == 0)
+    {
+        services.erase(queued);
+    }
+}
+
+
+void TriggerQueue::count(std::atomic<std::uint64_t> Metrics::* counter)
+{
+    if (metrics)
+    {
+        (metrics->*counter).fetch_add(1, std::memory_order_relaxed);
+    }
+}
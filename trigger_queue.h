@@ -0,0 +1,200 @@
+/**
+ * @file trigger_queue.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a bounded queue of collection triggers
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include "fifo.h"
+#include "metrics.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * @brief File creation events of a single directory, collected together
+ *
+ */
+struct Trigger
+{
+    /**
+     * @brief Directory to collect data from
+     *
+     */
+    std::filesystem::path directory {};
+
+    /**
+     * @brief Created files that triggered the collection, in order
+     *
+     */
+    std::vector<std::filesystem::path> files {};
+
+    /**
+     * @brief Time of the first file creation event
+     *
+     */
+    std::chrono::steady_clock::time_point detected {};
+
+    /**
+     * @brief Time the trigger was pushed onto the queue
+     *
+     */
+    std::chrono::steady_clock::time_point enqueued {};
+
+    /**
+     * @brief Index of the input root the directory belongs to, in the order
+     * the roots were added
+     *
+     */
+    std::size_t root {0};
+};
+
+
+/**
+ * @brief What a full bounded trigger queue does with a new trigger
+ *
+ */
+enum class OverflowPolicy
+{
+    /**
+     * @brief Wait for room, i.e. block the monitor thread, which leaves
+     * events in the kernel queue until it overflows and is rescanned
+     *
+     */
+    BLOCK,
+
+    /**
+     * @brief Discard the oldest queued trigger, fresh triggers are more
+     * useful than stale ones
+     *
+     */
+    DROP_OLDEST,
+
+    /**
+     * @brief Discard the new trigger
+     *
+     */
+    DROP_NEWEST,
+
+    /**
+     * @brief Add the files of the new trigger to a queued trigger of the same
+     * service and directory, discard the new trigger if there is none
+     *
+     */
+    COALESCE
+};
+
+
+/**
+ * @brief Bounded queue of triggers with a priority lane.
+ *
+ * A trigger of a service without queued triggers is pushed onto a priority
+ * lane, which is popped before the regular lane, such that a burst of
+ * repeated cores of one service cannot delay the first core of another one.
+ * Both lanes hold up to `capacity` triggers, a full regular lane applies the
+ * overflow policy, a full priority lane falls back to the regular lane.
+ * Every decision is counted in the metrics passed at construction.
+ * The service of a trigger is the second dot-separated field of the name of
+ * its first file, e.g. `Service` for `core.Service.0.lz4`.
+ *
+ */
+class TriggerQueue : public fifo<Trigger>
+{
+public:
+    using fifo<Trigger>::pop;
+
+    /**
+     * @brief Construct a new TriggerQueue object
+     *
+     * @param capacity Maximum number of triggers per lane, at least 1
+     * @param policy Handling of new triggers while the regular lane is full
+     * @param metrics Metrics counting admission decisions, or nullptr
+     */
+    TriggerQueue(std::size_t const capacity, OverflowPolicy const policy, Metrics* metrics = nullptr);
+
+    /**
+     * @brief Parse the name of an overflow policy
+     *
+     * @param name "block", "drop-oldest", "drop-newest" or "coalesce"
+     * @return policy, or nothing if the name is unknown
+     */
+    static std::optional<OverflowPolicy> parse(std::string const& name);
+
+    /**
+     * @brief Get the service name of a trigger
+     *
+     * @param trigger Trigger
+     * @return Second dot-separated field of the name of its first file, the
+     * whole name if it has no dot
+     */
+    static std::string service(Trigger const& trigger);
+
+    Trigger pop() override;
+    bool pop(Trigger& item) override;
+
+    /**
+     * @brief Push a trigger, applying the overflow policy if the regular lane
+     * is full
+     *
+     * A push waiting for room returns once the queue is closed, discarding
+     * the trigger.
+     *
+     * @param item Trigger to push
+     */
+    void push(Trigger const& item) override;
+
+    Trigger front() override;
+    bool empty() override;
+    std::size_t size() override;
+    void close() override;
+    bool closed() override;
+
+    /**
+     * @brief Get the maximum number of triggers per lane
+     *
+     * @return capacity of a lane
+     */
+    std::size_t capacity() const;
+
+protected:
+    bool pop_for(Trigger& item, std::chrono::nanoseconds const timeout) override;
+
+private:
+    bool pop_locked(Trigger& item);
+    void release(Trigger const& trigger);
+    void count(std::atomic<std::uint64_t> Metrics::* counter);
+
+private:
+    std::size_t limit {1};
+    OverflowPolicy policy {OverflowPolicy::BLOCK};
+    Metrics* metrics {nullptr};
+
+    std::mutex mutex {};
+    std::condition_variable not_empty {};
+    std::condition_variable not_full {};
+    bool is_closed {false};
+
+    std::deque<Trigger> priority {};
+    std::deque<Trigger> triggers {};
+
+    // number of queued triggers per service, services without any are
+    // removed
+    std::unordered_map<std::string, std::size_t> services {};
+};
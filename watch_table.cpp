@@ -0,0 +1,188 @@
+/**
+ * @file watch_table.cpp
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Definition of a table of the inotify watches of a directory tree
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#include "watch_table.h"
+
+#include <algorithm>
+
+
+void WatchTable::add_root(int const watch, std::filesystem::path const& path)
+{
+    auto& entry {watches[watch]};
+    unlink(watch, entry);
+    entry.parent = ROOT;
+    entry.name = path.native();
+}
+
+
+void WatchTable::add(int const watch, int const parent, std::string const& name)
+{
+    auto& entry {watches[watch]};
+    unlink(watch, entry);
+    entry.parent = parent;
+    entry.name = name;
+
+    auto const parent_entry {watches.find(parent)};
+    if (parent_entry != watches.end())
+    {
+        parent_entry->second.children.push_back(watch);
+    }
+}
+
+
+std::vector<int> WatchTable::remove(int const watch)
+{
+    std::vector<int> removed {};
+
+    auto const entry {watches.find(watch)};
+    if (entry == watches.end())
+    {
+        return removed;
+    }
+    unlink(watch, entry->second);
+
+    // collect the subtree first, erasing invalidates the children lists
+    removed.push_back(watch);
+    for (std::size_t i {0}; i < removed.size(); ++i)
+    {
+        auto const current {watches.find(removed[i])};
+        if (current != watches.end())
+        {
+            removed.insert(removed.end(), current->second.children.begin(), current->second.children.end());
+        }
+    }
+
+    for (int const descriptor : removed)
+    {
+        watches.erase(descriptor);
+    }
+    return removed;
+}
+
+
+void WatchTable::detach(int const watch)
+{
+    auto const entry {watches.find(watch)};
+    if (entry != watches.end())
+    {
+        unlink(watch, entry->second);
+        entry->second.parent = DETACHED;
+    }
+}
+
+
+int WatchTable::find(int const parent, std::string const& name) const
+{
+    auto const entry {watches.find(parent)};
+    if (entry == watches.end())
+    {
+        return -1;
+    }
+
+    for (int const child : entry->second.children)
+    {
+        auto const child_entry {watches.find(child)};
+        if (child_entry != watches.end() && child_entry->second.name == name)
+        {
+            return child;
+        }
+    }
+    return -1;
+}
+
+
+std::filesystem::path WatchTable::path(int const watch) const
+{
+    int root {-1};
+    return path(watch, root);
+}
+
+
+std::filesystem::path WatchTable::path(int const watch, int& root) const
+{
+    root = -1;
+
+    // collect the names up to the root, which holds the complete path
+    std::vector<std::string const*> names {};
+    int top {watch};
+    for (int current {watch}; current != ROOT;)
+    {
+        auto const entry {watches.find(current)};
+        if (entry == watches.end() || entry->second.parent == DETACHED)
+        {
+            return {};
+        }
+        names.push_back(&entry->second.name);
+        top = current;
+        current = entry->second.parent;
+    }
+    root = top;
+
+    std::filesystem::path result {};
+    for (auto name {names.rbegin()}; name != names.rend(); ++name)
+    {
+        result /= **name;
+    }
+    return result;
+}
+
+
+bool WatchTable::contains(int const watch) const
+{
+    return watches.count(watch) > 0;
+}
+
+
+void WatchTable::clear()
+{
+    watches.clear();
+}
+
+
+std::size_t WatchTable::size() const
+{
+    return watches.size();
+}
+
+
+std::size_t WatchTable::memory() const
+{
+    // hash buckets, plus a node per watch holding the next pointer and the
+    // entry itself, plus heap allocated names and children
+    std::size_t result {watches.bucket_count() * sizeof(void*)};
+    for (auto const& [watch, entry] : watches)
+    {
+        result += sizeof(void*) + sizeof(std::pair<int const, Watch>);
+        if (entry.name.capacity() > std::string {}.capacity())
+        {
+            result += entry.name.capacity() + 1;
+        }
+        result += entry.children.capacity() * sizeof(int);
+    }
+    return result;
+}
+
+
+void WatchTable::unlink(int const watch, Watch const& entry)
+{
+    if (entry.parent < 0)
+    {
+        return;
+    }
+
+    auto const parent {watches.find(entry.parent)};
+    if (parent != watches.end())
+    {
+        auto& children {parent->second.children};
+        children.erase(std::remove(children.begin(), children.end(), watch), children.end());
+    }
+}
@@ -0,0 +1,149 @@
+/**
+ * @file watch_table.h
+ * @author Max Beddies (max dot beddies at t dash online dot de)
+ * @brief Declaration of a table of the inotify watches of a directory tree
+ * @version 0.1
+ * @date 2022-08-24
+ *
+ * @copyright Copyright (c) 2022
+ *
+ */
+
+
+#pragma once
+
+
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/**
+ * @brief Estimated kernel memory of a single inotify watch on 64-bit kernels,
+ * including the inode and dentry it keeps in the cache
+ *
+ */
+constexpr std::size_t INOTIFY_WATCH_KERNEL_SIZE = 1024;
+
+
+/**
+ * @brief Table mapping the inotify watch descriptors of a directory tree to
+ * their directories.
+ *
+ * Every watch stores its parent watch and its own name instead of a complete
+ * path, such that large trees need little memory and a moved directory only
+ * updates a single entry, whatever the size of its subtree.
+ * Paths are assembled when an event arrives.
+ * The table is owned by the monitor thread.
+ *
+ */
+class WatchTable
+{
+public:
+    /**
+     * @brief Add the watch of the root directory
+     *
+     * @param watch Watch descriptor
+     * @param path Path of the root directory
+     */
+    void add_root(int const watch, std::filesystem::path const& path);
+
+    /**
+     * @brief Add the watch of a directory below a watched directory, adding an
+     * existing watch again moves it
+     *
+     * @param watch Watch descriptor
+     * @param parent Watch descriptor of the parent directory
+     * @param name Name of the directory within its parent
+     */
+    void add(int const watch, int const parent, std::string const& name);
+
+    /**
+     * @brief Remove a watch and all watches below it
+     *
+     * @param watch Watch descriptor
+     * @return Removed watch descriptors, including `watch`
+     */
+    std::vector<int> remove(int const watch);
+
+    /**
+     * @brief Detach a watch and its subtree from the tree, e.g. while its
+     * directory is moved, events of detached watches have no path
+     *
+     * @param watch Watch descriptor
+     */
+    void detach(int const watch);
+
+    /**
+     * @brief Find the watch of a directory within a watched directory
+     *
+     * @param parent Watch descriptor of the parent directory
+     * @param name Name of the directory
+     * @return Watch descriptor, or -1 if the directory is not watched
+     */
+    int find(int const parent, std::string const& name) const;
+
+    /**
+     * @brief Assemble the path of a watched directory
+     *
+     * @param watch Watch descriptor
+     * @return Path of the directory, empty if unknown or detached
+     */
+    std::filesystem::path path(int const watch) const;
+
+    /**
+     * @brief Assemble the path of a watched directory and find the watch of
+     * its root directory
+     *
+     * @param watch Watch descriptor
+     * @param root Set to the watch descriptor of the root directory, or -1
+     * @return Path of the directory, empty if unknown or detached
+     */
+    std::filesystem::path path(int const watch, int& root) const;
+
+    /**
+     * @brief Checks whether a watch descriptor belongs to the table
+     *
+     * @param watch Watch descriptor
+     * @return true if the watch is known, false otherwise
+     */
+    bool contains(int const watch) const;
+
+    /**
+     * @brief Remove all watches
+     *
+     */
+    void clear();
+
+    /**
+     * @brief Get the number of watches
+     *
+     * @return number of watches
+     */
+    std::size_t size() const;
+
+    /**
+     * @brief Estimate the memory used by the table in user space
+     *
+     * @return number of bytes
+     */
+    std::size_t memory() const;
+
+private:
+    static constexpr int ROOT {-1};
+    static constexpr int DETACHED {-2};
+
+    struct Watch
+    {
+        int parent {ROOT};
+        std::string name {};
+        std::vector<int> children {};
+    };
+
+    void unlink(int const watch, Watch const& entry);
+
+private:
+    std::unordered_map<int, Watch> watches {};
+};